@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/bench.c
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+bool bench_samples_init(struct bench_samples *samples, size_t capacity) {
+    samples->count = 0;
+    samples->capacity = capacity ? capacity : 1;
+    samples->ns = malloc(samples->capacity * sizeof(*samples->ns));
+    return samples->ns != NULL;
+}
+
+void bench_samples_add(struct bench_samples *samples, uint64_t ns) {
+    if (samples->count == samples->capacity) {
+        uint64_t *grown =
+            realloc(samples->ns, 2 * samples->capacity * sizeof(*grown));
+        if (!grown)
+            return;
+        samples->ns = grown;
+        samples->capacity *= 2;
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+bool bench_samples_merge(struct bench_samples *into,
+                         struct bench_samples *from) {
+    if (into->capacity - into->count < from->count) {
+        size_t capacity = into->count + from->count;
+        uint64_t *grown = realloc(into->ns, capacity * sizeof(*grown));
+        if (!grown)
+            return false;
+        into->ns = grown;
+        into->capacity = capacity;
+    }
+    memcpy(into->ns + into->count, from->ns, from->count * sizeof(*from->ns));
+    into->count += from->count;
+    from->count = 0;
+    return true;
+}
+
+void bench_samples_free(struct bench_samples *samples) {
+    free(samples->ns);
+    memset(samples, 0, sizeof(*samples));
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n iterations] [-o output.json]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+void bench_parse_options(int argc, char **argv, long default_iterations,
+                         struct bench_options *options) {
+    memset(options, 0, sizeof(*options));
+    options->iterations = default_iterations;
+    options->output = stdout;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:o:")) != -1) {
+        char *end;
+        switch (option) {
+        case 'n':
+            errno = 0;
+            options->iterations = strtol(optarg, &end, 10);
+            if (errno || *end || options->iterations <= 0)
+                usage(argv[0]);
+            break;
+        case 'o':
+            options->output = fopen(optarg, "w");
+            if (!options->output) {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+}
+
+static void write_string(FILE *output, const char *value) {
+    fputc('"', output);
+    for (; value && *value; value++) {
+        if (*value == '"' || *value == '\\')
+            fputc('\\', output);
+        if ((unsigned char)*value >= 0x20)
+            fputc(*value, output);
+    }
+    fputc('"', output);
+}
+
+void bench_begin(const struct bench_options *options, const char *benchmark,
+                 const char *backend) {
+    fputs("{\"benchmark\": ", options->output);
+    write_string(options->output, benchmark);
+    fputs(", \"backend\": ", options->output);
+    write_string(options->output, backend);
+    fputs(", \"cases\": [", options->output);
+}
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t left = *(const uint64_t *)a;
+    uint64_t right = *(const uint64_t *)b;
+    return (left > right) - (left < right);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const struct bench_samples *samples,
+                           unsigned int percent) {
+    if (samples->count == 0)
+        return 0;
+    size_t rank = (samples->count * percent + 99U) / 100U;
+    return samples->ns[rank ? rank - 1U : 0];
+}
+
+void bench_case(struct bench_options *options, const char *name,
+                struct bench_samples *samples, uint64_t keys, uint64_t errors,
+                uint64_t elapsed_ns) {
+    qsort(samples->ns, samples->count, sizeof(*samples->ns), compare_samples);
+    double seconds = (double)elapsed_ns / 1e9;
+    double rate = seconds > 0 ? 1.0 / seconds : 0;
+
+    FILE *output = options->output;
+    fputs(options->cases++ ? ",\n  " : "\n  ", output);
+    fputs("{\"name\": ", output);
+    write_string(output, name);
+    fprintf(output,
+            ", \"operations\": %zu, \"keys\": %llu, \"errors\": %llu, "
+            "\"seconds\": %.6f, \"operations_per_second\": %.1f, "
+            "\"keys_per_second\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+            "\"max_ns\": %llu}",
+            samples->count, (unsigned long long)keys,
+            (unsigned long long)errors, seconds,
+            (double)samples->count * rate, (double)keys * rate,
+            (unsigned long long)percentile(samples, 50),
+            (unsigned long long)percentile(samples, 99),
+            (unsigned long long)(samples->count
+                                     ? samples->ns[samples->count - 1U]
+                                     : 0));
+    fflush(output);
+}
+
+int bench_end(struct bench_options *options) {
+    fputs("\n]}\n", options->output);
+    bool failed = ferror(options->output) != 0;
+    if (options->output != stdout)
+        failed = fclose(options->output) != 0 || failed;
+    else
+        failed = fflush(options->output) != 0 || failed;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
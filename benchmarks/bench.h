@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/bench.h
+ *
+ * Shared helpers for the benchmark programs. Each program writes one JSON
+ * document:
+ *
+ *   {"benchmark": "...", "backend": "...", "cases": [
+ *     {"name": "...", "operations": N, "keys": N, "errors": N,
+ *      "seconds": S, "operations_per_second": R, "keys_per_second": R,
+ *      "p50_ns": N, "p99_ns": N, "max_ns": N}, ...]}
+ */
+
+#ifndef QKD_BENCH_H_
+#define QKD_BENCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Latencies of the operations of one case, in nanoseconds */
+struct bench_samples {
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+};
+
+bool bench_samples_init(struct bench_samples *samples, size_t capacity);
+void bench_samples_add(struct bench_samples *samples, uint64_t ns);
+/* Moves the samples of from into into, leaving from empty. */
+bool bench_samples_merge(struct bench_samples *into,
+                         struct bench_samples *from);
+void bench_samples_free(struct bench_samples *samples);
+
+struct bench_options {
+    long iterations; /* Operations per case, or per thread and case */
+    FILE *output;
+    size_t cases; /* Cases reported so far */
+};
+
+/*
+ * Parses "-n iterations" and "-o file", exiting with a usage message on
+ * errors. default_iterations applies when -n is not given.
+ */
+void bench_parse_options(int argc, char **argv, long default_iterations,
+                         struct bench_options *options);
+
+void bench_begin(const struct bench_options *options, const char *benchmark,
+                 const char *backend);
+
+/*
+ * Reports one case: keys is the number of keys the operations moved and
+ * elapsed_ns the wall time they took. Sorts samples.
+ */
+void bench_case(struct bench_options *options, const char *name,
+                struct bench_samples *samples, uint64_t keys, uint64_t errors,
+                uint64_t elapsed_ns);
+
+/* Closes the document; returns the exit status of the program. */
+int bench_end(struct bench_options *options);
+
+#endif /* QKD_BENCH_H_ */
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/etsi004_get_key.c
+ *
+ * GET_KEY throughput and latency of the ETSI 004 simulated backend with 1 to
+ * 8 threads, either all reading one shared stream or each reading its own.
+ * -n sets the keys read by each thread in each case.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "etsi004/api.h"
+#include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+
+#define MAX_THREADS 8
+/* The simulated backend generates at most this many indices per stream. */
+#define STREAM_KEYS 1024U
+
+struct worker {
+    const unsigned char *key_stream_id;
+    uint32_t first_index;
+    uint32_t stride;
+    long iterations;
+    pthread_barrier_t *start;
+    struct bench_samples samples;
+    uint64_t errors;
+};
+
+static bool open_stream(unsigned char *key_stream_id) {
+    struct qkd_qos_s qos = {
+        .Key_chunk_size = QKD_KEY_SIZE,
+        .Max_bps = 1000000000U,
+        .Min_bps = 100,
+        .Timeout = 1000,
+        .TTL = 0,
+    };
+    uint32_t status;
+
+    memset(key_stream_id, 0, QKD_KSID_SIZE);
+    if (OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) !=
+            QKD_STATUS_PEER_NOT_CONNECTED ||
+        OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) !=
+            QKD_STATUS_SUCCESS)
+        return false;
+
+    /* At Max_bps every index is generated within a millisecond. */
+    const struct timespec delay = {.tv_nsec = 2000000L};
+    nanosleep(&delay, NULL);
+    return true;
+}
+
+static void *run_worker(void *arg) {
+    struct worker *worker = arg;
+    unsigned char key[QKD_KEY_SIZE];
+    uint32_t status;
+
+    pthread_barrier_wait(worker->start);
+    uint32_t index = worker->first_index;
+    for (long i = 0; i < worker->iterations; i++) {
+        uint32_t requested = index;
+        uint64_t started = qkd_metrics_now();
+        uint32_t result =
+            GET_KEY(worker->key_stream_id, &requested, key, NULL, &status);
+        bench_samples_add(&worker->samples, qkd_metrics_now() - started);
+        if (result != QKD_STATUS_SUCCESS)
+            worker->errors++;
+        index = (index + worker->stride) % STREAM_KEYS;
+    }
+    return NULL;
+}
+
+static bool run_case(struct bench_options *options, int thread_count,
+                     bool shared) {
+    unsigned char stream_ids[MAX_THREADS][QKD_KSID_SIZE];
+    struct worker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    pthread_barrier_t start;
+    int streams = shared ? 1 : thread_count;
+    bool success = true;
+
+    for (int i = 0; i < streams && success; i++)
+        success = open_stream(stream_ids[i]);
+    if (!success || pthread_barrier_init(&start, NULL,
+                                         (unsigned int)thread_count + 1U)) {
+        fprintf(stderr, "Cannot open %d streams\n", streams);
+        return false;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        workers[i] = (struct worker){
+            .key_stream_id = stream_ids[shared ? 0 : i],
+            .first_index = shared ? (uint32_t)i : 0,
+            .stride = shared ? (uint32_t)thread_count : 1,
+            .iterations = options->iterations,
+            .start = &start,
+        };
+        if (!bench_samples_init(&workers[i].samples,
+                                (size_t)options->iterations) ||
+            pthread_create(&threads[i], NULL, run_worker, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot start worker threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    uint64_t started = qkd_metrics_now();
+    struct bench_samples samples;
+    uint64_t errors = 0;
+    bench_samples_init(&samples, (size_t)options->iterations * thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+        bench_samples_merge(&samples, &workers[i].samples);
+        bench_samples_free(&workers[i].samples);
+        errors += workers[i].errors;
+    }
+    uint64_t elapsed = qkd_metrics_now() - started;
+    pthread_barrier_destroy(&start);
+
+    char name[64];
+    snprintf(name, sizeof(name), "threads=%d,streams=%s", thread_count,
+             shared ? "shared" : "private");
+    bench_case(options, name, &samples, samples.count - errors, errors,
+               elapsed);
+    bench_samples_free(&samples);
+
+    uint32_t status;
+    for (int i = 0; i < streams; i++)
+        CLOSE(stream_ids[i], &status);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    struct bench_options options;
+    bench_parse_options(argc, argv, 20000, &options);
+
+    bench_begin(&options, "etsi004_get_key", get_active_004_backend()->name);
+    bool success = true;
+    for (int threads = 1; threads <= MAX_THREADS && success; threads *= 2) {
+        success = run_case(&options, threads, true);
+        if (success && threads > 1)
+            success = run_case(&options, threads, false);
+    }
+    int result = bench_end(&options);
+    return success ? result : EXIT_FAILURE;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/etsi014_get_key.c
+ *
+ * GET_KEY and GET_KEY_WITH_IDS throughput and latency for batches of 1 to
+ * 1024 keys, up to the max_key_per_request the KME reports. With the HTTPS
+ * backends the KMEs and SAEs are read from the QKD_MASTER_* and QKD_SLAVE_*
+ * variables used by the tests, such as a local mock KME, so every sample is a
+ * full round trip. -n sets the requests made for each batch size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "etsi014/api.h"
+#include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+
+#define MAX_BATCH 1024
+
+static const char *master_kme_hostname = "master.example";
+static const char *slave_kme_hostname = "slave.example";
+static const char *master_sae = "SAE_BENCH_MASTER";
+static const char *slave_sae = "SAE_BENCH_SLAVE";
+
+static void init_config(void) {
+#ifdef QKD_USE_ETSI014_BACKEND
+    const char *names[] = {"QKD_MASTER_KME_HOSTNAME", "QKD_SLAVE_KME_HOSTNAME",
+                           "QKD_MASTER_SAE", "QKD_SLAVE_SAE"};
+    const char **values[] = {&master_kme_hostname, &slave_kme_hostname,
+                             &master_sae, &slave_sae};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        *values[i] = getenv(names[i]);
+        if (!*values[i]) {
+            fprintf(stderr, "Required environment variable %s is not set\n",
+                    names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+#endif
+}
+
+static int32_t max_batch(void) {
+    qkd_status_t status = {0};
+    if (GET_STATUS(master_kme_hostname, slave_sae, &status) != QKD_STATUS_OK) {
+        fprintf(stderr, "GET_STATUS failed on %s\n", master_kme_hostname);
+        exit(EXIT_FAILURE);
+    }
+    int32_t limit = status.max_key_per_request;
+    qkd_status_free(&status);
+    return limit > 0 && limit < MAX_BATCH ? limit : MAX_BATCH;
+}
+
+static void run_batch(struct bench_options *options, int32_t batch) {
+    struct bench_samples issue, retrieve;
+    uint64_t issue_ns = 0, retrieve_ns = 0;
+    uint64_t issue_errors = 0, retrieve_errors = 0;
+    uint64_t issued_keys = 0, retrieved_keys = 0;
+    qkd_key_id_t ids[MAX_BATCH];
+
+    if (!bench_samples_init(&issue, (size_t)options->iterations) ||
+        !bench_samples_init(&retrieve, (size_t)options->iterations)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (long i = 0; i < options->iterations; i++) {
+        qkd_key_request_t request = {.number = batch};
+        qkd_key_container_t issued = {0};
+        uint64_t started = qkd_metrics_now();
+        uint32_t result =
+            GET_KEY(master_kme_hostname, slave_sae, &request, &issued);
+        uint64_t elapsed = qkd_metrics_now() - started;
+        bench_samples_add(&issue, elapsed);
+        issue_ns += elapsed;
+        if (result != QKD_STATUS_OK || issued.key_count != batch) {
+            issue_errors++;
+            qkd_key_container_free(&issued);
+            continue;
+        }
+        issued_keys += (uint64_t)batch;
+
+        /* Retrieving the keys on the slave side frees them on the KME. */
+        for (int32_t k = 0; k < batch; k++)
+            ids[k] = (qkd_key_id_t){.key_ID = issued.keys[k].key_ID};
+        qkd_key_ids_t key_ids = {.key_IDs = ids, .key_ID_count = batch};
+        qkd_key_container_t retrieved = {0};
+        started = qkd_metrics_now();
+        result = GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                                  &retrieved);
+        elapsed = qkd_metrics_now() - started;
+        bench_samples_add(&retrieve, elapsed);
+        retrieve_ns += elapsed;
+        if (result == QKD_STATUS_OK && retrieved.key_count == batch)
+            retrieved_keys += (uint64_t)batch;
+        else
+            retrieve_errors++;
+        qkd_key_container_free(&retrieved);
+        qkd_key_container_free(&issued);
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "get_key,batch=%d", (int)batch);
+    bench_case(options, name, &issue, issued_keys, issue_errors, issue_ns);
+    snprintf(name, sizeof(name), "get_key_with_ids,batch=%d", (int)batch);
+    bench_case(options, name, &retrieve, retrieved_keys, retrieve_errors,
+               retrieve_ns);
+    bench_samples_free(&issue);
+    bench_samples_free(&retrieve);
+}
+
+int main(int argc, char **argv) {
+    struct bench_options options;
+    bench_parse_options(argc, argv, 200, &options);
+    init_config();
+
+    int32_t limit = max_batch();
+    bench_begin(&options, "etsi014_get_key", get_active_014_backend()->name);
+    for (int32_t batch = 1; batch <= limit; batch *= 2)
+        run_batch(&options, batch);
+    return bench_end(&options);
+}
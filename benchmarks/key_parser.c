@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/key_parser.c
+ *
+ * Parsing speed of key container responses shaped like those of the
+ * supported KMEs, with 1 to 1024 256-bit keys and a key_ID_extension per
+ * key. Responses are parsed whole and in 1460 byte pieces, as they arrive
+ * from the network, into text and binary containers. -n sets the responses
+ * parsed in each case.
+ */
+
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "etsi014/api.h"
+#include "etsi014/key_stream_parser.h"
+#include "qkd_metrics.h"
+
+#define KEY_BYTES 32
+#define SEGMENT_SIZE 1460
+
+/* Builds a response with count keys from a fixed pseudo-random sequence. */
+static char *build_response(int32_t count, size_t *length) {
+    size_t capacity = 64 + (size_t)count * 256;
+    char *response = malloc(capacity);
+    if (!response)
+        return NULL;
+
+    uint32_t state = 0x9e3779b9U;
+    size_t used = (size_t)snprintf(response, capacity, "{\"keys\": [");
+    for (int32_t i = 0; i < count; i++) {
+        unsigned char key[KEY_BYTES];
+        char encoded[((KEY_BYTES + 2) / 3) * 4 + 1];
+        for (size_t j = 0; j < sizeof(key); j++) {
+            state = state * 1664525U + 1013904223U;
+            key[j] = (unsigned char)(state >> 24);
+        }
+        EVP_EncodeBlock((unsigned char *)encoded, key, sizeof(key));
+        used += (size_t)snprintf(
+            response + used, capacity - used,
+            "%s{\"key_ID\": \"%08x-%04x-4%03x-a%03x-%012x\", "
+            "\"key_ID_extension\": {\"hops\": 1}, \"key\": \"%s\"}",
+            i ? ", " : "", (unsigned int)state, (unsigned int)(i & 0xffff),
+            (unsigned int)(state & 0xfff), (unsigned int)(i & 0xfff),
+            (unsigned int)i, encoded);
+    }
+    used += (size_t)snprintf(response + used, capacity - used, "]}");
+    *length = used;
+    return response;
+}
+
+static bool parse(const char *response, size_t length, size_t segment,
+                  uint32_t flags, int32_t count) {
+    struct qkd_key_stream_parser parser;
+    qkd_key_container_t container = {.flags = flags};
+    bool parsed =
+        qkd_key_stream_parser_init(&parser, flags, count, KEY_BYTES * 8);
+    for (size_t offset = 0; parsed && offset < length; offset += segment) {
+        size_t piece = length - offset < segment ? length - offset : segment;
+        parsed = qkd_key_stream_parser_feed(&parser, response + offset, piece);
+    }
+    parsed = parsed && qkd_key_stream_parser_finish(&parser, &container) &&
+             container.key_count == count;
+    qkd_key_stream_parser_free(&parser);
+    qkd_key_container_free(&container);
+    return parsed;
+}
+
+static bool run_case(struct bench_options *options, int32_t count,
+                     size_t segment, uint32_t flags) {
+    size_t length;
+    char *response = build_response(count, &length);
+    struct bench_samples samples;
+    if (!response ||
+        !bench_samples_init(&samples, (size_t)options->iterations)) {
+        free(response);
+        return false;
+    }
+    const char *feed = segment ? "segments" : "whole";
+    if (segment == 0)
+        segment = length;
+
+    uint64_t errors = 0, elapsed = 0;
+    for (long i = 0; i < options->iterations; i++) {
+        uint64_t started = qkd_metrics_now();
+        bool parsed = parse(response, length, segment, flags, count);
+        uint64_t spent = qkd_metrics_now() - started;
+        bench_samples_add(&samples, spent);
+        elapsed += spent;
+        if (!parsed)
+            errors++;
+    }
+
+    char name[96];
+    snprintf(name, sizeof(name), "keys=%d,feed=%s,container=%s", (int)count,
+             feed, flags & QKD_KEY_CONTAINER_BINARY ? "binary" : "text");
+    bench_case(options, name, &samples,
+               ((uint64_t)samples.count - errors) * (uint64_t)count, errors,
+               elapsed);
+    bench_samples_free(&samples);
+    free(response);
+    return errors == 0;
+}
+
+int main(int argc, char **argv) {
+    static const int32_t counts[] = {1, 16, 128, 1024};
+    static const uint32_t flags[] = {
+        0, QKD_KEY_CONTAINER_ARENA | QKD_KEY_CONTAINER_BINARY};
+    struct bench_options options;
+    bench_parse_options(argc, argv, 1000, &options);
+
+    bench_begin(&options, "key_parser", "none");
+    bool success = true;
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        for (size_t j = 0; j < sizeof(flags) / sizeof(flags[0]); j++) {
+            success = run_case(&options, counts[i], 0, flags[j]) && success;
+            success =
+                run_case(&options, counts[i], SEGMENT_SIZE, flags[j]) &&
+                success;
+        }
+    }
+    int result = bench_end(&options);
+    return success ? result : EXIT_FAILURE;
+}
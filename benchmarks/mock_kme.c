@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * benchmarks/mock_kme.c
+ *
+ * Mock ETSI 014 KME for load testing the HTTPS backends. It serves
+ *
+ *   GET       /api/v1/keys/{SAE_ID}/status
+ *   GET/POST  /api/v1/keys/{SAE_ID}/enc_keys
+ *   GET/POST  /api/v1/keys/{SAE_ID}/dec_keys
+ *
+ * over HTTP/1.1 with keep-alive and TLS, requiring client certificates when
+ * a CA is given. Keys come from the simulated ETSI 014 backend, so enc_keys
+ * stores keys that dec_keys hands out once and then deletes. Responses can be
+ * delayed to model a remote KME, and key generation limited to a rate.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "etsi014/api.h"
+#include "etsi014/backends/simulated.h"
+#include "qkd_etsi_api.h"
+
+#define MAX_HEADER 16384
+#define MAX_BODY (1024 * 1024)
+#define MAX_REQUEST_KEYS 1024
+#define PATH_PREFIX "/api/v1/keys/"
+
+struct options {
+    int port;
+    const char *cert;
+    const char *key;
+    const char *ca;
+    long latency_us; /* Added before every response */
+    long jitter_us;  /* Random extra delay, up to this value */
+    double rate;     /* Keys generated per second, 0 for unlimited */
+    const char *kme_id;
+};
+
+static struct options options = {.port = 8443, .kme_id = "MOCK_KME"};
+static SSL_CTX *tls_context;
+
+/* Keys that may still be issued under the generation rate */
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static double available_keys;
+static double burst_keys;
+static struct timespec last_refill;
+
+/* Growable response buffer */
+struct buffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static bool append(struct buffer *buffer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static bool append(struct buffer *buffer, const char *format, ...) {
+    for (;;) {
+        va_list arguments;
+        va_start(arguments, format);
+        size_t room = buffer->capacity - buffer->length;
+        int written = vsnprintf(buffer->data + buffer->length, room, format,
+                                arguments);
+        va_end(arguments);
+        if (written < 0)
+            return false;
+        if ((size_t)written < room) {
+            buffer->length += (size_t)written;
+            return true;
+        }
+
+        size_t capacity = buffer->capacity * 2 + (size_t)written + 1;
+        char *data = realloc(buffer->data, capacity);
+        if (!data)
+            return false;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
+static double elapsed_seconds(const struct timespec *from,
+                              const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) +
+           (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* Called with rate_lock held. */
+static void refill_keys(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    available_keys += elapsed_seconds(&last_refill, &now) * options.rate;
+    if (available_keys > burst_keys)
+        available_keys = burst_keys;
+    last_refill = now;
+}
+
+/* Takes count keys from the generation budget, or fails without waiting. */
+static bool take_keys(int32_t count) {
+    if (options.rate <= 0)
+        return true;
+
+    pthread_mutex_lock(&rate_lock);
+    refill_keys();
+    bool taken = available_keys >= count;
+    if (taken)
+        available_keys -= count;
+    pthread_mutex_unlock(&rate_lock);
+    return taken;
+}
+
+static void return_keys(int32_t count) {
+    if (options.rate <= 0)
+        return;
+    pthread_mutex_lock(&rate_lock);
+    available_keys += count;
+    pthread_mutex_unlock(&rate_lock);
+}
+
+static void inject_latency(unsigned int *seed) {
+    long delay_us = options.latency_us;
+    if (options.jitter_us > 0)
+        delay_us += (long)(rand_r(seed) % (options.jitter_us + 1));
+    if (delay_us <= 0)
+        return;
+
+    struct timespec delay = {.tv_sec = delay_us / 1000000L,
+                             .tv_nsec = (delay_us % 1000000L) * 1000L};
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+        ;
+}
+
+/* Reads the integer value of "name" from a query string or JSON body. */
+static bool find_integer(const char *text, const char *name, long *value) {
+    size_t length = strlen(name);
+    for (const char *at = strstr(text, name); at; at = strstr(at + 1, name)) {
+        const char *end = at + length;
+        bool quoted = at > text && at[-1] == '"';
+        bool parameter = at == text || at[-1] == '&';
+        if (quoted ? *end != '"' : !parameter)
+            continue;
+        if (*end == '"')
+            end++;
+        end += strspn(end, " \t\r\n");
+        if (*end != ':' && *end != '=')
+            continue;
+        end++;
+        end += strspn(end, " \t\r\n");
+        char *parsed;
+        errno = 0;
+        *value = strtol(end, &parsed, 10);
+        return parsed != end && errno == 0;
+    }
+    return false;
+}
+
+/*
+ * Collects key IDs from "key_ID": "..." members of a JSON body or key_ID=
+ * parameters of a query string, pointing into text and terminating them.
+ */
+static int32_t find_key_ids(char *text, bool json, qkd_key_id_t *ids) {
+    const char *name = json ? "\"key_ID\"" : "key_ID=";
+    int32_t count = 0;
+
+    for (char *at = strstr(text, name); at; at = strstr(at, name)) {
+        at += strlen(name);
+        if (json) {
+            at += strspn(at, " \t\r\n");
+            if (*at != ':')
+                continue;
+            at++;
+            at += strspn(at, " \t\r\n");
+            if (*at != '"')
+                continue;
+            at++;
+        }
+        char *end = at + strcspn(at, json ? "\"" : "&");
+        if (end == at || count == MAX_REQUEST_KEYS + 1)
+            return -1;
+        ids[count++].key_ID = at;
+        bool last = *end == '\0';
+        *end = '\0';
+        if (last)
+            break;
+        at = end + 1;
+    }
+    return count;
+}
+
+static void status_body(struct buffer *body, const char *sae_id,
+                        const qkd_status_t *status) {
+    append(body,
+           "{\"source_KME_ID\": \"%s\", \"target_KME_ID\": \"%s\", "
+           "\"master_SAE_ID\": \"%s\", \"slave_SAE_ID\": \"%s\", "
+           "\"key_size\": %d, \"stored_key_count\": %d, "
+           "\"max_key_count\": %d, \"max_key_per_request\": %d, "
+           "\"max_key_size\": %d, \"min_key_size\": %d, "
+           "\"max_SAE_ID_count\": %d}",
+           options.kme_id, options.kme_id, status->master_SAE_ID, sae_id,
+           (int)status->key_size, (int)status->stored_key_count,
+           (int)status->max_key_count, (int)status->max_key_per_request,
+           (int)status->max_key_size, (int)status->min_key_size,
+           (int)status->max_SAE_ID_count);
+}
+
+static bool keys_body(struct buffer *body,
+                      const qkd_key_container_t *container) {
+    bool appended = append(body, "{\"keys\": [");
+    for (int32_t i = 0; appended && i < container->key_count; i++)
+        appended = append(body, "%s{\"key_ID\": \"%s\", \"key\": \"%s\"}",
+                          i ? ", " : "", container->keys[i].key_ID,
+                          container->keys[i].key);
+    return appended && append(body, "]}");
+}
+
+static int error_body(struct buffer *body, int code, const char *message) {
+    body->length = 0;
+    append(body, "{\"message\": \"%s\"}", message);
+    return code;
+}
+
+static int status_code(uint32_t result) {
+    return result == QKD_STATUS_OK            ? 200
+           : result == QKD_STATUS_BAD_REQUEST ? 400
+                                              : 503;
+}
+
+/* Serves one request; returns the HTTP status and fills body. */
+static int handle_request(const char *method, char *target, char *body_text,
+                          struct buffer *body) {
+    const struct qkd_014_backend *store = &simulated_backend;
+    bool post = strcmp(method, "POST") == 0;
+    if (!post && strcmp(method, "GET") != 0)
+        return error_body(body, 405, "Method not allowed");
+    if (strncmp(target, PATH_PREFIX, strlen(PATH_PREFIX)) != 0)
+        return error_body(body, 404, "Not found");
+
+    char *sae_id = target + strlen(PATH_PREFIX);
+    char *operation = strchr(sae_id, '/');
+    if (!operation || operation == sae_id)
+        return error_body(body, 404, "Not found");
+    *operation++ = '\0';
+    char *query = strchr(operation, '?');
+    if (query)
+        *query++ = '\0';
+    char *parameters = post ? body_text : query ? query : "";
+
+    if (strcmp(operation, "status") == 0 && !post) {
+        qkd_status_t status = {0};
+        uint32_t result = store->get_status(options.kme_id, sae_id, &status);
+        if (result == QKD_STATUS_OK) {
+            if (options.rate > 0) {
+                pthread_mutex_lock(&rate_lock);
+                refill_keys();
+                if (status.stored_key_count > (int32_t)available_keys)
+                    status.stored_key_count = (int32_t)available_keys;
+                pthread_mutex_unlock(&rate_lock);
+            }
+            status_body(body, sae_id, &status);
+        }
+        qkd_status_free(&status);
+        return result == QKD_STATUS_OK
+                   ? 200
+                   : error_body(body, status_code(result), "Status failed");
+    }
+
+    qkd_key_container_t container = {0};
+    uint32_t result;
+    if (strcmp(operation, "enc_keys") == 0) {
+        long number = 1, size = 0;
+        if ((find_integer(parameters, "number", &number) &&
+             (number < 1 || number > MAX_REQUEST_KEYS)) ||
+            (find_integer(parameters, "size", &size) &&
+             (size < 0 || size > INT32_MAX)))
+            return error_body(body, 400, "Invalid number or size");
+        if (!take_keys((int32_t)number))
+            return error_body(body, 503, "Keys not yet generated");
+
+        qkd_key_request_t request = {.number = (int32_t)number,
+                                     .size = (int32_t)size};
+        result = store->get_key(options.kme_id, sae_id, &request, &container);
+        if (result != QKD_STATUS_OK)
+            return_keys((int32_t)number);
+    } else if (strcmp(operation, "dec_keys") == 0) {
+        static __thread qkd_key_id_t ids[MAX_REQUEST_KEYS + 1];
+        int32_t count = find_key_ids(parameters, post, ids);
+        if (count <= 0 || count > MAX_REQUEST_KEYS)
+            return error_body(body, 400, "Invalid key IDs");
+
+        qkd_key_ids_t key_ids = {.key_IDs = ids, .key_ID_count = count};
+        result = store->get_key_with_ids(options.kme_id, sae_id, &key_ids,
+                                         &container);
+    } else {
+        return error_body(body, 404, "Not found");
+    }
+
+    int code = status_code(result);
+    if (result == QKD_STATUS_OK && !keys_body(body, &container))
+        code = error_body(body, 503, "Out of memory");
+    else if (result != QKD_STATUS_OK)
+        error_body(body, code, "Key request failed");
+    qkd_key_container_free(&container);
+    return code;
+}
+
+static bool write_all(SSL *ssl, const char *data, size_t length) {
+    while (length > 0) {
+        int written =
+            SSL_write(ssl, data, length > INT32_MAX ? INT32_MAX : (int)length);
+        if (written <= 0)
+            return false;
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static const char *reason(int code) {
+    switch (code) {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 413:
+        return "Payload Too Large";
+    default:
+        return "Service Unavailable";
+    }
+}
+
+/* Finds a header in the block after the request line, case-insensitively. */
+static const char *find_header(const char *headers, const char *name) {
+    size_t length = strlen(name);
+    for (const char *line = strstr(headers, "\r\n"); line;
+         line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, length) == 0 && line[length] == ':')
+            return line + length + 1 + strspn(line + length + 1, " \t");
+    }
+    return NULL;
+}
+
+/* Serves requests on one connection until the client closes it. */
+static void serve_connection(SSL *ssl, unsigned int seed) {
+    char *request = malloc(MAX_HEADER + MAX_BODY + 1);
+    struct buffer body = {.data = malloc(4096), .capacity = 4096};
+    struct buffer response = {.data = malloc(4096), .capacity = 4096};
+    size_t received = 0;
+    bool open = request && body.data && response.data;
+
+    while (open) {
+        /* Read up to the end of the headers */
+        char *headers_end;
+        request[received] = '\0';
+        while (!(headers_end = strstr(request, "\r\n\r\n"))) {
+            int read = received < MAX_HEADER
+                           ? SSL_read(ssl, request + received,
+                                      (int)(MAX_HEADER - received))
+                           : 0;
+            if (read <= 0)
+                goto done;
+            received += (size_t)read;
+            request[received] = '\0';
+        }
+        *headers_end = '\0';
+        char *body_text = headers_end + 4;
+        size_t header_length = (size_t)(body_text - request);
+
+        const char *value = find_header(request, "Content-Length");
+        long content_length = value ? strtol(value, NULL, 10) : 0;
+        if (content_length < 0 || content_length > MAX_BODY)
+            break;
+        while (received < header_length + (size_t)content_length) {
+            int read = SSL_read(ssl, request + received,
+                                (int)(header_length +
+                                      (size_t)content_length - received));
+            if (read <= 0)
+                goto done;
+            received += (size_t)read;
+        }
+        char saved = body_text[content_length];
+        body_text[content_length] = '\0';
+
+        value = find_header(request, "Connection");
+        bool keep_alive = !value || strncasecmp(value, "close", 5) != 0;
+        char method[8] = {0};
+        char *target = strchr(request, ' ');
+        if (target && (size_t)(target - request) < sizeof(method))
+            memcpy(method, request, (size_t)(target - request));
+        char *target_end = target ? strchr(++target, ' ') : NULL;
+        if (target_end)
+            *target_end = '\0';
+
+        body.length = 0;
+        int code = target_end ? handle_request(method, target, body_text, &body)
+                              : error_body(&body, 400, "Bad request");
+        inject_latency(&seed);
+
+        response.length = 0;
+        open = append(&response,
+                      "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+                      "Content-Length: %zu\r\nConnection: %s\r\n\r\n",
+                      code, reason(code), body.length,
+                      keep_alive ? "keep-alive" : "close") &&
+               append(&response, "%.*s", (int)body.length, body.data) &&
+               write_all(ssl, response.data, response.length) && keep_alive;
+
+        /* Keep pipelined bytes that follow this request */
+        body_text[content_length] = saved;
+        size_t consumed = header_length + (size_t)content_length;
+        memmove(request, request + consumed, received - consumed);
+        received -= consumed;
+    }
+
+done:
+    free(request);
+    free(body.data);
+    free(response.data);
+}
+
+static void *run_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    int enabled = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+
+    SSL *ssl = SSL_new(tls_context);
+    if (ssl && SSL_set_fd(ssl, fd) == 1 && SSL_accept(ssl) == 1) {
+        serve_connection(ssl, (unsigned int)fd ^ (unsigned int)time(NULL));
+        SSL_shutdown(ssl);
+    } else {
+        ERR_print_errors_fp(stderr);
+    }
+    SSL_free(ssl);
+    close(fd);
+    return NULL;
+}
+
+static bool create_tls_context(void) {
+    tls_context = SSL_CTX_new(TLS_server_method());
+    if (!tls_context ||
+        SSL_CTX_set_min_proto_version(tls_context, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_use_certificate_chain_file(tls_context, options.cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tls_context, options.key,
+                                    SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(tls_context) != 1)
+        return false;
+    if (options.ca) {
+        /* Sessions of verified clients can only be resumed with a context. */
+        static const unsigned char session_context[] = "mock_kme";
+        if (SSL_CTX_load_verify_locations(tls_context, options.ca, NULL) != 1 ||
+            SSL_CTX_set_session_id_context(tls_context, session_context,
+                                           sizeof(session_context) - 1U) != 1)
+            return false;
+        SSL_CTX_set_verify(tls_context,
+                           SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+                           NULL);
+    }
+    return true;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s -c cert.pem -k key.pem [-a ca.pem] [-p port]\n"
+            "          [-l latency_us] [-j jitter_us] [-r keys_per_second]\n"
+            "          [-i kme_id]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+static long parse_number(const char *text, const char *program) {
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno || *end || value < 0)
+        usage(program);
+    return value;
+}
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "a:c:i:j:k:l:p:r:")) != -1) {
+        switch (option) {
+        case 'a':
+            options.ca = optarg;
+            break;
+        case 'c':
+            options.cert = optarg;
+            break;
+        case 'i':
+            options.kme_id = optarg;
+            break;
+        case 'j':
+            options.jitter_us = parse_number(optarg, argv[0]);
+            break;
+        case 'k':
+            options.key = optarg;
+            break;
+        case 'l':
+            options.latency_us = parse_number(optarg, argv[0]);
+            break;
+        case 'p':
+            options.port = (int)parse_number(optarg, argv[0]);
+            break;
+        case 'r':
+            options.rate = (double)parse_number(optarg, argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!options.cert || !options.key || optind != argc ||
+        options.port > 65535)
+        usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!create_tls_context()) {
+        fprintf(stderr, "Cannot load the TLS credentials\n");
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * The budget starts full and holds one second of generation, but never
+     * less than the largest request.
+     */
+    qkd_status_t status = {0};
+    if (simulated_backend.get_status(options.kme_id, "", &status) !=
+        QKD_STATUS_OK)
+        return EXIT_FAILURE;
+    burst_keys = options.rate < status.max_key_count ? options.rate
+                                                     : status.max_key_count;
+    if (burst_keys < status.max_key_per_request)
+        burst_keys = status.max_key_per_request;
+    available_keys = burst_keys;
+    clock_gettime(CLOCK_MONOTONIC, &last_refill);
+    qkd_status_free(&status);
+
+    int server = socket(AF_INET6, SOCK_STREAM, 0);
+    int enabled = 1, disabled = 0;
+    struct sockaddr_in6 address = {.sin6_family = AF_INET6,
+                                   .sin6_port = htons((uint16_t)options.port),
+                                   .sin6_addr = in6addr_any};
+    if (server < 0 ||
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enabled,
+                   sizeof(enabled)) != 0 ||
+        setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, &disabled,
+                   sizeof(disabled)) != 0 ||
+        bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server, SOMAXCONN) != 0) {
+        perror("Cannot listen");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Mock KME %s listening on port %d\n", options.kme_id,
+            options.port);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, run_connection,
+                           (void *)(intptr_t)fd) != 0)
+            close(fd);
+    }
+}
@@ -75,12 +75,34 @@ struct qkd_004_backend {
                         struct qkd_metadata_s *metadata, uint32_t *status);
 
     uint32_t (*close)(const unsigned char *key_stream_id, uint32_t *status);
+
+    /* Optional, GET_KEY_BATCH falls back to get_key when NULL */
+    uint32_t (*get_key_batch)(const unsigned char *key_stream_id,
+                              uint32_t start_index, uint32_t count,
+                              unsigned char *key_buffer, uint32_t *retrieved,
+                              uint32_t *status);
 };
 
 /* Backend Management Functions */
 void register_qkd_004_backend(const struct qkd_004_backend *backend);
 const struct qkd_004_backend *get_active_004_backend(void);
 
+/*
+ * Returns the backend called name, or with a NULL name the one selected by
+ * QKD_ETSI004_BACKEND or at configure time. With QKD_BACKEND_PLUGINS the
+ * backend is loaded from its plugin on first use; otherwise only the
+ * built-in backend is available.
+ */
+const struct qkd_004_backend *qkd_004_load_backend(const char *name);
+
+/*
+ * Entry point exported by backend plugins. It returns NULL when abi_version
+ * differs from the one the plugin was built against.
+ */
+#define QKD_004_BACKEND_ABI_VERSION 1U
+
+const struct qkd_004_backend *qkd_004_plugin_backend(uint32_t abi_version);
+
 /* ETSI GS QKD 004 API functions */
 /*
  * The return value mirrors the value written to status. In particular,
@@ -97,6 +119,56 @@ uint32_t GET_KEY(const unsigned char *key_stream_id, uint32_t *index,
 
 uint32_t CLOSE(const unsigned char *key_stream_id, uint32_t *status);
 
+/*
+ * Retrieves count consecutive key chunks starting at start_index into
+ * key_buffer, which must hold count chunks of the Key_chunk_size negotiated
+ * by OPEN_CONNECT(). Backends without a native implementation only support
+ * QKD_KEY_SIZE chunks. Metadata is not returned. *retrieved is set to the
+ * number of chunks written; when it is less than count the return value is
+ * the status of the first missing chunk.
+ */
+uint32_t GET_KEY_BATCH(const unsigned char *key_stream_id,
+                       uint32_t start_index, uint32_t count,
+                       unsigned char *key_buffer, uint32_t *retrieved,
+                       uint32_t *status);
+
+/*
+ * Context API. A context binds calls to one backend, so that streams of
+ * different backends can be used side by side in a process; the functions
+ * above use the default context, whose backend is the one set with
+ * register_qkd_004_backend(). Backends keep their per-stream state keyed by
+ * key_stream_id, so a context only selects the backend. Passing NULL as ctx
+ * selects the default context.
+ */
+typedef struct qkd_004_ctx qkd_004_ctx_t;
+
+/* backend may be NULL for the backend the library was built with. */
+qkd_004_ctx_t *qkd_004_ctx_create(const struct qkd_004_backend *backend);
+void qkd_004_ctx_destroy(qkd_004_ctx_t *ctx);
+qkd_004_ctx_t *qkd_004_default_ctx(void);
+
+uint32_t qkd_004_ctx_open_connect(qkd_004_ctx_t *ctx, const char *source,
+                                  const char *destination,
+                                  struct qkd_qos_s *qos,
+                                  unsigned char *key_stream_id,
+                                  uint32_t *status);
+
+uint32_t qkd_004_ctx_get_key(qkd_004_ctx_t *ctx,
+                             const unsigned char *key_stream_id,
+                             uint32_t *index, unsigned char *key_buffer,
+                             struct qkd_metadata_s *metadata,
+                             uint32_t *status);
+
+uint32_t qkd_004_ctx_close(qkd_004_ctx_t *ctx,
+                           const unsigned char *key_stream_id,
+                           uint32_t *status);
+
+uint32_t qkd_004_ctx_get_key_batch(qkd_004_ctx_t *ctx,
+                                   const unsigned char *key_stream_id,
+                                   uint32_t start_index, uint32_t count,
+                                   unsigned char *key_buffer,
+                                   uint32_t *retrieved, uint32_t *status);
+
 #ifdef __cplusplus
 }
 #endif
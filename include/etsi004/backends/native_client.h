@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi004/backends/native_client.h
+ */
+
+#ifndef QKD_ETSI004_BACKENDS_NATIVE_CLIENT_H_
+#define QKD_ETSI004_BACKENDS_NATIVE_CLIENT_H_
+
+#include "etsi004/api.h"
+
+/*
+ * ETSI 004 client speaking to the QUBIP KMS directly, without the embedded
+ * Python interpreter. The destination URI is "server://host[:port]" and the
+ * connection uses TLS with the CLIENT_CERT_PEM, CLIENT_CERT_KEY and
+ * SERVER_CERT_PEM files, as the Python client does. Setting
+ * QKD_004_ALLOW_PLAINTEXT=1 allows plain TCP when no server CA is configured.
+ *
+ * Experimental: the message format has only been tested against the mock
+ * server in tests/etsi004/native_client_test.c, so the backend is built only
+ * with QKD_EXPERIMENTAL_NATIVE_CLIENT=ON.
+ */
+extern const struct qkd_004_backend native_client_backend;
+
+#endif /* QKD_ETSI004_BACKENDS_NATIVE_CLIENT_H_ */
@@ -18,6 +18,12 @@
 
 #if defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
 
+/*
+ * Both APIs have a simulated backend; distinct symbols keep them apart when
+ * an application loads the two libraries.
+ */
+#define simulated_backend etsi004_simulated_backend
+
 extern const struct qkd_004_backend simulated_backend;
 
 #endif /* QKD_USE_SIMULATED */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi004/key_ring.h
+ */
+
+#ifndef QKD_ETSI004_KEY_RING_H_
+#define QKD_ETSI004_KEY_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "etsi004/api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Optional read-ahead for a connected stream of the default context. A
+ * producer thread fetches consecutive key chunks from the backend, no faster
+ * than the Max_bps of the stream, into a bounded ring. GET_KEY() for the
+ * index at the head of the ring, without metadata, pops the chunk with
+ * atomic operations instead of calling the backend; other requests are
+ * passed through. Chunks are held in locked memory excluded from core dumps
+ * and cleansed once handed out. CLOSE() stops the ring of the stream.
+ */
+typedef struct qkd_004_key_ring_config {
+    uint32_t capacity;    /* Chunks held ahead of the consumers */
+    uint32_t batch_size;  /* Chunks per backend request, 0: capacity */
+    uint32_t first_index; /* Index of the first chunk to fetch */
+} qkd_004_key_ring_config_t;
+
+typedef struct qkd_004_key_ring_stats {
+    uint64_t hits;           /* Chunks handed out from the ring */
+    uint64_t misses;         /* GET_KEY calls passed to the backend */
+    uint64_t fetched;        /* Chunks stored by the producer */
+    uint64_t fetch_failures; /* Backend requests that returned no chunk */
+    uint32_t buffered;       /* Chunks currently held */
+    uint32_t next_index;     /* Index of the next chunk to be handed out */
+} qkd_004_key_ring_stats_t;
+
+/*
+ * qos is the one negotiated by OPEN_CONNECT(): the slots of the ring hold
+ * chunks of its Key_chunk_size, which must not be 0, and its Timeout bounds
+ * GET_KEY_WAIT(). key_buffer arguments hold Key_chunk_size bytes. Returns
+ * QKD_STATUS_KSID_IN_USE when the stream already has a ring.
+ */
+uint32_t qkd_004_key_ring_start(const unsigned char *key_stream_id,
+                                const struct qkd_qos_s *qos,
+                                const qkd_004_key_ring_config_t *config,
+                                uint32_t *status);
+void qkd_004_key_ring_stop(const unsigned char *key_stream_id);
+bool qkd_004_key_ring_get_stats(const unsigned char *key_stream_id,
+                                qkd_004_key_ring_stats_t *stats);
+
+/*
+ * Pops the next chunk of the stream's ring into key_buffer and its index
+ * into *index, waiting up to the Timeout of the stream for the producer.
+ * Returns QKD_STATUS_TIMEOUT when no chunk arrived in time, the last
+ * backend error when the producer can no longer fetch chunks, and
+ * QKD_STATUS_NO_CONNECTION for streams without a ring.
+ */
+uint32_t GET_KEY_WAIT(const unsigned char *key_stream_id, uint32_t *index,
+                      unsigned char *key_buffer, uint32_t *status);
+
+/*
+ * Non-blocking eventfd of the stream's ring for poll(2) and epoll(7), or -1
+ * for streams without a ring. It becomes readable when the producer stores
+ * chunks, or gets a backend error other than QKD_STATUS_INSUFFICIENT_KEY,
+ * after a GET_KEY() or GET_KEY_WAIT() found the ring empty, and when the
+ * first chunks arrive. Read it to clear it, then call GET_KEY() until it
+ * misses. The descriptor is owned by the ring and closed by CLOSE().
+ */
+int qkd_004_key_ring_fd(const unsigned char *key_stream_id);
+
+/*
+ * Used by GET_KEY: returns true and stores the chunk when *index is at the
+ * head of the stream's ring.
+ */
+bool qkd_004_key_ring_get_key(const unsigned char *key_stream_id,
+                              uint32_t index, unsigned char *key_buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QKD_ETSI004_KEY_RING_H_ */
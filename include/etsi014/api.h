@@ -13,6 +13,7 @@
 #ifndef QKD_ETSI014_API_H
 #define QKD_ETSI014_API_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* Response codes as per section 5 */
@@ -49,17 +50,42 @@ typedef struct qkd_key_request {
 } qkd_key_request_t;
 
 /* Key container format (section 6.3) */
+#define QKD_KEY_UUID_SIZE 16
+
 typedef struct qkd_key {
     char *key_ID;           /* UUID format string */
     void *key_ID_extension; /* Optional extension object */
-    char *key;              /* Base64 encoded key data */
+    char *key;              /* Base64 encoded key data, or raw bytes */
     void *key_extension;    /* Optional extension object */
+    size_t key_length;      /* Length of key in characters or bytes */
+    unsigned char key_UUID[QKD_KEY_UUID_SIZE]; /* key_ID, binary mode only */
 } qkd_key_t;
 
+/*
+ * Container storage options, set in flags before GET_KEY or GET_KEY_WITH_IDS.
+ * Without flags each key ID and key is a separate object from the locked
+ * pool of qkd_secure_alloc.h. With QKD_KEY_CONTAINER_ARENA the key array, key
+ * IDs and keys share one heap allocation, extended by further blocks only
+ * when a response is larger than expected, that qkd_key_container_free()
+ * cleanses and releases at once. QKD_KEY_CONTAINER_LOCKED locks the arena in
+ * memory and excludes it from core dumps. With QKD_KEY_CONTAINER_BINARY each
+ * key holds the decoded key bytes (key_length of them, not NUL terminated)
+ * and key_UUID the binary form of key_ID, which stays a string so it can be
+ * passed to GET_KEY_WITH_IDS. Flags are kept by qkd_key_container_free() so a
+ * container can be reused, and must not change while the container holds
+ * keys.
+ */
+#define QKD_KEY_CONTAINER_ARENA 0x1U
+#define QKD_KEY_CONTAINER_LOCKED 0x2U
+#define QKD_KEY_CONTAINER_BINARY 0x4U
+
 typedef struct qkd_key_container {
     qkd_key_t *keys;               /* Array of keys */
     int32_t key_count;             /* Number of keys in array */
     void *key_container_extension; /* Optional extension object */
+    uint32_t flags;                /* QKD_KEY_CONTAINER_* storage options */
+    void *arena;                   /* Storage of all keys in arena mode */
+    size_t arena_size;             /* Total bytes allocated for the arena */
 } qkd_key_container_t;
 
 /* Key IDs format (section 6.4) */
@@ -74,6 +100,38 @@ typedef struct qkd_key_ids {
     void *key_IDs_extension; /* Optional extension object */
 } qkd_key_ids_t;
 
+/*
+ * Completion callback of the asynchronous API. result is the value the
+ * blocking call would have returned; the output structure passed at
+ * submission is filled in before the callback runs.
+ */
+typedef void (*qkd_014_callback_t)(uint32_t result, void *user_data);
+
+/* Opaque asynchronous request engine, see qkd_014_async_create() */
+typedef struct qkd_014_async qkd_014_async_t;
+
+/* Opaque API context, see qkd_014_ctx_create() */
+typedef struct qkd_014_ctx qkd_014_ctx_t;
+
+struct qkd_014_backend;
+
+/*
+ * Settings of a context. Members left NULL take the defaults: the backend
+ * the library was built with, and the TLS paths from the QKD_MASTER_* and
+ * QKD_SLAVE_* environment variables. kme_hostname is used by calls that pass
+ * NULL as their hostname.
+ */
+typedef struct qkd_014_ctx_config {
+    const struct qkd_014_backend *backend;
+    const char *kme_hostname;
+    const char *master_cert_path;
+    const char *master_key_path;
+    const char *master_ca_cert_path;
+    const char *slave_cert_path;
+    const char *slave_key_path;
+    const char *slave_ca_cert_path;
+} qkd_014_ctx_config_t;
+
 /* ETSI 014 Backend Interface */
 struct qkd_014_backend {
     const char *name;
@@ -89,12 +147,80 @@ struct qkd_014_backend {
                                  const char *master_sae_id,
                                  qkd_key_ids_t *key_ids,
                                  qkd_key_container_t *container);
+
+    /*
+     * Optional non-blocking interface. Backends that leave these NULL are
+     * served by the API layer, which runs the blocking call at submission
+     * and defers the callback to qkd_014_async_perform().
+     */
+    void *(*async_create)(void);
+    void (*async_destroy)(void *engine);
+    int (*async_fd)(const void *engine);
+    int (*async_perform)(void *engine, int timeout_ms);
+
+    uint32_t (*get_status_async)(void *engine, const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 qkd_status_t *status,
+                                 qkd_014_callback_t callback, void *user_data);
+
+    uint32_t (*get_key_async)(void *engine, const char *kme_hostname,
+                              const char *slave_sae_id,
+                              qkd_key_request_t *request,
+                              qkd_key_container_t *container,
+                              qkd_014_callback_t callback, void *user_data);
+
+    uint32_t (*get_key_with_ids_async)(void *engine, const char *kme_hostname,
+                                       const char *master_sae_id,
+                                       qkd_key_ids_t *key_ids,
+                                       qkd_key_container_t *container,
+                                       qkd_014_callback_t callback,
+                                       void *user_data);
+
+    /*
+     * Optional per-context state, such as connection pools and credentials.
+     * Contexts of backends that leave these NULL use the plain functions
+     * above and share the backend's global state.
+     */
+    void *(*context_create)(const qkd_014_ctx_config_t *config);
+    void (*context_destroy)(void *context);
+
+    uint32_t (*context_get_status)(void *context, const char *kme_hostname,
+                                   const char *slave_sae_id,
+                                   qkd_status_t *status);
+
+    uint32_t (*context_get_key)(void *context, const char *kme_hostname,
+                                const char *slave_sae_id,
+                                qkd_key_request_t *request,
+                                qkd_key_container_t *container);
+
+    uint32_t (*context_get_key_with_ids)(void *context,
+                                         const char *kme_hostname,
+                                         const char *master_sae_id,
+                                         qkd_key_ids_t *key_ids,
+                                         qkd_key_container_t *container);
 };
 
 /* Backend Management Functions */
 void register_qkd_014_backend(const struct qkd_014_backend *backend);
 const struct qkd_014_backend *get_active_014_backend(void);
 
+/*
+ * Returns the backend called name, or with a NULL name the one selected by
+ * QKD_ETSI014_BACKEND or at configure time. With QKD_BACKEND_PLUGINS the
+ * backend is loaded from its plugin on first use, see qkd_plugin_load();
+ * otherwise only the built-in backend is available.
+ */
+const struct qkd_014_backend *qkd_014_load_backend(const char *name);
+
+/*
+ * Backend plugins export qkd_014_plugin_backend(), which returns their
+ * backend, or NULL when abi_version differs from the one they were built
+ * against. The version changes whenever struct qkd_014_backend does.
+ */
+#define QKD_014_BACKEND_ABI_VERSION 1U
+
+const struct qkd_014_backend *qkd_014_plugin_backend(uint32_t abi_version);
+
 /* ETSI GS QKD 014 API functions (section 5) */
 uint32_t GET_STATUS(const char *kme_hostname, const char *slave_sae_id,
                     qkd_status_t *status);
@@ -106,6 +232,75 @@ uint32_t GET_KEY_WITH_IDS(const char *kme_hostname, const char *master_sae_id,
                           qkd_key_ids_t *key_ids,
                           qkd_key_container_t *container);
 
+/*
+ * Context API. A context binds calls to one backend and its own state, so
+ * that several KMEs or identities can be served side by side in a process.
+ * The functions above use the default context, whose backend is the one
+ * set with register_qkd_014_backend(); only the default context goes
+ * through the key cache and the GET_KEY_WITH_IDS coalescer. A context may
+ * be used from several threads, but must not be destroyed while calls on
+ * it are in progress. Passing NULL as ctx selects the default context.
+ */
+qkd_014_ctx_t *qkd_014_ctx_create(const qkd_014_ctx_config_t *config);
+void qkd_014_ctx_destroy(qkd_014_ctx_t *ctx);
+qkd_014_ctx_t *qkd_014_default_ctx(void);
+
+uint32_t qkd_014_ctx_get_status(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                                const char *slave_sae_id,
+                                qkd_status_t *status);
+
+uint32_t qkd_014_ctx_get_key(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                             const char *slave_sae_id,
+                             qkd_key_request_t *request,
+                             qkd_key_container_t *container);
+
+uint32_t qkd_014_ctx_get_key_with_ids(qkd_014_ctx_t *ctx,
+                                      const char *kme_hostname,
+                                      const char *master_sae_id,
+                                      qkd_key_ids_t *key_ids,
+                                      qkd_key_container_t *container);
+
+/*
+ * Asynchronous API. An engine is bound to the backend active when it was
+ * created and must be driven from one thread at a time. Submission returns
+ * QKD_STATUS_OK when the callback will be invoked later from
+ * qkd_014_async_perform(); any other value means the request was rejected
+ * and no callback follows. The output structure must stay valid until the
+ * callback runs. Destroying an engine cancels outstanding requests without
+ * invoking their callbacks, and must not be done from within a callback.
+ */
+qkd_014_async_t *qkd_014_async_create(void);
+void qkd_014_async_destroy(qkd_014_async_t *async);
+
+/*
+ * File descriptor that becomes readable when qkd_014_async_perform() has work
+ * to do, suitable for poll/epoll based event loops.
+ */
+int qkd_014_async_fd(const qkd_014_async_t *async);
+
+/*
+ * Wait up to timeout_ms (0 polls, -1 blocks) for progress, run completion
+ * callbacks and return the number of requests still outstanding, or -1 on
+ * error.
+ */
+int qkd_014_async_perform(qkd_014_async_t *async, int timeout_ms);
+
+uint32_t GET_STATUS_ASYNC(qkd_014_async_t *async, const char *kme_hostname,
+                          const char *slave_sae_id, qkd_status_t *status,
+                          qkd_014_callback_t callback, void *user_data);
+
+uint32_t GET_KEY_ASYNC(qkd_014_async_t *async, const char *kme_hostname,
+                       const char *slave_sae_id, qkd_key_request_t *request,
+                       qkd_key_container_t *container,
+                       qkd_014_callback_t callback, void *user_data);
+
+uint32_t GET_KEY_WITH_IDS_ASYNC(qkd_014_async_t *async,
+                                const char *kme_hostname,
+                                const char *master_sae_id,
+                                qkd_key_ids_t *key_ids,
+                                qkd_key_container_t *container,
+                                qkd_014_callback_t callback, void *user_data);
+
 /*
  * Release strings and key arrays allocated by the wrapper. Opaque extension
  * objects remain owned by the caller or the backend that created them.
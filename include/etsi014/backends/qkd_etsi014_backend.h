@@ -17,14 +17,42 @@
 #include "etsi014/api.h"
 
 #ifdef QKD_USE_ETSI014_BACKEND
+struct qkd_tls_credentials;
+
 typedef struct {
     const char *cert_path;    // Path to public certificate
     const char *key_path;     // Path to private key
     const char *ca_cert_path; // Path to CA certificate
+    const struct qkd_tls_credentials *credentials; // Contents, loaded once
 } etsi014_cert_config_t;
 
+/*
+ * Returns the credentials of role (1 for the master SAE, 0 for the slave).
+ * The first call for a role reads its environment variables and loads the
+ * PEM files into memory; later calls, and every request, reuse them.
+ */
 int init_cert_config(int role, etsi014_cert_config_t *config);
 
+/*
+ * Drops the loaded credentials so that the next request reads the
+ * environment and the files again, e.g. after certificates were rotated.
+ * Must not be called while requests are in progress.
+ */
+void qkd_etsi014_credentials_cleanup(void);
+
+/*
+ * Close the idle pooled HTTPS connections. Handles in use by other threads are
+ * left untouched and return to the pool when their request completes.
+ */
+void qkd_etsi014_connection_pool_cleanup(void);
+
+/*
+ * Closes the file given by QKD_KME_RECORD and drops the responses loaded
+ * from QKD_KME_REPLAY, so that the next request reads both variables again.
+ * Must not be called while requests are in progress.
+ */
+void qkd_etsi014_recording_cleanup(void);
+
 extern const struct qkd_014_backend qkd_etsi014_backend;
 #endif /* QKD_USE_ETSI014_BACKEND */
 
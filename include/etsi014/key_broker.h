@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_broker.h
+ */
+
+#ifndef QKD_ETSI014_KEY_BROKER_H_
+#define QKD_ETSI014_KEY_BROKER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+
+#define QKD_KEY_BROKER_MAX_PAIRS 8
+
+typedef struct qkd_key_broker_pair {
+    const char *kme_hostname;
+    const char *slave_sae_id;
+} qkd_key_broker_pair_t;
+
+/*
+ * Optional broker that shares keys between the processes of one host. The
+ * process that starts it owns the backend connections: a background thread
+ * keeps a ring of keys per (KME, slave SAE) pair in a shared memory segment,
+ * between low_watermark and capacity keys. Every process attached to the
+ * segment, the owner included, serves single-key GET_KEY requests for those
+ * pairs by popping keys from the rings with atomic operations; a request
+ * only falls through to the backend of the process when its ring is empty.
+ *
+ * The segment is named when name is set (see shm_open(3)) and anonymous
+ * otherwise, in which case other processes attach to qkd_key_broker_fd().
+ * Children forked by the owner inherit the mapping and are attached as
+ * clients. A client that crashes while copying a key stalls its ring, so
+ * the broker suits cooperating workers of one service rather than
+ * untrusted processes.
+ */
+typedef struct qkd_key_broker_config {
+    const char *name; /* Shared memory object, NULL: anonymous memfd */
+    const qkd_key_broker_pair_t *pairs;
+    size_t pair_count;
+    int32_t capacity;      /* Keys held per pair after a refill */
+    int32_t low_watermark; /* Refill when this many keys or fewer remain */
+    int32_t batch_size;    /* 0: max_key_per_request from GET_STATUS */
+    int32_t key_size;      /* Key size in bits, 0: KME default */
+} qkd_key_broker_config_t;
+
+typedef struct qkd_key_broker_stats {
+    uint64_t hits;            /* GET_KEY calls of this process served */
+    uint64_t misses;          /* Eligible calls that found an empty ring */
+    uint64_t refills;         /* Successful batch requests of the owner */
+    uint64_t refill_failures; /* Failed batch requests of the owner */
+    uint64_t stored_keys;     /* Keys stored by the owner */
+    int32_t available_keys;   /* Keys currently held in all rings */
+} qkd_key_broker_stats_t;
+
+/* Creates the segment, attaches this process and starts filling it. */
+uint32_t qkd_key_broker_start(const qkd_key_broker_config_t *config);
+
+/* Called by the owner: stops filling, detaches and removes the segment. */
+void qkd_key_broker_stop(void);
+
+/* File descriptor of the segment of the owner, -1 when not started. */
+int qkd_key_broker_fd(void);
+
+/* Attaches a client process to a running broker. */
+uint32_t qkd_key_broker_attach(const char *name);
+uint32_t qkd_key_broker_attach_fd(int fd);
+void qkd_key_broker_detach(void);
+
+void qkd_key_broker_get_stats(qkd_key_broker_stats_t *stats);
+
+/*
+ * Used by GET_KEY: returns true and fills container when the request was
+ * served from a ring.
+ */
+bool qkd_key_broker_get_key(const char *kme_hostname, const char *slave_sae_id,
+                            const qkd_key_request_t *request,
+                            qkd_key_container_t *container);
+
+#endif /* QKD_ETSI014_KEY_BROKER_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_cache.h
+ */
+
+#ifndef QKD_ETSI014_KEY_CACHE_H_
+#define QKD_ETSI014_KEY_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+
+/*
+ * Optional client-side cache in front of GET_KEY. A background thread keeps
+ * between low_watermark and high_watermark keys per (KME, slave SAE) pair by
+ * fetching batches from the active backend, and single-key GET_KEY requests
+ * are served from memory. Cached keys live in locked memory excluded from
+ * core dumps and are cleansed as soon as they are handed out.
+ */
+typedef struct qkd_key_cache_config {
+    int32_t low_watermark;  /* Refill when this many keys or fewer remain */
+    int32_t high_watermark; /* Keys held per pair after a refill */
+    int32_t batch_size;     /* 0: max_key_per_request from GET_STATUS */
+    int32_t key_size;       /* Key size in bits, 0: KME default */
+} qkd_key_cache_config_t;
+
+typedef struct qkd_key_cache_stats {
+    uint64_t hits;            /* GET_KEY calls served from the cache */
+    uint64_t misses;          /* Eligible GET_KEY calls sent to the backend */
+    uint64_t refills;         /* Successful background batch requests */
+    uint64_t refill_failures; /* Failed background requests */
+    uint64_t prefetched_keys; /* Keys stored by background requests */
+    int32_t cached_keys;      /* Keys currently held */
+} qkd_key_cache_stats_t;
+
+uint32_t qkd_key_cache_enable(const qkd_key_cache_config_t *config);
+void qkd_key_cache_disable(void);
+void qkd_key_cache_get_stats(qkd_key_cache_stats_t *stats);
+
+/*
+ * Non-blocking eventfd of the (KME, slave SAE) pair for poll(2) and epoll(7),
+ * or -1 when the cache is disabled or full. It becomes readable when the
+ * background thread stores keys after a GET_KEY request found none cached,
+ * which it retries every second while the KME is out of key, and at once if
+ * keys are already cached. Read it to clear it, then call GET_KEY() until a
+ * request misses the cache. The descriptor is owned by the cache and closed
+ * by qkd_key_cache_disable().
+ */
+int qkd_key_cache_fd(const char *kme_hostname, const char *slave_sae_id);
+
+/*
+ * Used by GET_KEY: returns true and fills container when the request was
+ * served from the cache.
+ */
+bool qkd_key_cache_get_key(const char *kme_hostname, const char *slave_sae_id,
+                           const qkd_key_request_t *request,
+                           qkd_key_container_t *container);
+
+#endif /* QKD_ETSI014_KEY_CACHE_H_ */
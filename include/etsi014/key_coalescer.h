@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_coalescer.h
+ */
+
+#ifndef QKD_ETSI014_KEY_COALESCER_H_
+#define QKD_ETSI014_KEY_COALESCER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+
+/*
+ * Optional coalescing of concurrent GET_KEY_WITH_IDS calls. Calls for the
+ * same (KME, master SAE) pair that arrive within window_us of each other, up
+ * to max_key_ids IDs, are sent to the backend as a single request and the
+ * returned keys are handed back to each caller. If the combined request
+ * fails, every caller repeats its own request so that one bad key ID does not
+ * fail the others.
+ */
+typedef struct qkd_key_coalescer_config {
+    int32_t window_us;   /* Time the first caller waits for others */
+    int32_t max_key_ids; /* Key IDs per combined request */
+} qkd_key_coalescer_config_t;
+
+typedef struct qkd_key_coalescer_stats {
+    uint64_t calls;        /* GET_KEY_WITH_IDS calls handled */
+    uint64_t requests;     /* Requests sent to the backend */
+    uint64_t merged_calls; /* Calls served by a request of another caller */
+    uint64_t fallbacks;    /* Calls repeated after a combined request failed */
+} qkd_key_coalescer_stats_t;
+
+uint32_t qkd_key_coalescer_enable(const qkd_key_coalescer_config_t *config);
+void qkd_key_coalescer_disable(void);
+void qkd_key_coalescer_get_stats(qkd_key_coalescer_stats_t *stats);
+
+/*
+ * Used by GET_KEY_WITH_IDS: returns true and stores the status code in
+ * result when the call was handled by the coalescer.
+ */
+bool qkd_key_coalescer_get_key_with_ids(const char *kme_hostname,
+                                        const char *master_sae_id,
+                                        qkd_key_ids_t *key_ids,
+                                        qkd_key_container_t *container,
+                                        uint32_t *result);
+
+#endif /* QKD_ETSI014_KEY_COALESCER_H_ */
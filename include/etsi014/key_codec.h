@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_codec.h
+ */
+
+#ifndef QKD_ETSI014_KEY_CODEC_H_
+#define QKD_ETSI014_KEY_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "etsi014/api.h"
+
+#define QKD_KEY_UUID_LENGTH 36U /* Text form, without terminator */
+
+/*
+ * Validation and decoding of key_ID and key strings. The lookup tables do
+ * not depend on the locale, the input is never scanned for a terminator,
+ * and Base64 is handled 16 or 32 characters at a time with SSSE3 or AVX2
+ * when the CPU supports them, falling back to the tables otherwise.
+ */
+
+/* Parses a hyphenated UUID of exactly QKD_KEY_UUID_LENGTH characters. */
+bool qkd_parse_uuid(const char *value, size_t length,
+                    unsigned char uuid[QKD_KEY_UUID_SIZE]);
+
+/* True when value is padded Base64 of the standard alphabet. */
+bool qkd_is_base64(const char *value, size_t length);
+
+/*
+ * Validates and decodes padded Base64 in a single pass. output must hold
+ * length / 4 * 3 bytes; on failure its contents are undefined.
+ */
+bool qkd_decode_base64(const char *input, size_t length,
+                       unsigned char *output, size_t *output_length);
+
+#endif /* QKD_ETSI014_KEY_CODEC_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_container.h
+ */
+
+#ifndef QKD_ETSI014_KEY_CONTAINER_H_
+#define QKD_ETSI014_KEY_CONTAINER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+#include "qkd_secure_alloc.h"
+
+/*
+ * Fills a qkd_key_container_t for backends, honouring the storage flags the
+ * caller set. In arena mode all strings are copied into one block; otherwise
+ * each key ID and key gets its own qkd_secure_alloc() object. On failure the
+ * partially filled container is released with qkd_key_container_free().
+ */
+struct qkd_key_builder {
+    qkd_key_container_t *container;
+    char *next; /* Next free byte of the arena */
+    char *end;
+};
+
+/*
+ * Prepares container for count keys. string_size is the expected total
+ * length of all key IDs and keys including their terminators; in arena mode
+ * it sizes the first block, and the arena grows if more space is needed.
+ */
+bool qkd_key_builder_begin(struct qkd_key_builder *builder,
+                           qkd_key_container_t *container, int32_t count,
+                           size_t string_size);
+
+/*
+ * Adds a key received as Base64 text. In binary mode the text is validated
+ * and decoded while it is copied, and key_ID is parsed into key_UUID.
+ */
+bool qkd_key_builder_add(struct qkd_key_builder *builder, const char *key_ID,
+                         size_t key_ID_length, const char *key,
+                         size_t key_length);
+
+/*
+ * Adds a key held as raw bytes, encoding it only when the caller did not ask
+ * for binary keys. string_size must then allow for the Base64 form.
+ */
+bool qkd_key_builder_add_raw(struct qkd_key_builder *builder,
+                             const char *key_ID, size_t key_ID_length,
+                             const unsigned char uuid[QKD_KEY_UUID_SIZE],
+                             const unsigned char *key, size_t key_length);
+
+/*
+ * Releases the arena of a container built in arena mode, cleansing it first.
+ * Used by qkd_key_container_free().
+ */
+void qkd_key_arena_free(void *arena, uint32_t flags);
+
+#endif /* QKD_ETSI014_KEY_CONTAINER_H_ */
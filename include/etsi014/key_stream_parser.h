@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/key_stream_parser.h
+ */
+
+#ifndef QKD_ETSI014_KEY_STREAM_PARSER_H_
+#define QKD_ETSI014_KEY_STREAM_PARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+#include "etsi014/key_container.h"
+
+#define QKD_KEY_STREAM_MAX_DEPTH 32
+#define QKD_KEY_STREAM_NAME_SIZE 16
+#define QKD_KEY_STREAM_UUID_LENGTH 36
+
+/*
+ * Incremental parser for key container responses (section 6.3). Bytes are
+ * fed as they arrive; each key object is validated and copied into the
+ * output container as soon as it closes, so only the key being parsed is
+ * buffered, whatever the size of the response. Members other than keys,
+ * key_ID and key are skipped, including arbitrarily nested extensions.
+ */
+struct qkd_key_stream_parser {
+    qkd_key_container_t container;
+    struct qkd_key_builder builder;
+    int32_t max_keys;
+    bool failed;
+
+    /* Lexer */
+    uint8_t state;
+    uint8_t resume; /* State to return to after a literal or escape */
+    uint8_t depth;
+    uint8_t stack[QKD_KEY_STREAM_MAX_DEPTH];
+    const char *literal;
+    uint8_t literal_position;
+    uint8_t unicode_digits;
+    uint32_t unicode_value;
+
+    /* Where the string being lexed goes */
+    uint8_t capture;
+    bool name_overflow;
+    char name[QKD_KEY_STREAM_NAME_SIZE];
+    size_t name_length;
+    uint8_t member; /* Meaning of the member whose value comes next */
+
+    /* Document position */
+    bool seen_keys;
+    uint8_t keys_depth;  /* Depth of the keys array, 0 when outside */
+    uint8_t seen_fields; /* key_ID and key found in the current object */
+
+    /* Fields of the key object being parsed */
+    char key_ID[QKD_KEY_STREAM_UUID_LENGTH + 1];
+    size_t key_ID_length;
+    char *key;
+    size_t key_length;
+    size_t key_capacity;
+};
+
+/*
+ * Prepares parser to fill a container with the given storage flags.
+ * max_keys is the number of keys requested; key_size_bits sizes the initial
+ * arena and may be 0 when unknown.
+ */
+bool qkd_key_stream_parser_init(struct qkd_key_stream_parser *parser,
+                                uint32_t flags, int32_t max_keys,
+                                int32_t key_size_bits);
+
+/* Returns false once the input is known to be invalid. */
+bool qkd_key_stream_parser_feed(struct qkd_key_stream_parser *parser,
+                                const char *data, size_t length);
+
+/*
+ * Checks that the document is complete and moves the keys into container.
+ * The parser must still be released with qkd_key_stream_parser_free().
+ */
+bool qkd_key_stream_parser_finish(struct qkd_key_stream_parser *parser,
+                                  qkd_key_container_t *container);
+
+void qkd_key_stream_parser_free(struct qkd_key_stream_parser *parser);
+
+#endif /* QKD_ETSI014_KEY_STREAM_PARSER_H_ */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/etsi014/status_cache.h
+ */
+
+#ifndef QKD_ETSI014_STATUS_CACHE_H_
+#define QKD_ETSI014_STATUS_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "etsi014/api.h"
+
+/*
+ * Called when a fetched status differs from the one cached for its (KME,
+ * slave SAE) pair in anything but stored_key_count, from the thread that
+ * fetched it. The status is only valid during the call.
+ */
+typedef void (*qkd_status_cache_callback_t)(const char *kme_hostname,
+                                            const char *slave_sae_id,
+                                            const qkd_status_t *status,
+                                            void *user_data);
+
+/*
+ * Optional cache in front of GET_STATUS. A status younger than ttl_ms is
+ * answered from memory. Statuses that were read are fetched again by a
+ * background thread once they are refresh_ms old, so that readers rarely
+ * wait for the KME. Between fetches, stored_key_count is an estimate: the
+ * count last reported by the KME minus the keys GET_KEY has returned since.
+ */
+typedef struct qkd_status_cache_config {
+    int32_t ttl_ms;     /* Age after which GET_STATUS asks the KME again */
+    int32_t refresh_ms; /* Background refresh age, 0: half of ttl_ms */
+    qkd_status_cache_callback_t on_change; /* Optional */
+    void *user_data;
+} qkd_status_cache_config_t;
+
+typedef struct qkd_status_cache_stats {
+    uint64_t hits;             /* Reads served from memory */
+    uint64_t misses;           /* GET_STATUS calls sent to the backend */
+    uint64_t refreshes;        /* Successful background fetches */
+    uint64_t refresh_failures; /* Failed background fetches */
+    uint64_t changes;          /* Fetches that changed a cached status */
+} qkd_status_cache_stats_t;
+
+uint32_t qkd_status_cache_enable(const qkd_status_cache_config_t *config);
+void qkd_status_cache_disable(void);
+void qkd_status_cache_get_stats(qkd_status_cache_stats_t *stats);
+
+/*
+ * Fills the numeric fields of status from the cache without contacting the
+ * KME, leaving the string fields NULL. Returns false when the pair has no
+ * status younger than ttl_ms.
+ */
+bool qkd_status_cache_peek(const char *kme_hostname, const char *slave_sae_id,
+                           qkd_status_t *status);
+
+/*
+ * Used by GET_STATUS: returns true and stores the status code in result when
+ * the call was handled by the cache.
+ */
+bool qkd_status_cache_get_status(const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 qkd_status_t *status, uint32_t *result);
+
+/* Used by GET_KEY: lowers the estimate of the pair by the keys returned. */
+void qkd_status_cache_consume(const char *kme_hostname,
+                              const char *slave_sae_id, int32_t keys);
+
+#endif /* QKD_ETSI014_STATUS_CACHE_H_ */
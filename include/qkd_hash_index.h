@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/qkd_hash_index.h
+ */
+
+#ifndef QKD_HASH_INDEX_H_
+#define QKD_HASH_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QKD_HASH_KEY_SIZE 16
+
+/*
+ * Open-addressing hash table mapping 16-byte identifiers (KSIDs, binary
+ * UUIDs) to array slots. Linear probing with backward-shift deletion keeps
+ * lookups O(1) under churn without tombstones. The table is sized once for
+ * max_entries and never grows; callers are not thread-safe and must hold
+ * their own lock.
+ */
+struct qkd_hash_bucket {
+    unsigned char key[QKD_HASH_KEY_SIZE];
+    int32_t value; /* -1 when the bucket is empty */
+};
+
+struct qkd_hash_index {
+    struct qkd_hash_bucket *buckets;
+    size_t mask;
+    size_t count;
+    size_t max_entries;
+    uint64_t seed[2];
+};
+
+bool qkd_hash_index_init(struct qkd_hash_index *index, size_t max_entries);
+void qkd_hash_index_free(struct qkd_hash_index *index);
+
+/* Returns the value stored for key, or -1. */
+int32_t qkd_hash_index_find(const struct qkd_hash_index *index,
+                            const unsigned char *key);
+
+/* Adds key, or updates its value. Fails when max_entries are stored. */
+bool qkd_hash_index_insert(struct qkd_hash_index *index,
+                           const unsigned char *key, int32_t value);
+
+bool qkd_hash_index_remove(struct qkd_hash_index *index,
+                           const unsigned char *key);
+
+#endif /* QKD_HASH_INDEX_H_ */
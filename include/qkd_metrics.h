@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/qkd_metrics.h
+ */
+
+#ifndef QKD_METRICS_H_
+#define QKD_METRICS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Operations with metrics */
+enum qkd_metrics_op {
+    QKD_METRICS_004_OPEN_CONNECT,
+    QKD_METRICS_004_GET_KEY,
+    QKD_METRICS_004_GET_KEY_BATCH,
+    QKD_METRICS_004_CLOSE,
+    QKD_METRICS_014_GET_STATUS,
+    QKD_METRICS_014_GET_KEY,
+    QKD_METRICS_014_GET_KEY_WITH_IDS,
+    QKD_METRICS_OP_COUNT
+};
+
+/*
+ * TOTAL is the whole API call. Backends that talk to a KME add the time
+ * spent opening the TCP connection (including name resolution), in the TLS
+ * handshake, transferring the request and response, and parsing the
+ * response. Parsing may overlap the transfer when responses are parsed as
+ * they arrive. Phases are not recorded when they did not happen, such as the
+ * connection of a request that reused an open one.
+ */
+enum qkd_metrics_phase {
+    QKD_METRICS_TOTAL,
+    QKD_METRICS_CONNECT,
+    QKD_METRICS_TLS,
+    QKD_METRICS_TRANSFER,
+    QKD_METRICS_PARSE,
+    QKD_METRICS_PHASE_COUNT
+};
+
+/*
+ * Log-linear latency histogram in nanoseconds: values below 4 have their own
+ * bucket, and every power of two above is split into 4 buckets, so a bucket
+ * spans at most a quarter of its lower bound. The last bucket, from about 32
+ * minutes, also holds all longer values.
+ */
+#define QKD_METRICS_BUCKETS 160
+
+struct qkd_metrics_histogram {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[QKD_METRICS_BUCKETS];
+};
+
+struct qkd_metrics_op_stats {
+    uint64_t calls;
+    uint64_t errors; /* Calls that did not return success */
+    struct qkd_metrics_histogram phases[QKD_METRICS_PHASE_COUNT];
+};
+
+struct qkd_metrics_snapshot {
+    struct qkd_metrics_op_stats ops[QKD_METRICS_OP_COUNT];
+};
+
+/*
+ * Fills snapshot with the totals since the process started. Each thread
+ * accumulates into its own counters without locks or atomic read-modify-write
+ * operations; a snapshot merges them, and may miss calls that complete while
+ * it is taken. Subtract two snapshots to measure an interval.
+ */
+void qkd_metrics_snapshot(struct qkd_metrics_snapshot *snapshot);
+
+/*
+ * Returns an upper bound of the given percentile (0 to 100) of a histogram,
+ * accurate to its bucket width, or 0 for an empty histogram.
+ */
+uint64_t qkd_metrics_percentile(const struct qkd_metrics_histogram *histogram,
+                                double percentile);
+
+const char *qkd_metrics_op_name(enum qkd_metrics_op op);
+const char *qkd_metrics_phase_name(enum qkd_metrics_phase phase);
+
+/*
+ * Writes one line per operation that was called, and one per recorded phase:
+ *
+ *   014.get_key calls=10 errors=0
+ *   014.get_key.total count=10 mean_ns=... p50_ns=... p99_ns=... max_ns=...
+ *
+ * Returns 0, or -1 when writing fails.
+ */
+int qkd_metrics_export(const struct qkd_metrics_snapshot *snapshot,
+                       FILE *stream);
+
+/* Recording, used by the API layers and backends */
+uint64_t qkd_metrics_now(void);
+void qkd_metrics_record(enum qkd_metrics_op op, enum qkd_metrics_phase phase,
+                        uint64_t elapsed_ns);
+
+/* Counts one call started at qkd_metrics_now() and records its TOTAL. */
+void qkd_metrics_finish(enum qkd_metrics_op op, uint64_t started, bool failed);
+
+#endif /* QKD_METRICS_H_ */
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/qkd_plugin.h
+ */
+
+#ifndef QKD_PLUGIN_H_
+#define QKD_PLUGIN_H_
+
+#include <stdint.h>
+
+/* Entry point exported by every backend plugin. */
+typedef const void *(*qkd_plugin_entry_t)(uint32_t abi_version);
+
+/*
+ * Loads the backend plugin of api ("004" or "014") and returns what its
+ * entry point yields for abi_version, or NULL. name is either a backend name
+ * such as "simulated", looked up as libqkd-etsi<api>-<name>.so in
+ * QKD_PLUGIN_DIR, or a path containing '/'. A NULL name selects
+ * QKD_ETSI<api>_BACKEND, and then the backend the library was configured
+ * with. Plugins stay loaded for the lifetime of the process, so repeated
+ * calls return the same backend.
+ */
+const void *qkd_plugin_load(const char *api, const char *name,
+                            const char *entry_symbol, uint32_t abi_version);
+
+#endif /* QKD_PLUGIN_H_ */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * include/qkd_secure_alloc.h
+ */
+
+#ifndef QKD_SECURE_ALLOC_H_
+#define QKD_SECURE_ALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest object served from slabs; larger ones get their own mapping. */
+#define QKD_SECURE_MAX_SLAB_OBJECT 4096U
+
+/*
+ * Allocator for key material. Objects come from power-of-two size classes
+ * carved out of slabs that are locked in memory and excluded from core
+ * dumps. Each thread keeps a free list per class and only takes the class
+ * lock to exchange a batch of objects with the shared pool, so threads that
+ * fetch keys concurrently do not contend. Returned memory is zeroed, and
+ * qkd_secure_free() cleanses the whole object before it is reused. Slabs
+ * stay mapped for the life of the process.
+ */
+void *qkd_secure_alloc(size_t size);
+
+/*
+ * Cleanses and releases an object from qkd_secure_alloc(). Objects the
+ * allocator did not map, such as strings of a container built with strdup(),
+ * are cleansed and passed to free(). NULL is ignored.
+ */
+void qkd_secure_free(void *object);
+
+/* Copies length bytes of value and a terminator into a new object. */
+char *qkd_secure_strndup(const char *value, size_t length);
+
+typedef struct qkd_secure_alloc_stats {
+    uint64_t slabs;         /* Slabs mapped so far */
+    uint64_t large_objects; /* Objects above the largest class in use */
+} qkd_secure_alloc_stats_t;
+
+void qkd_secure_alloc_get_stats(qkd_secure_alloc_stats_t *stats);
+
+/*
+ * Anonymous mapping of at least *size bytes that is locked in memory and
+ * excluded from core dumps. *size is rounded up to whole pages.
+ */
+void *qkd_locked_alloc(size_t *size);
+
+/* Cleanses and unmaps a block from qkd_locked_alloc(). */
+void qkd_locked_free(void *region, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QKD_SECURE_ALLOC_H_ */
@@ -13,60 +13,245 @@
 
 #include "etsi004/api.h"
 #include "debug.h"
+#include "etsi004/key_ring.h"
+#include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-#if defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
+#if defined(QKD_BACKEND_PLUGINS)
+#include "qkd_plugin.h"
+#include <pthread.h>
+#define DEFAULT_BACKEND NULL
+#elif defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
 #include "etsi004/backends/simulated.h"
-static const struct qkd_004_backend *active_backend = &simulated_backend;
+#define DEFAULT_BACKEND (&simulated_backend)
 #elif defined(QKD_USE_ETSI014_BACKEND)
 #include "etsi004/backends/qkd_etsi014_backend.h"
-static const struct qkd_004_backend *active_backend = &qkd_etsi014_backend;
+#define DEFAULT_BACKEND (&qkd_etsi014_backend)
 #elif defined(QKD_USE_PYTHON_CLIENT) && QKD_USE_PYTHON_CLIENT
 #include "etsi004/backends/python_client.h"
-static const struct qkd_004_backend *active_backend = &python_client_backend;
+#define DEFAULT_BACKEND (&python_client_backend)
+#elif defined(QKD_USE_NATIVE_CLIENT) && QKD_USE_NATIVE_CLIENT
+#include "etsi004/backends/native_client.h"
+#define DEFAULT_BACKEND (&native_client_backend)
 #else
-static const struct qkd_004_backend *active_backend = NULL;
+#define DEFAULT_BACKEND NULL
 #endif
 
+struct qkd_004_ctx {
+    const struct qkd_004_backend *backend;
+};
+
+static struct qkd_004_ctx default_ctx = {.backend = DEFAULT_BACKEND};
+
+#ifdef QKD_BACKEND_PLUGINS
+/* The default backend is loaded on first use unless one was registered. */
+static pthread_once_t default_backend_once = PTHREAD_ONCE_INIT;
+
+static void load_default_backend(void) {
+    default_ctx.backend = qkd_004_load_backend(NULL);
+}
+
+static void keep_registered_backend(void) {}
+
+const struct qkd_004_backend *qkd_004_load_backend(const char *name) {
+    return qkd_plugin_load("004", name, "qkd_004_plugin_backend",
+                           QKD_004_BACKEND_ABI_VERSION);
+}
+#else
+const struct qkd_004_backend *qkd_004_load_backend(const char *name) {
+    if (name && strcmp(name, QKD_BACKEND_TYPE) != 0)
+        return NULL;
+    return DEFAULT_BACKEND;
+}
+#endif
+
+static qkd_004_ctx_t *default_context(void) {
+#ifdef QKD_BACKEND_PLUGINS
+    pthread_once(&default_backend_once, load_default_backend);
+#endif
+    return &default_ctx;
+}
+
 void register_qkd_004_backend(const struct qkd_004_backend *backend) {
-    active_backend = backend;
+#ifdef QKD_BACKEND_PLUGINS
+    pthread_once(&default_backend_once, keep_registered_backend);
+#endif
+    default_ctx.backend = backend;
 }
 
 const struct qkd_004_backend *get_active_004_backend(void) {
-    return active_backend;
+    return default_context()->backend;
 }
 
-uint32_t OPEN_CONNECT(const char *source, const char *destination,
-                      struct qkd_qos_s *qos, unsigned char *key_stream_id,
-                      uint32_t *status) {
-    if (!active_backend || !active_backend->open_connect) {
+qkd_004_ctx_t *qkd_004_default_ctx(void) { return default_context(); }
+
+qkd_004_ctx_t *qkd_004_ctx_create(const struct qkd_004_backend *backend) {
+    if (!backend)
+        backend = qkd_004_load_backend(NULL);
+    if (!backend) {
         QKD_DBG_ERR("No QKD backend registered");
+        return NULL;
+    }
+
+    qkd_004_ctx_t *ctx = malloc(sizeof(*ctx));
+    if (ctx)
+        ctx->backend = backend;
+    return ctx;
+}
+
+void qkd_004_ctx_destroy(qkd_004_ctx_t *ctx) {
+    if (ctx != &default_ctx)
+        free(ctx);
+}
+
+static uint32_t no_backend(uint32_t *status) {
+    QKD_DBG_ERR("No QKD backend registered");
+    if (status)
+        *status = QKD_STATUS_NO_CONNECTION;
+    return QKD_STATUS_NO_CONNECTION;
+}
+
+uint32_t qkd_004_ctx_open_connect(qkd_004_ctx_t *ctx, const char *source,
+                                  const char *destination,
+                                  struct qkd_qos_s *qos,
+                                  unsigned char *key_stream_id,
+                                  uint32_t *status) {
+    if (!ctx)
+        ctx = default_context();
+    const struct qkd_004_backend *backend = ctx->backend;
+    if (!backend || !backend->open_connect)
+        return no_backend(status);
+
+    uint64_t started = qkd_metrics_now();
+    uint32_t result = backend->open_connect(source, destination, qos,
+                                            key_stream_id, status);
+    qkd_metrics_finish(QKD_METRICS_004_OPEN_CONNECT, started,
+                       result != QKD_STATUS_SUCCESS);
+    return result;
+}
+
+uint32_t qkd_004_ctx_get_key(qkd_004_ctx_t *ctx,
+                             const unsigned char *key_stream_id,
+                             uint32_t *index, unsigned char *key_buffer,
+                             struct qkd_metadata_s *metadata,
+                             uint32_t *status) {
+    if (!ctx)
+        ctx = default_context();
+    const struct qkd_004_backend *backend = ctx->backend;
+    if (!backend || !backend->get_key)
+        return no_backend(status);
+
+    uint64_t started = qkd_metrics_now();
+    uint32_t result;
+    if (ctx == &default_ctx && index && key_buffer && !metadata &&
+        qkd_004_key_ring_get_key(key_stream_id, *index, key_buffer)) {
+        result = QKD_STATUS_SUCCESS;
+        if (status)
+            *status = result;
+    } else {
+        result = backend->get_key(key_stream_id, index, key_buffer, metadata,
+                                  status);
+    }
+    qkd_metrics_finish(QKD_METRICS_004_GET_KEY, started,
+                       result != QKD_STATUS_SUCCESS);
+    return result;
+}
+
+uint32_t qkd_004_ctx_close(qkd_004_ctx_t *ctx,
+                           const unsigned char *key_stream_id,
+                           uint32_t *status) {
+    if (!ctx)
+        ctx = default_context();
+    const struct qkd_004_backend *backend = ctx->backend;
+    if (!backend || !backend->close)
+        return no_backend(status);
+
+    if (ctx == &default_ctx)
+        qkd_004_key_ring_stop(key_stream_id);
+    uint64_t started = qkd_metrics_now();
+    uint32_t result = backend->close(key_stream_id, status);
+    qkd_metrics_finish(QKD_METRICS_004_CLOSE, started,
+                       result != QKD_STATUS_SUCCESS);
+    return result;
+}
+
+static uint32_t get_key_batch(const struct qkd_004_backend *backend,
+                              const unsigned char *key_stream_id,
+                              uint32_t start_index, uint32_t count,
+                              unsigned char *key_buffer, uint32_t *retrieved,
+                              uint32_t *status) {
+    if (!key_stream_id || !key_buffer || !retrieved || !status) {
         if (status)
             *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
-    return active_backend->open_connect(source, destination, qos, key_stream_id,
-                                        status);
+
+    *retrieved = 0;
+    if (count > UINT32_MAX - start_index) {
+        *status = QKD_STATUS_INSUFFICIENT_KEY;
+        return QKD_STATUS_INSUFFICIENT_KEY;
+    }
+    if (backend->get_key_batch)
+        return backend->get_key_batch(key_stream_id, start_index, count,
+                                      key_buffer, retrieved, status);
+
+    *status = QKD_STATUS_SUCCESS;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = start_index + i;
+        uint32_t result = backend->get_key(
+            key_stream_id, &index, key_buffer + (size_t)i * QKD_KEY_SIZE, NULL,
+            status);
+        if (result != QKD_STATUS_SUCCESS)
+            return result;
+        (*retrieved)++;
+    }
+    return QKD_STATUS_SUCCESS;
+}
+
+uint32_t qkd_004_ctx_get_key_batch(qkd_004_ctx_t *ctx,
+                                   const unsigned char *key_stream_id,
+                                   uint32_t start_index, uint32_t count,
+                                   unsigned char *key_buffer,
+                                   uint32_t *retrieved, uint32_t *status) {
+    if (!ctx)
+        ctx = default_context();
+    const struct qkd_004_backend *backend = ctx->backend;
+    if (!backend || !backend->get_key)
+        return no_backend(status);
+
+    uint64_t started = qkd_metrics_now();
+    uint32_t result = get_key_batch(backend, key_stream_id, start_index, count,
+                                    key_buffer, retrieved, status);
+    qkd_metrics_finish(QKD_METRICS_004_GET_KEY_BATCH, started,
+                       result != QKD_STATUS_SUCCESS);
+    return result;
+}
+
+uint32_t OPEN_CONNECT(const char *source, const char *destination,
+                      struct qkd_qos_s *qos, unsigned char *key_stream_id,
+                      uint32_t *status) {
+    return qkd_004_ctx_open_connect(NULL, source, destination, qos,
+                                    key_stream_id, status);
 }
 
 uint32_t GET_KEY(const unsigned char *key_stream_id, uint32_t *index,
                  unsigned char *key_buffer, struct qkd_metadata_s *metadata,
                  uint32_t *status) {
-    if (!active_backend || !active_backend->get_key) {
-        QKD_DBG_ERR("No QKD backend registered");
-        if (status)
-            *status = QKD_STATUS_NO_CONNECTION;
-        return QKD_STATUS_NO_CONNECTION;
-    }
-    return active_backend->get_key(key_stream_id, index, key_buffer, metadata,
-                                   status);
+    return qkd_004_ctx_get_key(NULL, key_stream_id, index, key_buffer,
+                               metadata, status);
 }
 
 uint32_t CLOSE(const unsigned char *key_stream_id, uint32_t *status) {
-    if (!active_backend || !active_backend->close) {
-        QKD_DBG_ERR("No QKD backend registered");
-        if (status)
-            *status = QKD_STATUS_NO_CONNECTION;
-        return QKD_STATUS_NO_CONNECTION;
-    }
-    return active_backend->close(key_stream_id, status);
+    return qkd_004_ctx_close(NULL, key_stream_id, status);
+}
+
+uint32_t GET_KEY_BATCH(const unsigned char *key_stream_id,
+                       uint32_t start_index, uint32_t count,
+                       unsigned char *key_buffer, uint32_t *retrieved,
+                       uint32_t *status) {
+    return qkd_004_ctx_get_key_batch(NULL, key_stream_id, start_index, count,
+                                     key_buffer, retrieved, status);
 }
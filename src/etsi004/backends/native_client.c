@@ -0,0 +1,822 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi004/backends/native_client.c
+ *
+ * The messages carry what the Python backend exchanges with the QUBIP
+ * client's QKDClient, encoded as JSON. A request is an object
+ * {"command": <name>, "data": {...}} and its reply one object holding at least
+ * "status". Objects follow each other on the connection without a length
+ * prefix or delimiter, so a reply is complete once its braces balance:
+ *
+ *   OPEN_CONNECT {source, destination, qos, key_stream_id}
+ *       -> {status, key_stream_id, qos}
+ *   GET_KEY      {key_stream_id, index, metadata}
+ *       -> {status, index, key_buffer, metadata}
+ *   CLOSE        {key_stream_id} -> {status}
+ *
+ * key_stream_id is a hyphenated UUID string, or null to open a new stream.
+ * qos uses the qkd_qos_s field names, like the dictionaries QKDClient takes
+ * and returns. key_buffer is an array of QKD_KEY_SIZE byte values, and
+ * metadata a string: the request descriptor the Python backend passes to
+ * get_key(), empty when no metadata is wanted, and the server's metadata in
+ * the reply. tests/etsi004/native_client_test.c runs the backend against a
+ * server speaking this format. The format has not been compared with the
+ * QUBIP server's traffic, which is why the backend is experimental.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <jansson.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "etsi004/backends/native_client.h"
+#include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+
+#define NATIVE_DEFAULT_PORT 25575
+#define NATIVE_DEFAULT_TIMEOUT_MS 5000
+#define NATIVE_MAX_MESSAGE (64U * 1024U)
+#define NATIVE_READ_CHUNK 4096U
+#define NATIVE_METADATA_REQUEST                                                \
+    "{\"format\":\"json\",\"version\":\"1.0\",\"source\":\"qkd_client\"}"
+
+struct native_connection {
+    int fd;
+    SSL *ssl; /* NULL for plain TCP */
+    int timeout_ms;
+    char *buffer; /* Received bytes not yet parsed */
+    size_t length;
+    size_t capacity;
+};
+
+/*
+ * Open streams, each with its own connection. The map and reference counts
+ * are guarded by streams_lock, and requests on one stream are serialized by
+ * its lock so that replies are read in order.
+ */
+struct native_stream {
+    unsigned char key_stream_id[QKD_KSID_SIZE];
+    struct native_connection connection;
+    pthread_mutex_t lock;
+    unsigned int references; /* The map holds one while the stream is open */
+    struct native_stream *next;
+};
+
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct native_stream *streams = NULL;
+
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+static SSL_CTX *tls_context = NULL;
+static bool allow_plaintext = false;
+
+/* Loads the client credentials once; without a server CA TLS is disabled. */
+static void initialize_tls(void) {
+    const char *plaintext = getenv("QKD_004_ALLOW_PLAINTEXT");
+    const char *cert = getenv("CLIENT_CERT_PEM");
+    const char *key = getenv("CLIENT_CERT_KEY");
+    const char *ca = getenv("SERVER_CERT_PEM");
+
+    allow_plaintext = plaintext && strcmp(plaintext, "1") == 0;
+    if (!ca || !*ca) {
+        if (!allow_plaintext) {
+            QKD_DBG_ERR("SERVER_CERT_PEM not set");
+        }
+        return;
+    }
+
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+    if (!context ||
+        SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION) != 1 ||
+        SSL_CTX_load_verify_locations(context, ca, NULL) != 1 ||
+        (cert && *cert &&
+         SSL_CTX_use_certificate_chain_file(context, cert) != 1) ||
+        (key && *key &&
+         SSL_CTX_use_PrivateKey_file(context, key, SSL_FILETYPE_PEM) != 1)) {
+        QKD_DBG_ERR("Failed to load TLS credentials: %s",
+                    ERR_error_string(ERR_get_error(), NULL));
+        SSL_CTX_free(context);
+        return;
+    }
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    tls_context = context;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Waits for events on fd until the deadline. */
+static bool wait_for(int fd, short events, long long deadline) {
+    for (;;) {
+        long long remaining = deadline - monotonic_ms();
+        if (remaining <= 0)
+            return false;
+
+        struct pollfd descriptor = {.fd = fd, .events = events};
+        int ready = poll(&descriptor, 1, (int)remaining);
+        if (ready > 0)
+            return true;
+        if (ready == 0 || errno != EINTR)
+            return false;
+    }
+}
+
+static int connect_socket(const char *host, int port, long long deadline) {
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints = {0};
+    struct addrinfo *addresses = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+        QKD_DBG_ERR("Cannot resolve %s", host);
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0;
+         address = address->ai_next) {
+        fd = socket(address->ai_family,
+                    address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    address->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        int result = connect(fd, address->ai_addr, address->ai_addrlen);
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (result != 0 &&
+            (errno != EINPROGRESS || !wait_for(fd, POLLOUT, deadline) ||
+             getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 ||
+             error != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (fd >= 0) {
+        int enabled = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    }
+    return fd;
+}
+
+/* Drives a non-blocking TLS call until it completes or the deadline. */
+static int tls_call(SSL *ssl, int fd, int result, long long deadline) {
+    switch (SSL_get_error(ssl, result)) {
+    case SSL_ERROR_WANT_READ:
+        return wait_for(fd, POLLIN, deadline) ? 0 : -1;
+    case SSL_ERROR_WANT_WRITE:
+        return wait_for(fd, POLLOUT, deadline) ? 0 : -1;
+    default:
+        return -1;
+    }
+}
+
+static void close_connection(struct native_connection *connection) {
+    if (connection->ssl) {
+        SSL_shutdown(connection->ssl);
+        SSL_free(connection->ssl);
+        connection->ssl = NULL;
+    }
+    if (connection->fd >= 0)
+        close(connection->fd);
+    connection->fd = -1;
+    free(connection->buffer);
+    connection->buffer = NULL;
+    connection->length = connection->capacity = 0;
+}
+
+static bool open_connection(struct native_connection *connection,
+                            const char *host, int port, int timeout_ms) {
+    pthread_once(&tls_once, initialize_tls);
+    if (!tls_context && !allow_plaintext)
+        return false;
+
+    long long deadline = monotonic_ms() + timeout_ms;
+    memset(connection, 0, sizeof(*connection));
+    connection->timeout_ms = timeout_ms;
+    uint64_t started = qkd_metrics_now();
+    connection->fd = connect_socket(host, port, deadline);
+    if (connection->fd < 0) {
+        QKD_DBG_ERR("Cannot connect to %s:%d", host, port);
+        return false;
+    }
+    uint64_t connected = qkd_metrics_now();
+    qkd_metrics_record(QKD_METRICS_004_OPEN_CONNECT, QKD_METRICS_CONNECT,
+                       connected - started);
+    if (!tls_context) {
+        QKD_DBG_WARN("Connected to %s:%d without TLS", host, port);
+        return true;
+    }
+
+    /* IP literals are checked against the certificate's IP addresses. */
+    unsigned char address[sizeof(struct in6_addr)];
+    bool is_address = inet_pton(AF_INET, host, address) == 1 ||
+                      inet_pton(AF_INET6, host, address) == 1;
+    SSL *ssl = SSL_new(tls_context);
+    if (!ssl || SSL_set_fd(ssl, connection->fd) != 1 ||
+        (is_address
+             ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host) != 1
+             : SSL_set_tlsext_host_name(ssl, host) != 1 ||
+                   SSL_set1_host(ssl, host) != 1)) {
+        SSL_free(ssl);
+        close_connection(connection);
+        return false;
+    }
+    connection->ssl = ssl;
+
+    int result;
+    while ((result = SSL_connect(ssl)) != 1) {
+        if (tls_call(ssl, connection->fd, result, deadline) != 0) {
+            QKD_DBG_ERR("TLS handshake with %s:%d failed: %s", host, port,
+                        ERR_error_string(ERR_get_error(), NULL));
+            close_connection(connection);
+            return false;
+        }
+    }
+    qkd_metrics_record(QKD_METRICS_004_OPEN_CONNECT, QKD_METRICS_TLS,
+                       qkd_metrics_now() - connected);
+    return true;
+}
+
+static bool send_all(struct native_connection *connection, const char *data,
+                     size_t size) {
+    long long deadline = monotonic_ms() + connection->timeout_ms;
+
+    /* A peer that closed the connection must not raise SIGPIPE here. */
+    sigset_t pipe_set, previous;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &previous);
+
+    bool sent = true;
+    while (size > 0 && sent) {
+        ssize_t written;
+        if (connection->ssl) {
+            int result = SSL_write(connection->ssl, data,
+                                   size > INT32_MAX ? INT32_MAX : (int)size);
+            written = result;
+            if (result <= 0 &&
+                tls_call(connection->ssl, connection->fd, result, deadline) !=
+                    0)
+                sent = false;
+        } else {
+            written = send(connection->fd, data, size, MSG_NOSIGNAL);
+            if (written < 0 && errno != EINTR &&
+                (errno != EAGAIN ||
+                 !wait_for(connection->fd, POLLOUT, deadline)))
+                sent = false;
+        }
+        if (written > 0) {
+            data += written;
+            size -= (size_t)written;
+        }
+    }
+
+    sigset_t pending;
+    if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+        struct timespec no_wait = {0, 0};
+        sigtimedwait(&pipe_set, NULL, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return sent;
+}
+
+/* Returns the length of the first complete JSON object, or 0. */
+static size_t message_length(const char *data, size_t length) {
+    size_t depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (in_string) {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                in_string = false;
+        } else if (c == '"') {
+            in_string = true;
+        } else if (c == '{') {
+            depth++;
+        } else if (c == '}' && depth > 0 && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/* Receives one message, adding the time spent decoding it to parse_ns. */
+static json_t *receive_message(struct native_connection *connection,
+                               uint64_t *parse_ns) {
+    long long deadline = monotonic_ms() + connection->timeout_ms;
+
+    size_t size;
+    while ((size = message_length(connection->buffer, connection->length)) ==
+           0) {
+        if (connection->length >= NATIVE_MAX_MESSAGE) {
+            QKD_DBG_ERR("Server message exceeds %u bytes", NATIVE_MAX_MESSAGE);
+            return NULL;
+        }
+        if (connection->capacity - connection->length < NATIVE_READ_CHUNK) {
+            size_t capacity = connection->length + NATIVE_READ_CHUNK;
+            char *buffer = realloc(connection->buffer, capacity);
+            if (!buffer)
+                return NULL;
+            connection->buffer = buffer;
+            connection->capacity = capacity;
+        }
+
+        char *end = connection->buffer + connection->length;
+        ssize_t received;
+        if (connection->ssl) {
+            int result = SSL_read(connection->ssl, end, NATIVE_READ_CHUNK);
+            received = result;
+            if (result <= 0 &&
+                tls_call(connection->ssl, connection->fd, result, deadline) !=
+                    0)
+                return NULL;
+        } else {
+            received = recv(connection->fd, end, NATIVE_READ_CHUNK, 0);
+            if (received == 0 ||
+                (received < 0 && errno != EINTR &&
+                 (errno != EAGAIN ||
+                  !wait_for(connection->fd, POLLIN, deadline))))
+                return NULL;
+        }
+        if (received > 0)
+            connection->length += (size_t)received;
+    }
+
+    json_error_t error;
+    uint64_t started = qkd_metrics_now();
+    json_t *message = json_loadb(connection->buffer, size, 0, &error);
+    *parse_ns += qkd_metrics_now() - started;
+    connection->length -= size;
+    memmove(connection->buffer, connection->buffer + size, connection->length);
+    if (!json_is_object(message)) {
+        QKD_DBG_ERR("Invalid server message: %s", error.text);
+        json_decref(message);
+        return NULL;
+    }
+    return message;
+}
+
+/* Sends a command and returns the reply; steals data. */
+static json_t *request(struct native_connection *connection,
+                       enum qkd_metrics_op op, const char *command,
+                       json_t *data) {
+    json_t *message = json_object();
+    char *encoded = NULL;
+    /* json_object_set_new() consumes data even when it fails. */
+    if (!message || !data ||
+        json_object_set_new(message, "command", json_string(command)) != 0)
+        json_decref(data);
+    else if (json_object_set_new(message, "data", data) == 0)
+        encoded = json_dumps(message, JSON_COMPACT);
+    json_decref(message);
+    if (!encoded)
+        return NULL;
+
+    uint64_t parse_ns = 0;
+    uint64_t started = qkd_metrics_now();
+    bool sent = send_all(connection, encoded, strlen(encoded));
+    free(encoded);
+    json_t *reply = sent ? receive_message(connection, &parse_ns) : NULL;
+    if (reply) {
+        qkd_metrics_record(op, QKD_METRICS_TRANSFER,
+                           qkd_metrics_now() - started - parse_ns);
+        qkd_metrics_record(op, QKD_METRICS_PARSE, parse_ns);
+    }
+    return reply;
+}
+
+static bool reply_status(const json_t *reply, uint32_t *status) {
+    json_t *value = json_object_get(reply, "status");
+    if (!json_is_integer(value) || json_integer_value(value) < 0 ||
+        json_integer_value(value) > UINT32_MAX)
+        return false;
+    *status = (uint32_t)json_integer_value(value);
+    return true;
+}
+
+static void format_uuid(const unsigned char *value, char *text) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < QKD_KSID_SIZE; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+            *text++ = '-';
+        *text++ = digits[value[i] >> 4];
+        *text++ = digits[value[i] & 0x0F];
+    }
+    *text = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static bool parse_uuid(const char *text, unsigned char *value) {
+    for (size_t i = 0; i < QKD_KSID_SIZE; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            if (*text++ != '-')
+                return false;
+        }
+        int high = hex_value(text[0]);
+        int low = high < 0 ? -1 : hex_value(text[1]);
+        if (low < 0)
+            return false;
+        value[i] = (unsigned char)(high << 4 | low);
+        text += 2;
+    }
+    return *text == '\0';
+}
+
+static json_t *uuid_json(const unsigned char *value) {
+    char text[37];
+    format_uuid(value, text);
+    return json_string(text);
+}
+
+static const struct {
+    const char *name;
+    size_t offset;
+} qos_fields[] = {
+    {"Key_chunk_size", offsetof(struct qkd_qos_s, Key_chunk_size)},
+    {"Max_bps", offsetof(struct qkd_qos_s, Max_bps)},
+    {"Min_bps", offsetof(struct qkd_qos_s, Min_bps)},
+    {"Jitter", offsetof(struct qkd_qos_s, Jitter)},
+    {"Priority", offsetof(struct qkd_qos_s, Priority)},
+    {"Timeout", offsetof(struct qkd_qos_s, Timeout)},
+    {"TTL", offsetof(struct qkd_qos_s, TTL)},
+};
+
+static json_t *qos_json(const struct qkd_qos_s *qos) {
+    json_t *object = json_object();
+    if (!object)
+        return NULL;
+    for (size_t i = 0; i < sizeof(qos_fields) / sizeof(qos_fields[0]); i++) {
+        const uint32_t *field =
+            (const uint32_t *)((const char *)qos + qos_fields[i].offset);
+        if (json_object_set_new(object, qos_fields[i].name,
+                                json_integer(*field)) != 0) {
+            json_decref(object);
+            return NULL;
+        }
+    }
+    char mimetype[sizeof(qos->Metadata_mimetype)];
+    memcpy(mimetype, qos->Metadata_mimetype, sizeof(mimetype));
+    mimetype[sizeof(mimetype) - 1] = '\0';
+    if (json_object_set_new(object, "Metadata_mimetype",
+                            json_string(mimetype)) != 0) {
+        json_decref(object);
+        return NULL;
+    }
+    return object;
+}
+
+static bool update_qos(const json_t *object, struct qkd_qos_s *qos) {
+    for (size_t i = 0; i < sizeof(qos_fields) / sizeof(qos_fields[0]); i++) {
+        json_t *value = json_object_get(object, qos_fields[i].name);
+        if (!value)
+            continue;
+        if (!json_is_integer(value) || json_integer_value(value) < 0 ||
+            json_integer_value(value) > UINT32_MAX)
+            return false;
+        *(uint32_t *)((char *)qos + qos_fields[i].offset) =
+            (uint32_t)json_integer_value(value);
+    }
+
+    json_t *mimetype = json_object_get(object, "Metadata_mimetype");
+    if (json_is_string(mimetype)) {
+        strncpy(qos->Metadata_mimetype, json_string_value(mimetype),
+                sizeof(qos->Metadata_mimetype) - 1);
+        qos->Metadata_mimetype[sizeof(qos->Metadata_mimetype) - 1] = '\0';
+    } else if (mimetype) {
+        return false;
+    }
+    return true;
+}
+
+/* Decodes key_buffer, an array of byte values, into one key chunk. */
+static bool decode_key(const json_t *value, unsigned char *key_buffer) {
+    if (!json_is_array(value) || json_array_size(value) != QKD_KEY_SIZE)
+        return false;
+
+    for (size_t i = 0; i < QKD_KEY_SIZE; i++) {
+        json_t *byte = json_array_get(value, i);
+        if (!json_is_integer(byte) || json_integer_value(byte) < 0 ||
+            json_integer_value(byte) > 255) {
+            OPENSSL_cleanse(key_buffer, i);
+            return false;
+        }
+        key_buffer[i] = (unsigned char)json_integer_value(byte);
+    }
+    return true;
+}
+
+static struct native_stream *
+acquire_stream(const unsigned char *key_stream_id) {
+    pthread_mutex_lock(&streams_lock);
+    struct native_stream *stream = streams;
+    while (stream &&
+           memcmp(stream->key_stream_id, key_stream_id, QKD_KSID_SIZE) != 0)
+        stream = stream->next;
+    if (stream)
+        stream->references++;
+    pthread_mutex_unlock(&streams_lock);
+    return stream;
+}
+
+static void release_stream(struct native_stream *stream) {
+    pthread_mutex_lock(&streams_lock);
+    bool last = --stream->references == 0;
+    pthread_mutex_unlock(&streams_lock);
+    if (!last)
+        return;
+
+    close_connection(&stream->connection);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+}
+
+static void remove_stream(struct native_stream *stream) {
+    pthread_mutex_lock(&streams_lock);
+    struct native_stream **link = &streams;
+    while (*link && *link != stream)
+        link = &(*link)->next;
+    if (*link) {
+        *link = stream->next;
+        stream->references--;
+    }
+    pthread_mutex_unlock(&streams_lock);
+}
+
+static bool parse_destination(const char *destination, char *host,
+                              size_t host_size, int *port) {
+    static const char scheme[] = "server://";
+    if (strncmp(destination, scheme, sizeof(scheme) - 1U) != 0)
+        return false;
+
+    const char *address = destination + sizeof(scheme) - 1U;
+    const char *colon = strrchr(address, ':');
+    size_t host_length = colon ? (size_t)(colon - address) : strlen(address);
+    if (host_length == 0 || host_length >= host_size)
+        return false;
+    memcpy(host, address, host_length);
+    host[host_length] = '\0';
+
+    *port = NATIVE_DEFAULT_PORT;
+    if (colon) {
+        char *end;
+        long value = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || value <= 0 || value > 65535)
+            return false;
+        *port = (int)value;
+    }
+    return true;
+}
+
+// Backend implementation for OPEN_CONNECT
+static uint32_t native_client_open_connect(const char *source,
+                                           const char *destination,
+                                           struct qkd_qos_s *qos,
+                                           unsigned char *key_stream_id,
+                                           uint32_t *status) {
+    if (!source || !destination || !qos || !key_stream_id || !status)
+        return QKD_STATUS_NO_CONNECTION;
+
+    char host[256];
+    int port;
+    if (!parse_destination(destination, host, sizeof(host), &port)) {
+        QKD_DBG_ERR("Invalid destination URI format: %s", destination);
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    struct native_stream *stream = calloc(1, sizeof(*stream));
+    int timeout_ms = qos->Timeout ? (int)(qos->Timeout > INT32_MAX
+                                              ? INT32_MAX
+                                              : qos->Timeout)
+                                  : NATIVE_DEFAULT_TIMEOUT_MS;
+    if (!stream ||
+        !open_connection(&stream->connection, host, port, timeout_ms)) {
+        free(stream);
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    static const unsigned char null_ksid[QKD_KSID_SIZE] = {0};
+    bool new_stream = memcmp(key_stream_id, null_ksid, QKD_KSID_SIZE) == 0;
+    json_t *data = json_object();
+    if (data) {
+        json_object_set_new(data, "source", json_string(source));
+        json_object_set_new(data, "destination", json_string(destination));
+        json_object_set_new(data, "qos", qos_json(qos));
+        json_object_set_new(data, "key_stream_id",
+                            new_stream ? json_null()
+                                       : uuid_json(key_stream_id));
+    }
+    json_t *reply = request(&stream->connection, QKD_METRICS_004_OPEN_CONNECT,
+                            "OPEN_CONNECT", data);
+
+    uint32_t status_value = QKD_STATUS_PEER_NOT_CONNECTED;
+    if (reply && !reply_status(reply, &status_value))
+        status_value = QKD_STATUS_NO_CONNECTION;
+
+    json_t *reply_qos = json_object_get(reply, "qos");
+    if (json_is_object(reply_qos) && !update_qos(reply_qos, qos))
+        status_value = QKD_STATUS_NO_CONNECTION;
+
+    bool opened = status_value == QKD_STATUS_SUCCESS ||
+                  status_value == QKD_STATUS_QOS_NOT_MET ||
+                  status_value == QKD_STATUS_PEER_NOT_CONNECTED;
+    json_t *reply_id = json_object_get(reply, "key_stream_id");
+    if (opened && json_is_string(reply_id)) {
+        if (!parse_uuid(json_string_value(reply_id), stream->key_stream_id)) {
+            QKD_DBG_ERR("Invalid key stream ID from server");
+            status_value = QKD_STATUS_NO_CONNECTION;
+            opened = false;
+        }
+    } else if (opened && !new_stream) {
+        memcpy(stream->key_stream_id, key_stream_id, QKD_KSID_SIZE);
+    } else {
+        opened = false;
+    }
+    json_decref(reply);
+
+    if (!opened) {
+        if (new_stream)
+            memset(key_stream_id, 0, QKD_KSID_SIZE);
+        close_connection(&stream->connection);
+        free(stream);
+        *status = status_value;
+        return status_value;
+    }
+
+    memcpy(key_stream_id, stream->key_stream_id, QKD_KSID_SIZE);
+    stream->references = 1;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_mutex_lock(&streams_lock);
+    stream->next = streams;
+    streams = stream;
+    pthread_mutex_unlock(&streams_lock);
+
+    *status = status_value;
+    return status_value;
+}
+
+static uint32_t copy_metadata(const json_t *value,
+                              struct qkd_metadata_s *metadata) {
+    if (!json_is_string(value))
+        return QKD_STATUS_NO_CONNECTION;
+
+    const char *text = json_string_value(value);
+    size_t length = strlen(text);
+    if (!metadata->Metadata_buffer || length >= metadata->Metadata_size) {
+        metadata->Metadata_size = (uint32_t)length + 1U;
+        return QKD_STATUS_METADATA_SIZE_INSUFFICIENT;
+    }
+    memcpy(metadata->Metadata_buffer, text, length + 1U);
+    metadata->Metadata_size = (uint32_t)length;
+    return QKD_STATUS_SUCCESS;
+}
+
+// Backend implementation for GET_KEY
+static uint32_t native_client_get_key(const unsigned char *key_stream_id,
+                                      uint32_t *index,
+                                      unsigned char *key_buffer,
+                                      struct qkd_metadata_s *metadata,
+                                      uint32_t *status) {
+    if (!key_stream_id || !index || !key_buffer || !status)
+        return QKD_STATUS_NO_CONNECTION;
+
+    struct native_stream *stream = acquire_stream(key_stream_id);
+    if (!stream) {
+        QKD_DBG_ERR("Key stream is not open");
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    bool wants_metadata = metadata && metadata->Metadata_size > 0;
+    json_t *data = json_object();
+    if (data) {
+        json_object_set_new(data, "key_stream_id", uuid_json(key_stream_id));
+        json_object_set_new(data, "index", json_integer(*index));
+        json_object_set_new(
+            data, "metadata",
+            json_string(wants_metadata ? NATIVE_METADATA_REQUEST : ""));
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    json_t *reply = request(&stream->connection, QKD_METRICS_004_GET_KEY,
+                            "GET_KEY", data);
+    pthread_mutex_unlock(&stream->lock);
+    release_stream(stream);
+
+    uint32_t status_value = QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY;
+    if (reply && !reply_status(reply, &status_value))
+        status_value = QKD_STATUS_NO_CONNECTION;
+
+    if (status_value == QKD_STATUS_SUCCESS) {
+        json_t *reply_index = json_object_get(reply, "index");
+        if (json_is_integer(reply_index) &&
+            json_integer_value(reply_index) >= 0 &&
+            json_integer_value(reply_index) <= UINT32_MAX)
+            *index = (uint32_t)json_integer_value(reply_index);
+
+        if (!decode_key(json_object_get(reply, "key_buffer"), key_buffer))
+            status_value = QKD_STATUS_INSUFFICIENT_KEY;
+        else if (wants_metadata)
+            status_value =
+                copy_metadata(json_object_get(reply, "metadata"), metadata);
+    }
+    json_decref(reply);
+
+    *status = status_value;
+    return status_value;
+}
+
+// Backend implementation for CLOSE
+static uint32_t native_client_close(const unsigned char *key_stream_id,
+                                    uint32_t *status) {
+    if (!key_stream_id || !status)
+        return QKD_STATUS_NO_CONNECTION;
+
+    struct native_stream *stream = acquire_stream(key_stream_id);
+    if (!stream) {
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    json_t *data = json_object();
+    if (data)
+        json_object_set_new(data, "key_stream_id", uuid_json(key_stream_id));
+
+    pthread_mutex_lock(&stream->lock);
+    json_t *reply = request(&stream->connection, QKD_METRICS_004_CLOSE, "CLOSE",
+                            data);
+    pthread_mutex_unlock(&stream->lock);
+    remove_stream(stream);
+    release_stream(stream);
+
+    uint32_t status_value = QKD_STATUS_PEER_NOT_CONNECTED;
+    if (reply && !reply_status(reply, &status_value))
+        status_value = QKD_STATUS_NO_CONNECTION;
+    json_decref(reply);
+
+    *status = status_value;
+    return status_value;
+}
+
+// Export the backend interface
+const struct qkd_004_backend native_client_backend = {
+    .name = "native_client",
+    .open_connect = native_client_open_connect,
+    .get_key = native_client_get_key,
+    .close = native_client_close};
+
+#ifdef QKD_BACKEND_PLUGIN
+const struct qkd_004_backend *qkd_004_plugin_backend(uint32_t abi_version) {
+    return abi_version == QKD_004_BACKEND_ABI_VERSION ? &native_client_backend
+                                                      : NULL;
+}
+#endif
@@ -11,18 +11,62 @@
  */
 
 #include <Python.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "debug.h"
 #include "etsi004/backends/python_client.h"
 #include "qkd_etsi_api.h"
 
-// Python module and client instance
+#if PY_VERSION_HEX < 0x03090000
+#define PyObject_Vectorcall _PyObject_Vectorcall
+#define PyObject_CallNoArgs(callable) PyObject_CallObject(callable, NULL)
+#endif
+
+// Interned attribute names, resolved once when the module is loaded
+static struct {
+    PyObject *bytes;
+    PyObject *close;
+    PyObject *connect;
+    PyObject *get_key;
+    PyObject *get_key_batch;
+    PyObject *open_connect;
+    PyObject *qos;
+} py_names;
+
+// Python module and client class
 static PyObject *py_qkd_client_module = NULL;
 static PyObject *py_qkd_client_class = NULL;
-static PyObject *py_qkd_client_instance = NULL;
+static PyObject *py_uuid_class = NULL;
+static PyObject *py_uuid_kwnames = NULL; /* ("bytes",) for UUID(bytes=...) */
 static bool owns_python_interpreter = false;
+static pthread_mutex_t python_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool python_ready = false;
+
+/*
+ * Each open stream has its own QKDClient instance, so that streams do not
+ * share a connection. Python objects are only touched with the GIL held;
+ * the map and reference counts are guarded by streams_lock, and calls on
+ * one stream are serialized by its lock, which is never taken with the GIL
+ * held. The Python client performs its socket I/O through the socket
+ * module, which releases the GIL while blocked, so other streams progress.
+ */
+struct python_stream {
+    unsigned char key_stream_id[QKD_KSID_SIZE];
+    PyObject *client;
+    PyObject *uuid;          /* The key stream ID as a uuid.UUID */
+    PyObject *get_key;       /* Bound client methods; get_key_batch is */
+    PyObject *get_key_batch; /* NULL when the client does not provide it */
+    pthread_mutex_t lock;
+    unsigned int references; /* The map holds one while the stream is open */
+    struct python_stream *next;
+};
+
+static pthread_mutex_t streams_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct python_stream *streams = NULL;
 
 // Helper functions for Python integration
 static bool initialize_python(void);
@@ -44,6 +88,12 @@ static uint32_t python_client_get_key(const unsigned char *key_stream_id,
                                       uint32_t *status);
 static uint32_t python_client_close(const unsigned char *key_stream_id,
                                     uint32_t *status);
+static uint32_t python_client_get_key_batch(const unsigned char *key_stream_id,
+                                            uint32_t start_index,
+                                            uint32_t count,
+                                            unsigned char *key_buffer,
+                                            uint32_t *retrieved,
+                                            uint32_t *status);
 
 static void finalize_owned_python(void) {
     if (owns_python_interpreter && Py_IsInitialized())
@@ -51,17 +101,44 @@ static void finalize_owned_python(void) {
     owns_python_interpreter = false;
 }
 
-// Initialize the Python interpreter and the QKD client module
-static bool initialize_python(void) {
-    if (py_qkd_client_instance)
-        return true;
+static bool intern_names(void) {
+    py_names.bytes = PyUnicode_InternFromString("bytes");
+    py_names.close = PyUnicode_InternFromString("close");
+    py_names.connect = PyUnicode_InternFromString("connect");
+    py_names.get_key = PyUnicode_InternFromString("get_key");
+    py_names.get_key_batch = PyUnicode_InternFromString("get_key_batch");
+    py_names.open_connect = PyUnicode_InternFromString("open_connect");
+    py_names.qos = PyUnicode_InternFromString("qos");
+    py_uuid_kwnames = py_names.bytes ? PyTuple_Pack(1, py_names.bytes) : NULL;
+    return py_names.close && py_names.connect && py_names.get_key &&
+           py_names.get_key_batch && py_names.open_connect && py_names.qos &&
+           py_uuid_kwnames;
+}
 
-    if (!Py_IsInitialized()) {
-        Py_Initialize();
-        owns_python_interpreter = true;
+static bool load_uuid_class(void) {
+    PyObject *uuid_module = PyImport_ImportModule("uuid");
+    if (!uuid_module)
+        return false;
+    py_uuid_class = PyObject_GetAttrString(uuid_module, "UUID");
+    Py_DECREF(uuid_module);
+    if (!py_uuid_class || !PyCallable_Check(py_uuid_class)) {
+        Py_XDECREF(py_uuid_class);
+        py_uuid_class = NULL;
+        return false;
     }
-    if (!Py_IsInitialized()) {
-        QKD_DBG_ERR("Failed to initialize Python interpreter");
+    return true;
+}
+
+// Imports the qkd_client module. Called with the GIL held.
+static bool load_client_class(void) {
+    if (!py_uuid_kwnames && !intern_names()) {
+        PyErr_Print();
+        QKD_DBG_ERR("Failed to create Python attribute names");
+        return false;
+    }
+    if (!py_uuid_class && !load_uuid_class()) {
+        PyErr_Print();
+        QKD_DBG_ERR("Failed to load uuid.UUID");
         return false;
     }
 
@@ -70,7 +147,6 @@ static bool initialize_python(void) {
     if (!sys_module) {
         PyErr_Print();
         QKD_DBG_ERR("Failed to import sys module");
-        finalize_owned_python();
         return false;
     }
 
@@ -83,7 +159,6 @@ static bool initialize_python(void) {
         Py_XDECREF(path_str);
         Py_XDECREF(sys_path);
         Py_DECREF(sys_module);
-        finalize_owned_python();
         return false;
     }
     Py_DECREF(path_str);
@@ -95,7 +170,6 @@ static bool initialize_python(void) {
     if (!py_qkd_client_module) {
         PyErr_Print();
         QKD_DBG_ERR("Failed to import qkd_client module");
-        finalize_owned_python();
         return false;
     }
 
@@ -109,53 +183,142 @@ static bool initialize_python(void) {
         Py_DECREF(py_qkd_client_module);
         py_qkd_client_class = NULL;
         py_qkd_client_module = NULL;
-        finalize_owned_python();
         return false;
     }
+    return true;
+}
 
-    // Create an instance of the QKDClient class
-    py_qkd_client_instance = PyObject_CallObject(py_qkd_client_class, NULL);
-    if (!py_qkd_client_instance) {
-        PyErr_Print();
-        QKD_DBG_ERR("Failed to create QKDClient instance");
-        Py_DECREF(py_qkd_client_class);
-        Py_DECREF(py_qkd_client_module);
-        py_qkd_client_class = NULL;
-        py_qkd_client_module = NULL;
+// Initialize the Python interpreter and the QKD client module
+static bool initialize_python(void) {
+    pthread_mutex_lock(&python_init_lock);
+    if (python_ready) {
+        pthread_mutex_unlock(&python_init_lock);
+        return true;
+    }
+
+    PyGILState_STATE gil = PyGILState_UNLOCKED;
+    if (!Py_IsInitialized()) {
+        Py_Initialize();
+        owns_python_interpreter = true;
+    } else {
+        gil = PyGILState_Ensure();
+    }
+    if (!Py_IsInitialized()) {
+        QKD_DBG_ERR("Failed to initialize Python interpreter");
+        owns_python_interpreter = false;
+        pthread_mutex_unlock(&python_init_lock);
+        return false;
+    }
+
+    python_ready = load_client_class();
+    if (!owns_python_interpreter) {
+        PyGILState_Release(gil);
+    } else if (!python_ready) {
         finalize_owned_python();
+    } else {
+        /*
+         * Py_Initialize() left this thread holding the GIL. Release it so
+         * that every call, from any thread, takes it with PyGILState_Ensure.
+         */
+        PyEval_SaveThread();
+    }
+    pthread_mutex_unlock(&python_init_lock);
+    return python_ready;
+}
+
+/* Returns the open stream with a reference held, or NULL. */
+static struct python_stream *
+acquire_stream(const unsigned char *key_stream_id) {
+    pthread_mutex_lock(&streams_lock);
+    struct python_stream *stream = streams;
+    while (stream &&
+           memcmp(stream->key_stream_id, key_stream_id, QKD_KSID_SIZE) != 0)
+        stream = stream->next;
+    if (stream)
+        stream->references++;
+    pthread_mutex_unlock(&streams_lock);
+    return stream;
+}
+
+static void release_stream(struct python_stream *stream) {
+    pthread_mutex_lock(&streams_lock);
+    bool last = --stream->references == 0;
+    pthread_mutex_unlock(&streams_lock);
+    if (!last)
+        return;
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+    Py_XDECREF(stream->get_key_batch);
+    Py_XDECREF(stream->get_key);
+    Py_XDECREF(stream->uuid);
+    Py_XDECREF(stream->client);
+    PyGILState_Release(gil);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream);
+}
+
+/*
+ * Registers the client of a newly opened stream, resolving its key methods
+ * and UUID once. A stream opened again in the same process, as when both
+ * peers run in it, is served by the newest client until that one is closed.
+ * Called with the GIL held; steals client.
+ */
+static bool add_stream(const unsigned char *key_stream_id, PyObject *client) {
+    struct python_stream *stream = calloc(1, sizeof(*stream));
+    PyObject *uuid = stream ? uuid_from_bytes(key_stream_id) : NULL;
+    if (!uuid) {
+        PyErr_Print();
+        free(stream);
+        Py_DECREF(client);
         return false;
     }
+    memcpy(stream->key_stream_id, key_stream_id, QKD_KSID_SIZE);
+    stream->client = client;
+    stream->uuid = uuid;
+    stream->get_key = PyObject_GetAttr(client, py_names.get_key);
+    if (!stream->get_key || !PyCallable_Check(stream->get_key)) {
+        QKD_DBG_WARN("Python client has no callable get_key");
+        Py_CLEAR(stream->get_key);
+        PyErr_Clear();
+    }
+    stream->get_key_batch = PyObject_GetAttr(client, py_names.get_key_batch);
+    if (!stream->get_key_batch || !PyCallable_Check(stream->get_key_batch)) {
+        Py_CLEAR(stream->get_key_batch);
+        PyErr_Clear();
+    }
+    stream->references = 1;
+    pthread_mutex_init(&stream->lock, NULL);
 
+    pthread_mutex_lock(&streams_lock);
+    stream->next = streams;
+    streams = stream;
+    pthread_mutex_unlock(&streams_lock);
     return true;
 }
 
+/* Removes a stream from the map, leaving it to the last reference holder. */
+static void remove_stream(struct python_stream *stream) {
+    pthread_mutex_lock(&streams_lock);
+    struct python_stream **link = &streams;
+    while (*link && *link != stream)
+        link = &(*link)->next;
+    if (*link) {
+        *link = stream->next;
+        stream->references--;
+    }
+    pthread_mutex_unlock(&streams_lock);
+}
+
 static PyObject *uuid_from_bytes(const unsigned char *value) {
-    PyObject *uuid_module = PyImport_ImportModule("uuid");
-    PyObject *uuid_class = NULL;
-    PyObject *uuid_bytes = NULL;
-    PyObject *kwargs = NULL;
-    PyObject *args = NULL;
-    PyObject *uuid_value = NULL;
+    PyObject *uuid_bytes =
+        PyBytes_FromStringAndSize((const char *)value, QKD_KSID_SIZE);
+    if (!uuid_bytes)
+        return NULL;
 
-    if (!uuid_module)
-        goto cleanup;
-    uuid_class = PyObject_GetAttrString(uuid_module, "UUID");
-    uuid_bytes = PyBytes_FromStringAndSize((const char *)value, QKD_KSID_SIZE);
-    kwargs = PyDict_New();
-    args = PyTuple_New(0);
-    if (!uuid_class || !PyCallable_Check(uuid_class) || !uuid_bytes ||
-        !kwargs || !args ||
-        PyDict_SetItemString(kwargs, "bytes", uuid_bytes) != 0)
-        goto cleanup;
-
-    uuid_value = PyObject_Call(uuid_class, args, kwargs);
-
-cleanup:
-    Py_XDECREF(args);
-    Py_XDECREF(kwargs);
-    Py_XDECREF(uuid_bytes);
-    Py_XDECREF(uuid_class);
-    Py_XDECREF(uuid_module);
+    PyObject *args[] = {uuid_bytes};
+    PyObject *uuid_value =
+        PyObject_Vectorcall(py_uuid_class, args, 0, py_uuid_kwnames);
+    Py_DECREF(uuid_bytes);
     return uuid_value;
 }
 
@@ -250,23 +413,10 @@ static bool convert_python_to_qos(PyObject *py_qos, struct qkd_qos_s *qos) {
     return true;
 }
 
-// Backend implementation for OPEN_CONNECT
-static uint32_t python_client_open_connect(const char *source,
-                                           const char *destination,
-                                           struct qkd_qos_s *qos,
-                                           unsigned char *key_stream_id,
-                                           uint32_t *status) {
-    if (!source || !destination || !qos || !key_stream_id || !status)
-        return QKD_STATUS_NO_CONNECTION;
-
-    // Initialize Python and QKD client if not already done
-    if (!initialize_python()) {
-        if (status) {
-            *status = QKD_STATUS_NO_CONNECTION;
-        }
-        return QKD_STATUS_NO_CONNECTION;
-    }
-
+// Connects a new client and opens its stream. Called with the GIL held.
+static uint32_t open_stream(PyObject *client, const char *source,
+                            const char *destination, struct qkd_qos_s *qos,
+                            unsigned char *key_stream_id, uint32_t *status) {
     // Convert QoS structure to Python dictionary
     PyObject *py_qos = convert_qos_to_python_dict(qos);
     if (!py_qos) {
@@ -277,7 +427,7 @@ static uint32_t python_client_open_connect(const char *source,
     }
 
     // Set the QoS on the Python client instance
-    if (PyObject_SetAttrString(py_qkd_client_instance, "qos", py_qos) == -1) {
+    if (PyObject_SetAttr(client, py_names.qos, py_qos) == -1) {
         PyErr_Print();
         Py_DECREF(py_qos);
         if (status) {
@@ -311,8 +461,7 @@ static uint32_t python_client_open_connect(const char *source,
     }
 
     // Call connect() method on the Python client
-    PyObject *py_connect_method =
-        PyObject_GetAttrString(py_qkd_client_instance, "connect");
+    PyObject *py_connect_method = PyObject_GetAttr(client, py_names.connect);
     if (!py_connect_method || !PyCallable_Check(py_connect_method)) {
         PyErr_Print();
         Py_XDECREF(py_connect_method);
@@ -324,21 +473,20 @@ static uint32_t python_client_open_connect(const char *source,
 
     PyObject *py_host = PyUnicode_FromString(server_host);
     PyObject *py_port = PyLong_FromLong(server_port);
-    PyObject *py_args = NULL;
-    if (py_host && py_port)
-        py_args = PyTuple_Pack(2, py_host, py_port);
-    Py_XDECREF(py_host);
-    Py_XDECREF(py_port);
-    if (!py_args) {
+    if (!py_host || !py_port) {
         PyErr_Print();
+        Py_XDECREF(py_host);
+        Py_XDECREF(py_port);
         Py_DECREF(py_connect_method);
         *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
 
+    PyObject *connect_args[] = {py_host, py_port};
     PyObject *py_connect_result =
-        PyObject_CallObject(py_connect_method, py_args);
-    Py_DECREF(py_args);
+        PyObject_Vectorcall(py_connect_method, connect_args, 2, NULL);
+    Py_DECREF(py_host);
+    Py_DECREF(py_port);
     Py_DECREF(py_connect_method);
 
     if (!py_connect_result) {
@@ -393,7 +541,7 @@ static uint32_t python_client_open_connect(const char *source,
 
     // Call open_connect() method on the Python client
     PyObject *py_open_connect_method =
-        PyObject_GetAttrString(py_qkd_client_instance, "open_connect");
+        PyObject_GetAttr(client, py_names.open_connect);
     if (!py_open_connect_method || !PyCallable_Check(py_open_connect_method)) {
         PyErr_Print();
         Py_XDECREF(py_open_connect_method);
@@ -408,15 +556,11 @@ static uint32_t python_client_open_connect(const char *source,
     // key_stream_id=None)
     PyObject *py_source = PyUnicode_FromString(source);
     PyObject *py_destination = PyUnicode_FromString(destination);
-    py_args = NULL;
-    if (py_source && py_destination)
-        py_args = PyTuple_Pack(4, py_source, py_destination, Py_None,
-                               py_key_stream_id);
-    Py_XDECREF(py_source);
-    Py_XDECREF(py_destination);
-    Py_DECREF(py_key_stream_id);
-    if (!py_args) {
+    if (!py_source || !py_destination) {
         PyErr_Print();
+        Py_XDECREF(py_source);
+        Py_XDECREF(py_destination);
+        Py_DECREF(py_key_stream_id);
         Py_DECREF(py_open_connect_method);
         *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
@@ -425,9 +569,13 @@ static uint32_t python_client_open_connect(const char *source,
     QKD_DBG_INFO("Calling Python open_connect with 4 parameters (source, dest, "
                  "qos=None, key_stream_id)");
 
-    PyObject *py_open_connect_result =
-        PyObject_CallObject(py_open_connect_method, py_args);
-    Py_DECREF(py_args);
+    PyObject *open_connect_args[] = {py_source, py_destination, Py_None,
+                                     py_key_stream_id};
+    PyObject *py_open_connect_result = PyObject_Vectorcall(
+        py_open_connect_method, open_connect_args, 4, NULL);
+    Py_DECREF(py_source);
+    Py_DECREF(py_destination);
+    Py_DECREF(py_key_stream_id);
     Py_DECREF(py_open_connect_method);
 
     if (!py_open_connect_result || !PyTuple_Check(py_open_connect_result)) {
@@ -471,7 +619,7 @@ static uint32_t python_client_open_connect(const char *source,
 
             // Get the bytes attribute of the UUID
             PyObject *py_bytes =
-                PyObject_GetAttrString(py_key_stream_id_result, "bytes");
+                PyObject_GetAttr(py_key_stream_id_result, py_names.bytes);
             if (py_bytes && PyBytes_Check(py_bytes) &&
                 PyBytes_Size(py_bytes) == QKD_KSID_SIZE) {
                 // Copy the UUID bytes to the output buffer
@@ -508,8 +656,7 @@ static uint32_t python_client_open_connect(const char *source,
         }
     }
 
-    PyObject *py_updated_qos =
-        PyObject_GetAttrString(py_qkd_client_instance, "qos");
+    PyObject *py_updated_qos = PyObject_GetAttr(client, py_names.qos);
     if (py_updated_qos && PyDict_Check(py_updated_qos)) {
         if (!convert_python_to_qos(py_updated_qos, qos))
             status_value = QKD_STATUS_NO_CONNECTION;
@@ -532,42 +679,79 @@ static uint32_t python_client_open_connect(const char *source,
     return status_value;
 }
 
-// Backend implementation for GET_KEY
-static uint32_t python_client_get_key(const unsigned char *key_stream_id,
-                                      uint32_t *index,
-                                      unsigned char *key_buffer,
-                                      struct qkd_metadata_s *metadata,
-                                      uint32_t *status) {
-    if (!key_stream_id || !index || !key_buffer || !status)
+// Backend implementation for OPEN_CONNECT
+static uint32_t python_client_open_connect(const char *source,
+                                           const char *destination,
+                                           struct qkd_qos_s *qos,
+                                           unsigned char *key_stream_id,
+                                           uint32_t *status) {
+    if (!source || !destination || !qos || !key_stream_id || !status)
         return QKD_STATUS_NO_CONNECTION;
 
-    if (!py_qkd_client_instance) {
-        if (status) {
-            *status = QKD_STATUS_NO_CONNECTION;
-        }
+    // Initialize Python and load the QKD client if not already done
+    if (!initialize_python()) {
+        *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
 
-    // Call get_key() method on the Python client
-    PyObject *py_get_key_method =
-        PyObject_GetAttrString(py_qkd_client_instance, "get_key");
-    if (!py_get_key_method || !PyCallable_Check(py_get_key_method)) {
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *client = PyObject_CallNoArgs(py_qkd_client_class);
+    if (!client) {
         PyErr_Print();
-        Py_XDECREF(py_get_key_method);
-        if (status) {
-            *status = QKD_STATUS_NO_CONNECTION;
-        }
+        QKD_DBG_ERR("Failed to create QKDClient instance");
+        PyGILState_Release(gil);
+        *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
 
-    PyObject *py_uuid = uuid_from_bytes(key_stream_id);
-
-    if (!py_uuid) {
-        PyErr_Print();
-        Py_XDECREF(py_get_key_method);
-        if (status) {
-            *status = QKD_STATUS_NO_CONNECTION;
+    uint32_t status_value = open_stream(client, source, destination, qos,
+                                        key_stream_id, status);
+    static const unsigned char null_ksid[QKD_KSID_SIZE] = {0};
+    bool opened = status_value == QKD_STATUS_SUCCESS ||
+                  status_value == QKD_STATUS_QOS_NOT_MET ||
+                  status_value == QKD_STATUS_PEER_NOT_CONNECTED;
+    if (opened && memcmp(key_stream_id, null_ksid, QKD_KSID_SIZE) != 0) {
+        if (!add_stream(key_stream_id, client)) {
+            status_value = QKD_STATUS_NO_CONNECTION;
+            *status = status_value;
         }
+    } else {
+        Py_DECREF(client);
+    }
+    PyGILState_Release(gil);
+    return status_value;
+}
+
+/*
+ * Takes the stream's lock and then the GIL for a call on its client. Returns
+ * NULL when the stream is not open in this process.
+ */
+static struct python_stream *begin_stream_call(const unsigned char *ksid,
+                                               PyGILState_STATE *gil) {
+    struct python_stream *stream = acquire_stream(ksid);
+    if (!stream) {
+        QKD_DBG_ERR("Key stream is not open");
+        return NULL;
+    }
+    pthread_mutex_lock(&stream->lock);
+    *gil = PyGILState_Ensure();
+    return stream;
+}
+
+static void end_stream_call(struct python_stream *stream,
+                            PyGILState_STATE gil) {
+    PyGILState_Release(gil);
+    pthread_mutex_unlock(&stream->lock);
+    release_stream(stream);
+}
+
+// Calls get_key() on a stream's client. Called with the GIL held.
+static uint32_t get_stream_key(struct python_stream *stream, uint32_t *index,
+                               unsigned char *key_buffer,
+                               struct qkd_metadata_s *metadata,
+                               uint32_t *status) {
+    if (!stream->get_key) {
+        *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
 
@@ -579,8 +763,6 @@ static uint32_t python_client_get_key(const unsigned char *key_stream_id,
     if (metadata && metadata->Metadata_size > 0 &&
         (!metadata->Metadata_buffer || json_len >= metadata->Metadata_size)) {
         metadata->Metadata_size = (uint32_t)json_len + 1U;
-        Py_DECREF(py_uuid);
-        Py_DECREF(py_get_key_method);
         *status = QKD_STATUS_METADATA_SIZE_INSUFFICIENT;
         return QKD_STATUS_METADATA_SIZE_INSUFFICIENT;
     }
@@ -596,23 +778,19 @@ static uint32_t python_client_get_key(const unsigned char *key_stream_id,
     PyObject *py_metadata_bytes =
         PyBytes_FromStringAndSize(metadata_data, metadata_size);
     PyObject *py_index = PyLong_FromUnsignedLong(*index);
-    PyObject *py_args = NULL;
-    if (py_metadata_bytes && py_index)
-        py_args = PyTuple_Pack(3, py_uuid, py_index, py_metadata_bytes);
-    Py_DECREF(py_uuid);
-    Py_XDECREF(py_index);
-    Py_XDECREF(py_metadata_bytes);
-    if (!py_args) {
+    if (!py_metadata_bytes || !py_index) {
         PyErr_Print();
-        Py_DECREF(py_get_key_method);
+        Py_XDECREF(py_index);
+        Py_XDECREF(py_metadata_bytes);
         *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
 
+    PyObject *args[] = {stream->uuid, py_index, py_metadata_bytes};
     PyObject *py_get_key_result =
-        PyObject_CallObject(py_get_key_method, py_args);
-    Py_DECREF(py_args);
-    Py_DECREF(py_get_key_method);
+        PyObject_Vectorcall(stream->get_key, args, 3, NULL);
+    Py_DECREF(py_index);
+    Py_DECREF(py_metadata_bytes);
 
     if (!py_get_key_result || !PyTuple_Check(py_get_key_result)) {
         PyErr_Print();
@@ -679,22 +857,31 @@ static uint32_t python_client_get_key(const unsigned char *key_stream_id,
     return status_value;
 }
 
-// Backend implementation for CLOSE
-static uint32_t python_client_close(const unsigned char *key_stream_id,
-                                    uint32_t *status) {
-    if (!key_stream_id || !status)
+// Backend implementation for GET_KEY
+static uint32_t python_client_get_key(const unsigned char *key_stream_id,
+                                      uint32_t *index,
+                                      unsigned char *key_buffer,
+                                      struct qkd_metadata_s *metadata,
+                                      uint32_t *status) {
+    if (!key_stream_id || !index || !key_buffer || !status)
         return QKD_STATUS_NO_CONNECTION;
 
-    if (!py_qkd_client_instance) {
-        if (status) {
-            *status = QKD_STATUS_NO_CONNECTION;
-        }
+    PyGILState_STATE gil;
+    struct python_stream *stream = begin_stream_call(key_stream_id, &gil);
+    if (!stream) {
+        *status = QKD_STATUS_NO_CONNECTION;
         return QKD_STATUS_NO_CONNECTION;
     }
+    uint32_t status_value =
+        get_stream_key(stream, index, key_buffer, metadata, status);
+    end_stream_call(stream, gil);
+    return status_value;
+}
 
+// Calls close() on a stream's client. Called with the GIL held.
+static uint32_t close_stream(PyObject *client, uint32_t *status) {
     // Call close() method on the Python client
-    PyObject *py_close_method =
-        PyObject_GetAttrString(py_qkd_client_instance, "close");
+    PyObject *py_close_method = PyObject_GetAttr(client, py_names.close);
     if (!py_close_method || !PyCallable_Check(py_close_method)) {
         PyErr_Print();
         Py_XDECREF(py_close_method);
@@ -704,7 +891,7 @@ static uint32_t python_client_close(const unsigned char *key_stream_id,
         return QKD_STATUS_NO_CONNECTION;
     }
 
-    PyObject *py_close_result = PyObject_CallObject(py_close_method, NULL);
+    PyObject *py_close_result = PyObject_CallNoArgs(py_close_method);
     Py_DECREF(py_close_method);
 
     if (!py_close_result) {
@@ -729,9 +916,169 @@ static uint32_t python_client_close(const unsigned char *key_stream_id,
     return status_value;
 }
 
+// Backend implementation for CLOSE
+static uint32_t python_client_close(const unsigned char *key_stream_id,
+                                    uint32_t *status) {
+    if (!key_stream_id || !status)
+        return QKD_STATUS_NO_CONNECTION;
+
+    PyGILState_STATE gil;
+    struct python_stream *stream = begin_stream_call(key_stream_id, &gil);
+    if (!stream) {
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+    uint32_t status_value = close_stream(stream->client, status);
+    remove_stream(stream);
+    end_stream_call(stream, gil);
+    return status_value;
+}
+
+// Calls get_key_batch(key_stream_id, start_index, count) on the Python
+// client, which returns (status, key_material) with the keys concatenated.
+static uint32_t call_get_key_batch(struct python_stream *stream,
+                                   uint32_t start_index, uint32_t count,
+                                   unsigned char *key_buffer,
+                                   uint32_t *retrieved) {
+    PyObject *py_start = PyLong_FromUnsignedLong(start_index);
+    PyObject *py_count = PyLong_FromUnsignedLong(count);
+    PyObject *py_result = NULL;
+    if (py_start && py_count) {
+        PyObject *args[] = {stream->uuid, py_start, py_count};
+        py_result = PyObject_Vectorcall(stream->get_key_batch, args, 3, NULL);
+    }
+    Py_XDECREF(py_start);
+    Py_XDECREF(py_count);
+    if (!py_result || !PyTuple_Check(py_result)) {
+        PyErr_Print();
+        Py_XDECREF(py_result);
+        return QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY;
+    }
+
+    uint32_t status_value = QKD_STATUS_NO_CONNECTION;
+    if (PyTuple_Size(py_result) < 2 ||
+        !python_to_uint32(PyTuple_GetItem(py_result, 0), &status_value)) {
+        Py_DECREF(py_result);
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    PyObject *py_key_material = PyTuple_GetItem(py_result, 1);
+    if (py_key_material && PyBytes_Check(py_key_material)) {
+        Py_ssize_t size = PyBytes_Size(py_key_material);
+        if (size % QKD_KEY_SIZE != 0 ||
+            (size_t)size / QKD_KEY_SIZE > (size_t)count) {
+            QKD_DBG_ERR("Python get_key_batch returned %zd bytes for %u keys",
+                        size, count);
+            Py_DECREF(py_result);
+            return QKD_STATUS_NO_CONNECTION;
+        }
+        memcpy(key_buffer, PyBytes_AsString(py_key_material), (size_t)size);
+        *retrieved = (uint32_t)(size / QKD_KEY_SIZE);
+    }
+    Py_DECREF(py_result);
+
+    if (status_value == QKD_STATUS_SUCCESS && *retrieved < count)
+        status_value = QKD_STATUS_INSUFFICIENT_KEY;
+    return status_value;
+}
+
+// Fallback for clients without get_key_batch: one get_key() call per index,
+// reusing the bound method, stream UUID and empty metadata request.
+static uint32_t call_get_key_per_index(struct python_stream *stream,
+                                       uint32_t start_index, uint32_t count,
+                                       unsigned char *key_buffer,
+                                       uint32_t *retrieved) {
+    if (!stream->get_key)
+        return QKD_STATUS_NO_CONNECTION;
+
+    PyObject *py_metadata_bytes = PyBytes_FromStringAndSize("", 0);
+    uint32_t status_value = QKD_STATUS_SUCCESS;
+    if (!py_metadata_bytes) {
+        PyErr_Print();
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    for (uint32_t i = 0; i < count && status_value == QKD_STATUS_SUCCESS;
+         i++) {
+        PyObject *py_index = PyLong_FromUnsignedLong(start_index + i);
+        PyObject *py_result = NULL;
+        if (py_index) {
+            PyObject *args[] = {stream->uuid, py_index, py_metadata_bytes};
+            py_result = PyObject_Vectorcall(stream->get_key, args, 3, NULL);
+            Py_DECREF(py_index);
+        }
+        if (!py_result || !PyTuple_Check(py_result)) {
+            PyErr_Print();
+            Py_XDECREF(py_result);
+            status_value = QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY;
+            break;
+        }
+
+        if (PyTuple_Size(py_result) < 3 ||
+            !python_to_uint32(PyTuple_GetItem(py_result, 0), &status_value)) {
+            status_value = QKD_STATUS_NO_CONNECTION;
+        } else if (status_value == QKD_STATUS_SUCCESS) {
+            PyObject *py_key_material = PyTuple_GetItem(py_result, 1);
+            if (!py_key_material || !PyBytes_Check(py_key_material) ||
+                PyBytes_Size(py_key_material) != QKD_KEY_SIZE) {
+                status_value = QKD_STATUS_INSUFFICIENT_KEY;
+            } else {
+                memcpy(key_buffer + (size_t)i * QKD_KEY_SIZE,
+                       PyBytes_AsString(py_key_material), QKD_KEY_SIZE);
+                (*retrieved)++;
+            }
+        }
+        Py_DECREF(py_result);
+    }
+
+    Py_DECREF(py_metadata_bytes);
+    return status_value;
+}
+
+// Backend implementation for GET_KEY_BATCH
+static uint32_t python_client_get_key_batch(const unsigned char *key_stream_id,
+                                            uint32_t start_index,
+                                            uint32_t count,
+                                            unsigned char *key_buffer,
+                                            uint32_t *retrieved,
+                                            uint32_t *status) {
+    if (!key_stream_id || !key_buffer || !retrieved || !status)
+        return QKD_STATUS_NO_CONNECTION;
+
+    *retrieved = 0;
+    PyGILState_STATE gil;
+    struct python_stream *stream = begin_stream_call(key_stream_id, &gil);
+    if (!stream) {
+        *status = QKD_STATUS_NO_CONNECTION;
+        return QKD_STATUS_NO_CONNECTION;
+    }
+
+    uint32_t status_value;
+    if (stream->get_key_batch)
+        status_value = call_get_key_batch(stream, start_index, count,
+                                          key_buffer, retrieved);
+    else
+        status_value = call_get_key_per_index(stream, start_index, count,
+                                              key_buffer, retrieved);
+    end_stream_call(stream, gil);
+
+    QKD_DBG_INFO("Python get_key_batch retrieved %u of %u keys", *retrieved,
+                 count);
+    *status = status_value;
+    return status_value;
+}
+
 // Export the backend interface
 const struct qkd_004_backend python_client_backend = {
     .name = "python_client",
     .open_connect = python_client_open_connect,
     .get_key = python_client_get_key,
-    .close = python_client_close};
+    .close = python_client_close,
+    .get_key_batch = python_client_get_key_batch};
+
+#ifdef QKD_BACKEND_PLUGIN
+const struct qkd_004_backend *qkd_004_plugin_backend(uint32_t abi_version) {
+    return abi_version == QKD_004_BACKEND_ABI_VERSION ? &python_client_backend
+                                                      : NULL;
+}
+#endif
@@ -10,10 +10,13 @@
  * src/etsi004/backends/simulated.c
  */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -21,20 +24,50 @@
 #include "etsi004/api.h"
 #include "etsi004/backends/simulated.h"
 #include "qkd_etsi_api.h"
+#include "qkd_hash_index.h"
 
 #if defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
 
-#define MAX_STREAMS 16
+#ifndef QKD_SIM_MAX_STREAMS
+#define QKD_SIM_MAX_STREAMS 16
+#endif
+
+#ifndef QKD_SIM_MAX_CHUNK_SIZE
+#define QKD_SIM_MAX_CHUNK_SIZE 65536
+#endif
+
+#define MAX_STREAMS QKD_SIM_MAX_STREAMS
 #define MAX_KEYS_PER_STREAM 1024
+#define MAX_CHUNK_SIZE QKD_SIM_MAX_CHUNK_SIZE
+#define SEED_SIZE 32 /* SHA-256 digest, also the AES-256 key size */
+#define METADATA_SIZE 96
+
+struct priority_level;
 
 struct stream_state {
     unsigned char key_id[QKD_KSID_SIZE];
-    unsigned char key_secret[QKD_KEY_SIZE];
+    EVP_MD_CTX *key_prefix; /* SHA-256 state after absorbing the secret */
     struct qkd_qos_s qos;
     bool in_use;
     bool peer_connected;
     bool uses_legacy_key;
     uint64_t creation_time;
+    uint32_t rate_bps;   /* Share of the link, Max_bps without a link */
+    uint64_t rate_since; /* When rate_bps was last set */
+    uint64_t accrued;    /* Bit-milliseconds generated until rate_since */
+    struct priority_level *level;
+    int prev_in_level; /* Neighbouring slots in the level, or -1 */
+    int next_in_level;
+    bool capped; /* Reached Max_bps while the link was being shared */
+};
+
+/* Open streams of one Priority, in the order they were opened. */
+struct priority_level {
+    uint32_t priority;
+    int first; /* Slot of the first stream, or -1 */
+    int last;
+    size_t count;
+    struct priority_level *next; /* Next higher Priority value */
 };
 
 static const unsigned char test_key_uuid[QKD_KSID_SIZE] = {
@@ -47,6 +80,32 @@ static bool closed_stream_in_use[MAX_STREAMS];
 static size_t next_closed_stream;
 static bool legacy_stream_id_issued;
 
+/* KSID lookups for open and recently closed streams, and unused slots. */
+static struct qkd_hash_index stream_index;
+static struct qkd_hash_index closed_index;
+static int free_streams[MAX_STREAMS];
+static int free_stream_count;
+static bool registry_initialized;
+
+/*
+ * Capacity of the link shared by all streams, 0 when each stream produces
+ * key at its own Max_bps. Read from QKD_SIM_LINK_BPS whenever a stream is
+ * opened.
+ */
+static uint64_t link_bps;
+static uint64_t reserved_bps; /* Min_bps summed over open streams */
+static bool rates_shared;     /* Rates were last set from a shared link */
+static struct priority_level *priority_levels; /* Lowest Priority first */
+
+/*
+ * Guards the stream table, its indexes, the closed-stream ring, the link
+ * scheduler state and legacy_stream_id_issued. Stream state only changes
+ * when a stream is opened, connected or closed, so GET_KEY derives keys
+ * under the shared read lock and calls on independent streams run in
+ * parallel.
+ */
+static pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static uint32_t set_status(uint32_t *status, uint32_t value) {
     if (status)
         *status = value;
@@ -57,20 +116,30 @@ static int find_stream(const unsigned char *key_id) {
     if (!key_id)
         return -1;
 
-    for (int i = 0; i < MAX_STREAMS; i++) {
-        if (streams[i].in_use &&
-            memcmp(streams[i].key_id, key_id, QKD_KSID_SIZE) == 0)
-            return i;
+    return qkd_hash_index_find(&stream_index, key_id);
+}
+
+/* Called with registry_lock held for writing. */
+static bool initialize_registry(void) {
+    if (registry_initialized)
+        return true;
+    if (!qkd_hash_index_init(&stream_index, MAX_STREAMS))
+        return false;
+    if (!qkd_hash_index_init(&closed_index, MAX_STREAMS)) {
+        qkd_hash_index_free(&stream_index);
+        return false;
     }
-    return -1;
+    for (int i = 0; i < MAX_STREAMS; i++)
+        free_streams[i] = MAX_STREAMS - 1 - i;
+    free_stream_count = MAX_STREAMS;
+    registry_initialized = true;
+    return true;
 }
 
 static int allocate_stream(void) {
-    for (int i = 0; i < MAX_STREAMS; i++) {
-        if (!streams[i].in_use)
-            return i;
-    }
-    return -1;
+    if (free_stream_count == 0)
+        return -1;
+    return free_streams[free_stream_count - 1];
 }
 
 static bool is_null_stream_id(const unsigned char *key_stream_id) {
@@ -105,20 +174,95 @@ static bool generate_stream_id(unsigned char *key_stream_id,
 }
 
 static bool was_closed(const unsigned char *key_stream_id) {
-    for (int i = 0; i < MAX_STREAMS; i++) {
-        if (closed_stream_in_use[i] &&
-            memcmp(closed_streams[i], key_stream_id, QKD_KSID_SIZE) == 0)
-            return true;
-    }
-    return false;
+    return qkd_hash_index_find(&closed_index, key_stream_id) >= 0;
 }
 
 static void remember_closed(const unsigned char *key_stream_id) {
+    if (closed_stream_in_use[next_closed_stream])
+        qkd_hash_index_remove(&closed_index,
+                              closed_streams[next_closed_stream]);
     memcpy(closed_streams[next_closed_stream], key_stream_id, QKD_KSID_SIZE);
     closed_stream_in_use[next_closed_stream] = true;
+    qkd_hash_index_insert(&closed_index, key_stream_id,
+                          (int32_t)next_closed_stream);
     next_closed_stream = (next_closed_stream + 1U) % MAX_STREAMS;
 }
 
+static void clear_stream(struct stream_state *stream) {
+    EVP_MD_CTX_free(stream->key_prefix);
+    OPENSSL_cleanse(stream, sizeof(*stream));
+}
+
+/* Appends the open stream in slot stream_idx to the list of its Priority. */
+static bool join_level(int stream_idx) {
+    struct stream_state *stream = &streams[stream_idx];
+    struct priority_level **link = &priority_levels;
+
+    while (*link && (*link)->priority < stream->qos.Priority)
+        link = &(*link)->next;
+    if (!*link || (*link)->priority != stream->qos.Priority) {
+        struct priority_level *level = malloc(sizeof(*level));
+        if (!level)
+            return false;
+        level->priority = stream->qos.Priority;
+        level->first = -1;
+        level->last = -1;
+        level->count = 0;
+        level->next = *link;
+        *link = level;
+    }
+
+    struct priority_level *level = *link;
+    stream->level = level;
+    stream->prev_in_level = level->last;
+    stream->next_in_level = -1;
+    if (level->last >= 0)
+        streams[level->last].next_in_level = stream_idx;
+    else
+        level->first = stream_idx;
+    level->last = stream_idx;
+    level->count++;
+    return true;
+}
+
+static void leave_level(int stream_idx) {
+    struct stream_state *stream = &streams[stream_idx];
+    struct priority_level *level = stream->level;
+
+    if (stream->prev_in_level >= 0)
+        streams[stream->prev_in_level].next_in_level = stream->next_in_level;
+    else
+        level->first = stream->next_in_level;
+    if (stream->next_in_level >= 0)
+        streams[stream->next_in_level].prev_in_level = stream->prev_in_level;
+    else
+        level->last = stream->prev_in_level;
+    stream->level = NULL;
+    if (--level->count > 0)
+        return;
+
+    struct priority_level **link = &priority_levels;
+    while (*link != level)
+        link = &(*link)->next;
+    *link = level->next;
+    free(level);
+}
+
+static void allocate_rates(void);
+
+/* Closes the stream in slot stream_idx and returns the slot to the pool. */
+static void release_stream(int stream_idx) {
+    struct stream_state *stream = &streams[stream_idx];
+
+    leave_level(stream_idx);
+    reserved_bps -= stream->qos.Min_bps;
+    qkd_hash_index_remove(&stream_index, stream->key_id);
+    remember_closed(stream->key_id);
+    clear_stream(stream);
+    free_streams[free_stream_count++] = stream_idx;
+    allocate_rates();
+}
+
 static uint64_t get_current_time_ms(void) {
     struct timespec ts;
 
@@ -133,8 +277,8 @@ static bool normalize_qos(struct qkd_qos_s *qos) {
 
     if (qos->Key_chunk_size == 0)
         qos->Key_chunk_size = QKD_KEY_SIZE;
-    else if (qos->Key_chunk_size != QKD_KEY_SIZE) {
-        qos->Key_chunk_size = QKD_KEY_SIZE;
+    else if (qos->Key_chunk_size > MAX_CHUNK_SIZE) {
+        qos->Key_chunk_size = MAX_CHUNK_SIZE;
         supported = false;
     }
 
@@ -156,37 +300,273 @@ static bool normalize_qos(struct qkd_qos_s *qos) {
     return supported;
 }
 
-static bool generate_key(const struct stream_state *stream, unsigned char *key,
-                         uint32_t index) {
-    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-    unsigned int key_size = 0;
-    bool success = false;
+/*
+ * Every chunk starts from a seed SHA-256(secret || index), or SHA-256(index)
+ * for the legacy fixture. Chunks of up to SEED_SIZE bytes are a prefix of
+ * the seed, so QKD_KEY_SIZE chunks are the seed itself; longer ones are the
+ * AES-256-CTR keystream under the seed, which costs one digest and one key
+ * schedule per chunk whatever its size. The digest state after the secret
+ * is computed once per stream and copied into per-thread contexts for every
+ * index, so derivation neither allocates nor re-fetches the algorithms.
+ */
+static bool prepare_key_prefix(struct stream_state *stream) {
+    unsigned char secret[QKD_KEY_SIZE];
 
-    if (!ctx)
+    stream->key_prefix = EVP_MD_CTX_new();
+    if (!stream->key_prefix ||
+        EVP_DigestInit_ex(stream->key_prefix, EVP_sha256(), NULL) != 1)
         return false;
+    if (stream->uses_legacy_key)
+        return true;
+
+    bool success =
+        RAND_bytes(secret, sizeof(secret)) == 1 &&
+        EVP_DigestUpdate(stream->key_prefix, secret, sizeof(secret)) == 1;
+    OPENSSL_cleanse(secret, sizeof(secret));
+    return success;
+}
+
+struct scratch_contexts {
+    EVP_MD_CTX *digest;
+    EVP_CIPHER_CTX *cipher; /* Created for the first chunk above SEED_SIZE */
+};
+
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t scratch_key;
+static bool scratch_key_ready;
+
+static void free_scratch_contexts(void *arg) {
+    struct scratch_contexts *scratch = arg;
+
+    EVP_MD_CTX_free(scratch->digest);
+    EVP_CIPHER_CTX_free(scratch->cipher);
+    free(scratch);
+}
+
+static void create_scratch_key(void) {
+    scratch_key_ready =
+        pthread_key_create(&scratch_key, free_scratch_contexts) == 0;
+}
+
+static struct scratch_contexts *get_scratch_contexts(void) {
+    pthread_once(&scratch_once, create_scratch_key);
+    if (!scratch_key_ready)
+        return NULL;
+
+    struct scratch_contexts *scratch = pthread_getspecific(scratch_key);
+    if (!scratch) {
+        scratch = calloc(1, sizeof(*scratch));
+        if (!scratch)
+            return NULL;
+        scratch->digest = EVP_MD_CTX_new();
+        if (!scratch->digest ||
+            pthread_setspecific(scratch_key, scratch) != 0) {
+            free_scratch_contexts(scratch);
+            return NULL;
+        }
+    }
+    return scratch;
+}
+
+static bool prepare_cipher(struct scratch_contexts *scratch) {
+    if (scratch->cipher)
+        return true;
+
+    scratch->cipher = EVP_CIPHER_CTX_new();
+    if (scratch->cipher &&
+        EVP_EncryptInit_ex(scratch->cipher, EVP_aes_256_ctr(), NULL, NULL,
+                           NULL) == 1)
+        return true;
+    EVP_CIPHER_CTX_free(scratch->cipher);
+    scratch->cipher = NULL;
+    return false;
+}
+
+/* Writes the keystream of the seed over the zeroed chunk. */
+static bool expand_seed(EVP_CIPHER_CTX *cipher, const unsigned char *seed,
+                        unsigned char *key, uint32_t key_size) {
+    static const unsigned char iv[16];
+    int written = 0;
+
+    memset(key, 0, key_size);
+    return EVP_EncryptInit_ex(cipher, NULL, NULL, seed, iv) == 1 &&
+           EVP_EncryptUpdate(cipher, key, &written, key, (int)key_size) == 1 &&
+           (uint32_t)written == key_size;
+}
 
-    bool digest_ok = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) == 1;
-    if (digest_ok && !stream->uses_legacy_key)
-        digest_ok = EVP_DigestUpdate(ctx, stream->key_secret,
-                                     sizeof(stream->key_secret)) == 1;
-    if (digest_ok)
-        digest_ok = EVP_DigestUpdate(ctx, &index, sizeof(index)) == 1;
-    if (digest_ok && EVP_DigestFinal_ex(ctx, key, &key_size) == 1 &&
-        key_size == QKD_KEY_SIZE)
-        success = true;
-
-    EVP_MD_CTX_free(ctx);
+static bool derive_key(struct scratch_contexts *scratch,
+                       const struct stream_state *stream, unsigned char *key,
+                       uint32_t index) {
+    uint32_t key_size = stream->qos.Key_chunk_size;
+    unsigned char seed[SEED_SIZE];
+    unsigned int seed_size = 0;
+    unsigned char *digest = key_size == SEED_SIZE ? key : seed;
+
+    bool success =
+        EVP_MD_CTX_copy_ex(scratch->digest, stream->key_prefix) == 1 &&
+        EVP_DigestUpdate(scratch->digest, &index, sizeof(index)) == 1 &&
+        EVP_DigestFinal_ex(scratch->digest, digest, &seed_size) == 1 &&
+        seed_size == SEED_SIZE;
+    if (success && key_size < SEED_SIZE)
+        memcpy(key, seed, key_size);
+    else if (success && key_size > SEED_SIZE)
+        success = prepare_cipher(scratch) &&
+                  expand_seed(scratch->cipher, seed, key, key_size);
+    OPENSSL_cleanse(seed, sizeof(seed));
     return success;
 }
 
+static bool generate_keys(const struct stream_state *stream,
+                          unsigned char *keys, uint32_t start_index,
+                          uint32_t count) {
+    struct scratch_contexts *scratch = get_scratch_contexts();
+    size_t key_size = stream->qos.Key_chunk_size;
+    bool success = scratch != NULL;
+
+    for (uint32_t i = 0; success && i < count; i++)
+        success = derive_key(scratch, stream, keys + (size_t)i * key_size,
+                             start_index + i);
+    return success;
+}
+
+static bool generate_key(const struct stream_state *stream, unsigned char *key,
+                         uint32_t index) {
+    return generate_keys(stream, key, index, 1);
+}
+
+/* Bit-milliseconds of key generated by now, saturating at a full stream. */
+static uint64_t accrued_bits(const struct stream_state *stream, uint64_t now) {
+    uint64_t full = (uint64_t)MAX_KEYS_PER_STREAM * 8000U *
+                    stream->qos.Key_chunk_size;
+    uint64_t elapsed = now - stream->rate_since;
+
+    if (stream->accrued >= full)
+        return full;
+    if (stream->rate_bps > 0 &&
+        elapsed > (full - stream->accrued) / stream->rate_bps)
+        return full;
+    return stream->accrued + elapsed * stream->rate_bps;
+}
+
+/* Number of leading indices generated so far, bounded by the stream size. */
+static uint32_t available_keys(const struct stream_state *stream) {
+    uint64_t generated_keys =
+        1U + accrued_bits(stream, get_current_time_ms()) /
+                 (8000U * stream->qos.Key_chunk_size);
+
+    if (generated_keys > MAX_KEYS_PER_STREAM)
+        return MAX_KEYS_PER_STREAM;
+    return (uint32_t)generated_keys;
+}
+
+static void read_link_rate(void) {
+    const char *value = getenv("QKD_SIM_LINK_BPS");
+    link_bps = 0;
+    if (!value || value[0] == '\0')
+        return;
+
+    char *end = NULL;
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (*end != '\0' || value[0] == '-' || errno != 0) {
+        QKD_DBG_WARN("Ignoring invalid QKD_SIM_LINK_BPS value: %s", value);
+        return;
+    }
+    link_bps = parsed;
+}
+
+/*
+ * Admission control: a stream joins a shared link only while the Min_bps of
+ * all open streams fits in it. Otherwise Min_bps is lowered to what is left,
+ * for the caller to try again with.
+ */
+static bool admit_stream(struct qkd_qos_s *qos) {
+    if (link_bps == 0)
+        return true;
+
+    uint64_t unreserved =
+        reserved_bps < link_bps ? link_bps - reserved_bps : 0;
+    if (qos->Min_bps <= unreserved)
+        return true;
+    qos->Min_bps = (uint32_t)unreserved;
+    return false;
+}
+
+/*
+ * Splits spare equally between the streams of one priority, none above its
+ * Max_bps, and returns what they could not take.
+ */
+static uint64_t share_rate(const struct priority_level *level,
+                           uint64_t spare) {
+    size_t uncapped = level->count;
+
+    while (uncapped > 0 && spare > 0) {
+        uint64_t share = spare / uncapped;
+        bool changed = false;
+        for (int i = level->first; i >= 0; i = streams[i].next_in_level) {
+            struct stream_state *stream = &streams[i];
+            uint32_t headroom = stream->qos.Max_bps - stream->rate_bps;
+            if (stream->capped || headroom > share)
+                continue;
+            stream->rate_bps = stream->qos.Max_bps;
+            spare -= headroom;
+            stream->capped = true;
+            uncapped--;
+            changed = true;
+        }
+        if (changed)
+            continue;
+
+        uint64_t remainder = spare - share * uncapped;
+        for (int i = level->first; i >= 0; i = streams[i].next_in_level) {
+            struct stream_state *stream = &streams[i];
+            if (stream->capped)
+                continue;
+            stream->rate_bps += (uint32_t)share + (remainder > 0 ? 1U : 0U);
+            if (remainder > 0)
+                remainder--;
+        }
+        spare = 0;
+    }
+    return spare;
+}
+
+/*
+ * Called with registry_lock held for writing whenever a stream opens or
+ * closes. On a shared link every stream gets its Min_bps, and the rest of
+ * the link goes to streams in order of Priority, lowest value first, shared
+ * equally between streams of one priority up to their Max_bps. Key already
+ * generated is kept when the rates change. Without a link a stream keeps
+ * the Max_bps it opened with, so nothing is visited unless the link was
+ * shared before.
+ */
+static void allocate_rates(void) {
+    if (link_bps == 0 && !rates_shared)
+        return;
+
+    uint64_t now = get_current_time_ms();
+    for (const struct priority_level *level = priority_levels; level;
+         level = level->next) {
+        for (int i = level->first; i >= 0; i = streams[i].next_in_level) {
+            struct stream_state *stream = &streams[i];
+            stream->accrued = accrued_bits(stream, now);
+            stream->rate_since = now;
+            stream->rate_bps =
+                link_bps == 0 ? stream->qos.Max_bps : stream->qos.Min_bps;
+            stream->capped = false;
+        }
+    }
+    rates_shared = link_bps != 0;
+
+    uint64_t spare = link_bps > reserved_bps ? link_bps - reserved_bps : 0;
+    for (const struct priority_level *level = priority_levels;
+         level && spare > 0; level = level->next)
+        spare = share_rate(level, spare);
+}
+
 static bool can_generate_key(const struct stream_state *stream,
                              uint32_t requested_index) {
-    uint64_t elapsed_ms = get_current_time_ms() - stream->creation_time;
-    uint64_t generated_keys = 1U + (elapsed_ms * stream->qos.Max_bps) /
-                                       (8000U * stream->qos.Key_chunk_size);
-
-    return requested_index < MAX_KEYS_PER_STREAM &&
-           requested_index < generated_keys;
+    return requested_index < available_keys(stream);
 }
 
 static uint32_t prepare_metadata(const struct stream_state *stream,
@@ -201,10 +581,12 @@ static uint32_t prepare_metadata(const struct stream_state *stream,
     }
 
     uint64_t age_ms = get_current_time_ms() - stream->creation_time;
-    int written =
-        snprintf(value, 64, "{\"age\": %" PRIu64 ", \"hops\": 0}", age_ms);
+    int written = snprintf(value, METADATA_SIZE,
+                           "{\"age\": %" PRIu64 ", \"hops\": 0, \"bps\": "
+                           "%" PRIu32 "}",
+                           age_ms, stream->rate_bps);
 
-    if (written < 0 || written >= 64)
+    if (written < 0 || written >= METADATA_SIZE)
         return QKD_STATUS_NO_CONNECTION;
 
     uint32_t required_size = (uint32_t)written + 1U;
@@ -225,13 +607,9 @@ static bool stream_has_expired(const struct stream_state *stream) {
     return get_current_time_ms() - stream->creation_time >= lifetime_ms;
 }
 
-static uint32_t sim_open_connect(const char *source, const char *destination,
-                                 struct qkd_qos_s *qos,
-                                 unsigned char *key_stream_id,
-                                 uint32_t *status) {
-    if (!source || !destination || !qos || !key_stream_id || !status)
-        return set_status(status, QKD_STATUS_NO_CONNECTION);
-
+static uint32_t open_connect_locked(struct qkd_qos_s *qos,
+                                    unsigned char *key_stream_id,
+                                    uint32_t *status) {
     bool needs_generated_id = is_null_stream_id(key_stream_id);
     int stream_idx = needs_generated_id ? -1 : find_stream(key_stream_id);
     if (stream_idx >= 0) {
@@ -248,9 +626,12 @@ static uint32_t sim_open_connect(const char *source, const char *destination,
 
     if (!needs_generated_id && was_closed(key_stream_id))
         return set_status(status, QKD_STATUS_KSID_IN_USE);
+    read_link_rate();
+    if (!admit_stream(qos))
+        return set_status(status, QKD_STATUS_QOS_NOT_MET);
 
     {
-        int new_stream_idx = allocate_stream();
+        int new_stream_idx = initialize_registry() ? allocate_stream() : -1;
         if (new_stream_idx < 0)
             return set_status(status, QKD_STATUS_NO_CONNECTION);
 
@@ -266,62 +647,155 @@ static uint32_t sim_open_connect(const char *source, const char *destination,
         memset(stream, 0, sizeof(*stream));
         memcpy(stream->key_id, key_stream_id, QKD_KSID_SIZE);
         stream->uses_legacy_key = uses_legacy_id;
-        if (!stream->uses_legacy_key &&
-            RAND_bytes(stream->key_secret, sizeof(stream->key_secret)) != 1) {
-            OPENSSL_cleanse(stream, sizeof(*stream));
+        if (!prepare_key_prefix(stream)) {
+            clear_stream(stream);
             return set_status(status, QKD_STATUS_NO_CONNECTION);
         }
         stream->qos = *qos;
+        if (!join_level(new_stream_idx)) {
+            clear_stream(stream);
+            return set_status(status, QKD_STATUS_NO_CONNECTION);
+        }
         stream->in_use = true;
         stream->creation_time = get_current_time_ms();
+        stream->rate_bps = qos->Max_bps;
+        stream->rate_since = stream->creation_time;
+        reserved_bps += qos->Min_bps;
+        allocate_rates();
+        qkd_hash_index_insert(&stream_index, key_stream_id, new_stream_idx);
+        free_stream_count--;
         if (uses_legacy_id)
             legacy_stream_id_issued = true;
         return set_status(status, QKD_STATUS_PEER_NOT_CONNECTED);
     }
 }
 
-static uint32_t sim_get_key(const unsigned char *key_stream_id, uint32_t *index,
-                            unsigned char *key_buffer,
-                            struct qkd_metadata_s *metadata, uint32_t *status) {
-    if (!key_stream_id || !index || !key_buffer || !status)
+static uint32_t sim_open_connect(const char *source, const char *destination,
+                                 struct qkd_qos_s *qos,
+                                 unsigned char *key_stream_id,
+                                 uint32_t *status) {
+    if (!source || !destination || !qos || !key_stream_id || !status)
         return set_status(status, QKD_STATUS_NO_CONNECTION);
 
+    pthread_rwlock_wrlock(&registry_lock);
+    uint32_t result = open_connect_locked(qos, key_stream_id, status);
+    pthread_rwlock_unlock(&registry_lock);
+    return result;
+}
+
+/* Called with registry_lock held for reading. */
+static uint32_t get_key_shared(const unsigned char *key_stream_id,
+                               uint32_t index, unsigned char *key_buffer,
+                               struct qkd_metadata_s *metadata,
+                               bool *expired) {
     int stream_idx = find_stream(key_stream_id);
     if (stream_idx < 0 || !streams[stream_idx].peer_connected)
-        return set_status(status, QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY);
+        return QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY;
 
-    struct stream_state *stream = &streams[stream_idx];
+    const struct stream_state *stream = &streams[stream_idx];
     if (stream_has_expired(stream)) {
-        remember_closed(stream->key_id);
-        OPENSSL_cleanse(stream, sizeof(*stream));
-        return set_status(status, QKD_STATUS_INSUFFICIENT_KEY);
+        *expired = true;
+        return QKD_STATUS_INSUFFICIENT_KEY;
     }
 
-    char metadata_value[64];
+    char metadata_value[METADATA_SIZE];
     uint32_t metadata_size = 0;
     uint32_t metadata_status =
         prepare_metadata(stream, metadata, metadata_value, &metadata_size);
     if (metadata_status != QKD_STATUS_SUCCESS)
-        return set_status(status, metadata_status);
+        return metadata_status;
 
-    if (!can_generate_key(stream, *index))
-        return set_status(status, QKD_STATUS_INSUFFICIENT_KEY);
-    if (!generate_key(stream, key_buffer, *index))
-        return set_status(status, QKD_STATUS_NO_CONNECTION);
+    if (!can_generate_key(stream, index))
+        return QKD_STATUS_INSUFFICIENT_KEY;
+    if (!generate_key(stream, key_buffer, index))
+        return QKD_STATUS_NO_CONNECTION;
 
     if (metadata_size > 0) {
         memcpy(metadata->Metadata_buffer, metadata_value, metadata_size);
         metadata->Metadata_size = metadata_size - 1U;
     }
 
-    return set_status(status, QKD_STATUS_SUCCESS);
+    return QKD_STATUS_SUCCESS;
 }
 
-static uint32_t sim_close(const unsigned char *key_stream_id,
-                          uint32_t *status) {
-    if (!key_stream_id || !status)
+/* Called with registry_lock held for writing. */
+static void expire_stream(const unsigned char *key_stream_id) {
+    int stream_idx = find_stream(key_stream_id);
+    if (stream_idx >= 0 && stream_has_expired(&streams[stream_idx]))
+        release_stream(stream_idx);
+}
+
+static uint32_t sim_get_key(const unsigned char *key_stream_id, uint32_t *index,
+                            unsigned char *key_buffer,
+                            struct qkd_metadata_s *metadata, uint32_t *status) {
+    if (!key_stream_id || !index || !key_buffer || !status)
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+
+    bool expired = false;
+    pthread_rwlock_rdlock(&registry_lock);
+    uint32_t result =
+        get_key_shared(key_stream_id, *index, key_buffer, metadata, &expired);
+    pthread_rwlock_unlock(&registry_lock);
+
+    if (expired) {
+        pthread_rwlock_wrlock(&registry_lock);
+        expire_stream(key_stream_id);
+        pthread_rwlock_unlock(&registry_lock);
+    }
+    return set_status(status, result);
+}
+
+/* Called with registry_lock held for reading. */
+static uint32_t get_key_batch_shared(const unsigned char *key_stream_id,
+                                     uint32_t start_index, uint32_t count,
+                                     unsigned char *key_buffer,
+                                     uint32_t *retrieved, bool *expired) {
+    int stream_idx = find_stream(key_stream_id);
+    if (stream_idx < 0 || !streams[stream_idx].peer_connected)
+        return QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY;
+
+    const struct stream_state *stream = &streams[stream_idx];
+    if (stream_has_expired(stream)) {
+        *expired = true;
+        return QKD_STATUS_INSUFFICIENT_KEY;
+    }
+
+    uint32_t available = available_keys(stream);
+    uint32_t ready = 0;
+    if (start_index < available)
+        ready = available - start_index < count ? available - start_index
+                                                : count;
+    if (ready > 0 && !generate_keys(stream, key_buffer, start_index, ready))
+        return QKD_STATUS_NO_CONNECTION;
+
+    *retrieved = ready;
+    return ready == count ? QKD_STATUS_SUCCESS : QKD_STATUS_INSUFFICIENT_KEY;
+}
+
+static uint32_t sim_get_key_batch(const unsigned char *key_stream_id,
+                                  uint32_t start_index, uint32_t count,
+                                  unsigned char *key_buffer,
+                                  uint32_t *retrieved, uint32_t *status) {
+    if (!key_stream_id || !key_buffer || !retrieved || !status)
         return set_status(status, QKD_STATUS_NO_CONNECTION);
 
+    bool expired = false;
+    *retrieved = 0;
+    pthread_rwlock_rdlock(&registry_lock);
+    uint32_t result = get_key_batch_shared(key_stream_id, start_index, count,
+                                           key_buffer, retrieved, &expired);
+    pthread_rwlock_unlock(&registry_lock);
+
+    if (expired) {
+        pthread_rwlock_wrlock(&registry_lock);
+        expire_stream(key_stream_id);
+        pthread_rwlock_unlock(&registry_lock);
+    }
+    return set_status(status, result);
+}
+
+static uint32_t close_locked(const unsigned char *key_stream_id,
+                             uint32_t *status) {
     int stream_idx = find_stream(key_stream_id);
     if (stream_idx < 0) {
         if (was_closed(key_stream_id))
@@ -329,17 +803,34 @@ static uint32_t sim_close(const unsigned char *key_stream_id,
         return set_status(status, QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY);
     }
 
-    struct stream_state *stream = &streams[stream_idx];
-    remember_closed(stream->key_id);
-    OPENSSL_cleanse(stream, sizeof(*stream));
-
+    release_stream(stream_idx);
     return set_status(status, QKD_STATUS_SUCCESS);
 }
 
+static uint32_t sim_close(const unsigned char *key_stream_id,
+                          uint32_t *status) {
+    if (!key_stream_id || !status)
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+
+    pthread_rwlock_wrlock(&registry_lock);
+    uint32_t result = close_locked(key_stream_id, status);
+    pthread_rwlock_unlock(&registry_lock);
+    return result;
+}
+
 const struct qkd_004_backend simulated_backend = {.name = "simulated",
                                                   .open_connect =
                                                       sim_open_connect,
                                                   .get_key = sim_get_key,
-                                                  .close = sim_close};
+                                                  .close = sim_close,
+                                                  .get_key_batch =
+                                                      sim_get_key_batch};
+
+#ifdef QKD_BACKEND_PLUGIN
+const struct qkd_004_backend *qkd_004_plugin_backend(uint32_t abi_version) {
+    return abi_version == QKD_004_BACKEND_ABI_VERSION ? &simulated_backend
+                                                      : NULL;
+}
+#endif
 
 #endif /* QKD_USE_SIMULATED */
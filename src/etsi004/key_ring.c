@@ -0,0 +1,627 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi004/key_ring.c
+ */
+
+#include <errno.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "etsi004/api.h"
+#include "etsi004/key_ring.h"
+#include "qkd_etsi_api.h"
+#include "qkd_secure_alloc.h"
+
+#define MAX_RINGS 16
+#define MAX_RING_CHUNKS 65536U
+#define CACHE_LINE_SIZE 64U
+#define RETRY_DELAY_MS 100U
+#define MAX_PACING_DELAY_MS 1000U
+#define FULL_WAIT_MS 1000U
+
+/*
+ * A slot is free for position p of its ring when its sequence is p and holds
+ * the chunk of position p when it is p + 1. Consumers set it to
+ * p + capacity once they have copied the chunk out. Slots hold chunks of the
+ * negotiated Key_chunk_size, slot_size bytes apart.
+ */
+struct ring_slot {
+    uint64_t sequence;
+    uint32_t index;
+    unsigned char key[];
+};
+
+/*
+ * Ring of one stream. The producer thread is the only writer of tail and
+ * next_index; consumers advance head with a CAS. lock and the condition
+ * variables are only used to sleep: by the producer when the ring is full,
+ * by GET_KEY_WAIT() when it is empty, and by qkd_004_key_ring_stop().
+ * event_fd is signalled for consumers that found the ring empty, which arm
+ * it through fd_armed.
+ */
+struct key_ring {
+    unsigned char key_stream_id[QKD_KSID_SIZE];
+    unsigned char *slots;
+    unsigned char *fetched_keys; /* Producer buffer of batch_size chunks */
+    void *region;
+    size_t region_size;
+    size_t slot_size;
+    uint32_t chunk_size;
+    uint32_t capacity;
+    uint32_t batch_size;
+    uint32_t timeout_ms;
+    uint32_t chunk_interval_ms;
+    uint32_t max_bps;
+    uint32_t next_index;
+    uint64_t started_ms;
+    uint64_t produced_chunks;
+    uint32_t error;
+    uint32_t producer_waiting;
+    uint32_t consumers_waiting;
+    uint32_t users;
+    uint32_t fd_armed;
+    int event_fd;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t produced;
+    pthread_cond_t consumed;
+    pthread_cond_t idle;
+    pthread_t thread;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fetched;
+    uint64_t fetch_failures;
+    uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+static struct {
+    pthread_rwlock_t lock;
+    struct key_ring *rings[MAX_RINGS];
+    uint32_t ring_count;
+} registry = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+
+static uint32_t set_status(uint32_t *status, uint32_t value) {
+    if (status)
+        *status = value;
+    return value;
+}
+
+static uint64_t get_current_time_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static struct timespec deadline_after(uint32_t delay_ms) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(delay_ms / 1000U);
+    deadline.tv_nsec += (long)(delay_ms % 1000U) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+static uint32_t buffered_chunks(const struct key_ring *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    return tail > head ? (uint32_t)(tail - head) : 0;
+}
+
+static void counter_add(uint64_t *counter, uint64_t value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static struct ring_slot *slot_at(const struct key_ring *ring,
+                                 uint64_t position) {
+    return (struct ring_slot *)(ring->slots +
+                                (size_t)(position % ring->capacity) *
+                                    ring->slot_size);
+}
+
+/* Called by the producer only. */
+static bool push_chunk(struct key_ring *ring, uint32_t index,
+                       const unsigned char *key) {
+    uint64_t position = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct ring_slot *slot = slot_at(ring, position);
+
+    /* A consumer may still be copying the chunk of the previous lap. */
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != position)
+        return false;
+
+    __atomic_store_n(&slot->index, index, __ATOMIC_RELAXED);
+    memcpy(slot->key, key, ring->chunk_size);
+    __atomic_store_n(&slot->sequence, position + 1U, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, position + 1U, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+/*
+ * Claims the chunk at the head of the ring, only if its index is index when
+ * match is set, and copies it out. The caller wakes the producer.
+ */
+static bool pop_chunk(struct key_ring *ring, bool match, uint32_t *index,
+                      unsigned char *key_buffer) {
+    uint64_t position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct ring_slot *slot;
+
+    for (;;) {
+        slot = slot_at(ring, position);
+        uint64_t sequence =
+            __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t difference = (int64_t)(sequence - (position + 1U));
+        if (difference < 0)
+            return false;
+        if (difference > 0) {
+            position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (match &&
+            __atomic_load_n(&slot->index, __ATOMIC_RELAXED) != *index)
+            return false;
+        if (__atomic_compare_exchange_n(&ring->head, &position, position + 1U,
+                                        true, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+
+    *index = slot->index;
+    memcpy(key_buffer, slot->key, ring->chunk_size);
+    OPENSSL_cleanse(slot->key, ring->chunk_size);
+    __atomic_store_n(&slot->sequence, position + ring->capacity,
+                     __ATOMIC_RELEASE);
+    counter_add(&ring->hits, 1);
+    return true;
+}
+
+static void wake_producer(struct key_ring *ring) {
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_signal(&ring->consumed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+static void notify_fd(struct key_ring *ring) {
+    uint64_t increment = 1;
+
+    if (__atomic_load_n(&ring->fd_armed, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->fd_armed, 0, __ATOMIC_SEQ_CST) &&
+        write(ring->event_fd, &increment, sizeof(increment)) < 0) {
+        QKD_DBG_WARN("Failed to signal the key ring descriptor");
+    }
+}
+
+/*
+ * Called by consumers that found the ring empty. A chunk pushed before the
+ * producer could see fd_armed is caught by the second look at the ring.
+ */
+static void arm_fd(struct key_ring *ring) {
+    __atomic_store_n(&ring->fd_armed, 1, __ATOMIC_SEQ_CST);
+    if (buffered_chunks(ring) > 0)
+        notify_fd(ring);
+}
+
+static void wake_consumers(struct key_ring *ring) {
+    if (__atomic_load_n(&ring->consumers_waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->produced);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+/* Chunks the stream may have delivered by now at its Max_bps. */
+static uint64_t paced_chunks(const struct key_ring *ring) {
+    if (ring->max_bps == 0)
+        return UINT64_MAX;
+    uint64_t elapsed_ms = get_current_time_ms() - ring->started_ms;
+    return 1U + elapsed_ms * ring->max_bps / (8000U * ring->chunk_size);
+}
+
+/* Called without ring->lock. Returns the number of chunks fetched. */
+static uint32_t fetch_chunks(struct key_ring *ring, uint32_t wanted,
+                             uint32_t *result) {
+    const struct qkd_004_backend *backend = get_active_004_backend();
+    uint32_t retrieved = 0;
+    uint32_t status = QKD_STATUS_NO_CONNECTION;
+
+    if (!backend || !backend->get_key) {
+        *result = QKD_STATUS_NO_CONNECTION;
+        return 0;
+    }
+    if (backend->get_key_batch) {
+        *result = backend->get_key_batch(ring->key_stream_id,
+                                         ring->next_index, wanted,
+                                         ring->fetched_keys, &retrieved,
+                                         &status);
+        return retrieved <= wanted ? retrieved : 0;
+    }
+
+    *result = QKD_STATUS_SUCCESS;
+    while (retrieved < wanted) {
+        uint32_t index = ring->next_index + retrieved;
+        *result = backend->get_key(
+            ring->key_stream_id, &index,
+            ring->fetched_keys + (size_t)retrieved * ring->chunk_size, NULL,
+            &status);
+        if (*result != QKD_STATUS_SUCCESS)
+            break;
+        retrieved++;
+    }
+    return retrieved;
+}
+
+/*
+ * Called with ring->lock held. Returns the delay before the next attempt and
+ * sets full when the delay is only there to wait for consumers.
+ */
+static uint32_t produce(struct key_ring *ring, bool *full) {
+    uint32_t free_slots = ring->capacity - buffered_chunks(ring);
+    uint64_t paced = paced_chunks(ring);
+    uint64_t wanted = paced > ring->produced_chunks
+                          ? paced - ring->produced_chunks
+                          : 0;
+    if (wanted > free_slots)
+        wanted = free_slots;
+    if (wanted > ring->batch_size)
+        wanted = ring->batch_size;
+    if (wanted > UINT32_MAX - ring->next_index)
+        wanted = UINT32_MAX - ring->next_index;
+    *full = free_slots == 0;
+    if (*full)
+        return FULL_WAIT_MS;
+    if (wanted == 0)
+        return ring->chunk_interval_ms;
+
+    pthread_mutex_unlock(&ring->lock);
+    uint32_t result;
+    uint32_t retrieved = fetch_chunks(ring, (uint32_t)wanted, &result);
+    uint32_t stored = 0;
+    while (stored < retrieved &&
+           push_chunk(ring, ring->next_index,
+                      ring->fetched_keys + (size_t)stored * ring->chunk_size)) {
+        __atomic_store_n(&ring->next_index, ring->next_index + 1U,
+                         __ATOMIC_RELAXED);
+        stored++;
+    }
+    OPENSSL_cleanse(ring->fetched_keys, (size_t)retrieved * ring->chunk_size);
+    if (stored > 0) {
+        counter_add(&ring->fetched, stored);
+        notify_fd(ring);
+        wake_consumers(ring);
+    }
+    pthread_mutex_lock(&ring->lock);
+
+    ring->produced_chunks += stored;
+    if (retrieved > 0) {
+        __atomic_store_n(&ring->error, QKD_STATUS_SUCCESS, __ATOMIC_RELAXED);
+        return 0;
+    }
+    counter_add(&ring->fetch_failures, 1);
+    if (result != QKD_STATUS_INSUFFICIENT_KEY) {
+        __atomic_store_n(&ring->error, result, __ATOMIC_RELAXED);
+        notify_fd(ring);
+        pthread_cond_broadcast(&ring->produced);
+        return RETRY_DELAY_MS;
+    }
+    return ring->chunk_interval_ms;
+}
+
+static void *producer_thread(void *arg) {
+    struct key_ring *ring = arg;
+
+    pthread_mutex_lock(&ring->lock);
+    while (!ring->stopping) {
+        bool full = false;
+        uint32_t delay_ms = produce(ring, &full);
+        if (delay_ms == 0 || ring->stopping)
+            continue;
+
+        /* Consumers only take the lock when they see this flag set. */
+        __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (!full || buffered_chunks(ring) == ring->capacity) {
+            struct timespec deadline = deadline_after(delay_ms);
+            pthread_cond_timedwait(&ring->consumed, &ring->lock, &deadline);
+        }
+        __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+static void free_ring(struct key_ring *ring) {
+    if (ring->event_fd >= 0)
+        close(ring->event_fd);
+    qkd_locked_free(ring->region, ring->region_size);
+    pthread_cond_destroy(&ring->idle);
+    pthread_cond_destroy(&ring->consumed);
+    pthread_cond_destroy(&ring->produced);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+static struct key_ring *create_ring(const unsigned char *key_stream_id,
+                                    const struct qkd_qos_s *qos,
+                                    const qkd_004_key_ring_config_t *config) {
+    /* Both the slots and the producer buffer hold up to MAX_RING_CHUNKS. */
+    uint64_t chunk_size = qos->Key_chunk_size;
+    if (chunk_size > SIZE_MAX / 2U / MAX_RING_CHUNKS - CACHE_LINE_SIZE)
+        return NULL;
+
+    void *memory = NULL;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, sizeof(struct key_ring)) != 0)
+        return NULL;
+
+    struct key_ring *ring = memory;
+    memset(ring, 0, sizeof(*ring));
+    memcpy(ring->key_stream_id, key_stream_id, QKD_KSID_SIZE);
+    ring->chunk_size = qos->Key_chunk_size;
+    ring->slot_size = (offsetof(struct ring_slot, key) + ring->chunk_size +
+                       sizeof(uint64_t) - 1U) &
+                      ~(sizeof(uint64_t) - 1U);
+    ring->capacity = config->capacity;
+    ring->batch_size = config->batch_size > 0 ? config->batch_size
+                                              : config->capacity;
+    ring->timeout_ms = qos->Timeout;
+    ring->max_bps = qos->Max_bps;
+    uint64_t interval_ms =
+        ring->max_bps > 0
+            ? (8000U * (uint64_t)ring->chunk_size + ring->max_bps - 1U) /
+                  ring->max_bps
+            : RETRY_DELAY_MS;
+    ring->chunk_interval_ms =
+        interval_ms < MAX_PACING_DELAY_MS ? (uint32_t)interval_ms
+                                          : RETRY_DELAY_MS;
+    ring->next_index = config->first_index;
+    ring->fd_armed = 1;
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->produced, NULL);
+    pthread_cond_init(&ring->consumed, NULL);
+    pthread_cond_init(&ring->idle, NULL);
+
+    size_t slots_size = (size_t)ring->capacity * ring->slot_size;
+    ring->region_size =
+        slots_size + (size_t)ring->batch_size * ring->chunk_size;
+    ring->region = qkd_locked_alloc(&ring->region_size);
+    if (!ring->region || ring->event_fd < 0) {
+        free_ring(ring);
+        return NULL;
+    }
+    ring->slots = ring->region;
+    ring->fetched_keys = ring->slots + slots_size;
+    for (uint32_t i = 0; i < ring->capacity; i++)
+        slot_at(ring, i)->sequence = i;
+    return ring;
+}
+
+/* Called with registry.lock held. */
+static int find_ring(const unsigned char *key_stream_id) {
+    for (int i = 0; i < MAX_RINGS; i++) {
+        if (registry.rings[i] &&
+            memcmp(registry.rings[i]->key_stream_id, key_stream_id,
+                   QKD_KSID_SIZE) == 0)
+            return i;
+    }
+    return -1;
+}
+
+uint32_t qkd_004_key_ring_start(const unsigned char *key_stream_id,
+                                const struct qkd_qos_s *qos,
+                                const qkd_004_key_ring_config_t *config,
+                                uint32_t *status) {
+    if (!key_stream_id || !qos || !config || config->capacity == 0 ||
+        config->capacity > MAX_RING_CHUNKS ||
+        config->batch_size > config->capacity)
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+    if (qos->Key_chunk_size == 0)
+        return set_status(status, QKD_STATUS_QOS_NOT_MET);
+    const struct qkd_004_backend *backend = get_active_004_backend();
+    if (!backend || !backend->get_key) {
+        QKD_DBG_ERR("No QKD backend registered");
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+    }
+
+    struct key_ring *ring = create_ring(key_stream_id, qos, config);
+    if (!ring)
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+
+    pthread_rwlock_wrlock(&registry.lock);
+    uint32_t result = QKD_STATUS_SUCCESS;
+    int free_index = find_ring(key_stream_id) >= 0 ? -2 : -1;
+    for (int i = 0; free_index == -1 && i < MAX_RINGS; i++) {
+        if (!registry.rings[i])
+            free_index = i;
+    }
+    if (free_index == -2) {
+        result = QKD_STATUS_KSID_IN_USE;
+    } else if (free_index < 0) {
+        result = QKD_STATUS_NO_CONNECTION;
+    } else {
+        ring->started_ms = get_current_time_ms();
+        if (pthread_create(&ring->thread, NULL, producer_thread, ring) != 0) {
+            result = QKD_STATUS_NO_CONNECTION;
+        } else {
+            registry.rings[free_index] = ring;
+            __atomic_store_n(&registry.ring_count, registry.ring_count + 1U,
+                             __ATOMIC_RELEASE);
+        }
+    }
+    pthread_rwlock_unlock(&registry.lock);
+
+    if (result != QKD_STATUS_SUCCESS)
+        free_ring(ring);
+    return set_status(status, result);
+}
+
+void qkd_004_key_ring_stop(const unsigned char *key_stream_id) {
+    if (!key_stream_id ||
+        __atomic_load_n(&registry.ring_count, __ATOMIC_ACQUIRE) == 0)
+        return;
+
+    pthread_rwlock_wrlock(&registry.lock);
+    int ring_index = find_ring(key_stream_id);
+    struct key_ring *ring = ring_index >= 0 ? registry.rings[ring_index] : NULL;
+    if (ring) {
+        registry.rings[ring_index] = NULL;
+        __atomic_store_n(&registry.ring_count, registry.ring_count - 1U,
+                         __ATOMIC_RELEASE);
+    }
+    pthread_rwlock_unlock(&registry.lock);
+    if (!ring)
+        return;
+
+    /* Waiting consumers hold a reference that outlives the registry entry. */
+    pthread_mutex_lock(&ring->lock);
+    ring->stopping = true;
+    pthread_cond_broadcast(&ring->produced);
+    pthread_cond_broadcast(&ring->consumed);
+    while (ring->users > 0)
+        pthread_cond_wait(&ring->idle, &ring->lock);
+    pthread_mutex_unlock(&ring->lock);
+
+    pthread_join(ring->thread, NULL);
+    free_ring(ring);
+}
+
+bool qkd_004_key_ring_get_stats(const unsigned char *key_stream_id,
+                                qkd_004_key_ring_stats_t *stats) {
+    if (!key_stream_id || !stats)
+        return false;
+
+    pthread_rwlock_rdlock(&registry.lock);
+    int ring_index = find_ring(key_stream_id);
+    if (ring_index >= 0) {
+        struct key_ring *ring = registry.rings[ring_index];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        stats->hits = __atomic_load_n(&ring->hits, __ATOMIC_RELAXED);
+        stats->misses = __atomic_load_n(&ring->misses, __ATOMIC_RELAXED);
+        stats->fetched = __atomic_load_n(&ring->fetched, __ATOMIC_RELAXED);
+        stats->fetch_failures =
+            __atomic_load_n(&ring->fetch_failures, __ATOMIC_RELAXED);
+        stats->buffered = buffered_chunks(ring);
+        stats->next_index =
+            stats->buffered > 0
+                ? __atomic_load_n(&slot_at(ring, head)->index,
+                                  __ATOMIC_RELAXED)
+                : __atomic_load_n(&ring->next_index, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&registry.lock);
+    return ring_index >= 0;
+}
+
+int qkd_004_key_ring_fd(const unsigned char *key_stream_id) {
+    if (!key_stream_id)
+        return -1;
+
+    pthread_rwlock_rdlock(&registry.lock);
+    int ring_index = find_ring(key_stream_id);
+    int fd = ring_index >= 0 ? registry.rings[ring_index]->event_fd : -1;
+    pthread_rwlock_unlock(&registry.lock);
+    return fd;
+}
+
+bool qkd_004_key_ring_get_key(const unsigned char *key_stream_id,
+                              uint32_t index, unsigned char *key_buffer) {
+    if (!key_stream_id ||
+        __atomic_load_n(&registry.ring_count, __ATOMIC_ACQUIRE) == 0)
+        return false;
+
+    pthread_rwlock_rdlock(&registry.lock);
+    int ring_index = find_ring(key_stream_id);
+    struct key_ring *ring = ring_index >= 0 ? registry.rings[ring_index] : NULL;
+    bool served = ring && pop_chunk(ring, true, &index, key_buffer);
+    if (served) {
+        wake_producer(ring);
+    } else if (ring) {
+        counter_add(&ring->misses, 1);
+        if (buffered_chunks(ring) == 0)
+            arm_fd(ring);
+    }
+    pthread_rwlock_unlock(&registry.lock);
+    return served;
+}
+
+/* Called with ring->lock held and a reference taken on the ring. */
+static uint32_t wait_for_chunk(struct key_ring *ring, uint32_t *index,
+                               unsigned char *key_buffer) {
+    struct timespec deadline = deadline_after(ring->timeout_ms);
+    uint32_t result = QKD_STATUS_TIMEOUT;
+
+    __atomic_fetch_add(&ring->consumers_waiting, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if (pop_chunk(ring, false, index, key_buffer)) {
+            result = QKD_STATUS_SUCCESS;
+            __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+            pthread_cond_signal(&ring->consumed);
+            break;
+        }
+        uint32_t error = __atomic_load_n(&ring->error, __ATOMIC_RELAXED);
+        if (ring->stopping || error != QKD_STATUS_SUCCESS) {
+            result = ring->stopping ? QKD_STATUS_NO_CONNECTION : error;
+            break;
+        }
+        if (ring->timeout_ms == 0 ||
+            pthread_cond_timedwait(&ring->produced, &ring->lock, &deadline) ==
+                ETIMEDOUT) {
+            if (pop_chunk(ring, false, index, key_buffer))
+                result = QKD_STATUS_SUCCESS;
+            else
+                arm_fd(ring);
+            break;
+        }
+    }
+    __atomic_fetch_sub(&ring->consumers_waiting, 1, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+uint32_t GET_KEY_WAIT(const unsigned char *key_stream_id, uint32_t *index,
+                      unsigned char *key_buffer, uint32_t *status) {
+    if (!key_stream_id || !index || !key_buffer)
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+
+    pthread_rwlock_rdlock(&registry.lock);
+    int ring_index = find_ring(key_stream_id);
+    struct key_ring *ring = ring_index >= 0 ? registry.rings[ring_index] : NULL;
+    if (!ring) {
+        pthread_rwlock_unlock(&registry.lock);
+        return set_status(status, QKD_STATUS_NO_CONNECTION);
+    }
+    if (pop_chunk(ring, false, index, key_buffer)) {
+        wake_producer(ring);
+        pthread_rwlock_unlock(&registry.lock);
+        return set_status(status, QKD_STATUS_SUCCESS);
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    ring->users++;
+    pthread_rwlock_unlock(&registry.lock);
+    uint32_t result = wait_for_chunk(ring, index, key_buffer);
+    if (--ring->users == 0 && ring->stopping)
+        pthread_cond_signal(&ring->idle);
+    pthread_mutex_unlock(&ring->lock);
+    return set_status(status, result);
+}
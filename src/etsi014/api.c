@@ -14,76 +14,503 @@
 
 #include "etsi014/api.h"
 #include "debug.h"
-#include <openssl/crypto.h>
+#include "etsi014/key_broker.h"
+#include "etsi014/key_cache.h"
+#include "etsi014/key_coalescer.h"
+#include "etsi014/key_container.h"
+#include "etsi014/status_cache.h"
+#include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+#include "qkd_secure_alloc.h"
+#include <errno.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
-#if defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
+#if defined(QKD_BACKEND_PLUGINS)
+#include "qkd_plugin.h"
+#include <pthread.h>
+#define DEFAULT_BACKEND NULL
+#elif defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
 #include "etsi014/backends/simulated.h"
-static const struct qkd_014_backend *active_backend = &simulated_backend;
+#define DEFAULT_BACKEND (&simulated_backend)
 #elif defined(QKD_USE_ETSI014_BACKEND)
 #include "etsi014/backends/qkd_etsi014_backend.h"
-static const struct qkd_014_backend *active_backend = &qkd_etsi014_backend;
+#define DEFAULT_BACKEND (&qkd_etsi014_backend)
 #else
-static const struct qkd_014_backend *active_backend = NULL;
+#define DEFAULT_BACKEND NULL
 #endif
 
+struct qkd_014_ctx {
+    const struct qkd_014_backend *backend;
+    void *context; /* Backend state, NULL when the backend has none */
+    char *kme_hostname;
+};
+
+static struct qkd_014_ctx default_ctx = {.backend = DEFAULT_BACKEND};
+
+#ifdef QKD_BACKEND_PLUGINS
+/*
+ * The default backend is loaded on first use, unless one was registered
+ * before, so that processes which never call the API load no plugin.
+ */
+static pthread_once_t default_backend_once = PTHREAD_ONCE_INIT;
+
+static void load_default_backend(void) {
+    default_ctx.backend = qkd_014_load_backend(NULL);
+}
+
+static void keep_registered_backend(void) {}
+
+const struct qkd_014_backend *qkd_014_load_backend(const char *name) {
+    return qkd_plugin_load("014", name, "qkd_014_plugin_backend",
+                           QKD_014_BACKEND_ABI_VERSION);
+}
+#else
+const struct qkd_014_backend *qkd_014_load_backend(const char *name) {
+    if (name && strcmp(name, QKD_BACKEND_TYPE) != 0)
+        return NULL;
+    return DEFAULT_BACKEND;
+}
+#endif
+
+static qkd_014_ctx_t *default_context(void) {
+#ifdef QKD_BACKEND_PLUGINS
+    pthread_once(&default_backend_once, load_default_backend);
+#endif
+    return &default_ctx;
+}
+
 void register_qkd_014_backend(const struct qkd_014_backend *backend) {
-    active_backend = backend;
+#ifdef QKD_BACKEND_PLUGINS
+    pthread_once(&default_backend_once, keep_registered_backend);
+#endif
+    default_ctx.backend = backend;
 }
 
 const struct qkd_014_backend *get_active_014_backend(void) {
-    return active_backend;
+    return default_context()->backend;
 }
 
-uint32_t GET_STATUS(const char *kme_hostname, const char *slave_sae_id,
-                    qkd_status_t *status) {
+qkd_014_ctx_t *qkd_014_default_ctx(void) { return default_context(); }
+
+qkd_014_ctx_t *qkd_014_ctx_create(const qkd_014_ctx_config_t *config) {
+    const struct qkd_014_backend *backend = config && config->backend
+                                                ? config->backend
+                                                : qkd_014_load_backend(NULL);
+    if (!backend) {
+        QKD_DBG_ERR("No REST backend available");
+        return NULL;
+    }
+
+    qkd_014_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    ctx->backend = backend;
+    if (config && config->kme_hostname) {
+        ctx->kme_hostname = strdup(config->kme_hostname);
+        if (!ctx->kme_hostname) {
+            free(ctx);
+            return NULL;
+        }
+    }
+    if (backend->context_create && backend->context_destroy) {
+        ctx->context = backend->context_create(config);
+        if (!ctx->context) {
+            free(ctx->kme_hostname);
+            free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+void qkd_014_ctx_destroy(qkd_014_ctx_t *ctx) {
+    if (!ctx || ctx == &default_ctx)
+        return;
+
+    if (ctx->context)
+        ctx->backend->context_destroy(ctx->context);
+    free(ctx->kme_hostname);
+    free(ctx);
+}
+
+static uint32_t ctx_get_status(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                               const char *slave_sae_id, qkd_status_t *status) {
+    if (!ctx)
+        ctx = default_context();
+    if (!kme_hostname)
+        kme_hostname = ctx->kme_hostname;
     if (!kme_hostname || !slave_sae_id || !status) {
         QKD_DBG_ERR("Invalid parameters in GET_STATUS");
         return QKD_STATUS_BAD_REQUEST;
     }
 
-    if (!active_backend || !active_backend->get_status) {
+    const struct qkd_014_backend *backend = ctx->backend;
+    if (!backend || !backend->get_status) {
         QKD_DBG_ERR("No REST backend available");
         return QKD_STATUS_SERVER_ERROR;
     }
 
-    return active_backend->get_status(kme_hostname, slave_sae_id, status);
+    uint32_t result;
+    if (ctx == &default_ctx &&
+        qkd_status_cache_get_status(kme_hostname, slave_sae_id, status,
+                                    &result))
+        return result;
+
+    if (ctx->context && backend->context_get_status)
+        return backend->context_get_status(ctx->context, kme_hostname,
+                                           slave_sae_id, status);
+    return backend->get_status(kme_hostname, slave_sae_id, status);
 }
 
-uint32_t GET_KEY(const char *kme_hostname, const char *slave_sae_id,
-                 qkd_key_request_t *request, qkd_key_container_t *container) {
+static uint32_t ctx_get_key(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                            const char *slave_sae_id,
+                            qkd_key_request_t *request,
+                            qkd_key_container_t *container) {
+    if (!ctx)
+        ctx = default_context();
+    if (!kme_hostname)
+        kme_hostname = ctx->kme_hostname;
     if (!kme_hostname || !slave_sae_id || !container) {
         QKD_DBG_ERR("Invalid parameters in GET_KEY");
         return QKD_STATUS_BAD_REQUEST;
     }
 
-    if (!active_backend || !active_backend->get_key) {
+    const struct qkd_014_backend *backend = ctx->backend;
+    if (!backend || !backend->get_key) {
+        QKD_DBG_ERR("No REST backend available");
+        return QKD_STATUS_SERVER_ERROR;
+    }
+
+    QKD_DBG_INFO("GET_KEY(): Active backend name: %s", backend->name);
+
+    if (ctx == &default_ctx &&
+        (qkd_key_broker_get_key(kme_hostname, slave_sae_id, request,
+                                container) ||
+         qkd_key_cache_get_key(kme_hostname, slave_sae_id, request,
+                               container)))
+        return QKD_STATUS_OK;
+
+    uint32_t result;
+    if (ctx->context && backend->context_get_key)
+        result = backend->context_get_key(ctx->context, kme_hostname,
+                                          slave_sae_id, request, container);
+    else
+        result =
+            backend->get_key(kme_hostname, slave_sae_id, request, container);
+    if (ctx == &default_ctx && result == QKD_STATUS_OK)
+        qkd_status_cache_consume(kme_hostname, slave_sae_id,
+                                 container->key_count);
+    return result;
+}
+
+static uint32_t ctx_get_key_with_ids(qkd_014_ctx_t *ctx,
+                                     const char *kme_hostname,
+                                     const char *master_sae_id,
+                                     qkd_key_ids_t *key_ids,
+                                     qkd_key_container_t *container) {
+    if (!ctx)
+        ctx = default_context();
+    if (!kme_hostname)
+        kme_hostname = ctx->kme_hostname;
+    if (!kme_hostname || !master_sae_id || !key_ids || !container) {
+        QKD_DBG_ERR("Invalid parameters in GET_KEY_WITH_IDS");
+        return QKD_STATUS_BAD_REQUEST;
+    }
+
+    const struct qkd_014_backend *backend = ctx->backend;
+    if (!backend || !backend->get_key_with_ids) {
         QKD_DBG_ERR("No REST backend available");
         return QKD_STATUS_SERVER_ERROR;
     }
 
-    QKD_DBG_INFO("GET_KEY(): Active backend name: %s", active_backend->name);
+    uint32_t result;
+    if (ctx == &default_ctx &&
+        qkd_key_coalescer_get_key_with_ids(kme_hostname, master_sae_id,
+                                           key_ids, container, &result))
+        return result;
+
+    if (ctx->context && backend->context_get_key_with_ids)
+        return backend->context_get_key_with_ids(
+            ctx->context, kme_hostname, master_sae_id, key_ids, container);
+    return backend->get_key_with_ids(kme_hostname, master_sae_id, key_ids,
+                                     container);
+}
+
+uint32_t qkd_014_ctx_get_status(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                                const char *slave_sae_id,
+                                qkd_status_t *status) {
+    uint64_t started = qkd_metrics_now();
+    uint32_t result = ctx_get_status(ctx, kme_hostname, slave_sae_id, status);
+    qkd_metrics_finish(QKD_METRICS_014_GET_STATUS, started,
+                       result != QKD_STATUS_OK);
+    return result;
+}
+
+uint32_t qkd_014_ctx_get_key(qkd_014_ctx_t *ctx, const char *kme_hostname,
+                             const char *slave_sae_id,
+                             qkd_key_request_t *request,
+                             qkd_key_container_t *container) {
+    uint64_t started = qkd_metrics_now();
+    uint32_t result =
+        ctx_get_key(ctx, kme_hostname, slave_sae_id, request, container);
+    qkd_metrics_finish(QKD_METRICS_014_GET_KEY, started,
+                       result != QKD_STATUS_OK);
+    return result;
+}
 
-    return active_backend->get_key(kme_hostname, slave_sae_id, request,
-                                   container);
+uint32_t qkd_014_ctx_get_key_with_ids(qkd_014_ctx_t *ctx,
+                                      const char *kme_hostname,
+                                      const char *master_sae_id,
+                                      qkd_key_ids_t *key_ids,
+                                      qkd_key_container_t *container) {
+    uint64_t started = qkd_metrics_now();
+    uint32_t result = ctx_get_key_with_ids(ctx, kme_hostname, master_sae_id,
+                                           key_ids, container);
+    qkd_metrics_finish(QKD_METRICS_014_GET_KEY_WITH_IDS, started,
+                       result != QKD_STATUS_OK);
+    return result;
+}
+
+uint32_t GET_STATUS(const char *kme_hostname, const char *slave_sae_id,
+                    qkd_status_t *status) {
+    return qkd_014_ctx_get_status(default_context(), kme_hostname, slave_sae_id,
+                                  status);
+}
+
+uint32_t GET_KEY(const char *kme_hostname, const char *slave_sae_id,
+                 qkd_key_request_t *request, qkd_key_container_t *container) {
+    return qkd_014_ctx_get_key(default_context(), kme_hostname, slave_sae_id,
+                               request, container);
 }
 
 uint32_t GET_KEY_WITH_IDS(const char *kme_hostname, const char *master_sae_id,
                           qkd_key_ids_t *key_ids,
                           qkd_key_container_t *container) {
-    if (!kme_hostname || !master_sae_id || !key_ids || !container) {
-        QKD_DBG_ERR("Invalid parameters in GET_KEY_WITH_IDS");
+    return qkd_014_ctx_get_key_with_ids(default_context(), kme_hostname,
+                                        master_sae_id, key_ids, container);
+}
+
+/*
+ * Deferred completion used when the backend has no asynchronous interface:
+ * the blocking call runs at submission and its result is queued until the
+ * next qkd_014_async_perform().
+ */
+struct deferred_completion {
+    uint32_t result;
+    qkd_014_callback_t callback;
+    void *user_data;
+    struct deferred_completion *next;
+};
+
+struct qkd_014_async {
+    const struct qkd_014_backend *backend;
+    void *engine; /* Backend engine, NULL when emulated */
+    int event_fd;
+    struct deferred_completion *head;
+    struct deferred_completion *tail;
+    size_t pending;
+};
+
+static bool has_async_interface(const struct qkd_014_backend *backend) {
+    return backend->async_create && backend->async_destroy &&
+           backend->async_fd && backend->async_perform &&
+           backend->get_status_async && backend->get_key_async &&
+           backend->get_key_with_ids_async;
+}
+
+qkd_014_async_t *qkd_014_async_create(void) {
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    if (!backend) {
+        QKD_DBG_ERR("No REST backend available");
+        return NULL;
+    }
+
+    qkd_014_async_t *async = calloc(1, sizeof(*async));
+    if (!async)
+        return NULL;
+    async->backend = backend;
+    async->event_fd = -1;
+
+    if (has_async_interface(backend)) {
+        async->engine = backend->async_create();
+        if (!async->engine) {
+            free(async);
+            return NULL;
+        }
+        return async;
+    }
+
+    async->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (async->event_fd < 0) {
+        free(async);
+        return NULL;
+    }
+    return async;
+}
+
+void qkd_014_async_destroy(qkd_014_async_t *async) {
+    if (!async)
+        return;
+
+    if (async->engine)
+        async->backend->async_destroy(async->engine);
+    while (async->head) {
+        struct deferred_completion *completion = async->head;
+        async->head = completion->next;
+        free(completion);
+    }
+    if (async->event_fd >= 0)
+        close(async->event_fd);
+    free(async);
+}
+
+int qkd_014_async_fd(const qkd_014_async_t *async) {
+    if (!async)
+        return -1;
+    return async->engine ? async->backend->async_fd(async->engine)
+                         : async->event_fd;
+}
+
+int qkd_014_async_perform(qkd_014_async_t *async, int timeout_ms) {
+    if (!async)
+        return -1;
+    if (async->engine)
+        return async->backend->async_perform(async->engine, timeout_ms);
+    if (async->pending == 0)
+        return 0;
+
+    uint64_t counter;
+    if (read(async->event_fd, &counter, sizeof(counter)) < 0 &&
+        errno != EAGAIN)
+        return -1;
+
+    /* Callbacks may submit new requests, which run on the next call. */
+    struct deferred_completion *completion = async->head;
+    async->head = NULL;
+    async->tail = NULL;
+    while (completion) {
+        struct deferred_completion *next = completion->next;
+        async->pending--;
+        completion->callback(completion->result, completion->user_data);
+        free(completion);
+        completion = next;
+    }
+    return (int)async->pending;
+}
+
+/*
+ * Queues the callback of a request the blocking backend call has already
+ * completed. If that fails the request is rejected, so release drops the
+ * output the call filled in before no callback follows.
+ */
+static uint32_t defer_completion(qkd_014_async_t *async, uint32_t result,
+                                 qkd_014_callback_t callback, void *user_data,
+                                 void (*release)(void *output),
+                                 void *output) {
+    struct deferred_completion *completion = malloc(sizeof(*completion));
+    if (!completion) {
+        QKD_DBG_ERR("Failed to queue async completion");
+        release(output);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+
+    completion->result = result;
+    completion->callback = callback;
+    completion->user_data = user_data;
+    completion->next = NULL;
+    if (async->tail)
+        async->tail->next = completion;
+    else
+        async->head = completion;
+    async->tail = completion;
+    async->pending++;
+
+    uint64_t increment = 1;
+    if (write(async->event_fd, &increment, sizeof(increment)) < 0) {
+        QKD_DBG_WARN("Failed to signal async completion");
+    }
+    return QKD_STATUS_OK;
+}
+
+static void release_status(void *status) { qkd_status_free(status); }
+
+static void release_container(void *container) {
+    qkd_key_container_free(container);
+}
+
+uint32_t GET_STATUS_ASYNC(qkd_014_async_t *async, const char *kme_hostname,
+                          const char *slave_sae_id, qkd_status_t *status,
+                          qkd_014_callback_t callback, void *user_data) {
+    if (!async || !kme_hostname || !slave_sae_id || !status || !callback) {
+        QKD_DBG_ERR("Invalid parameters in GET_STATUS_ASYNC");
         return QKD_STATUS_BAD_REQUEST;
     }
+    if (!async->backend->get_status) {
+        QKD_DBG_ERR("No REST backend available");
+        return QKD_STATUS_SERVER_ERROR;
+    }
+
+    if (async->engine)
+        return async->backend->get_status_async(async->engine, kme_hostname,
+                                                slave_sae_id, status, callback,
+                                                user_data);
+    uint32_t result =
+        async->backend->get_status(kme_hostname, slave_sae_id, status);
+    return defer_completion(async, result, callback, user_data, release_status,
+                            status);
+}
+
+uint32_t GET_KEY_ASYNC(qkd_014_async_t *async, const char *kme_hostname,
+                       const char *slave_sae_id, qkd_key_request_t *request,
+                       qkd_key_container_t *container,
+                       qkd_014_callback_t callback, void *user_data) {
+    if (!async || !kme_hostname || !slave_sae_id || !container || !callback) {
+        QKD_DBG_ERR("Invalid parameters in GET_KEY_ASYNC");
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    if (!async->backend->get_key) {
+        QKD_DBG_ERR("No REST backend available");
+        return QKD_STATUS_SERVER_ERROR;
+    }
 
-    if (!active_backend || !active_backend->get_key_with_ids) {
+    if (async->engine)
+        return async->backend->get_key_async(async->engine, kme_hostname,
+                                             slave_sae_id, request, container,
+                                             callback, user_data);
+    uint32_t result = async->backend->get_key(kme_hostname, slave_sae_id,
+                                              request, container);
+    return defer_completion(async, result, callback, user_data,
+                            release_container, container);
+}
+
+uint32_t GET_KEY_WITH_IDS_ASYNC(qkd_014_async_t *async,
+                                const char *kme_hostname,
+                                const char *master_sae_id,
+                                qkd_key_ids_t *key_ids,
+                                qkd_key_container_t *container,
+                                qkd_014_callback_t callback, void *user_data) {
+    if (!async || !kme_hostname || !master_sae_id || !key_ids || !container ||
+        !callback) {
+        QKD_DBG_ERR("Invalid parameters in GET_KEY_WITH_IDS_ASYNC");
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    if (!async->backend->get_key_with_ids) {
         QKD_DBG_ERR("No REST backend available");
         return QKD_STATUS_SERVER_ERROR;
     }
 
-    return active_backend->get_key_with_ids(kme_hostname, master_sae_id,
-                                            key_ids, container);
+    if (async->engine)
+        return async->backend->get_key_with_ids_async(
+            async->engine, kme_hostname, master_sae_id, key_ids, container,
+            callback, user_data);
+    uint32_t result = async->backend->get_key_with_ids(
+        kme_hostname, master_sae_id, key_ids, container);
+    return defer_completion(async, result, callback, user_data,
+                            release_container, container);
 }
 
 void qkd_status_free(qkd_status_t *status) {
@@ -101,13 +528,17 @@ void qkd_key_container_free(qkd_key_container_t *container) {
     if (!container)
         return;
 
-    for (int32_t i = 0; container->keys && i < container->key_count; i++) {
-        free(container->keys[i].key_ID);
-        if (container->keys[i].key)
-            OPENSSL_cleanse(container->keys[i].key,
-                            strlen(container->keys[i].key));
-        free(container->keys[i].key);
+    uint32_t flags = container->flags;
+    if (container->arena) {
+        qkd_key_arena_free(container->arena, flags);
+    } else {
+        for (int32_t i = 0; container->keys && i < container->key_count;
+             i++) {
+            qkd_secure_free(container->keys[i].key_ID);
+            qkd_secure_free(container->keys[i].key);
+        }
+        free(container->keys);
     }
-    free(container->keys);
     memset(container, 0, sizeof(*container));
+    container->flags = flags;
 }
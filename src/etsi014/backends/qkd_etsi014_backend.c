@@ -8,20 +8,32 @@
  * - Daniel Sobral Blanco (@dasobral) - UC3M
  */
 
-#include <ctype.h>
 #include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <jansson.h>
 #include <limits.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "etsi014/api.h"
 #include "etsi014/backends/qkd_etsi014_backend.h"
+#include "etsi014/key_stream_parser.h"
+#include "qkd_metrics.h"
+#include "qkd_secure_alloc.h"
 
 #ifdef QKD_USE_ETSI014_BACKEND
 
@@ -30,55 +42,702 @@
 #define CONNECT_TIMEOUT_SECONDS 10L
 #define REQUEST_TIMEOUT_SECONDS 30L
 #define MAX_RESPONSE_SIZE (16U * 1024U * 1024U)
+#define MAX_PEM_SIZE (1024U * 1024U)
+#define DEFAULT_POOL_SIZE 8UL
+#define MAX_POOL_SIZE 256UL
+#define DEFAULT_IDLE_TIMEOUT_SECONDS 60UL
+#define MAX_IDLE_TIMEOUT_SECONDS 3600UL
+#define MAX_ENDPOINTS 8U
+#define LATENCY_SAMPLES 128U
+#define HEDGE_UPDATE_INTERVAL 16U
+#define DEFAULT_FAILURE_THRESHOLD 3UL
+#define MAX_FAILURE_THRESHOLD 1000UL
+#define DEFAULT_RETRY_SECONDS 5UL
+#define MAX_RETRY_SECONDS 3600UL
+#define MAX_HEDGE_DELAY_MS 600000UL
+#define ADAPTIVE_HEDGE_DELAY ULONG_MAX
 
-struct memory_buffer {
+/*
+ * Body of a KME response. Key responses are parsed as they arrive; other
+ * responses, and key responses that are recorded, are collected in data.
+ */
+struct response_body {
     char *data;
     size_t size;
+    struct qkd_key_stream_parser *keys;
+    uint64_t parse_ns; /* Time spent parsing keys as they arrived */
 };
 
-int init_cert_config(int role, etsi014_cert_config_t *config) {
-    if (!config || (role != 0 && role != 1))
-        return QKD_STATUS_BAD_REQUEST;
+/*
+ * Reusable easy handles. Each handle has its own multi handle, whose
+ * connection cache retains the TCP connection and TLS session to the KME the
+ * handle last talked to. Handles are keyed by KME hostname and the
+ * certificate triple so that a connection authenticated with one SAE's
+ * credentials is never reused for another.
+ */
+struct pooled_handle {
+    CURL *curl;
+    CURLM *multi; /* Created on first use */
+    char *pool_key;
+    uint64_t last_used_ms;
+    bool in_use;
+};
 
-    const char *cert_path = role == 1 ? getenv("QKD_MASTER_CERT_PATH")
-                                      : getenv("QKD_SLAVE_CERT_PATH");
-    const char *key_path = role == 1 ? getenv("QKD_MASTER_KEY_PATH")
-                                     : getenv("QKD_SLAVE_KEY_PATH");
-    const char *ca_cert_path = role == 1 ? getenv("QKD_MASTER_CA_CERT_PATH")
-                                         : getenv("QKD_SLAVE_CA_CERT_PATH");
+struct connection_pool {
+    pthread_mutex_t lock;
+    struct pooled_handle *handles;
+    size_t size;
+    uint64_t idle_timeout_ms;
+    bool initialized;
+};
+
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+static bool curl_ready;
+
+/*
+ * Certificate, private key and CA bundle of one role, read once and handed
+ * to libcurl as in-memory blobs. libcurl compares blobs when matching
+ * connections for reuse, so connections authenticated with different
+ * credentials are never mixed up.
+ */
+struct qkd_tls_credentials {
+    char *cert_path;
+    char *key_path;
+    char *ca_cert_path;
+    struct curl_blob certificate;
+    struct curl_blob private_key; /* In locked memory */
+    struct curl_blob ca_certificates;
+    size_t private_key_region_size;
+    bool loaded; /* Otherwise libcurl reads the files itself */
+};
+
+/*
+ * Endpoint sets. A KME hostname may list redundant KMEs separated by commas,
+ * such as "https://kme1:443,https://kme2:443". Each request goes to the
+ * endpoint with the fewest requests in flight. An endpoint that fails
+ * QKD_KME_FAILURE_THRESHOLD requests in a row, with a transport error or a 5xx
+ * response, is skipped for QKD_KME_RETRY_SECONDS, after which a single request
+ * probes it again. Requests that fail are retried on the next endpoint.
+ * Blocking requests are also hedged when still pending after the p99 latency
+ * of their endpoint over its last LATENCY_SAMPLES requests, or after
+ * QKD_KME_HEDGE_DELAY_MS: the same request goes to a second endpoint and the
+ * first good response wins.
+ *
+ * Only GET_STATUS and GET_KEY_WITH_IDS may be sent twice. Each GET_KEY that
+ * reaches a KME hands out new keys, which are lost when another response
+ * wins, so GET_KEY is never hedged and fails over only when it could not
+ * have been sent: when resolving, connecting or the TLS handshake failed.
+ */
+struct kme_endpoint {
+    char *hostname;
+    unsigned int outstanding; /* Requests in flight */
+    unsigned long failures;   /* Consecutive failed requests */
+    uint64_t retry_at_ms;     /* When a failing endpoint may be probed */
+    bool probing;
+    uint32_t latencies_us[LATENCY_SAMPLES]; /* Recent good requests */
+    size_t latency_count;
+    uint64_t hedge_us; /* p99 of latencies_us, 0 until there are enough */
+    struct kme_endpoint *next;
+};
+
+struct endpoint_registry {
+    pthread_mutex_t lock;
+    struct kme_endpoint *endpoints;
+    unsigned long failure_threshold;
+    uint64_t retry_ms;
+    unsigned long hedge_delay_ms;
+    unsigned int rotation; /* Spreads ties between endpoints */
+    bool initialized;
+};
+
+/* Endpoints named by one hostname; a single KME has no shared state. */
+struct endpoint_set {
+    const char *hostname;
+    struct kme_endpoint *endpoints[MAX_ENDPOINTS];
+    size_t count;
+};
+
+enum endpoint_outcome { ENDPOINT_GOOD, ENDPOINT_FAILED, ENDPOINT_CANCELLED };
+
+/*
+ * State of one context: its connection pool, endpoints and credentials.
+ * Paths left NULL in the context configuration are read from the
+ * environment. The plain backend functions use default_instance.
+ */
+struct https_instance {
+    struct connection_pool pool;
+    struct endpoint_registry endpoints;
+    pthread_mutex_t credentials_lock;
+    struct qkd_tls_credentials *credentials[2];
+    char *paths[2][3]; /* Certificate, key and CA paths of each role */
+};
+
+static struct https_instance default_instance = {
+    .pool = {.lock = PTHREAD_MUTEX_INITIALIZER},
+    .endpoints = {.lock = PTHREAD_MUTEX_INITIALIZER},
+    .credentials_lock = PTHREAD_MUTEX_INITIALIZER};
+
+static bool read_pem_file(const char *path, struct curl_blob *blob,
+                          size_t *locked_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    bool read = false;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        size = ftell(file);
+    if (size > 0 && size <= (long)MAX_PEM_SIZE &&
+        fseek(file, 0, SEEK_SET) == 0) {
+        size_t region_size = (size_t)size;
+        void *data = locked_size ? qkd_locked_alloc(&region_size)
+                                 : malloc((size_t)size);
+        if (data && fread(data, 1, (size_t)size, file) == (size_t)size) {
+            blob->data = data;
+            blob->len = (size_t)size;
+            blob->flags = CURL_BLOB_NOCOPY;
+            if (locked_size)
+                *locked_size = region_size;
+            read = true;
+        } else if (data && locked_size) {
+            qkd_locked_free(data, region_size);
+        } else {
+            free(data);
+        }
+    }
+    fclose(file);
+    return read;
+}
+
+static void free_credentials(struct qkd_tls_credentials *loaded) {
+    if (!loaded)
+        return;
+    free(loaded->cert_path);
+    free(loaded->key_path);
+    free(loaded->ca_cert_path);
+    free(loaded->certificate.data);
+    qkd_locked_free(loaded->private_key.data,
+                    loaded->private_key_region_size);
+    free(loaded->ca_certificates.data);
+    free(loaded);
+}
+
+static const char *credential_path(const struct https_instance *instance,
+                                   int role, int index) {
+    static const char *const variables[2][3] = {
+        {"QKD_SLAVE_CERT_PATH", "QKD_SLAVE_KEY_PATH", "QKD_SLAVE_CA_CERT_PATH"},
+        {"QKD_MASTER_CERT_PATH", "QKD_MASTER_KEY_PATH",
+         "QKD_MASTER_CA_CERT_PATH"}};
+
+    if (instance->paths[role][index])
+        return instance->paths[role][index];
+    return getenv(variables[role][index]);
+}
+
+static struct qkd_tls_credentials *
+load_credentials(const struct https_instance *instance, int role) {
+    const char *cert_path = credential_path(instance, role, 0);
+    const char *key_path = credential_path(instance, role, 1);
+    const char *ca_cert_path = credential_path(instance, role, 2);
 
     if (!cert_path || !key_path || !ca_cert_path) {
-        QKD_DBG_ERR("Required %s certificate environment variables not set",
+        QKD_DBG_ERR("Required %s certificate paths not set",
                     role == 1 ? "QKD_MASTER" : "QKD_SLAVE");
-        return QKD_STATUS_BAD_REQUEST;
+        return NULL;
+    }
+
+    struct qkd_tls_credentials *loaded = calloc(1, sizeof(*loaded));
+    if (!loaded)
+        return NULL;
+    loaded->cert_path = strdup(cert_path);
+    loaded->key_path = strdup(key_path);
+    loaded->ca_cert_path = strdup(ca_cert_path);
+    if (!loaded->cert_path || !loaded->key_path || !loaded->ca_cert_path) {
+        free_credentials(loaded);
+        return NULL;
+    }
+
+    /* Unreadable files are left to libcurl, which reports the error. */
+    loaded->loaded =
+        read_pem_file(cert_path, &loaded->certificate, NULL) &&
+        read_pem_file(key_path, &loaded->private_key,
+                      &loaded->private_key_region_size) &&
+        read_pem_file(ca_cert_path, &loaded->ca_certificates, NULL);
+    if (!loaded->loaded) {
+        QKD_DBG_WARN("Could not preload %s credentials",
+                     role == 1 ? "QKD_MASTER" : "QKD_SLAVE");
     }
+    return loaded;
+}
+
+static int get_cert_config(struct https_instance *instance, int role,
+                           etsi014_cert_config_t *config) {
+    if (!config || (role != 0 && role != 1))
+        return QKD_STATUS_BAD_REQUEST;
 
-    config->cert_path = cert_path;
-    config->key_path = key_path;
-    config->ca_cert_path = ca_cert_path;
+    pthread_mutex_lock(&instance->credentials_lock);
+    if (!instance->credentials[role])
+        instance->credentials[role] = load_credentials(instance, role);
+    const struct qkd_tls_credentials *loaded = instance->credentials[role];
+    pthread_mutex_unlock(&instance->credentials_lock);
+    if (!loaded)
+        return QKD_STATUS_BAD_REQUEST;
+
+    config->cert_path = loaded->cert_path;
+    config->key_path = loaded->key_path;
+    config->ca_cert_path = loaded->ca_cert_path;
+    config->credentials = loaded;
     return QKD_STATUS_OK;
 }
 
-static size_t write_memory_callback(void *contents, size_t size, size_t nmemb,
-                                    void *user_data) {
-    struct memory_buffer *buffer = user_data;
+int init_cert_config(int role, etsi014_cert_config_t *config) {
+    return get_cert_config(&default_instance, role, config);
+}
+
+static void release_credentials(struct https_instance *instance) {
+    pthread_mutex_lock(&instance->credentials_lock);
+    for (size_t i = 0; i < 2; i++) {
+        free_credentials(instance->credentials[i]);
+        instance->credentials[i] = NULL;
+    }
+    pthread_mutex_unlock(&instance->credentials_lock);
+}
+
+void qkd_etsi014_credentials_cleanup(void) {
+    release_credentials(&default_instance);
+}
+
+static void initialize_curl(void) {
+    curl_ready = curl_global_init(CURL_GLOBAL_DEFAULT) == CURLE_OK;
+}
+
+static uint64_t get_current_time_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static unsigned long read_env_limit(const char *name, unsigned long fallback,
+                                    unsigned long maximum) {
+    const char *value = getenv(name);
+    if (!value || value[0] == '\0')
+        return fallback;
+
+    char *end = NULL;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (*end != '\0' || value[0] == '-' || parsed > maximum) {
+        QKD_DBG_WARN("Ignoring invalid %s value: %s", name, value);
+        return fallback;
+    }
+    return parsed;
+}
+
+/* Called with pool->lock held. */
+static bool initialize_pool(struct connection_pool *pool) {
+    if (pool->initialized)
+        return true;
+
+    size_t size = read_env_limit("QKD_CONNECTION_POOL_SIZE", DEFAULT_POOL_SIZE,
+                                 MAX_POOL_SIZE);
+    unsigned long idle_timeout =
+        read_env_limit("QKD_CONNECTION_IDLE_TIMEOUT",
+                       DEFAULT_IDLE_TIMEOUT_SECONDS, MAX_IDLE_TIMEOUT_SECONDS);
+
+    if (size > 0) {
+        pool->handles = calloc(size, sizeof(*pool->handles));
+        if (!pool->handles)
+            return false;
+    }
+    pool->size = size;
+    pool->idle_timeout_ms = (uint64_t)idle_timeout * 1000U;
+    pool->initialized = true;
+    QKD_DBG_INFO("Connection pool: %zu handles, %lu s idle timeout", size,
+                 idle_timeout);
+    return true;
+}
+
+static void discard_pooled_handle(struct pooled_handle *handle) {
+    if (handle->multi)
+        curl_multi_cleanup(handle->multi);
+    curl_easy_cleanup(handle->curl);
+    free(handle->pool_key);
+    memset(handle, 0, sizeof(*handle));
+}
+
+static char *build_pool_key(const char *kme_hostname,
+                            const etsi014_cert_config_t *cert_config) {
+    int length = snprintf(NULL, 0, "%s\n%s\n%s\n%s", kme_hostname,
+                          cert_config->cert_path, cert_config->key_path,
+                          cert_config->ca_cert_path);
+    if (length < 0)
+        return NULL;
+
+    char *key = malloc((size_t)length + 1U);
+    if (key)
+        snprintf(key, (size_t)length + 1U, "%s\n%s\n%s\n%s", kme_hostname,
+                 cert_config->cert_path, cert_config->key_path,
+                 cert_config->ca_cert_path);
+    return key;
+}
+
+/*
+ * Returns an easy handle for the given pool key. *slot is set to the pool
+ * entry owning the handle, or NULL when the pool is disabled or exhausted and
+ * the caller received a temporary handle.
+ */
+static CURL *acquire_handle(struct connection_pool *pool, const char *pool_key,
+                            struct pooled_handle **slot) {
+    *slot = NULL;
+    pthread_once(&curl_once, initialize_curl);
+    if (!curl_ready)
+        return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (!initialize_pool(pool)) {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    uint64_t now = get_current_time_ms();
+    struct pooled_handle *empty = NULL;
+    struct pooled_handle *oldest = NULL;
+    for (size_t i = 0; i < pool->size; i++) {
+        struct pooled_handle *handle = &pool->handles[i];
+        if (handle->in_use)
+            continue;
+        if (handle->curl && now - handle->last_used_ms >= pool->idle_timeout_ms)
+            discard_pooled_handle(handle);
+        if (!handle->curl) {
+            if (!empty)
+                empty = handle;
+            continue;
+        }
+        if (strcmp(handle->pool_key, pool_key) == 0) {
+            handle->in_use = true;
+            *slot = handle;
+            pthread_mutex_unlock(&pool->lock);
+            return handle->curl;
+        }
+        if (!oldest || handle->last_used_ms < oldest->last_used_ms)
+            oldest = handle;
+    }
+
+    struct pooled_handle *target = empty ? empty : oldest;
+    if (target) {
+        if (target->curl)
+            discard_pooled_handle(target);
+        target->pool_key = strdup(pool_key);
+        target->curl = target->pool_key ? curl_easy_init() : NULL;
+        if (!target->curl) {
+            discard_pooled_handle(target);
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        target->in_use = true;
+        *slot = target;
+        pthread_mutex_unlock(&pool->lock);
+        return target->curl;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    QKD_DBG_VERB("Connection pool exhausted, using a temporary handle");
+    return curl_easy_init();
+}
+
+static void release_handle(struct connection_pool *pool, CURL *curl,
+                           struct pooled_handle *slot, bool reusable) {
+    if (!slot) {
+        curl_easy_cleanup(curl);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (reusable) {
+        slot->last_used_ms = get_current_time_ms();
+        slot->in_use = false;
+    } else {
+        discard_pooled_handle(slot);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void close_idle_handles(struct connection_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < pool->size; i++) {
+        if (!pool->handles[i].in_use)
+            discard_pooled_handle(&pool->handles[i]);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void qkd_etsi014_connection_pool_cleanup(void) {
+    close_idle_handles(&default_instance.pool);
+}
+
+/* Called with registry->lock held. */
+static void initialize_registry(struct endpoint_registry *registry) {
+    if (registry->initialized)
+        return;
+
+    registry->failure_threshold =
+        read_env_limit("QKD_KME_FAILURE_THRESHOLD", DEFAULT_FAILURE_THRESHOLD,
+                       MAX_FAILURE_THRESHOLD);
+    if (registry->failure_threshold == 0)
+        registry->failure_threshold = 1;
+    registry->retry_ms = (uint64_t)read_env_limit("QKD_KME_RETRY_SECONDS",
+                                                  DEFAULT_RETRY_SECONDS,
+                                                  MAX_RETRY_SECONDS) *
+                         1000U;
+    registry->hedge_delay_ms = read_env_limit(
+        "QKD_KME_HEDGE_DELAY_MS", ADAPTIVE_HEDGE_DELAY, MAX_HEDGE_DELAY_MS);
+    registry->initialized = true;
+}
+
+/* Called with registry->lock held. */
+static struct kme_endpoint *find_endpoint(struct endpoint_registry *registry,
+                                          const char *hostname,
+                                          size_t length) {
+    struct kme_endpoint *endpoint;
+    for (endpoint = registry->endpoints; endpoint; endpoint = endpoint->next) {
+        if (strncmp(endpoint->hostname, hostname, length) == 0 &&
+            endpoint->hostname[length] == '\0')
+            return endpoint;
+    }
+
+    endpoint = calloc(1, sizeof(*endpoint));
+    if (!endpoint)
+        return NULL;
+    endpoint->hostname = strndup(hostname, length);
+    if (!endpoint->hostname) {
+        free(endpoint);
+        return NULL;
+    }
+    endpoint->next = registry->endpoints;
+    registry->endpoints = endpoint;
+    return endpoint;
+}
+
+/*
+ * Splits a comma-separated hostname into its endpoints. Returns false when
+ * the list has an empty or non-HTTPS entry or more than MAX_ENDPOINTS.
+ */
+static bool resolve_endpoints(struct endpoint_registry *registry,
+                              const char *kme_hostname,
+                              struct endpoint_set *set) {
+    memset(set, 0, sizeof(*set));
+    set->hostname = kme_hostname;
+    if (!strchr(kme_hostname, ',')) {
+        set->count = 1;
+        return true;
+    }
+
+    bool valid = true;
+    pthread_mutex_lock(&registry->lock);
+    initialize_registry(registry);
+    for (const char *entry = kme_hostname; valid && entry;) {
+        const char *comma = strchr(entry, ',');
+        size_t length = comma ? (size_t)(comma - entry) : strlen(entry);
+        while (length > 0 && (*entry == ' ' || *entry == '\t')) {
+            entry++;
+            length--;
+        }
+        while (length > 0 && (entry[length - 1] == ' ' ||
+                              entry[length - 1] == '\t'))
+            length--;
+        valid = length > sizeof("https://") - 1U &&
+                strncmp(entry, "https://", sizeof("https://") - 1U) == 0;
+
+        struct kme_endpoint *endpoint =
+            valid ? find_endpoint(registry, entry, length) : NULL;
+        bool duplicate = false;
+        for (size_t i = 0; endpoint && i < set->count; i++)
+            duplicate = duplicate || set->endpoints[i] == endpoint;
+        if (!endpoint || (!duplicate && set->count == MAX_ENDPOINTS)) {
+            valid = false;
+        } else if (!duplicate) {
+            set->endpoints[set->count++] = endpoint;
+        }
+        entry = comma ? comma + 1 : NULL;
+    }
+    pthread_mutex_unlock(&registry->lock);
+
+    if (!valid) {
+        QKD_DBG_ERR("Invalid KME endpoint list: %s", kme_hostname);
+    }
+    return valid;
+}
+
+static const char *endpoint_hostname(const struct endpoint_set *set,
+                                     size_t index) {
+    return set->endpoints[index] ? set->endpoints[index]->hostname
+                                 : set->hostname;
+}
+
+/* Whether a request that failed with result may go to another endpoint. */
+static bool may_resend(enum qkd_metrics_op op, CURLcode result) {
+    if (op != QKD_METRICS_014_GET_KEY)
+        return true;
+    return result == CURLE_COULDNT_RESOLVE_PROXY ||
+           result == CURLE_COULDNT_RESOLVE_HOST ||
+           result == CURLE_COULDNT_CONNECT ||
+           result == CURLE_SSL_CONNECT_ERROR;
+}
+
+/*
+ * Picks the endpoint for a request among those whose bit is not set in
+ * tried, and counts the request as in flight. Failing endpoints are only
+ * picked for a probe once their retry time has passed, or for the first
+ * try of a request when every endpoint is failing. *is_probe is set when
+ * the request is the probe of a failing endpoint, which must be passed to
+ * finish_endpoint(). *hedge_us is set to how long to wait before hedging, or
+ * 0 to not hedge. Returns -1 when no endpoint is left.
+ */
+static int choose_endpoint(struct endpoint_registry *registry,
+                           const struct endpoint_set *set, unsigned int tried,
+                           bool *is_probe, uint64_t *hedge_us) {
+    *is_probe = false;
+    *hedge_us = 0;
+    if (!set->endpoints[0])
+        return tried & 1U ? -1 : 0;
+
+    pthread_mutex_lock(&registry->lock);
+    uint64_t now = get_current_time_ms();
+    unsigned int start = registry->rotation++;
+    int best = -1;
+    bool best_usable = false;
+    for (size_t offset = 0; offset < set->count; offset++) {
+        size_t i = (start + offset) % set->count;
+        const struct kme_endpoint *endpoint = set->endpoints[i];
+        if (tried & (1U << i))
+            continue;
+        bool usable = endpoint->failures < registry->failure_threshold ||
+                      (now >= endpoint->retry_at_ms && !endpoint->probing);
+        if (!usable && tried)
+            continue;
+
+        const struct kme_endpoint *current =
+            best < 0 ? NULL : set->endpoints[best];
+        if (!current || (usable && !best_usable) ||
+            (usable == best_usable && usable &&
+             endpoint->outstanding < current->outstanding) ||
+            (!usable && !best_usable &&
+             endpoint->retry_at_ms < current->retry_at_ms)) {
+            best = (int)i;
+            best_usable = usable;
+        }
+    }
+
+    if (best >= 0) {
+        struct kme_endpoint *endpoint = set->endpoints[best];
+        endpoint->outstanding++;
+        if (endpoint->failures >= registry->failure_threshold &&
+            !endpoint->probing) {
+            endpoint->probing = true;
+            *is_probe = true;
+        }
+        if (registry->hedge_delay_ms == ADAPTIVE_HEDGE_DELAY)
+            *hedge_us = endpoint->hedge_us;
+        else
+            *hedge_us = (uint64_t)registry->hedge_delay_ms * 1000U;
+    }
+    pthread_mutex_unlock(&registry->lock);
+    return best;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint32_t first = *(const uint32_t *)a;
+    uint32_t second = *(const uint32_t *)b;
+    return (first > second) - (first < second);
+}
+
+/* Ends a request counted by choose_endpoint(). */
+static void finish_endpoint(struct endpoint_registry *registry,
+                            struct kme_endpoint *endpoint, bool is_probe,
+                            enum endpoint_outcome outcome,
+                            uint64_t elapsed_ns) {
+    if (!endpoint)
+        return;
+
+    pthread_mutex_lock(&registry->lock);
+    endpoint->outstanding--;
+    if (is_probe)
+        endpoint->probing = false;
+    if (outcome == ENDPOINT_GOOD) {
+        endpoint->failures = 0;
+        uint64_t elapsed_us = elapsed_ns / 1000U;
+        endpoint->latencies_us[endpoint->latency_count % LATENCY_SAMPLES] =
+            elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+        endpoint->latency_count++;
+        if (endpoint->latency_count >= LATENCY_SAMPLES &&
+            endpoint->latency_count % HEDGE_UPDATE_INTERVAL == 0) {
+            uint32_t sorted[LATENCY_SAMPLES];
+            memcpy(sorted, endpoint->latencies_us, sizeof(sorted));
+            qsort(sorted, LATENCY_SAMPLES, sizeof(sorted[0]),
+                  compare_latencies);
+            endpoint->hedge_us = sorted[(LATENCY_SAMPLES * 99U + 99U) / 100U -
+                                        1U];
+        }
+    } else if (outcome == ENDPOINT_FAILED) {
+        endpoint->failures++;
+        if (endpoint->failures >= registry->failure_threshold) {
+            if (endpoint->failures == registry->failure_threshold) {
+                QKD_DBG_WARN("KME %s is failing, retrying in %" PRIu64 " ms",
+                             endpoint->hostname, registry->retry_ms);
+            }
+            endpoint->retry_at_ms = get_current_time_ms() + registry->retry_ms;
+        }
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+static void release_endpoints(struct endpoint_registry *registry) {
+    pthread_mutex_lock(&registry->lock);
+    while (registry->endpoints) {
+        struct kme_endpoint *endpoint = registry->endpoints;
+        registry->endpoints = endpoint->next;
+        free(endpoint->hostname);
+        free(endpoint);
+    }
+    pthread_mutex_unlock(&registry->lock);
+}
+
+static size_t write_response_callback(void *contents, size_t size,
+                                      size_t nmemb, void *user_data) {
+    struct response_body *body = user_data;
 
     if (nmemb != 0 && size > SIZE_MAX / nmemb)
         return 0;
     size_t received = size * nmemb;
-    if (received > SIZE_MAX - buffer->size - 1U)
+    if (received > SIZE_MAX - body->size - 1U)
         return 0;
-    if (received > MAX_RESPONSE_SIZE - buffer->size)
+    if (received > MAX_RESPONSE_SIZE - body->size)
         return 0;
 
-    char *new_data = realloc(buffer->data, buffer->size + received + 1U);
+    /*
+     * A body that is not a key container is still consumed, so that the HTTP
+     * status of error responses can be reported.
+     */
+    if (body->keys) {
+        uint64_t started = qkd_metrics_now();
+        qkd_key_stream_parser_feed(body->keys, contents, received);
+        body->parse_ns += qkd_metrics_now() - started;
+        /* Key responses are only kept raw when they are being recorded. */
+        if (!body->data) {
+            body->size += received;
+            return received;
+        }
+    }
+
+    char *new_data = realloc(body->data, body->size + received + 1U);
     if (!new_data)
         return 0;
 
-    buffer->data = new_data;
-    memcpy(buffer->data + buffer->size, contents, received);
-    buffer->size += received;
-    buffer->data[buffer->size] = '\0';
+    body->data = new_data;
+    memcpy(body->data + body->size, contents, received);
+    body->size += received;
+    body->data[body->size] = '\0';
     return received;
 }
 
@@ -99,50 +758,6 @@ static char *duplicate_json_string(json_t *root, const char *name) {
     return json_is_string(field) ? strdup(json_string_value(field)) : NULL;
 }
 
-static bool is_uuid_string(const char *value) {
-    if (!value || strlen(value) != 36)
-        return false;
-
-    for (size_t i = 0; i < 36; i++) {
-        if (i == 8 || i == 13 || i == 18 || i == 23) {
-            if (value[i] != '-')
-                return false;
-        } else if (!isxdigit((unsigned char)value[i])) {
-            return false;
-        }
-    }
-    return true;
-}
-
-static bool is_base64_string(const char *value) {
-    if (!value)
-        return false;
-
-    size_t length = strlen(value);
-    if (length == 0 || length % 4U != 0)
-        return false;
-
-    size_t padding = 0;
-    if (value[length - 1U] == '=')
-        padding++;
-    if (length > 1U && value[length - 2U] == '=')
-        padding++;
-
-    for (size_t i = 0; i < length - padding; i++) {
-        unsigned char character = (unsigned char)value[i];
-        bool alphanumeric = (character >= 'A' && character <= 'Z') ||
-                            (character >= 'a' && character <= 'z') ||
-                            (character >= '0' && character <= '9');
-        if (!alphanumeric && character != '+' && character != '/')
-            return false;
-    }
-    for (size_t i = length - padding; i < length; i++) {
-        if (value[i] != '=')
-            return false;
-    }
-    return true;
-}
-
 int parse_response_to_qkd_status(const char *response, qkd_status_t *status) {
     if (!response || !status)
         return -1;
@@ -189,52 +804,6 @@ int parse_response_to_qkd_status(const char *response, qkd_status_t *status) {
     return 0;
 }
 
-int parse_response_to_qkd_keys(const char *response,
-                               qkd_key_container_t *container) {
-    if (!response || !container)
-        return -1;
-
-    json_error_t error;
-    json_t *root = json_loads(response, JSON_REJECT_DUPLICATES, &error);
-    if (!json_is_object(root)) {
-        QKD_DBG_ERR("Error parsing keys JSON: %s", error.text);
-        json_decref(root);
-        return -1;
-    }
-
-    json_t *keys = json_object_get(root, "keys");
-    size_t key_count = json_is_array(keys) ? json_array_size(keys) : 0;
-    if (!json_is_array(keys) || key_count == 0 || key_count > MAX_KEYS ||
-        key_count > INT32_MAX) {
-        json_decref(root);
-        return -1;
-    }
-
-    qkd_key_container_t parsed = {0};
-    parsed.keys = calloc(key_count, sizeof(*parsed.keys));
-    parsed.key_count = (int32_t)key_count;
-    if (!parsed.keys) {
-        json_decref(root);
-        return -1;
-    }
-
-    for (size_t i = 0; i < key_count; i++) {
-        json_t *key_data = json_array_get(keys, i);
-        parsed.keys[i].key_ID = duplicate_json_string(key_data, "key_ID");
-        parsed.keys[i].key = duplicate_json_string(key_data, "key");
-        if (!is_uuid_string(parsed.keys[i].key_ID) ||
-            !is_base64_string(parsed.keys[i].key)) {
-            json_decref(root);
-            qkd_key_container_free(&parsed);
-            return -1;
-        }
-    }
-
-    json_decref(root);
-    *container = parsed;
-    return 0;
-}
-
 static char *build_post_data(const qkd_key_ids_t *key_ids,
                              const char *master_sae_id) {
     json_t *root = json_object();
@@ -325,64 +894,112 @@ static char *build_url(const char *hostname, const char *sae_id,
     return url;
 }
 
-static char *handle_request_https(const char *url, const char *post_data,
-                                  long *http_code,
-                                  const etsi014_cert_config_t *cert_config) {
-    if (!url || !http_code || !cert_config)
-        return NULL;
-
-    *http_code = 0;
-    struct memory_buffer response = {.data = malloc(1), .size = 0};
-    if (!response.data)
-        return NULL;
-    response.data[0] = '\0';
-
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        free(response.data);
-        return NULL;
-    }
-
+static struct curl_slist *build_json_headers(void) {
     struct curl_slist *headers =
         curl_slist_append(NULL, "Accept: application/json");
     struct curl_slist *new_headers =
         curl_slist_append(headers, "Content-Type: application/json");
     if (!headers || !new_headers) {
         curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(response.data);
         return NULL;
     }
-    headers = new_headers;
+    return new_headers;
+}
 
+static void configure_credentials(CURL *curl,
+                                  const etsi014_cert_config_t *cert_config) {
+    const struct qkd_tls_credentials *loaded = cert_config->credentials;
+    bool client_blobs = false;
+    bool ca_blob = false;
+
+#if LIBCURL_VERSION_NUM >= 0x074700
+    if (loaded && loaded->loaded) {
+        client_blobs = curl_easy_setopt(curl, CURLOPT_SSLCERT_BLOB,
+                                        &loaded->certificate) == CURLE_OK &&
+                       curl_easy_setopt(curl, CURLOPT_SSLKEY_BLOB,
+                                        &loaded->private_key) == CURLE_OK;
+#if LIBCURL_VERSION_NUM >= 0x074d00
+        ca_blob = curl_easy_setopt(curl, CURLOPT_CAINFO_BLOB,
+                                   &loaded->ca_certificates) == CURLE_OK;
+#endif
+    }
+#else
+    (void)loaded;
+#endif
+    if (client_blobs) {
+        curl_easy_setopt(curl, CURLOPT_SSLCERTTYPE, "PEM");
+        curl_easy_setopt(curl, CURLOPT_SSLKEYTYPE, "PEM");
+    } else {
+        curl_easy_setopt(curl, CURLOPT_SSLCERT, cert_config->cert_path);
+        curl_easy_setopt(curl, CURLOPT_SSLKEY, cert_config->key_path);
+    }
+    if (!ca_blob)
+        curl_easy_setopt(curl, CURLOPT_CAINFO, cert_config->ca_cert_path);
+}
+
+static void configure_request(CURL *curl, const char *url,
+                              const char *post_data,
+                              struct curl_slist *headers,
+                              struct response_body *response,
+                              const etsi014_cert_config_t *cert_config,
+                              long http_version, uint64_t idle_timeout_ms) {
     curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
-    curl_easy_setopt(curl, CURLOPT_SSLCERT, cert_config->cert_path);
-    curl_easy_setopt(curl, CURLOPT_SSLKEY, cert_config->key_path);
-    curl_easy_setopt(curl, CURLOPT_CAINFO, cert_config->ca_cert_path);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, http_version);
+    configure_credentials(curl, cert_config);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
     curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2);
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, CONNECT_TIMEOUT_SECONDS);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, REQUEST_TIMEOUT_SECONDS);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN,
+                     (long)(idle_timeout_ms / 1000U));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     if (post_data)
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+}
 
-    CURLcode result = curl_easy_perform(curl);
-    if (result == CURLE_OK)
-        result = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, http_code);
+/* URL and body of a validated request, shared by blocking and async calls. */
+struct kme_request {
+    char *url;
+    char *post_data;
+    int32_t key_count; /* Keys expected in the response */
+    int32_t key_size;  /* Their size in bits, 0 when unknown */
+    enum qkd_metrics_op op;
+};
 
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    if (result != CURLE_OK) {
-        QKD_DBG_ERR("HTTPS request failed: %s", curl_easy_strerror(result));
-        free(response.data);
-        return NULL;
+/*
+ * Records the connection, TLS and transfer phases of a completed transfer.
+ * curl reports them as times since the start; a reused connection has none.
+ */
+static void record_phases(CURL *curl, enum qkd_metrics_op op) {
+    long connects = 0;
+    curl_off_t connect_us = 0, tls_us = 0, total_us = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) !=
+            CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_us) !=
+            CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls_us) !=
+            CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_us) != CURLE_OK)
+        return;
+
+    curl_off_t connected_us = connect_us;
+    if (connects > 0) {
+        qkd_metrics_record(op, QKD_METRICS_CONNECT,
+                           (uint64_t)connect_us * 1000U);
+        if (tls_us > connect_us) {
+            qkd_metrics_record(op, QKD_METRICS_TLS,
+                               (uint64_t)(tls_us - connect_us) * 1000U);
+            connected_us = tls_us;
+        }
     }
-    return response.data;
+    if (total_us >= connected_us)
+        qkd_metrics_record(op, QKD_METRICS_TRANSFER,
+                           (uint64_t)(total_us - connected_us) * 1000U);
 }
 
 static uint32_t map_http_error(long http_code) {
@@ -393,8 +1010,8 @@ static uint32_t map_http_error(long http_code) {
     return QKD_STATUS_SERVER_ERROR;
 }
 
-static uint32_t handle_keys_response(char *response, long http_code,
-                                     qkd_key_container_t *container) {
+static uint32_t handle_status_response(char *response, long http_code,
+                                       qkd_status_t *status) {
     if (!response)
         return QKD_STATUS_SERVER_ERROR;
     if (http_code < 200 || http_code >= 300) {
@@ -402,39 +1019,250 @@ static uint32_t handle_keys_response(char *response, long http_code,
         return map_http_error(http_code);
     }
 
-    int parsed = parse_response_to_qkd_keys(response, container);
+    int parsed = parse_response_to_qkd_status(response, status);
     free(response);
     return parsed == 0 ? QKD_STATUS_OK : QKD_STATUS_SERVER_ERROR;
 }
 
-static uint32_t get_status(const char *kme_hostname, const char *slave_sae_id,
-                           qkd_status_t *status) {
-    etsi014_cert_config_t config;
-    if (init_cert_config(1, &config) != QKD_STATUS_OK)
-        return QKD_STATUS_BAD_REQUEST;
-
-    char *url = build_url(kme_hostname, slave_sae_id, "status");
-    if (!url)
-        return QKD_STATUS_SERVER_ERROR;
-
-    long http_code;
-    char *response = handle_request_https(url, NULL, &http_code, &config);
-    free(url);
-    if (!response)
+static uint32_t handle_keys_response(struct qkd_key_stream_parser *parser,
+                                     bool received, long http_code,
+                                     qkd_key_container_t *container) {
+    if (!received)
         return QKD_STATUS_SERVER_ERROR;
-    if (http_code < 200 || http_code >= 300) {
-        free(response);
+    if (http_code < 200 || http_code >= 300)
         return map_http_error(http_code);
+    return qkd_key_stream_parser_finish(parser, container)
+               ? QKD_STATUS_OK
+               : QKD_STATUS_SERVER_ERROR;
+}
+
+/*
+ * Recording and replay of KME responses. With QKD_KME_RECORD set, the HTTP
+ * status, duration and body of every response to a blocking call are
+ * appended to that file. With QKD_KME_REPLAY set, blocking calls are
+ * validated as usual but never reach the KME: each operation is answered
+ * with its recorded responses in turn, starting over after the last one,
+ * and the bodies go through the same parsing as when they are received.
+ * QKD_KME_REPLAY_TIMING=1 also delays each reply by its recorded duration.
+ * Both files hold key material. The variables are read on first use.
+ */
+#define RECORDING_OPS 3U /* GET_STATUS, GET_KEY and GET_KEY_WITH_IDS */
+#define REPLAY_CHUNK_SIZE 16384U /* What curl hands to write callbacks */
+
+static const char recording_magic[8] = "QKDKME1";
+
+/* Precedes each body in the file, in host byte order. */
+struct recorded_response {
+    uint32_t op; /* Offset from QKD_METRICS_014_GET_STATUS */
+    int32_t http_code;
+    uint64_t duration_ns;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+struct kme_recording {
+    pthread_mutex_t lock;
+    bool configured;
+    int record_fd;
+    bool replaying;
+    bool timing;
+    unsigned char *replay; /* The whole file, in locked memory */
+    size_t replay_size;
+    size_t *offsets[RECORDING_OPS]; /* Headers of each operation */
+    size_t counts[RECORDING_OPS];
+    size_t next[RECORDING_OPS];
+};
+
+static struct kme_recording recording = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                                         .record_fd = -1};
+
+static bool read_replay_file(struct kme_recording *state, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 ||
+        info.st_size < (off_t)sizeof(recording_magic)) {
+        if (fd >= 0)
+            close(fd);
+        return false;
     }
 
-    int parsed = parse_response_to_qkd_status(response, status);
-    free(response);
-    return parsed == 0 ? QKD_STATUS_OK : QKD_STATUS_SERVER_ERROR;
+    size_t size = (size_t)info.st_size;
+    state->replay_size = size;
+    state->replay = qkd_locked_alloc(&state->replay_size);
+    size_t done = 0;
+    while (state->replay && done < size) {
+        ssize_t count = read(fd, state->replay + done, size - done);
+        if (count <= 0)
+            break;
+        done += (size_t)count;
+    }
+    close(fd);
+    if (done != size ||
+        memcmp(state->replay, recording_magic, sizeof(recording_magic)) != 0)
+        return false;
+
+    /* Two passes over the records: count them, then index them. */
+    for (int pass = 0; pass < 2; pass++) {
+        size_t offset = sizeof(recording_magic);
+        while (offset < size) {
+            struct recorded_response header;
+            if (size - offset < sizeof(header))
+                return false;
+            memcpy(&header, state->replay + offset, sizeof(header));
+            if (header.op >= RECORDING_OPS ||
+                header.size > size - offset - sizeof(header))
+                return false;
+            if (pass == 0)
+                state->counts[header.op]++;
+            else
+                state->offsets[header.op][state->next[header.op]++] = offset;
+            offset += sizeof(header) + header.size;
+        }
+        if (pass == 1)
+            break;
+        for (size_t op = 0; op < RECORDING_OPS; op++) {
+            state->offsets[op] = calloc(state->counts[op] + 1U,
+                                        sizeof(*state->offsets[op]));
+            if (!state->offsets[op])
+                return false;
+        }
+    }
+    memset(state->next, 0, sizeof(state->next));
+    return true;
 }
 
-static uint32_t get_key(const char *kme_hostname, const char *slave_sae_id,
-                        qkd_key_request_t *request,
-                        qkd_key_container_t *container) {
+static void release_replay(struct kme_recording *state) {
+    qkd_locked_free(state->replay, state->replay_size);
+    state->replay = NULL;
+    state->replay_size = 0;
+    for (size_t op = 0; op < RECORDING_OPS; op++) {
+        free(state->offsets[op]);
+        state->offsets[op] = NULL;
+        state->counts[op] = 0;
+        state->next[op] = 0;
+    }
+}
+
+static int open_record_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (info.st_size == 0 &&
+        write(fd, recording_magic, sizeof(recording_magic)) !=
+            (ssize_t)sizeof(recording_magic)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Returns the recording state, reading the environment on first use. */
+static struct kme_recording *get_recording(void) {
+    struct kme_recording *state = &recording;
+    if (__atomic_load_n(&state->configured, __ATOMIC_ACQUIRE))
+        return state;
+
+    pthread_mutex_lock(&state->lock);
+    if (!state->configured) {
+        const char *record_path = getenv("QKD_KME_RECORD");
+        const char *replay_path = getenv("QKD_KME_REPLAY");
+        if (replay_path && replay_path[0] != '\0') {
+            /* A broken file fails every call rather than reach the KME. */
+            state->replaying = true;
+            state->timing = read_env_limit("QKD_KME_REPLAY_TIMING", 0, 1) == 1;
+            if (!read_replay_file(state, replay_path)) {
+                QKD_DBG_ERR("Cannot replay KME responses from %s",
+                            replay_path);
+                release_replay(state);
+            }
+        } else if (record_path && record_path[0] != '\0') {
+            state->record_fd = open_record_file(record_path);
+            if (state->record_fd < 0) {
+                QKD_DBG_ERR("Cannot record KME responses to %s: %s",
+                            record_path, strerror(errno));
+            }
+        }
+        __atomic_store_n(&state->configured, true, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&state->lock);
+    return state;
+}
+
+void qkd_etsi014_recording_cleanup(void) {
+    struct kme_recording *state = &recording;
+
+    pthread_mutex_lock(&state->lock);
+    if (state->record_fd >= 0)
+        close(state->record_fd);
+    state->record_fd = -1;
+    release_replay(state);
+    state->replaying = false;
+    state->timing = false;
+    __atomic_store_n(&state->configured, false, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&state->lock);
+}
+
+static void record_response(struct kme_recording *state,
+                            enum qkd_metrics_op op,
+                            const struct response_body *response,
+                            long http_code, uint64_t duration_ns) {
+    if (state->record_fd < 0 || !response->data ||
+        response->size > UINT32_MAX)
+        return;
+
+    struct recorded_response header = {
+        .op = (uint32_t)(op - QKD_METRICS_014_GET_STATUS),
+        .http_code = (int32_t)http_code,
+        .duration_ns = duration_ns,
+        .size = (uint32_t)response->size};
+    struct iovec parts[2] = {{&header, sizeof(header)},
+                             {response->data, response->size}};
+    pthread_mutex_lock(&state->lock);
+    ssize_t written = writev(state->record_fd, parts, 2);
+    pthread_mutex_unlock(&state->lock);
+    if (written != (ssize_t)(sizeof(header) + response->size)) {
+        QKD_DBG_WARN("Failed to record a KME response");
+    }
+}
+
+/* The next recorded response of op, or NULL when none was recorded. */
+static const unsigned char *
+next_recorded(struct kme_recording *state, enum qkd_metrics_op op,
+              struct recorded_response *header) {
+    size_t index = (size_t)(op - QKD_METRICS_014_GET_STATUS);
+    if (state->counts[index] == 0)
+        return NULL;
+
+    size_t turn = __atomic_fetch_add(&state->next[index], 1, __ATOMIC_RELAXED);
+    size_t offset = state->offsets[index][turn % state->counts[index]];
+    memcpy(header, state->replay + offset, sizeof(*header));
+    return state->replay + offset + sizeof(*header);
+}
+
+static void kme_request_free(struct kme_request *request) {
+    free(request->url);
+    free(request->post_data);
+    memset(request, 0, sizeof(*request));
+}
+
+static uint32_t prepare_status_request(const char *kme_hostname,
+                                       const char *slave_sae_id,
+                                       struct kme_request *prepared) {
+    memset(prepared, 0, sizeof(*prepared));
+    prepared->op = QKD_METRICS_014_GET_STATUS;
+    prepared->url = build_url(kme_hostname, slave_sae_id, "status");
+    return prepared->url ? QKD_STATUS_OK : QKD_STATUS_SERVER_ERROR;
+}
+
+static uint32_t prepare_key_request(const char *kme_hostname,
+                                    const char *slave_sae_id,
+                                    const qkd_key_request_t *request,
+                                    struct kme_request *prepared) {
+    memset(prepared, 0, sizeof(*prepared));
     if (request) {
         if (request->number < 0 || request->size < 0 ||
             request->additional_SAE_count < 0 ||
@@ -454,56 +1282,982 @@ static uint32_t get_key(const char *kme_hostname, const char *slave_sae_id,
     if (suffix_length < 0 || (size_t)suffix_length >= sizeof(suffix))
         return QKD_STATUS_BAD_REQUEST;
 
-    char *url = build_url(kme_hostname, slave_sae_id, suffix);
-    if (!url)
+    prepared->url = build_url(kme_hostname, slave_sae_id, suffix);
+    prepared->op = QKD_METRICS_014_GET_KEY;
+    prepared->key_count = number;
+    prepared->key_size = size;
+    return prepared->url ? QKD_STATUS_OK : QKD_STATUS_SERVER_ERROR;
+}
+
+static uint32_t prepare_key_with_ids_request(const char *kme_hostname,
+                                             const char *master_sae_id,
+                                             const qkd_key_ids_t *key_ids,
+                                             struct kme_request *prepared) {
+    memset(prepared, 0, sizeof(*prepared));
+    if (key_ids->key_ID_count <= 0 || key_ids->key_ID_count > MAX_KEYS ||
+        !key_ids->key_IDs || key_ids->key_IDs_extension)
+        return QKD_STATUS_BAD_REQUEST;
+
+    prepared->url = build_url(kme_hostname, master_sae_id, "dec_keys");
+    prepared->post_data = build_post_data(key_ids, master_sae_id);
+    if (!prepared->url || !prepared->post_data) {
+        kme_request_free(prepared);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    prepared->key_count = key_ids->key_ID_count;
+    prepared->op = QKD_METRICS_014_GET_KEY_WITH_IDS;
+    return QKD_STATUS_OK;
+}
+
+/* What a blocking call asks for, prepared again for each endpoint tried. */
+struct kme_call {
+    enum qkd_metrics_op op;
+    const char *sae_id;
+    const qkd_key_request_t *request;
+    const qkd_key_ids_t *key_ids;
+    uint32_t container_flags;
+};
+
+static uint32_t prepare_call(const struct kme_call *call, const char *hostname,
+                             struct kme_request *prepared) {
+    switch (call->op) {
+    case QKD_METRICS_014_GET_STATUS:
+        return prepare_status_request(hostname, call->sae_id, prepared);
+    case QKD_METRICS_014_GET_KEY:
+        return prepare_key_request(hostname, call->sae_id, call->request,
+                                   prepared);
+    default:
+        return prepare_key_with_ids_request(hostname, call->sae_id,
+                                            call->key_ids, prepared);
+    }
+}
+
+/* One transfer of a blocking call, to one endpoint. */
+struct transfer {
+    struct kme_endpoint *endpoint; /* NULL for a single hostname */
+    struct kme_request prepared;
+    struct qkd_key_stream_parser parser;
+    struct response_body response;
+    struct curl_slist *headers;
+    struct pooled_handle *slot;
+    CURL *curl;
+    CURLcode result;
+    long http_code;
+    uint64_t started;
+    bool counted;  /* In flight for its endpoint */
+    bool is_probe; /* Probe of a failing endpoint */
+    bool active;   /* Added to the multi handle */
+};
+
+/*
+ * A blocking call drives its transfers on the multi handle of the first
+ * transfer's pooled handle, so that its connections are kept for the next
+ * call. Transfers are released when the call ends.
+ */
+struct blocking_call {
+    struct https_instance *instance;
+    const struct kme_call *call;
+    const etsi014_cert_config_t *config;
+    struct kme_recording *recording;
+    struct endpoint_set set;
+    struct transfer transfers[MAX_ENDPOINTS];
+    size_t started;
+    unsigned int tried; /* Endpoints with a transfer */
+    CURLM *multi;
+    bool temporary_multi;
+};
+
+static void stop_transfer(struct blocking_call *state,
+                          struct transfer *transfer,
+                          enum endpoint_outcome outcome) {
+    if (transfer->active) {
+        curl_multi_remove_handle(state->multi, transfer->curl);
+        transfer->active = false;
+    }
+    if (transfer->counted) {
+        finish_endpoint(&state->instance->endpoints, transfer->endpoint,
+                        transfer->is_probe, outcome,
+                        qkd_metrics_now() - transfer->started);
+        transfer->counted = false;
+    }
+}
+
+static void free_transfer(struct blocking_call *state,
+                          struct transfer *transfer) {
+    if (transfer->curl) {
+        /* The handle must not keep pointers into this call's memory. */
+        curl_easy_setopt(transfer->curl, CURLOPT_HTTPHEADER, NULL);
+        curl_easy_setopt(transfer->curl, CURLOPT_WRITEDATA, NULL);
+        curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, NULL);
+        release_handle(&state->instance->pool, transfer->curl, transfer->slot,
+                       transfer->result == CURLE_OK);
+    }
+    curl_slist_free_all(transfer->headers);
+    if (transfer->response.keys && transfer->response.data)
+        OPENSSL_cleanse(transfer->response.data, transfer->response.size);
+    free(transfer->response.data);
+    qkd_key_stream_parser_free(&transfer->parser);
+    kme_request_free(&transfer->prepared);
+}
+
+/*
+ * Starts a transfer to the best endpoint not tried yet. *hedge_us is set as
+ * by choose_endpoint().
+ */
+static uint32_t start_transfer(struct blocking_call *state,
+                               uint64_t *hedge_us) {
+    bool is_probe;
+    int index = choose_endpoint(&state->instance->endpoints, &state->set,
+                                state->tried, &is_probe, hedge_us);
+    if (index < 0)
         return QKD_STATUS_SERVER_ERROR;
+    state->tried |= 1U << index;
+
+    struct transfer *transfer = &state->transfers[state->started++];
+    transfer->is_probe = is_probe;
+    const char *hostname = endpoint_hostname(&state->set, (size_t)index);
+    transfer->endpoint = state->set.endpoints[index];
+    transfer->started = qkd_metrics_now();
+    transfer->counted = true;
+    transfer->result = CURLE_FAILED_INIT;
+
+    uint32_t result = prepare_call(state->call, hostname, &transfer->prepared);
+    if (result != QKD_STATUS_OK) {
+        stop_transfer(state, transfer, ENDPOINT_CANCELLED);
+        return result;
+    }
+
+    bool body_ready;
+    if (state->call->op == QKD_METRICS_014_GET_STATUS) {
+        transfer->response.data = malloc(1);
+        body_ready = transfer->response.data != NULL;
+        if (body_ready)
+            transfer->response.data[0] = '\0';
+    } else {
+        body_ready = qkd_key_stream_parser_init(
+            &transfer->parser, state->call->container_flags,
+            transfer->prepared.key_count, transfer->prepared.key_size);
+        transfer->response.keys = &transfer->parser;
+        if (body_ready && state->recording->record_fd >= 0) {
+            transfer->response.data = calloc(1, 1);
+            body_ready = transfer->response.data != NULL;
+        }
+    }
+
+    char *pool_key = build_pool_key(hostname, state->config);
+    if (body_ready && pool_key)
+        transfer->curl =
+            acquire_handle(&state->instance->pool, pool_key, &transfer->slot);
+    free(pool_key);
+    transfer->headers = transfer->curl ? build_json_headers() : NULL;
+    if (!transfer->headers) {
+        stop_transfer(state, transfer, ENDPOINT_CANCELLED);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+
+    /* Resetting options keeps the handle's sessions. */
+    curl_easy_reset(transfer->curl);
+    configure_request(transfer->curl, transfer->prepared.url,
+                      transfer->prepared.post_data, transfer->headers,
+                      &transfer->response, state->config, CURL_HTTP_VERSION_1_1,
+                      state->instance->pool.idle_timeout_ms);
+    curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer);
+
+    if (!state->multi) {
+        if (transfer->slot && !transfer->slot->multi)
+            transfer->slot->multi = curl_multi_init();
+        state->temporary_multi = !transfer->slot;
+        state->multi =
+            transfer->slot ? transfer->slot->multi : curl_multi_init();
+    }
+    if (!state->multi ||
+        curl_multi_add_handle(state->multi, transfer->curl) != CURLM_OK) {
+        stop_transfer(state, transfer, ENDPOINT_CANCELLED);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+    transfer->active = true;
+    return QKD_STATUS_OK;
+}
+
+/*
+ * Collects finished transfers, failing over to the next endpoint when one
+ * fails and may_resend() allows it. Returns the first good transfer, if any.
+ */
+static struct transfer *collect_transfers(struct blocking_call *state,
+                                          size_t *active) {
+    CURLMsg *message;
+    int remaining;
+
+    while ((message = curl_multi_info_read(state->multi, &remaining))) {
+        if (message->msg != CURLMSG_DONE)
+            continue;
+
+        struct transfer *transfer = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+        transfer->result = message->data.result;
+        if (transfer->result == CURLE_OK)
+            transfer->result = curl_easy_getinfo(
+                transfer->curl, CURLINFO_RESPONSE_CODE, &transfer->http_code);
+        bool good = transfer->result == CURLE_OK && transfer->http_code < 500;
+        stop_transfer(state, transfer,
+                      good ? ENDPOINT_GOOD : ENDPOINT_FAILED);
+        (*active)--;
+        if (good)
+            return transfer;
+
+        if (transfer->result != CURLE_OK) {
+            QKD_DBG_ERR("HTTPS request to %s failed: %s",
+                        transfer->prepared.url,
+                        curl_easy_strerror(transfer->result));
+        } else {
+            QKD_DBG_ERR("HTTPS request to %s failed with HTTP %ld",
+                        transfer->prepared.url, transfer->http_code);
+        }
+        uint64_t hedge_us;
+        if (may_resend(state->call->op, transfer->result) &&
+            start_transfer(state, &hedge_us) == QKD_STATUS_OK)
+            (*active)++;
+    }
+    return NULL;
+}
+
+static uint32_t handle_response(enum qkd_metrics_op op,
+                                struct response_body *response,
+                                struct qkd_key_stream_parser *parser,
+                                long http_code, void *output) {
+    uint32_t result;
+    uint64_t started = qkd_metrics_now();
+    if (op == QKD_METRICS_014_GET_STATUS) {
+        result = handle_status_response(response->data, http_code, output);
+        response->data = NULL;
+    } else {
+        result = handle_keys_response(parser, true, http_code, output);
+    }
+    qkd_metrics_record(op, QKD_METRICS_PARSE,
+                       response->parse_ns + qkd_metrics_now() - started);
+    return result;
+}
+
+static uint32_t finish_call(const struct blocking_call *state,
+                            struct transfer *winner, void *output) {
+    enum qkd_metrics_op op = state->call->op;
+    record_phases(winner->curl, op);
+    record_response(state->recording, op, &winner->response,
+                    winner->http_code, qkd_metrics_now() - winner->started);
+    return handle_response(op, &winner->response, &winner->parser,
+                           winner->http_code, output);
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec deadline = {
+        .tv_sec = (time_t)(deadline_ns / 1000000000U),
+        .tv_nsec = (long)(deadline_ns % 1000000000U)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) ==
+           EINTR)
+        ;
+}
+
+/*
+ * Answers a blocking call with the next recorded response of its operation,
+ * fed to the parsers in pieces of the size curl would deliver.
+ */
+static uint32_t replay_call(struct kme_recording *state,
+                            const char *kme_hostname,
+                            const struct kme_call *call, void *output) {
+    struct kme_request prepared;
+    uint32_t result = prepare_call(call, kme_hostname, &prepared);
+    if (result != QKD_STATUS_OK) {
+        kme_request_free(&prepared);
+        return result;
+    }
+
+    uint64_t started = qkd_metrics_now();
+    struct recorded_response header;
+    const unsigned char *body = next_recorded(state, call->op, &header);
+    struct qkd_key_stream_parser parser = {0};
+    struct response_body response = {0};
+    bool ready = body != NULL;
+    if (!ready) {
+        QKD_DBG_ERR("No recorded response for %s",
+                    qkd_metrics_op_name(call->op));
+    } else if (call->op == QKD_METRICS_014_GET_STATUS) {
+        response.data = calloc(1, 1);
+        ready = response.data != NULL;
+    } else {
+        ready = qkd_key_stream_parser_init(&parser, call->container_flags,
+                                           prepared.key_count,
+                                           prepared.key_size);
+        response.keys = &parser;
+    }
+    for (size_t offset = 0; ready && offset < header.size;
+         offset += REPLAY_CHUNK_SIZE) {
+        size_t length = header.size - offset < REPLAY_CHUNK_SIZE
+                            ? header.size - offset
+                            : REPLAY_CHUNK_SIZE;
+        ready = write_response_callback((void *)(body + offset), 1, length,
+                                        &response) == length;
+    }
+
+    if (ready && state->timing)
+        sleep_until(started + header.duration_ns);
+    result = ready ? handle_response(call->op, &response, &parser,
+                                     header.http_code, output)
+                   : QKD_STATUS_SERVER_ERROR;
+    free(response.data);
+    qkd_key_stream_parser_free(&parser);
+    kme_request_free(&prepared);
+    return result;
+}
+
+/*
+ * Performs a blocking call on the endpoints of kme_hostname, delivering the
+ * response to output: a status, or a key container that is filled while the
+ * response is received.
+ */
+static uint32_t perform_call(struct https_instance *instance,
+                             const char *kme_hostname,
+                             const struct kme_call *call, int role,
+                             void *output) {
+    struct kme_recording *recording = get_recording();
+    if (recording->replaying)
+        return replay_call(recording, kme_hostname, call, output);
 
     etsi014_cert_config_t config;
-    if (init_cert_config(1, &config) != QKD_STATUS_OK) {
-        free(url);
+    if (get_cert_config(instance, role, &config) != QKD_STATUS_OK)
         return QKD_STATUS_BAD_REQUEST;
+    struct blocking_call state = {.instance = instance,
+                                  .call = call,
+                                  .config = &config,
+                                  .recording = recording};
+    if (!resolve_endpoints(&instance->endpoints, kme_hostname, &state.set))
+        return QKD_STATUS_BAD_REQUEST;
+    pthread_once(&curl_once, initialize_curl);
+    if (!curl_ready)
+        return QKD_STATUS_SERVER_ERROR;
+
+    uint64_t hedge_us;
+    uint32_t result = start_transfer(&state, &hedge_us);
+    if (call->op == QKD_METRICS_014_GET_KEY)
+        hedge_us = 0;
+    uint64_t hedge_at = hedge_us ? qkd_metrics_now() + hedge_us * 1000U : 0;
+    size_t active = result == QKD_STATUS_OK ? 1 : 0;
+    struct transfer *winner = NULL;
+    while (active > 0) {
+        int running;
+        if (curl_multi_perform(state.multi, &running) != CURLM_OK)
+            break;
+        winner = collect_transfers(&state, &active);
+        if (winner || active == 0)
+            break;
+
+        int timeout_ms = 1000;
+        if (hedge_at && !state.transfers[0].active)
+            hedge_at = 0;
+        if (hedge_at) {
+            uint64_t now = qkd_metrics_now();
+            if (now >= hedge_at) {
+                hedge_at = 0;
+                QKD_DBG_INFO("Hedging slow request to %s",
+                             state.transfers[0].prepared.url);
+                if (start_transfer(&state, &hedge_us) == QKD_STATUS_OK)
+                    active++;
+                continue;
+            }
+            uint64_t wait_ms = (hedge_at - now + 999999U) / 1000000U;
+            if (wait_ms < (uint64_t)timeout_ms)
+                timeout_ms = (int)wait_ms;
+        }
+        curl_multi_poll(state.multi, NULL, 0, timeout_ms, NULL);
     }
 
-    long http_code;
-    char *response = handle_request_https(url, NULL, &http_code, &config);
-    free(url);
-    return handle_keys_response(response, http_code, container);
+    if (winner)
+        result = finish_call(&state, winner, output);
+    else if (result == QKD_STATUS_OK)
+        result = QKD_STATUS_SERVER_ERROR;
+    for (size_t i = 0; i < state.started; i++)
+        stop_transfer(&state, &state.transfers[i], ENDPOINT_CANCELLED);
+    for (size_t i = 0; i < state.started; i++)
+        free_transfer(&state, &state.transfers[i]);
+    if (state.temporary_multi && state.multi)
+        curl_multi_cleanup(state.multi);
+    return result;
+}
+
+static uint32_t instance_get_status(void *context, const char *kme_hostname,
+                                    const char *slave_sae_id,
+                                    qkd_status_t *status) {
+    struct https_instance *instance = context;
+    struct kme_call call = {.op = QKD_METRICS_014_GET_STATUS,
+                            .sae_id = slave_sae_id};
+    return perform_call(instance, kme_hostname, &call, 1, status);
+}
+
+static uint32_t instance_get_key(void *context, const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 qkd_key_request_t *request,
+                                 qkd_key_container_t *container) {
+    struct https_instance *instance = context;
+    struct kme_call call = {.op = QKD_METRICS_014_GET_KEY,
+                            .sae_id = slave_sae_id,
+                            .request = request,
+                            .container_flags = container->flags};
+    return perform_call(instance, kme_hostname, &call, 1, container);
+}
+
+static uint32_t instance_get_key_with_ids(void *context,
+                                          const char *kme_hostname,
+                                          const char *master_sae_id,
+                                          qkd_key_ids_t *key_ids,
+                                          qkd_key_container_t *container) {
+    struct https_instance *instance = context;
+    struct kme_call call = {.op = QKD_METRICS_014_GET_KEY_WITH_IDS,
+                            .sae_id = master_sae_id,
+                            .key_ids = key_ids,
+                            .container_flags = container->flags};
+    return perform_call(instance, kme_hostname, &call, 0, container);
+}
+
+static uint32_t get_status(const char *kme_hostname, const char *slave_sae_id,
+                           qkd_status_t *status) {
+    return instance_get_status(&default_instance, kme_hostname, slave_sae_id,
+                               status);
+}
+
+static uint32_t get_key(const char *kme_hostname, const char *slave_sae_id,
+                        qkd_key_request_t *request,
+                        qkd_key_container_t *container) {
+    return instance_get_key(&default_instance, kme_hostname, slave_sae_id,
+                            request, container);
 }
 
 static uint32_t get_key_with_ids(const char *kme_hostname,
                                  const char *master_sae_id,
                                  qkd_key_ids_t *key_ids,
                                  qkd_key_container_t *container) {
-    if (key_ids->key_ID_count <= 0 || key_ids->key_ID_count > MAX_KEYS ||
-        !key_ids->key_IDs || key_ids->key_IDs_extension)
-        return QKD_STATUS_BAD_REQUEST;
+    return instance_get_key_with_ids(&default_instance, kme_hostname,
+                                     master_sae_id, key_ids, container);
+}
 
-    char *url = build_url(kme_hostname, master_sae_id, "dec_keys");
-    char *post_data = build_post_data(key_ids, master_sae_id);
-    if (!url || !post_data) {
+/*
+ * Asynchronous engine. All transfers of one engine share a curl_multi handle
+ * and therefore its connection cache; with QKD_HTTP2_MULTIPLEX=1 requests to
+ * the same KME are multiplexed over a single HTTP/2 connection. curl's
+ * sockets and timeout are registered in an epoll instance, whose descriptor
+ * is what the application polls.
+ */
+#define ASYNC_MAX_EVENTS 64
+
+enum async_kind { ASYNC_STATUS, ASYNC_KEYS };
+
+struct async_request {
+    CURL *curl;
+    struct curl_slist *headers;
+    struct response_body response;
+    struct qkd_key_stream_parser keys;
+    struct kme_request prepared;
+    struct endpoint_set set;
+    struct kme_endpoint *endpoint; /* In flight for it until completed */
+    bool is_probe;                 /* Probe of a failing endpoint */
+    size_t hostname_length;        /* Of the endpoint, at the start of url */
+    unsigned int tried;
+    uint64_t started;
+    enum async_kind kind;
+    void *output;
+    qkd_014_callback_t callback;
+    void *user_data;
+    struct async_request *prev;
+    struct async_request *next;
+};
+
+struct async_engine {
+    CURLM *multi;
+    int epoll_fd;
+    int timer_fd;
+    long http_version;
+    struct async_request *requests;
+    size_t outstanding;
+};
+
+static int async_socket_callback(CURL *easy, curl_socket_t socket, int what,
+                                 void *user_data, void *socket_data) {
+    struct async_engine *engine = user_data;
+    (void)easy;
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+        curl_multi_assign(engine->multi, socket, NULL);
+        return 0;
+    }
+
+    struct epoll_event event = {.events = 0, .data.fd = socket};
+    if (what & CURL_POLL_IN)
+        event.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT)
+        event.events |= EPOLLOUT;
+    int operation = socket_data ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(engine->epoll_fd, operation, socket, &event) != 0) {
+        QKD_DBG_ERR("Failed to register socket %d for polling", (int)socket);
+        return 0;
+    }
+    if (!socket_data)
+        curl_multi_assign(engine->multi, socket, engine);
+    return 0;
+}
+
+static int async_timer_callback(CURLM *multi, long timeout_ms,
+                                void *user_data) {
+    struct async_engine *engine = user_data;
+    struct itimerspec spec = {0};
+    (void)multi;
+
+    if (timeout_ms == 0) {
+        spec.it_value.tv_nsec = 1;
+    } else if (timeout_ms > 0) {
+        spec.it_value.tv_sec = timeout_ms / 1000;
+        spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    }
+    timerfd_settime(engine->timer_fd, 0, &spec, NULL);
+    return 0;
+}
+
+static void async_request_destroy(struct async_engine *engine,
+                                  struct async_request *request) {
+    if (request->prev)
+        request->prev->next = request->next;
+    else
+        engine->requests = request->next;
+    if (request->next)
+        request->next->prev = request->prev;
+
+    finish_endpoint(&default_instance.endpoints, request->endpoint,
+                    request->is_probe, ENDPOINT_CANCELLED, 0);
+    curl_multi_remove_handle(engine->multi, request->curl);
+    curl_easy_cleanup(request->curl);
+    curl_slist_free_all(request->headers);
+    free(request->response.data);
+    qkd_key_stream_parser_free(&request->keys);
+    kme_request_free(&request->prepared);
+    free(request);
+    engine->outstanding--;
+}
+
+/* Sends a failed request to the next endpoint of its set, if any is left. */
+static bool async_retry(struct async_engine *engine,
+                        struct async_request *request) {
+    struct endpoint_registry *registry = &default_instance.endpoints;
+    bool is_probe;
+    uint64_t hedge_us;
+    int index = choose_endpoint(registry, &request->set, request->tried,
+                                &is_probe, &hedge_us);
+    if (index < 0)
+        return false;
+
+    struct kme_endpoint *endpoint = request->set.endpoints[index];
+    const char *path = request->prepared.url + request->hostname_length;
+    size_t length = strlen(endpoint->hostname) + strlen(path);
+    char *url = malloc(length + 1U);
+    bool body_ready = url != NULL;
+    if (body_ready && request->kind == ASYNC_KEYS) {
+        qkd_key_container_t *container = request->output;
+        qkd_key_stream_parser_free(&request->keys);
+        body_ready = qkd_key_stream_parser_init(
+            &request->keys, container->flags, request->prepared.key_count,
+            request->prepared.key_size);
+    } else if (body_ready) {
+        free(request->response.data);
+        request->response.data = calloc(1, 1);
+        body_ready = request->response.data != NULL;
+    }
+    if (!body_ready) {
+        finish_endpoint(registry, endpoint, is_probe, ENDPOINT_CANCELLED, 0);
         free(url);
-        free(post_data);
-        return QKD_STATUS_BAD_REQUEST;
+        return false;
     }
 
+    snprintf(url, length + 1U, "%s%s", endpoint->hostname, path);
+    free(request->prepared.url);
+    request->prepared.url = url;
+    request->response.size = 0;
+    request->response.parse_ns = 0;
+    request->endpoint = endpoint;
+    request->is_probe = is_probe;
+    request->hostname_length = strlen(endpoint->hostname);
+    request->tried |= 1U << index;
+    request->started = qkd_metrics_now();
+
+    curl_multi_remove_handle(engine->multi, request->curl);
+    curl_easy_setopt(request->curl, CURLOPT_URL, url);
+    if (curl_multi_add_handle(engine->multi, request->curl) != CURLM_OK) {
+        finish_endpoint(registry, endpoint, is_probe, ENDPOINT_CANCELLED, 0);
+        request->endpoint = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void async_complete_finished(struct async_engine *engine) {
+    CURLMsg *message;
+    int remaining;
+
+    while ((message = curl_multi_info_read(engine->multi, &remaining))) {
+        if (message->msg != CURLMSG_DONE)
+            continue;
+
+        struct async_request *request = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &request);
+        CURLcode code = message->data.result;
+        long http_code = 0;
+        if (code == CURLE_OK)
+            code = curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE,
+                                     &http_code);
+        if (code != CURLE_OK) {
+            QKD_DBG_ERR("HTTPS request to %s failed: %s",
+                        request->prepared.url, curl_easy_strerror(code));
+        } else {
+            record_phases(request->curl, request->prepared.op);
+        }
+        bool good = code == CURLE_OK && http_code < 500;
+        finish_endpoint(&default_instance.endpoints, request->endpoint,
+                        request->is_probe,
+                        good ? ENDPOINT_GOOD : ENDPOINT_FAILED,
+                        qkd_metrics_now() - request->started);
+        request->endpoint = NULL;
+        if (!good && may_resend(request->prepared.op, code) &&
+            async_retry(engine, request))
+            continue;
+
+        uint32_t result;
+        uint64_t started = qkd_metrics_now();
+        if (request->kind == ASYNC_STATUS) {
+            char *response = code == CURLE_OK ? request->response.data : NULL;
+            if (response)
+                request->response.data = NULL;
+            result = handle_status_response(response, http_code,
+                                            request->output);
+        } else {
+            result = handle_keys_response(&request->keys, code == CURLE_OK,
+                                          http_code, request->output);
+        }
+        if (code == CURLE_OK)
+            qkd_metrics_record(request->prepared.op, QKD_METRICS_PARSE,
+                               request->response.parse_ns + qkd_metrics_now() -
+                                   started);
+        qkd_014_callback_t callback = request->callback;
+        void *user_data = request->user_data;
+        async_request_destroy(engine, request);
+        callback(result, user_data);
+    }
+}
+
+static void async_destroy(void *state);
+
+static void *async_create(void) {
+    pthread_once(&curl_once, initialize_curl);
+    if (!curl_ready)
+        return NULL;
+
+    struct async_engine *engine = calloc(1, sizeof(*engine));
+    if (!engine)
+        return NULL;
+
+    engine->multi = curl_multi_init();
+    engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    engine->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event timer_event = {.events = EPOLLIN,
+                                      .data.fd = engine->timer_fd};
+    if (!engine->multi || engine->epoll_fd < 0 || engine->timer_fd < 0 ||
+        epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->timer_fd,
+                  &timer_event) != 0) {
+        if (engine->multi)
+            curl_multi_cleanup(engine->multi);
+        if (engine->epoll_fd >= 0)
+            close(engine->epoll_fd);
+        if (engine->timer_fd >= 0)
+            close(engine->timer_fd);
+        free(engine);
+        return NULL;
+    }
+
+    /* Transfers beyond the pool size queue for a connection to the KME. */
+    struct connection_pool *pool = &default_instance.pool;
+    pthread_mutex_lock(&pool->lock);
+    bool pool_ready = initialize_pool(pool);
+    long max_connections = (long)pool->size;
+    pthread_mutex_unlock(&pool->lock);
+    if (!pool_ready) {
+        async_destroy(engine);
+        return NULL;
+    }
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                      max_connections);
+
+    const char *http2 = getenv("QKD_HTTP2_MULTIPLEX");
+    engine->http_version = CURL_HTTP_VERSION_1_1;
+    if (http2 && strcmp(http2, "1") == 0) {
+        engine->http_version = CURL_HTTP_VERSION_2TLS;
+        curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING,
+                          CURLPIPE_MULTIPLEX);
+    }
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETFUNCTION,
+                      async_socket_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_SOCKETDATA, engine);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERFUNCTION,
+                      async_timer_callback);
+    curl_multi_setopt(engine->multi, CURLMOPT_TIMERDATA, engine);
+    return engine;
+}
+
+static void async_destroy(void *state) {
+    struct async_engine *engine = state;
+
+    if (!engine)
+        return;
+    while (engine->requests)
+        async_request_destroy(engine, engine->requests);
+    curl_multi_cleanup(engine->multi);
+    close(engine->epoll_fd);
+    close(engine->timer_fd);
+    free(engine);
+}
+
+static int async_fd(const void *state) {
+    const struct async_engine *engine = state;
+    return engine->epoll_fd;
+}
+
+static int async_perform(void *state, int timeout_ms) {
+    struct async_engine *engine = state;
+    struct epoll_event events[ASYNC_MAX_EVENTS];
+    int running;
+
+    if (engine->outstanding == 0)
+        return 0;
+
+    int count =
+        epoll_wait(engine->epoll_fd, events, ASYNC_MAX_EVENTS, timeout_ms);
+    if (count < 0)
+        return errno == EINTR ? (int)engine->outstanding : -1;
+
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.fd == engine->timer_fd) {
+            uint64_t expirations;
+            if (read(engine->timer_fd, &expirations, sizeof(expirations)) < 0) {
+                QKD_DBG_VERB("Spurious timer wake-up");
+            }
+            curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0,
+                                     &running);
+            continue;
+        }
+
+        int flags = 0;
+        if (events[i].events & EPOLLIN)
+            flags |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT)
+            flags |= CURL_CSELECT_OUT;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            flags |= CURL_CSELECT_ERR;
+        curl_multi_socket_action(engine->multi, events[i].data.fd, flags,
+                                 &running);
+    }
+
+    async_complete_finished(engine);
+    return engine->outstanding > INT_MAX ? INT_MAX : (int)engine->outstanding;
+}
+
+/*
+ * Asynchronous requests are spread over endpoint sets and fail over like
+ * blocking ones, but are not hedged.
+ */
+static uint32_t async_submit(struct async_engine *engine,
+                             const char *kme_hostname,
+                             const struct kme_call *call, int role,
+                             enum async_kind kind, void *output,
+                             qkd_014_callback_t callback, void *user_data) {
     etsi014_cert_config_t config;
-    if (init_cert_config(0, &config) != QKD_STATUS_OK) {
-        free(url);
-        free(post_data);
+    if (init_cert_config(role, &config) != QKD_STATUS_OK)
+        return QKD_STATUS_BAD_REQUEST;
+
+    struct async_request *request = calloc(1, sizeof(*request));
+    if (!request)
+        return QKD_STATUS_SERVER_ERROR;
+    struct endpoint_registry *registry = &default_instance.endpoints;
+    if (!resolve_endpoints(registry, kme_hostname, &request->set)) {
+        free(request);
         return QKD_STATUS_BAD_REQUEST;
     }
+    uint64_t hedge_us;
+    int index = choose_endpoint(registry, &request->set, 0,
+                                &request->is_probe, &hedge_us);
+    const char *hostname = endpoint_hostname(&request->set, (size_t)index);
+    request->endpoint = request->set.endpoints[index];
+    request->hostname_length = strlen(hostname);
+    request->tried = 1U << index;
+    request->started = qkd_metrics_now();
+    request->kind = kind;
+    request->output = output;
+    request->callback = callback;
+    request->user_data = user_data;
+    uint32_t result = prepare_call(call, hostname, &request->prepared);
+
+    bool body_ready = result == QKD_STATUS_OK;
+    if (body_ready && kind == ASYNC_KEYS) {
+        qkd_key_container_t *container = output;
+        body_ready = qkd_key_stream_parser_init(
+            &request->keys, container->flags, request->prepared.key_count,
+            request->prepared.key_size);
+        request->response.keys = &request->keys;
+    } else if (body_ready) {
+        request->response.data = malloc(1);
+        body_ready = request->response.data != NULL;
+        if (body_ready)
+            request->response.data[0] = '\0';
+    }
+    if (body_ready) {
+        request->headers = build_json_headers();
+        request->curl = curl_easy_init();
+    }
+    if (!body_ready || !request->headers || !request->curl) {
+        finish_endpoint(registry, request->endpoint, request->is_probe,
+                        ENDPOINT_CANCELLED, 0);
+        curl_easy_cleanup(request->curl);
+        curl_slist_free_all(request->headers);
+        free(request->response.data);
+        qkd_key_stream_parser_free(&request->keys);
+        kme_request_free(&request->prepared);
+        free(request);
+        return result != QKD_STATUS_OK ? result : QKD_STATUS_SERVER_ERROR;
+    }
 
-    long http_code;
-    char *response = handle_request_https(url, post_data, &http_code, &config);
-    free(url);
-    free(post_data);
-    return handle_keys_response(response, http_code, container);
+    configure_request(request->curl, request->prepared.url,
+                      request->prepared.post_data, request->headers,
+                      &request->response, &config, engine->http_version,
+                      default_instance.pool.idle_timeout_ms);
+    curl_easy_setopt(request->curl, CURLOPT_PRIVATE, request);
+    if (engine->http_version == CURL_HTTP_VERSION_2TLS)
+        curl_easy_setopt(request->curl, CURLOPT_PIPEWAIT, 1L);
+
+    request->next = engine->requests;
+    if (engine->requests)
+        engine->requests->prev = request;
+    engine->requests = request;
+    engine->outstanding++;
+    if (curl_multi_add_handle(engine->multi, request->curl) != CURLM_OK) {
+        async_request_destroy(engine, request);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+    return QKD_STATUS_OK;
+}
+
+static uint32_t get_status_async(void *engine, const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 qkd_status_t *status,
+                                 qkd_014_callback_t callback,
+                                 void *user_data) {
+    struct kme_call call = {.op = QKD_METRICS_014_GET_STATUS,
+                            .sae_id = slave_sae_id};
+    return async_submit(engine, kme_hostname, &call, 1, ASYNC_STATUS, status,
+                        callback, user_data);
+}
+
+static uint32_t get_key_async(void *engine, const char *kme_hostname,
+                              const char *slave_sae_id,
+                              qkd_key_request_t *request,
+                              qkd_key_container_t *container,
+                              qkd_014_callback_t callback, void *user_data) {
+    struct kme_call call = {.op = QKD_METRICS_014_GET_KEY,
+                            .sae_id = slave_sae_id,
+                            .request = request};
+    return async_submit(engine, kme_hostname, &call, 1, ASYNC_KEYS, container,
+                        callback, user_data);
+}
+
+static uint32_t get_key_with_ids_async(void *engine, const char *kme_hostname,
+                                       const char *master_sae_id,
+                                       qkd_key_ids_t *key_ids,
+                                       qkd_key_container_t *container,
+                                       qkd_014_callback_t callback,
+                                       void *user_data) {
+    struct kme_call call = {.op = QKD_METRICS_014_GET_KEY_WITH_IDS,
+                            .sae_id = master_sae_id,
+                            .key_ids = key_ids};
+    return async_submit(engine, kme_hostname, &call, 0, ASYNC_KEYS, container,
+                        callback, user_data);
+}
+
+static void instance_destroy(void *context);
+
+static void *instance_create(const qkd_014_ctx_config_t *config) {
+    struct https_instance *instance = calloc(1, sizeof(*instance));
+    if (!instance)
+        return NULL;
+    pthread_mutex_init(&instance->pool.lock, NULL);
+    pthread_mutex_init(&instance->endpoints.lock, NULL);
+    pthread_mutex_init(&instance->credentials_lock, NULL);
+    if (!config)
+        return instance;
+
+    const char *paths[2][3] = {{config->slave_cert_path, config->slave_key_path,
+                                config->slave_ca_cert_path},
+                               {config->master_cert_path,
+                                config->master_key_path,
+                                config->master_ca_cert_path}};
+    for (size_t role = 0; role < 2; role++) {
+        for (size_t i = 0; i < 3; i++) {
+            if (!paths[role][i])
+                continue;
+            instance->paths[role][i] = strdup(paths[role][i]);
+            if (!instance->paths[role][i]) {
+                instance_destroy(instance);
+                return NULL;
+            }
+        }
+    }
+    return instance;
+}
+
+static void instance_destroy(void *context) {
+    struct https_instance *instance = context;
+    if (!instance)
+        return;
+
+    close_idle_handles(&instance->pool);
+    free(instance->pool.handles);
+    release_endpoints(&instance->endpoints);
+    release_credentials(instance);
+    for (size_t role = 0; role < 2; role++) {
+        for (size_t i = 0; i < 3; i++)
+            free(instance->paths[role][i]);
+    }
+    pthread_mutex_destroy(&instance->pool.lock);
+    pthread_mutex_destroy(&instance->endpoints.lock);
+    pthread_mutex_destroy(&instance->credentials_lock);
+    free(instance);
 }
 
 const struct qkd_014_backend qkd_etsi014_backend = {
     .name = "qkd_etsi014_backend",
     .get_status = get_status,
     .get_key = get_key,
-    .get_key_with_ids = get_key_with_ids};
+    .get_key_with_ids = get_key_with_ids,
+    .context_create = instance_create,
+    .context_destroy = instance_destroy,
+    .context_get_status = instance_get_status,
+    .context_get_key = instance_get_key,
+    .context_get_key_with_ids = instance_get_key_with_ids,
+    .async_create = async_create,
+    .async_destroy = async_destroy,
+    .async_fd = async_fd,
+    .async_perform = async_perform,
+    .get_status_async = get_status_async,
+    .get_key_async = get_key_async,
+    .get_key_with_ids_async = get_key_with_ids_async};
+
+#ifdef QKD_BACKEND_PLUGIN
+const struct qkd_014_backend *qkd_014_plugin_backend(uint32_t abi_version) {
+    return abi_version == QKD_014_BACKEND_ABI_VERSION ? &qkd_etsi014_backend
+                                                      : NULL;
+}
+#endif
 
 #endif /* QKD_USE_ETSI014_BACKEND */
@@ -10,10 +10,9 @@
  * src/etsi014/backends/simulated.c
  */
 
-#include <limits.h>
 #include <openssl/crypto.h>
-#include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -23,94 +22,144 @@
 #include "debug.h"
 #include "etsi014/api.h"
 #include "etsi014/backends/simulated.h"
+#include "etsi014/key_container.h"
 #include "qkd_etsi_api.h"
+#include "qkd_hash_index.h"
+#include "qkd_secure_alloc.h"
 
 #if defined(QKD_USE_SIMULATED) && QKD_USE_SIMULATED
 
-#define MAX_KEYS 16
-#define KEY_SIZE_BYTES 32
-#define BASE64_KEY_SIZE (((KEY_SIZE_BYTES + 2) / 3) * 4 + 1)
+#ifndef QKD_SIM_MAX_KEYS
+#define QKD_SIM_MAX_KEYS 16
+#endif
+
+#ifndef QKD_SIM_MAX_KEY_SIZE_BITS
+#define QKD_SIM_MAX_KEY_SIZE_BITS 65536
+#endif
+
+#define MAX_KEYS QKD_SIM_MAX_KEYS
+#define MAX_KEYS_PER_REQUEST (MAX_KEYS < 1024 ? MAX_KEYS : 1024)
+#define MIN_KEY_SIZE_BITS 8
+#define MAX_KEY_SIZE_BITS QKD_SIM_MAX_KEY_SIZE_BITS
 #define UUID_STRING_SIZE 37
 
+/*
+ * Keys of the default size live in the slot itself; larger ones are
+ * allocated from the secure pool when generated so that the store stays
+ * small.
+ */
 struct stored_key {
-    char key_data[BASE64_KEY_SIZE];
+    unsigned char *material; /* inline_material or a secure object */
+    size_t material_size;
+    unsigned char inline_material[QKD_KEY_SIZE];
     char key_id[UUID_STRING_SIZE];
+    uuid_t uuid;
+    uint32_t claim; /* Request that last matched the key */
     bool in_use;
 };
 
+/*
+ * Serializes access to the key store, which the key cache refills from a
+ * background thread.
+ */
+static pthread_mutex_t key_store_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct stored_key key_store[MAX_KEYS];
 static int32_t stored_keys;
 
-static char *base64_encode(const unsigned char *input, size_t length) {
-    if (length > INT_MAX)
-        return NULL;
+/* Binary UUID lookups into key_store, and unused slots. */
+static struct qkd_hash_index key_index;
+static int free_keys[MAX_KEYS];
+static uint32_t last_claim;
 
-    size_t encoded_size = 4U * ((length + 2U) / 3U);
-    char *encoded = malloc(encoded_size + 1U);
-    if (!encoded)
-        return NULL;
-
-    int result = EVP_EncodeBlock((unsigned char *)encoded, input, (int)length);
-    if (result < 0 || (size_t)result != encoded_size) {
-        free(encoded);
-        return NULL;
-    }
-    encoded[encoded_size] = '\0';
-    return encoded;
+/* Called with key_store_lock held. */
+static bool initialize_key_store(void) {
+    if (key_index.buckets)
+        return true;
+    if (!qkd_hash_index_init(&key_index, MAX_KEYS))
+        return false;
+    for (int i = 0; i < MAX_KEYS; i++)
+        free_keys[i] = MAX_KEYS - 1 - i;
+    return true;
 }
 
-static char *generate_uuid_string(void) {
+static int find_key(const char *key_id) {
     uuid_t uuid;
-    char *uuid_string = malloc(UUID_STRING_SIZE);
 
-    if (!uuid_string)
-        return NULL;
-    uuid_generate_random(uuid);
-    uuid_unparse_lower(uuid, uuid_string);
-    return uuid_string;
-}
+    if (!key_id || uuid_parse(key_id, uuid) != 0)
+        return -1;
 
-static int find_key(const char *key_id) {
-    if (!key_id)
+    int index = qkd_hash_index_find(&key_index, uuid);
+    if (index < 0 || strcmp(key_store[index].key_id, key_id) != 0)
         return -1;
+    return index;
+}
 
-    for (int i = 0; i < MAX_KEYS; i++) {
-        if (key_store[i].in_use && strcmp(key_store[i].key_id, key_id) == 0)
-            return i;
-    }
-    return -1;
+static void clear_key(struct stored_key *stored) {
+    if (stored->material && stored->material != stored->inline_material)
+        qkd_secure_free(stored->material);
+    OPENSSL_cleanse(stored, sizeof(*stored));
 }
 
-static int store_key(const qkd_key_t *key) {
-    for (int i = 0; i < MAX_KEYS; i++) {
-        if (!key_store[i].in_use) {
-            memcpy(key_store[i].key_id, key->key_ID, UUID_STRING_SIZE);
-            memcpy(key_store[i].key_data, key->key, BASE64_KEY_SIZE);
-            key_store[i].in_use = true;
-            stored_keys++;
-            return i;
-        }
-    }
-    return -1;
+static void release_key(int index) {
+    qkd_hash_index_remove(&key_index, key_store[index].uuid);
+    clear_key(&key_store[index]);
+    stored_keys--;
+    free_keys[MAX_KEYS - 1 - stored_keys] = index;
 }
 
-static bool create_key(qkd_key_t *key) {
-    unsigned char material[KEY_SIZE_BYTES];
+/*
+ * Generates a key straight into a free slot of the store. Keys are kept as
+ * raw bytes and only Base64 encoded for callers that want text.
+ */
+static int generate_key(size_t size) {
+    if (stored_keys == MAX_KEYS)
+        return -1;
 
-    if (RAND_bytes(material, sizeof(material)) != 1) {
-        OPENSSL_cleanse(material, sizeof(material));
-        return false;
+    int index = free_keys[MAX_KEYS - 1 - stored_keys];
+    struct stored_key *stored = &key_store[index];
+    stored->material = size <= sizeof(stored->inline_material)
+                           ? stored->inline_material
+                           : qkd_secure_alloc(size);
+    stored->material_size = size;
+    if (!stored->material || RAND_bytes(stored->material, (int)size) != 1) {
+        clear_key(stored);
+        return -1;
+    }
+    uuid_generate_random(stored->uuid);
+    uuid_unparse_lower(stored->uuid, stored->key_id);
+    if (!qkd_hash_index_insert(&key_index, stored->uuid, index)) {
+        clear_key(stored);
+        return -1;
     }
+    stored->in_use = true;
+    stored_keys++;
+    return index;
+}
+
+/* Copies stored keys into container using the caller's storage flags. */
+static bool fill_container(qkd_key_container_t *container,
+                           const int *indices, int32_t count) {
+    struct qkd_key_builder builder;
+    size_t string_size = 0;
 
-    key->key = base64_encode(material, sizeof(material));
-    OPENSSL_cleanse(material, sizeof(material));
-    key->key_ID = generate_uuid_string();
-    if (!key->key || !key->key_ID) {
-        free(key->key);
-        free(key->key_ID);
-        memset(key, 0, sizeof(*key));
+    for (int32_t i = 0; i < count; i++) {
+        size_t material_size = key_store[indices[i]].material_size;
+        string_size += UUID_STRING_SIZE + 4U * ((material_size + 2U) / 3U) + 1U;
+    }
+    if (!qkd_key_builder_begin(&builder, container, count, string_size)) {
+        qkd_key_container_free(container);
         return false;
     }
+    for (int32_t i = 0; i < count; i++) {
+        const struct stored_key *stored = &key_store[indices[i]];
+        if (!qkd_key_builder_add_raw(&builder, stored->key_id,
+                                     UUID_STRING_SIZE - 1, stored->uuid,
+                                     stored->material,
+                                     stored->material_size)) {
+            qkd_key_container_free(container);
+            return false;
+        }
+    }
     return true;
 }
 
@@ -135,18 +184,21 @@ static uint32_t sim_get_status(const char *kme_hostname,
     }
 
     status->key_size = QKD_KEY_SIZE_BITS;
+    pthread_mutex_lock(&key_store_lock);
     status->stored_key_count = MAX_KEYS - stored_keys;
+    pthread_mutex_unlock(&key_store_lock);
     status->max_key_count = MAX_KEYS;
-    status->max_key_per_request = MAX_KEYS;
-    status->max_key_size = QKD_KEY_SIZE_BITS;
-    status->min_key_size = QKD_KEY_SIZE_BITS;
+    status->max_key_per_request = MAX_KEYS_PER_REQUEST;
+    status->max_key_size = MAX_KEY_SIZE_BITS;
+    status->min_key_size = MIN_KEY_SIZE_BITS;
     status->max_SAE_ID_count = 0;
     return QKD_STATUS_OK;
 }
 
-static uint32_t sim_get_key(const char *kme_hostname, const char *slave_sae_id,
-                            qkd_key_request_t *request,
-                            qkd_key_container_t *container) {
+static uint32_t get_key_locked(const char *kme_hostname,
+                               const char *slave_sae_id,
+                               qkd_key_request_t *request,
+                               qkd_key_container_t *container) {
     if (!kme_hostname || !slave_sae_id || !container)
         return QKD_STATUS_BAD_REQUEST;
     if (request) {
@@ -159,93 +211,92 @@ static uint32_t sim_get_key(const char *kme_hostname, const char *slave_sae_id,
     int32_t number = request && request->number > 0 ? request->number : 1;
     int32_t size =
         request && request->size > 0 ? request->size : QKD_KEY_SIZE_BITS;
-    if (number > MAX_KEYS || size != QKD_KEY_SIZE_BITS)
+    if (number > MAX_KEYS_PER_REQUEST || size < MIN_KEY_SIZE_BITS ||
+        size > MAX_KEY_SIZE_BITS || size % MIN_KEY_SIZE_BITS != 0)
         return QKD_STATUS_BAD_REQUEST;
-    if (number > MAX_KEYS - stored_keys)
-        return QKD_STATUS_SERVER_ERROR;
-
-    memset(container, 0, sizeof(*container));
-    container->keys = calloc((size_t)number, sizeof(*container->keys));
-    if (!container->keys)
+    if (number > MAX_KEYS - stored_keys || !initialize_key_store())
         return QKD_STATUS_SERVER_ERROR;
-    container->key_count = number;
 
-    int stored_indices[MAX_KEYS];
+    int stored_indices[MAX_KEYS_PER_REQUEST];
     for (int32_t i = 0; i < number; i++) {
-        if (!create_key(&container->keys[i])) {
-            for (int32_t j = 0; j < i; j++) {
-                OPENSSL_cleanse(&key_store[stored_indices[j]],
-                                sizeof(key_store[stored_indices[j]]));
-                stored_keys--;
-            }
-            qkd_key_container_free(container);
-            return QKD_STATUS_SERVER_ERROR;
-        }
-        stored_indices[i] = store_key(&container->keys[i]);
+        stored_indices[i] = generate_key((size_t)size / QKD_BITS_PER_BYTE);
         if (stored_indices[i] < 0) {
-            for (int32_t j = 0; j < i; j++) {
-                OPENSSL_cleanse(&key_store[stored_indices[j]],
-                                sizeof(key_store[stored_indices[j]]));
-                stored_keys--;
-            }
-            qkd_key_container_free(container);
+            for (int32_t j = 0; j < i; j++)
+                release_key(stored_indices[j]);
             return QKD_STATUS_SERVER_ERROR;
         }
     }
+    if (!fill_container(container, stored_indices, number)) {
+        for (int32_t i = 0; i < number; i++)
+            release_key(stored_indices[i]);
+        return QKD_STATUS_SERVER_ERROR;
+    }
     return QKD_STATUS_OK;
 }
 
-static uint32_t sim_get_key_with_ids(const char *kme_hostname,
-                                     const char *master_sae_id,
-                                     qkd_key_ids_t *key_ids,
-                                     qkd_key_container_t *container) {
+static uint32_t get_key_with_ids_locked(const char *kme_hostname,
+                                        const char *master_sae_id,
+                                        qkd_key_ids_t *key_ids,
+                                        qkd_key_container_t *container) {
     if (!kme_hostname || !master_sae_id || !key_ids || !container ||
-        key_ids->key_ID_count <= 0 || key_ids->key_ID_count > MAX_KEYS ||
-        !key_ids->key_IDs || key_ids->key_IDs_extension)
+        key_ids->key_ID_count <= 0 ||
+        key_ids->key_ID_count > MAX_KEYS_PER_REQUEST || !key_ids->key_IDs ||
+        key_ids->key_IDs_extension)
         return QKD_STATUS_BAD_REQUEST;
 
-    int matched_indices[MAX_KEYS];
+    /* A key matched twice within one request is a duplicate ID. */
+    uint32_t claim = ++last_claim;
+    int matched_indices[MAX_KEYS_PER_REQUEST];
     for (int32_t i = 0; i < key_ids->key_ID_count; i++) {
         if (key_ids->key_IDs[i].key_ID_extension)
             return QKD_STATUS_BAD_REQUEST;
         matched_indices[i] = find_key(key_ids->key_IDs[i].key_ID);
-        if (matched_indices[i] < 0)
+        if (matched_indices[i] < 0 ||
+            key_store[matched_indices[i]].claim == claim)
             return QKD_STATUS_BAD_REQUEST;
-        for (int32_t j = 0; j < i; j++) {
-            if (matched_indices[j] == matched_indices[i])
-                return QKD_STATUS_BAD_REQUEST;
-        }
+        key_store[matched_indices[i]].claim = claim;
     }
 
-    memset(container, 0, sizeof(*container));
-    container->keys =
-        calloc((size_t)key_ids->key_ID_count, sizeof(*container->keys));
-    if (!container->keys)
+    if (!fill_container(container, matched_indices, key_ids->key_ID_count))
         return QKD_STATUS_SERVER_ERROR;
-    container->key_count = key_ids->key_ID_count;
 
-    for (int32_t i = 0; i < container->key_count; i++) {
-        struct stored_key *stored = &key_store[matched_indices[i]];
-        container->keys[i].key_ID = strdup(stored->key_id);
-        container->keys[i].key = strdup(stored->key_data);
-        if (!container->keys[i].key_ID || !container->keys[i].key) {
-            qkd_key_container_free(container);
-            return QKD_STATUS_SERVER_ERROR;
-        }
-    }
-
-    for (int32_t i = 0; i < container->key_count; i++) {
-        OPENSSL_cleanse(&key_store[matched_indices[i]],
-                        sizeof(key_store[matched_indices[i]]));
-        stored_keys--;
-    }
+    for (int32_t i = 0; i < container->key_count; i++)
+        release_key(matched_indices[i]);
     return QKD_STATUS_OK;
 }
 
+static uint32_t sim_get_key(const char *kme_hostname, const char *slave_sae_id,
+                            qkd_key_request_t *request,
+                            qkd_key_container_t *container) {
+    pthread_mutex_lock(&key_store_lock);
+    uint32_t result =
+        get_key_locked(kme_hostname, slave_sae_id, request, container);
+    pthread_mutex_unlock(&key_store_lock);
+    return result;
+}
+
+static uint32_t sim_get_key_with_ids(const char *kme_hostname,
+                                     const char *master_sae_id,
+                                     qkd_key_ids_t *key_ids,
+                                     qkd_key_container_t *container) {
+    pthread_mutex_lock(&key_store_lock);
+    uint32_t result = get_key_with_ids_locked(kme_hostname, master_sae_id,
+                                              key_ids, container);
+    pthread_mutex_unlock(&key_store_lock);
+    return result;
+}
+
 const struct qkd_014_backend simulated_backend = {.name = "simulated",
                                                   .get_status = sim_get_status,
                                                   .get_key = sim_get_key,
                                                   .get_key_with_ids =
                                                       sim_get_key_with_ids};
 
+#ifdef QKD_BACKEND_PLUGIN
+const struct qkd_014_backend *qkd_014_plugin_backend(uint32_t abi_version) {
+    return abi_version == QKD_014_BACKEND_ABI_VERSION ? &simulated_backend
+                                                      : NULL;
+}
+#endif
+
 #endif /* QKD_USE_SIMULATED */
@@ -0,0 +1,696 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_broker.c
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "etsi014/api.h"
+#include "etsi014/key_broker.h"
+#include "etsi014/key_container.h"
+#include "etsi014/status_cache.h"
+#include "qkd_etsi_api.h"
+
+#define BROKER_MAGIC 0x51424b52U /* "QBKR" */
+#define BROKER_VERSION 2U
+#define MAX_RING_KEYS 65536
+#define MAX_BROKER_KEY_SIZE_BITS 8192
+#define MAX_NAME_SIZE 256
+#define KEY_ID_SIZE 37
+#define CACHE_LINE_SIZE 64U
+#define RETRY_DELAY_MS 1000U
+#define IDLE_WAIT_SECONDS 1
+
+/*
+ * A slot is free for position p of its ring when its sequence is p and holds
+ * the key of position p when it is p + 1. Consumers set it to p + capacity
+ * once they have copied the key out, which frees it for the next lap.
+ */
+struct broker_slot {
+    uint64_t sequence;
+    char key_ID[KEY_ID_SIZE];
+    char key[];
+};
+
+/* Ring of one (KME, slave SAE) pair. Only the owner writes tail. */
+struct broker_ring {
+    char kme_hostname[MAX_NAME_SIZE];
+    char slave_sae_id[MAX_NAME_SIZE];
+    uint64_t offset; /* Of the first slot from the start of the segment */
+    uint32_t capacity;
+    uint32_t slot_size;
+    int32_t requested_key_size; /* Size matched against GET_KEY requests */
+    int32_t key_size;
+    int32_t low_watermark;
+    int32_t batch_size;
+    uint64_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+/* Start of the shared segment, followed by the slots of every ring. */
+struct broker_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t ring_count;
+    int32_t owner_pid; /* Process that created the segment */
+    uint64_t refills;  /* Counters are only written by the owner */
+    uint64_t refill_failures;
+    uint64_t stored_keys;
+    uint32_t owner_waiting __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct broker_ring rings[QKD_KEY_BROKER_MAX_PAIRS];
+};
+
+static struct {
+    pthread_rwlock_t lock;
+    bool attached;
+    bool owner;
+    bool stopping;
+    struct broker_segment *segment;
+    size_t size;
+    int fd;
+    char *name;
+    pthread_t thread;
+    bool filling[QKD_KEY_BROKER_MAX_PAIRS];
+    uint64_t retry_after_ms[QKD_KEY_BROKER_MAX_PAIRS];
+    uint64_t hits;
+    uint64_t misses;
+} broker = {.lock = PTHREAD_RWLOCK_INITIALIZER, .fd = -1};
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static uint64_t get_current_time_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static size_t base64_size(int32_t key_size_bits) {
+    size_t bytes = ((size_t)key_size_bits + 7U) / 8U;
+    return 4U * ((bytes + 2U) / 3U);
+}
+
+static size_t round_up(size_t value, size_t alignment) {
+    return (value + alignment - 1U) / alignment * alignment;
+}
+
+/* The futex is shared between processes, so it cannot be private. */
+static void futex_wait(uint32_t *word, uint32_t value, time_t seconds) {
+    struct timespec timeout = {.tv_sec = seconds};
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static struct broker_slot *slot_at(struct broker_segment *segment,
+                                   const struct broker_ring *ring,
+                                   uint64_t position) {
+    unsigned char *base = (unsigned char *)segment + ring->offset;
+    return (struct broker_slot *)(base + (position % ring->capacity) *
+                                             ring->slot_size);
+}
+
+static int32_t available_keys(const struct broker_ring *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    return tail > head ? (int32_t)(tail - head) : 0;
+}
+
+static void counter_add(uint64_t *counter, uint64_t value) {
+    uint64_t current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    __atomic_store_n(counter, current + value, __ATOMIC_RELAXED);
+}
+
+/* Called by the owner only, which is the single producer of every ring. */
+static bool push_key(struct broker_segment *segment, struct broker_ring *ring,
+                     const qkd_key_t *key) {
+    size_t id_length = key->key_ID ? strlen(key->key_ID) : 0;
+    size_t key_length = key->key ? strlen(key->key) : 0;
+
+    if (id_length == 0 || id_length >= KEY_ID_SIZE || key_length == 0 ||
+        sizeof(struct broker_slot) + key_length + 1U > ring->slot_size)
+        return false;
+
+    uint64_t position = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct broker_slot *slot = slot_at(segment, ring, position);
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != position)
+        return false;
+
+    memcpy(slot->key_ID, key->key_ID, id_length + 1U);
+    memcpy(slot->key, key->key, key_length + 1U);
+    __atomic_store_n(&slot->sequence, position + 1U, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, position + 1U, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+static bool refill_ring(struct broker_segment *segment,
+                        struct broker_ring *ring) {
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    if (!backend || !backend->get_key)
+        return false;
+
+    int32_t wanted = (int32_t)ring->capacity - available_keys(ring);
+    if (wanted > ring->batch_size)
+        wanted = ring->batch_size;
+    if (wanted <= 0)
+        return true;
+
+    qkd_key_request_t request = {.number = wanted,
+                                 .size = ring->key_size};
+    qkd_key_container_t container = {.flags = QKD_KEY_CONTAINER_ARENA};
+    if (backend->get_key(ring->kme_hostname, ring->slave_sae_id, &request,
+                         &container) != QKD_STATUS_OK)
+        return false;
+    qkd_status_cache_consume(ring->kme_hostname, ring->slave_sae_id,
+                             container.key_count);
+
+    int32_t stored = 0;
+    for (int32_t i = 0; i < container.key_count; i++) {
+        if (push_key(segment, ring, &container.keys[i]))
+            stored++;
+    }
+    counter_add(&segment->refills, 1);
+    counter_add(&segment->stored_keys, (uint64_t)stored);
+
+    if (stored < container.key_count) {
+        QKD_DBG_WARN("Discarded %d brokered keys",
+                     container.key_count - stored);
+    }
+    qkd_key_container_free(&container);
+    return stored > 0;
+}
+
+/* Returns the index of a ring to refill, -1 when all are full enough. */
+static int next_ring_to_refill(struct broker_segment *segment, uint64_t now) {
+    for (uint32_t i = 0; i < segment->ring_count; i++) {
+        const struct broker_ring *ring = &segment->rings[i];
+        int32_t available = available_keys(ring);
+        if (broker.retry_after_ms[i] > now)
+            continue;
+        if (available <= ring->low_watermark)
+            broker.filling[i] = true;
+        if (broker.filling[i] && available < (int32_t)ring->capacity)
+            return (int)i;
+        broker.filling[i] = false;
+    }
+    return -1;
+}
+
+static void *fill_thread(void *arg) {
+    struct broker_segment *segment = arg;
+
+    while (!__atomic_load_n(&broker.stopping, __ATOMIC_ACQUIRE)) {
+        int index = next_ring_to_refill(segment, get_current_time_ms());
+        if (index >= 0) {
+            if (!refill_ring(segment, &segment->rings[index])) {
+                counter_add(&segment->refill_failures, 1);
+                broker.retry_after_ms[index] =
+                    get_current_time_ms() + RETRY_DELAY_MS;
+            }
+            continue;
+        }
+
+        /*
+         * Consumers only make a system call to wake this thread when they
+         * see the flag set after taking a ring to its low watermark.
+         */
+        __atomic_store_n(&segment->owner_waiting, 1, __ATOMIC_SEQ_CST);
+        if (next_ring_to_refill(segment, get_current_time_ms()) < 0 &&
+            !__atomic_load_n(&broker.stopping, __ATOMIC_ACQUIRE))
+            futex_wait(&segment->owner_waiting, 1, IDLE_WAIT_SECONDS);
+        __atomic_store_n(&segment->owner_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+static void wake_owner(struct broker_segment *segment) {
+    if (__atomic_load_n(&segment->owner_waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&segment->owner_waiting, 0, __ATOMIC_SEQ_CST))
+        futex_wake(&segment->owner_waiting);
+}
+
+/* Learns the key size and batch limit of the pair from GET_STATUS. */
+static bool initialize_ring(struct broker_ring *ring,
+                            const qkd_key_broker_pair_t *pair,
+                            const qkd_key_broker_config_t *config,
+                            const struct qkd_014_backend *backend) {
+    int32_t key_size = config->key_size;
+    int32_t batch_size = config->capacity;
+    qkd_status_t status = {0};
+    size_t kme_length = strlen(pair->kme_hostname);
+    size_t sae_length = strlen(pair->slave_sae_id);
+
+    if (kme_length >= MAX_NAME_SIZE || sae_length >= MAX_NAME_SIZE)
+        return false;
+
+    if (backend->get_status &&
+        backend->get_status(pair->kme_hostname, pair->slave_sae_id,
+                            &status) == QKD_STATUS_OK) {
+        if (key_size == 0)
+            key_size = status.key_size;
+        if (status.max_key_per_request > 0 &&
+            status.max_key_per_request < batch_size)
+            batch_size = status.max_key_per_request;
+        qkd_status_free(&status);
+    }
+    if (key_size <= 0)
+        key_size = QKD_KEY_SIZE_BITS;
+    if (config->batch_size > 0 && config->batch_size < batch_size)
+        batch_size = config->batch_size;
+    if (key_size > MAX_BROKER_KEY_SIZE_BITS) {
+        QKD_DBG_ERR("Key size %d is too large for the key broker", key_size);
+        return false;
+    }
+
+    memcpy(ring->kme_hostname, pair->kme_hostname, kme_length + 1U);
+    memcpy(ring->slave_sae_id, pair->slave_sae_id, sae_length + 1U);
+    ring->capacity = (uint32_t)config->capacity;
+    ring->slot_size = (uint32_t)round_up(
+        sizeof(struct broker_slot) + base64_size(key_size) + 1U,
+        CACHE_LINE_SIZE);
+    ring->requested_key_size = config->key_size;
+    ring->key_size = key_size;
+    ring->low_watermark = config->low_watermark;
+    ring->batch_size = batch_size;
+    return true;
+}
+
+static void *map_segment(int fd, size_t size) {
+    void *segment =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment == MAP_FAILED)
+        return NULL;
+    if (mlock(segment, size) != 0) {
+        QKD_DBG_WARN("Failed to lock key broker memory");
+    }
+#ifdef MADV_DONTDUMP
+    madvise(segment, size, MADV_DONTDUMP);
+#endif
+    return segment;
+}
+
+static void unmap_segment(void) {
+    if (broker.owner)
+        OPENSSL_cleanse(broker.segment, broker.size);
+    munlock(broker.segment, broker.size);
+    munmap(broker.segment, broker.size);
+    if (broker.fd >= 0)
+        close(broker.fd);
+    if (broker.name)
+        shm_unlink(broker.name);
+    free(broker.name);
+    broker.segment = NULL;
+    broker.size = 0;
+    broker.fd = -1;
+    broker.name = NULL;
+    broker.owner = false;
+}
+
+/* Children share the rings of the owner but not its filling thread. */
+static void forget_ownership(void) {
+    if (!broker.owner)
+        return;
+
+    broker.owner = false;
+    free(broker.name);
+    broker.name = NULL;
+    if (broker.fd >= 0)
+        close(broker.fd);
+    broker.fd = -1;
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, forget_ownership);
+}
+
+/*
+ * True when name is a broker segment whose owner has exited without stopping
+ * it. Anything else under the name, including a segment that is still being
+ * set up, is left alone.
+ */
+static bool is_stale_segment(const char *name) {
+    struct broker_segment header;
+    size_t length = offsetof(struct broker_segment, refills);
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    ssize_t count = pread(fd, &header, length, 0);
+    close(fd);
+    if (count != (ssize_t)length || header.magic != BROKER_MAGIC ||
+        header.version != BROKER_VERSION || header.owner_pid <= 0)
+        return false;
+    return kill((pid_t)header.owner_pid, 0) != 0 && errno == ESRCH;
+}
+
+static int create_segment_fd(const char *name) {
+    if (!name)
+        return memfd_create("qkd-key-broker", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd >= 0 || errno != EEXIST)
+        return fd;
+    if (!is_stale_segment(name)) {
+        QKD_DBG_ERR("Key broker segment %s is in use", name);
+        return -1;
+    }
+
+    /* Clients of the dead owner keep their mapping of the old segment. */
+    QKD_DBG_WARN("Replacing stale key broker segment %s", name);
+    shm_unlink(name);
+    return shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+}
+
+static bool is_valid_config(const qkd_key_broker_config_t *config) {
+    if (!config || !config->pairs || config->pair_count == 0 ||
+        config->pair_count > QKD_KEY_BROKER_MAX_PAIRS ||
+        config->low_watermark < 0 ||
+        config->capacity <= config->low_watermark ||
+        config->capacity > MAX_RING_KEYS || config->batch_size < 0 ||
+        config->key_size < 0 || config->key_size > MAX_BROKER_KEY_SIZE_BITS)
+        return false;
+
+    for (size_t i = 0; i < config->pair_count; i++) {
+        if (!config->pairs[i].kme_hostname || !config->pairs[i].slave_sae_id)
+            return false;
+    }
+    return true;
+}
+
+uint32_t qkd_key_broker_start(const qkd_key_broker_config_t *config) {
+    if (!is_valid_config(config))
+        return QKD_STATUS_BAD_REQUEST;
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    if (!backend || !backend->get_key) {
+        QKD_DBG_ERR("No REST backend available");
+        return QKD_STATUS_SERVER_ERROR;
+    }
+
+    struct broker_segment layout = {.magic = BROKER_MAGIC,
+                                    .version = BROKER_VERSION,
+                                    .ring_count = (uint32_t)config->pair_count,
+                                    .owner_pid = (int32_t)getpid()};
+    size_t size = round_up(sizeof(layout), CACHE_LINE_SIZE);
+    for (size_t i = 0; i < config->pair_count; i++) {
+        struct broker_ring *ring = &layout.rings[i];
+        if (!initialize_ring(ring, &config->pairs[i], config, backend))
+            return QKD_STATUS_BAD_REQUEST;
+        ring->offset = size;
+        size += (size_t)ring->capacity * ring->slot_size;
+    }
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    layout.size = round_up(size, page_size);
+
+    pthread_once(&atfork_once, register_atfork);
+    pthread_rwlock_wrlock(&broker.lock);
+    if (broker.attached) {
+        pthread_rwlock_unlock(&broker.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+
+    broker.fd = create_segment_fd(config->name);
+    if (broker.fd < 0)
+        goto fail;
+    broker.owner = true;
+    if (config->name && !(broker.name = strdup(config->name)))
+        goto fail;
+    if (ftruncate(broker.fd, (off_t)layout.size) != 0)
+        goto fail;
+    if (!config->name &&
+        fcntl(broker.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+        QKD_DBG_WARN("Failed to seal the key broker segment");
+    }
+    broker.size = (size_t)layout.size;
+    broker.segment = map_segment(broker.fd, broker.size);
+    if (!broker.segment)
+        goto fail;
+
+    *broker.segment = layout;
+    for (uint32_t i = 0; i < layout.ring_count; i++) {
+        struct broker_ring *ring = &broker.segment->rings[i];
+        for (uint64_t position = 0; position < ring->capacity; position++)
+            slot_at(broker.segment, ring, position)->sequence = position;
+        broker.filling[i] = false;
+        broker.retry_after_ms[i] = 0;
+    }
+    broker.stopping = false;
+    broker.hits = 0;
+    broker.misses = 0;
+    if (pthread_create(&broker.thread, NULL, fill_thread, broker.segment) !=
+        0)
+        goto fail;
+
+    __atomic_store_n(&broker.attached, true, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&broker.lock);
+    return QKD_STATUS_OK;
+
+fail:
+    if (broker.segment) {
+        unmap_segment();
+    } else {
+        if (broker.fd >= 0)
+            close(broker.fd);
+        if (config->name && broker.owner)
+            shm_unlink(config->name);
+        free(broker.name);
+        broker.fd = -1;
+        broker.name = NULL;
+        broker.owner = false;
+    }
+    pthread_rwlock_unlock(&broker.lock);
+    return QKD_STATUS_SERVER_ERROR;
+}
+
+static bool is_valid_segment(const struct broker_segment *segment,
+                             size_t size) {
+    if (segment->magic != BROKER_MAGIC ||
+        segment->version != BROKER_VERSION || segment->size != size ||
+        segment->ring_count == 0 ||
+        segment->ring_count > QKD_KEY_BROKER_MAX_PAIRS)
+        return false;
+
+    for (uint32_t i = 0; i < segment->ring_count; i++) {
+        const struct broker_ring *ring = &segment->rings[i];
+        if (!memchr(ring->kme_hostname, '\0', MAX_NAME_SIZE) ||
+            !memchr(ring->slave_sae_id, '\0', MAX_NAME_SIZE) ||
+            ring->capacity == 0 || ring->capacity > MAX_RING_KEYS ||
+            ring->slot_size % CACHE_LINE_SIZE != 0 ||
+            ring->slot_size <= sizeof(struct broker_slot) ||
+            ring->offset % CACHE_LINE_SIZE != 0 ||
+            ring->offset < sizeof(*segment) || ring->offset > size ||
+            (size - ring->offset) / ring->slot_size < ring->capacity)
+            return false;
+    }
+    return true;
+}
+
+uint32_t qkd_key_broker_attach_fd(int fd) {
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 0 ||
+        (uint64_t)st.st_size < sizeof(struct broker_segment))
+        return QKD_STATUS_BAD_REQUEST;
+
+    pthread_rwlock_wrlock(&broker.lock);
+    if (broker.attached) {
+        pthread_rwlock_unlock(&broker.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+
+    size_t size = (size_t)st.st_size;
+    struct broker_segment *segment = map_segment(fd, size);
+    if (!segment) {
+        pthread_rwlock_unlock(&broker.lock);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+    if (!is_valid_segment(segment, size)) {
+        QKD_DBG_ERR("Not a key broker segment");
+        munlock(segment, size);
+        munmap(segment, size);
+        pthread_rwlock_unlock(&broker.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+
+    broker.segment = segment;
+    broker.size = size;
+    broker.hits = 0;
+    broker.misses = 0;
+    __atomic_store_n(&broker.attached, true, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&broker.lock);
+    return QKD_STATUS_OK;
+}
+
+uint32_t qkd_key_broker_attach(const char *name) {
+    if (!name)
+        return QKD_STATUS_BAD_REQUEST;
+
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        QKD_DBG_ERR("Key broker segment %s not found", name);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    uint32_t result = qkd_key_broker_attach_fd(fd);
+    close(fd);
+    return result;
+}
+
+void qkd_key_broker_detach(void) {
+    pthread_rwlock_wrlock(&broker.lock);
+    if (!broker.attached) {
+        pthread_rwlock_unlock(&broker.lock);
+        return;
+    }
+    __atomic_store_n(&broker.attached, false, __ATOMIC_RELEASE);
+
+    if (broker.owner) {
+        __atomic_store_n(&broker.stopping, true, __ATOMIC_RELEASE);
+        __atomic_store_n(&broker.segment->owner_waiting, 0, __ATOMIC_SEQ_CST);
+        futex_wake(&broker.segment->owner_waiting);
+        pthread_join(broker.thread, NULL);
+    }
+    unmap_segment();
+    pthread_rwlock_unlock(&broker.lock);
+}
+
+void qkd_key_broker_stop(void) { qkd_key_broker_detach(); }
+
+int qkd_key_broker_fd(void) {
+    pthread_rwlock_rdlock(&broker.lock);
+    int fd = broker.attached && broker.owner ? broker.fd : -1;
+    pthread_rwlock_unlock(&broker.lock);
+    return fd;
+}
+
+void qkd_key_broker_get_stats(qkd_key_broker_stats_t *stats) {
+    if (!stats)
+        return;
+
+    memset(stats, 0, sizeof(*stats));
+    pthread_rwlock_rdlock(&broker.lock);
+    if (broker.attached) {
+        struct broker_segment *segment = broker.segment;
+        stats->hits = __atomic_load_n(&broker.hits, __ATOMIC_RELAXED);
+        stats->misses = __atomic_load_n(&broker.misses, __ATOMIC_RELAXED);
+        stats->refills = __atomic_load_n(&segment->refills, __ATOMIC_RELAXED);
+        stats->refill_failures =
+            __atomic_load_n(&segment->refill_failures, __ATOMIC_RELAXED);
+        stats->stored_keys =
+            __atomic_load_n(&segment->stored_keys, __ATOMIC_RELAXED);
+        for (uint32_t i = 0; i < segment->ring_count; i++)
+            stats->available_keys += available_keys(&segment->rings[i]);
+    }
+    pthread_rwlock_unlock(&broker.lock);
+}
+
+static bool is_brokered_request(const struct broker_ring *ring,
+                                const qkd_key_request_t *request) {
+    if (!request)
+        return ring->requested_key_size == 0;
+
+    return (request->number == 0 || request->number == 1) &&
+           request->size == ring->requested_key_size &&
+           request->additional_SAE_count == 0 &&
+           !request->additional_slave_SAE_IDs &&
+           !request->extension_mandatory;
+}
+
+/*
+ * Claims the oldest key of the ring by advancing head past a filled slot,
+ * copies it into container and hands the slot back to the owner.
+ */
+static bool pop_key(struct broker_segment *segment, struct broker_ring *ring,
+                    qkd_key_container_t *container) {
+    uint64_t position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    struct broker_slot *slot;
+
+    for (;;) {
+        slot = slot_at(segment, ring, position);
+        uint64_t sequence =
+            __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t difference = (int64_t)(sequence - (position + 1U));
+        if (difference < 0)
+            return false;
+        if (difference > 0) {
+            position = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&ring->head, &position, position + 1U,
+                                        true, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+
+    size_t key_ID_length = strnlen(slot->key_ID, KEY_ID_SIZE - 1U);
+    size_t key_length =
+        strnlen(slot->key, ring->slot_size - sizeof(struct broker_slot) - 1U);
+    struct qkd_key_builder builder;
+    bool copied = qkd_key_builder_begin(&builder, container, 1,
+                                        key_ID_length + key_length + 2U) &&
+                  qkd_key_builder_add(&builder, slot->key_ID, key_ID_length,
+                                      slot->key, key_length);
+    if (!copied)
+        qkd_key_container_free(container);
+
+    OPENSSL_cleanse(slot->key_ID, ring->slot_size - sizeof(slot->sequence));
+    __atomic_store_n(&slot->sequence, position + ring->capacity,
+                     __ATOMIC_RELEASE);
+    if (available_keys(ring) <= ring->low_watermark)
+        wake_owner(segment);
+    return copied;
+}
+
+bool qkd_key_broker_get_key(const char *kme_hostname, const char *slave_sae_id,
+                            const qkd_key_request_t *request,
+                            qkd_key_container_t *container) {
+    if (!__atomic_load_n(&broker.attached, __ATOMIC_ACQUIRE))
+        return false;
+
+    pthread_rwlock_rdlock(&broker.lock);
+    struct broker_segment *segment = broker.segment;
+    struct broker_ring *ring = NULL;
+    for (uint32_t i = 0; broker.attached && i < segment->ring_count; i++) {
+        if (strcmp(segment->rings[i].kme_hostname, kme_hostname) == 0 &&
+            strcmp(segment->rings[i].slave_sae_id, slave_sae_id) == 0) {
+            ring = &segment->rings[i];
+            break;
+        }
+    }
+
+    bool served = false;
+    if (ring && is_brokered_request(ring, request)) {
+        served = pop_key(segment, ring, container);
+        __atomic_fetch_add(served ? &broker.hits : &broker.misses, 1,
+                           __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&broker.lock);
+    return served;
+}
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_cache.c
+ */
+
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "etsi014/api.h"
+#include "etsi014/key_cache.h"
+#include "etsi014/key_container.h"
+#include "etsi014/status_cache.h"
+#include "qkd_etsi_api.h"
+
+#define MAX_CACHE_ENTRIES 16
+#define MAX_CACHED_KEYS 1024
+#define MAX_CACHED_KEY_SIZE_BITS 8192
+#define KEY_ID_SIZE 37
+#define RETRY_DELAY_MS 1000U
+#define IDLE_WAIT_SECONDS 1
+
+/* Keys of one (KME, slave SAE) pair, kept in a ring of fixed-size slots. */
+struct cache_entry {
+    char *kme_hostname;
+    char *slave_sae_id;
+    unsigned char *region;
+    size_t region_size;
+    size_t slot_size;
+    int32_t capacity;
+    int32_t head;
+    int32_t count;
+    int32_t batch_size;
+    int32_t key_size;
+    bool initialized;
+    bool filling; /* Below the low watermark and not yet back at the high */
+    bool fd_armed; /* A request found no key since event_fd was signalled */
+    int event_fd;  /* -1 until qkd_key_cache_fd() is called */
+    uint64_t retry_after_ms;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool enabled;
+    bool stopping;
+    qkd_key_cache_config_t config;
+    struct cache_entry entries[MAX_CACHE_ENTRIES];
+    size_t entry_count;
+    qkd_key_cache_stats_t stats;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER,
+           .wake = PTHREAD_COND_INITIALIZER};
+
+static uint64_t get_current_time_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static size_t base64_size(int32_t key_size_bits) {
+    size_t bytes = ((size_t)key_size_bits + 7U) / 8U;
+    return 4U * ((bytes + 2U) / 3U);
+}
+
+static unsigned char *slot_at(const struct cache_entry *entry,
+                              int32_t position) {
+    return entry->region + (size_t)position * entry->slot_size;
+}
+
+static void release_entry(struct cache_entry *entry) {
+    if (entry->event_fd >= 0)
+        close(entry->event_fd);
+    qkd_locked_free(entry->region, entry->region_size);
+    free(entry->kme_hostname);
+    free(entry->slave_sae_id);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* Called with cache.lock held. */
+static struct cache_entry *find_entry(const char *kme_hostname,
+                                      const char *slave_sae_id, bool create) {
+    for (size_t i = 0; i < cache.entry_count; i++) {
+        struct cache_entry *entry = &cache.entries[i];
+        if (strcmp(entry->kme_hostname, kme_hostname) == 0 &&
+            strcmp(entry->slave_sae_id, slave_sae_id) == 0)
+            return entry;
+    }
+    if (!create || cache.entry_count == MAX_CACHE_ENTRIES)
+        return NULL;
+
+    struct cache_entry *entry = &cache.entries[cache.entry_count];
+    entry->event_fd = -1;
+    entry->fd_armed = true;
+    entry->kme_hostname = strdup(kme_hostname);
+    entry->slave_sae_id = strdup(slave_sae_id);
+    if (!entry->kme_hostname || !entry->slave_sae_id) {
+        release_entry(entry);
+        return NULL;
+    }
+    cache.entry_count++;
+    return entry;
+}
+
+/* Called with cache.lock held. */
+static struct cache_entry *next_entry_to_refill(uint64_t now) {
+    for (size_t i = 0; i < cache.entry_count; i++) {
+        struct cache_entry *entry = &cache.entries[i];
+        if (entry->retry_after_ms > now)
+            continue;
+        if (!entry->initialized || entry->count <= cache.config.low_watermark)
+            entry->filling = true;
+        if (entry->filling &&
+            (!entry->initialized || entry->count < entry->capacity))
+            return entry;
+        entry->filling = false;
+    }
+    return NULL;
+}
+
+/* Learns the key size and batch limit of the pair from GET_STATUS. */
+static bool initialize_entry(struct cache_entry *entry,
+                             const struct qkd_014_backend *backend) {
+    int32_t key_size = cache.config.key_size;
+    int32_t batch_size = cache.config.high_watermark;
+    qkd_status_t status = {0};
+
+    if (backend->get_status &&
+        backend->get_status(entry->kme_hostname, entry->slave_sae_id,
+                            &status) == QKD_STATUS_OK) {
+        if (key_size == 0)
+            key_size = status.key_size;
+        if (status.max_key_per_request > 0 &&
+            status.max_key_per_request < batch_size)
+            batch_size = status.max_key_per_request;
+        qkd_status_free(&status);
+    }
+    if (key_size <= 0)
+        key_size = QKD_KEY_SIZE_BITS;
+    if (cache.config.batch_size > 0 && cache.config.batch_size < batch_size)
+        batch_size = cache.config.batch_size;
+    if (key_size > MAX_CACHED_KEY_SIZE_BITS) {
+        QKD_DBG_ERR("Key size %d is too large for the key cache", key_size);
+        return false;
+    }
+
+    size_t slot_size = KEY_ID_SIZE + base64_size(key_size) + 1U;
+    size_t region_size = slot_size * (size_t)cache.config.high_watermark;
+    unsigned char *region = qkd_locked_alloc(&region_size);
+    if (!region)
+        return false;
+
+    pthread_mutex_lock(&cache.lock);
+    entry->region = region;
+    entry->region_size = region_size;
+    entry->slot_size = slot_size;
+    entry->capacity = cache.config.high_watermark;
+    entry->batch_size = batch_size;
+    entry->key_size = key_size;
+    entry->initialized = true;
+    pthread_mutex_unlock(&cache.lock);
+    return true;
+}
+
+/* Called with cache.lock held. */
+static bool store_key(struct cache_entry *entry, const qkd_key_t *key) {
+    size_t id_length = key->key_ID ? strlen(key->key_ID) : 0;
+    size_t key_length = key->key ? strlen(key->key) : 0;
+
+    if (entry->count == entry->capacity || id_length == 0 ||
+        id_length >= KEY_ID_SIZE || key_length == 0 ||
+        KEY_ID_SIZE + key_length + 1U > entry->slot_size)
+        return false;
+
+    int32_t position = (entry->head + entry->count) % entry->capacity;
+    unsigned char *slot = slot_at(entry, position);
+    memcpy(slot, key->key_ID, id_length + 1U);
+    memcpy(slot + KEY_ID_SIZE, key->key, key_length + 1U);
+    entry->count++;
+    return true;
+}
+
+/* Called with cache.lock held. */
+static void signal_fd(struct cache_entry *entry) {
+    uint64_t increment = 1;
+
+    entry->fd_armed = false;
+    if (write(entry->event_fd, &increment, sizeof(increment)) < 0) {
+        QKD_DBG_WARN("Failed to signal the key cache descriptor");
+    }
+}
+
+static bool refill_entry(struct cache_entry *entry) {
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    if (!backend || !backend->get_key)
+        return false;
+    if (!entry->initialized && !initialize_entry(entry, backend))
+        return false;
+
+    pthread_mutex_lock(&cache.lock);
+    int32_t wanted = entry->capacity - entry->count;
+    pthread_mutex_unlock(&cache.lock);
+    if (wanted > entry->batch_size)
+        wanted = entry->batch_size;
+    if (wanted <= 0)
+        return true;
+
+    qkd_key_request_t request = {.number = wanted,
+                                 .size = entry->key_size};
+    qkd_key_container_t container = {.flags = QKD_KEY_CONTAINER_ARENA};
+    if (backend->get_key(entry->kme_hostname, entry->slave_sae_id, &request,
+                         &container) != QKD_STATUS_OK)
+        return false;
+    qkd_status_cache_consume(entry->kme_hostname, entry->slave_sae_id,
+                             container.key_count);
+
+    pthread_mutex_lock(&cache.lock);
+    int32_t stored = 0;
+    for (int32_t i = 0; i < container.key_count; i++) {
+        if (store_key(entry, &container.keys[i]))
+            stored++;
+    }
+    cache.stats.refills++;
+    cache.stats.prefetched_keys += (uint64_t)stored;
+    cache.stats.cached_keys += stored;
+    if (stored > 0 && entry->fd_armed && entry->event_fd >= 0)
+        signal_fd(entry);
+    pthread_mutex_unlock(&cache.lock);
+
+    if (stored < container.key_count) {
+        QKD_DBG_WARN("Discarded %d prefetched keys",
+                     container.key_count - stored);
+    }
+    qkd_key_container_free(&container);
+    return stored > 0;
+}
+
+static void *refill_thread(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&cache.lock);
+    while (!cache.stopping) {
+        struct cache_entry *entry = next_entry_to_refill(get_current_time_ms());
+        if (!entry) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += IDLE_WAIT_SECONDS;
+            pthread_cond_timedwait(&cache.wake, &cache.lock, &deadline);
+            continue;
+        }
+
+        /* Entries are only released after this thread has been joined. */
+        pthread_mutex_unlock(&cache.lock);
+        bool refilled = refill_entry(entry);
+        pthread_mutex_lock(&cache.lock);
+        if (!refilled) {
+            cache.stats.refill_failures++;
+            entry->retry_after_ms = get_current_time_ms() + RETRY_DELAY_MS;
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return NULL;
+}
+
+uint32_t qkd_key_cache_enable(const qkd_key_cache_config_t *config) {
+    if (!config || config->low_watermark < 0 ||
+        config->high_watermark <= config->low_watermark ||
+        config->high_watermark > MAX_CACHED_KEYS || config->batch_size < 0 ||
+        config->key_size < 0 || config->key_size > MAX_CACHED_KEY_SIZE_BITS)
+        return QKD_STATUS_BAD_REQUEST;
+
+    pthread_mutex_lock(&cache.lock);
+    if (cache.enabled) {
+        pthread_mutex_unlock(&cache.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    cache.config = *config;
+    cache.stopping = false;
+    memset(&cache.stats, 0, sizeof(cache.stats));
+    if (pthread_create(&cache.thread, NULL, refill_thread, NULL) != 0) {
+        pthread_mutex_unlock(&cache.lock);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+    cache.enabled = true;
+    pthread_mutex_unlock(&cache.lock);
+    return QKD_STATUS_OK;
+}
+
+void qkd_key_cache_disable(void) {
+    pthread_mutex_lock(&cache.lock);
+    if (!cache.enabled) {
+        pthread_mutex_unlock(&cache.lock);
+        return;
+    }
+    cache.enabled = false;
+    cache.stopping = true;
+    pthread_cond_signal(&cache.wake);
+    pthread_mutex_unlock(&cache.lock);
+
+    pthread_join(cache.thread, NULL);
+
+    pthread_mutex_lock(&cache.lock);
+    for (size_t i = 0; i < cache.entry_count; i++)
+        release_entry(&cache.entries[i]);
+    cache.entry_count = 0;
+    cache.stats.cached_keys = 0;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void qkd_key_cache_get_stats(qkd_key_cache_stats_t *stats) {
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&cache.lock);
+    *stats = cache.stats;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+int qkd_key_cache_fd(const char *kme_hostname, const char *slave_sae_id) {
+    if (!kme_hostname || !slave_sae_id)
+        return -1;
+
+    pthread_mutex_lock(&cache.lock);
+    struct cache_entry *entry =
+        cache.enabled ? find_entry(kme_hostname, slave_sae_id, true) : NULL;
+    if (entry && entry->event_fd < 0) {
+        entry->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        /* Keys cached before the descriptor existed are announced now. */
+        if (entry->event_fd >= 0 && entry->count > 0)
+            signal_fd(entry);
+    }
+    int fd = entry ? entry->event_fd : -1;
+    if (entry && !entry->initialized)
+        pthread_cond_signal(&cache.wake);
+    pthread_mutex_unlock(&cache.lock);
+    return fd;
+}
+
+static bool is_cacheable_request(const qkd_key_request_t *request) {
+    if (!request)
+        return cache.config.key_size == 0;
+
+    return (request->number == 0 || request->number == 1) &&
+           request->size == cache.config.key_size &&
+           request->additional_SAE_count == 0 &&
+           !request->additional_slave_SAE_IDs &&
+           !request->extension_mandatory;
+}
+
+/* Called with cache.lock held. Moves the oldest key into container. */
+static bool take_key(struct cache_entry *entry,
+                     qkd_key_container_t *container) {
+    unsigned char *slot = slot_at(entry, entry->head);
+    const char *key_ID = (const char *)slot;
+    const char *key = (const char *)slot + KEY_ID_SIZE;
+    size_t key_ID_length = strlen(key_ID);
+    size_t key_length = strlen(key);
+
+    struct qkd_key_builder builder;
+    if (!qkd_key_builder_begin(&builder, container, 1,
+                               key_ID_length + key_length + 2U) ||
+        !qkd_key_builder_add(&builder, key_ID, key_ID_length, key,
+                             key_length)) {
+        qkd_key_container_free(container);
+        return false;
+    }
+    OPENSSL_cleanse(slot, entry->slot_size);
+    entry->head = (entry->head + 1) % entry->capacity;
+    entry->count--;
+    return true;
+}
+
+bool qkd_key_cache_get_key(const char *kme_hostname, const char *slave_sae_id,
+                           const qkd_key_request_t *request,
+                           qkd_key_container_t *container) {
+    pthread_mutex_lock(&cache.lock);
+    if (!cache.enabled || !is_cacheable_request(request)) {
+        pthread_mutex_unlock(&cache.lock);
+        return false;
+    }
+
+    bool served = false;
+    struct cache_entry *entry = find_entry(kme_hostname, slave_sae_id, true);
+    if (entry && entry->initialized && entry->count > 0)
+        served = take_key(entry, container);
+
+    if (served) {
+        cache.stats.hits++;
+        cache.stats.cached_keys--;
+    } else {
+        cache.stats.misses++;
+        if (entry)
+            entry->fd_armed = true;
+    }
+    if (entry && (!entry->initialized ||
+                  entry->count <= cache.config.low_watermark))
+        pthread_cond_signal(&cache.wake);
+    pthread_mutex_unlock(&cache.lock);
+    return served;
+}
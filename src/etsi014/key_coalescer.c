@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_coalescer.c
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "etsi014/api.h"
+#include "etsi014/key_coalescer.h"
+#include "etsi014/key_container.h"
+#include "qkd_etsi_api.h"
+
+#define MAX_KEY_IDS 1024
+#define MAX_WINDOW_US 1000000
+
+/* One GET_KEY_WITH_IDS call, living on the stack of the calling thread. */
+struct waiter {
+    qkd_key_ids_t *key_ids;
+    qkd_key_container_t *container;
+    uint32_t result;
+    bool done;
+    bool retry; /* The combined request failed, repeat the call alone */
+    struct waiter *next;
+};
+
+/*
+ * Calls collected for one (KME, master SAE) pair. The batch lives on the
+ * stack of its first caller, which sends the combined request.
+ */
+struct batch {
+    const char *kme_hostname;
+    const char *master_sae_id;
+    int32_t key_id_count;
+    int32_t waiter_count;
+    struct waiter *head;
+    struct waiter *tail;
+    pthread_cond_t full;
+    struct batch *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    bool enabled;
+    qkd_key_coalescer_config_t config;
+    struct batch *open;
+    qkd_key_coalescer_stats_t stats;
+} coalescer = {.lock = PTHREAD_MUTEX_INITIALIZER,
+               .done = PTHREAD_COND_INITIALIZER};
+
+uint32_t qkd_key_coalescer_enable(const qkd_key_coalescer_config_t *config) {
+    if (!config || config->window_us <= 0 ||
+        config->window_us > MAX_WINDOW_US || config->max_key_ids < 2 ||
+        config->max_key_ids > MAX_KEY_IDS)
+        return QKD_STATUS_BAD_REQUEST;
+
+    pthread_mutex_lock(&coalescer.lock);
+    if (coalescer.enabled) {
+        pthread_mutex_unlock(&coalescer.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    coalescer.config = *config;
+    coalescer.enabled = true;
+    memset(&coalescer.stats, 0, sizeof(coalescer.stats));
+    pthread_mutex_unlock(&coalescer.lock);
+    return QKD_STATUS_OK;
+}
+
+/* Batches already open are still sent; new calls go straight to the KME. */
+void qkd_key_coalescer_disable(void) {
+    pthread_mutex_lock(&coalescer.lock);
+    coalescer.enabled = false;
+    pthread_mutex_unlock(&coalescer.lock);
+}
+
+void qkd_key_coalescer_get_stats(qkd_key_coalescer_stats_t *stats) {
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&coalescer.lock);
+    *stats = coalescer.stats;
+    pthread_mutex_unlock(&coalescer.lock);
+}
+
+static bool is_coalescible(const qkd_key_ids_t *key_ids) {
+    if (!key_ids->key_IDs || key_ids->key_ID_count <= 0 ||
+        key_ids->key_ID_count >= coalescer.config.max_key_ids ||
+        key_ids->key_IDs_extension)
+        return false;
+
+    for (int32_t i = 0; i < key_ids->key_ID_count; i++) {
+        if (!key_ids->key_IDs[i].key_ID || key_ids->key_IDs[i].key_ID_extension)
+            return false;
+    }
+    return true;
+}
+
+/* Called with coalescer.lock held. */
+static struct batch *find_open_batch(const char *kme_hostname,
+                                     const char *master_sae_id,
+                                     int32_t key_id_count) {
+    for (struct batch *batch = coalescer.open; batch; batch = batch->next) {
+        if (batch->key_id_count + key_id_count <=
+                coalescer.config.max_key_ids &&
+            strcmp(batch->kme_hostname, kme_hostname) == 0 &&
+            strcmp(batch->master_sae_id, master_sae_id) == 0)
+            return batch;
+    }
+    return NULL;
+}
+
+/* Called with coalescer.lock held. */
+static void add_waiter(struct batch *batch, struct waiter *waiter) {
+    if (batch->tail)
+        batch->tail->next = waiter;
+    else
+        batch->head = waiter;
+    batch->tail = waiter;
+    batch->key_id_count += waiter->key_ids->key_ID_count;
+    batch->waiter_count++;
+}
+
+/* Called with coalescer.lock held. */
+static void close_batch(struct batch *batch) {
+    for (struct batch **link = &coalescer.open; *link;
+         link = &(*link)->next) {
+        if (*link == batch) {
+            *link = batch->next;
+            return;
+        }
+    }
+}
+
+static const qkd_key_t *find_response_key(const qkd_key_container_t *response,
+                                          const char *key_ID) {
+    for (int32_t i = 0; i < response->key_count; i++) {
+        if (response->keys[i].key_ID && response->keys[i].key &&
+            strcmp(response->keys[i].key_ID, key_ID) == 0)
+            return &response->keys[i];
+    }
+    return NULL;
+}
+
+/*
+ * Copies the keys requested by waiter out of the combined response, using
+ * the storage flags of the waiter's container.
+ */
+static void hand_out_keys(const qkd_key_container_t *response,
+                          struct waiter *waiter) {
+    int32_t count = waiter->key_ids->key_ID_count;
+    size_t string_size = 0;
+
+    for (int32_t i = 0; i < count; i++) {
+        const char *key_ID = waiter->key_ids->key_IDs[i].key_ID;
+        const qkd_key_t *key = find_response_key(response, key_ID);
+        if (!key) {
+            QKD_DBG_ERR("Key %s missing from the combined response", key_ID);
+            waiter->result = QKD_STATUS_SERVER_ERROR;
+            return;
+        }
+        string_size += strlen(key->key_ID) + strlen(key->key) + 2U;
+    }
+
+    struct qkd_key_builder builder;
+    bool built =
+        qkd_key_builder_begin(&builder, waiter->container, count, string_size);
+    for (int32_t i = 0; built && i < count; i++) {
+        const qkd_key_t *key =
+            find_response_key(response, waiter->key_ids->key_IDs[i].key_ID);
+        built = qkd_key_builder_add(&builder, key->key_ID, strlen(key->key_ID),
+                                    key->key, strlen(key->key));
+    }
+    if (!built) {
+        qkd_key_container_free(waiter->container);
+        waiter->result = QKD_STATUS_SERVER_ERROR;
+        return;
+    }
+    waiter->result = QKD_STATUS_OK;
+}
+
+/* Sends the combined request of batch and fills in every waiter. */
+static void send_batch(struct batch *batch,
+                       const struct qkd_014_backend *backend) {
+    if (batch->waiter_count == 1) {
+        struct waiter *waiter = batch->head;
+        waiter->result = backend->get_key_with_ids(
+            batch->kme_hostname, batch->master_sae_id, waiter->key_ids,
+            waiter->container);
+        return;
+    }
+
+    qkd_key_ids_t combined = {0};
+    combined.key_IDs =
+        calloc((size_t)batch->key_id_count, sizeof(*combined.key_IDs));
+    if (!combined.key_IDs) {
+        for (struct waiter *waiter = batch->head; waiter; waiter = waiter->next)
+            waiter->retry = true;
+        return;
+    }
+    for (struct waiter *waiter = batch->head; waiter; waiter = waiter->next) {
+        memcpy(&combined.key_IDs[combined.key_ID_count],
+               waiter->key_ids->key_IDs,
+               (size_t)waiter->key_ids->key_ID_count *
+                   sizeof(*combined.key_IDs));
+        combined.key_ID_count += waiter->key_ids->key_ID_count;
+    }
+
+    qkd_key_container_t response = {.flags = QKD_KEY_CONTAINER_ARENA};
+    uint32_t result = backend->get_key_with_ids(
+        batch->kme_hostname, batch->master_sae_id, &combined, &response);
+    free(combined.key_IDs);
+
+    for (struct waiter *waiter = batch->head; waiter; waiter = waiter->next) {
+        if (result == QKD_STATUS_OK)
+            hand_out_keys(&response, waiter);
+        else
+            waiter->retry = true;
+    }
+    if (result != QKD_STATUS_OK) {
+        QKD_DBG_WARN("Combined GET_KEY_WITH_IDS failed (%u), retrying %d "
+                     "calls separately",
+                     result, batch->waiter_count);
+    }
+    qkd_key_container_free(&response);
+}
+
+/* Waits until the batch is full or the coalescing window has elapsed. */
+static void collect_batch(struct batch *batch) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)coalescer.config.window_us * 1000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    while (batch->key_id_count < coalescer.config.max_key_ids) {
+        if (pthread_cond_timedwait(&batch->full, &coalescer.lock,
+                                   &deadline) == ETIMEDOUT)
+            break;
+    }
+}
+
+bool qkd_key_coalescer_get_key_with_ids(const char *kme_hostname,
+                                        const char *master_sae_id,
+                                        qkd_key_ids_t *key_ids,
+                                        qkd_key_container_t *container,
+                                        uint32_t *result) {
+    const struct qkd_014_backend *backend = get_active_014_backend();
+
+    pthread_mutex_lock(&coalescer.lock);
+    if (!coalescer.enabled || !backend || !is_coalescible(key_ids)) {
+        pthread_mutex_unlock(&coalescer.lock);
+        return false;
+    }
+    coalescer.stats.calls++;
+
+    struct waiter self = {.key_ids = key_ids, .container = container};
+    struct batch *batch =
+        find_open_batch(kme_hostname, master_sae_id, key_ids->key_ID_count);
+    if (batch) {
+        add_waiter(batch, &self);
+        if (batch->key_id_count == coalescer.config.max_key_ids)
+            pthread_cond_signal(&batch->full);
+        while (!self.done)
+            pthread_cond_wait(&coalescer.done, &coalescer.lock);
+    } else {
+        struct batch own = {.kme_hostname = kme_hostname,
+                            .master_sae_id = master_sae_id,
+                            .next = coalescer.open};
+        pthread_cond_init(&own.full, NULL);
+        add_waiter(&own, &self);
+        coalescer.open = &own;
+
+        collect_batch(&own);
+        close_batch(&own);
+        pthread_mutex_unlock(&coalescer.lock);
+
+        send_batch(&own, backend);
+
+        pthread_mutex_lock(&coalescer.lock);
+        coalescer.stats.requests++;
+        coalescer.stats.merged_calls += (uint64_t)(own.waiter_count - 1);
+        struct waiter *waiter = own.head;
+        while (waiter) {
+            struct waiter *next = waiter->next;
+            waiter->done = true;
+            waiter = next;
+        }
+        pthread_cond_broadcast(&coalescer.done);
+        pthread_cond_destroy(&own.full);
+    }
+
+    bool retry = self.retry;
+    if (retry) {
+        coalescer.stats.fallbacks++;
+        coalescer.stats.requests++;
+    }
+    pthread_mutex_unlock(&coalescer.lock);
+
+    if (retry)
+        self.result = backend->get_key_with_ids(kme_hostname, master_sae_id,
+                                                key_ids, container);
+    *result = self.result;
+    return true;
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_codec.c
+ */
+
+#include <openssl/crypto.h>
+#include <stdint.h>
+
+#include "etsi014/key_codec.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Table entry of characters outside the alphabet. */
+#define INVALID 0x80
+
+#define BASE64_VALUE(c)                                                        \
+    ((c) >= 'A' && (c) <= 'Z'   ? (c) - 'A'                                    \
+     : (c) >= 'a' && (c) <= 'z' ? (c) - 'a' + 26                               \
+     : (c) >= '0' && (c) <= '9' ? (c) - '0' + 52                               \
+     : (c) == '+'               ? 62                                           \
+     : (c) == '/'               ? 63                                           \
+                                : INVALID)
+
+#define HEX_VALUE(c)                                                           \
+    ((c) >= '0' && (c) <= '9'   ? (c) - '0'                                    \
+     : (c) >= 'a' && (c) <= 'f' ? (c) - 'a' + 10                               \
+     : (c) >= 'A' && (c) <= 'F' ? (c) - 'A' + 10                               \
+                                : INVALID)
+
+#define ROW(value, row)                                                        \
+    value((row) + 0), value((row) + 1), value((row) + 2), value((row) + 3),    \
+        value((row) + 4), value((row) + 5), value((row) + 6),                  \
+        value((row) + 7), value((row) + 8), value((row) + 9),                  \
+        value((row) + 10), value((row) + 11), value((row) + 12),               \
+        value((row) + 13), value((row) + 14), value((row) + 15)
+
+#define TABLE(value)                                                           \
+    {ROW(value, 0x00), ROW(value, 0x10), ROW(value, 0x20), ROW(value, 0x30),   \
+     ROW(value, 0x40), ROW(value, 0x50), ROW(value, 0x60), ROW(value, 0x70),   \
+     ROW(value, 0x80), ROW(value, 0x90), ROW(value, 0xa0), ROW(value, 0xb0),   \
+     ROW(value, 0xc0), ROW(value, 0xd0), ROW(value, 0xe0), ROW(value, 0xf0)}
+
+static const uint8_t base64_values[256] = TABLE(BASE64_VALUE);
+static const uint8_t hex_values[256] = TABLE(HEX_VALUE);
+
+/* Position of each byte of the UUID in its text form. */
+static const uint8_t uuid_offsets[QKD_KEY_UUID_SIZE] = {
+    0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34};
+
+bool qkd_parse_uuid(const char *value, size_t length,
+                    unsigned char uuid[QKD_KEY_UUID_SIZE]) {
+    const unsigned char *text = (const unsigned char *)value;
+    unsigned int invalid = 0;
+
+    if (length != QKD_KEY_UUID_LENGTH || text[8] != '-' || text[13] != '-' ||
+        text[18] != '-' || text[23] != '-')
+        return false;
+    for (size_t i = 0; i < QKD_KEY_UUID_SIZE; i++) {
+        unsigned int high = hex_values[text[uuid_offsets[i]]];
+        unsigned int low = hex_values[text[uuid_offsets[i] + 1U]];
+        invalid |= high | low;
+        uuid[i] = (unsigned char)(high << 4 | low);
+    }
+    return !(invalid & INVALID);
+}
+
+#ifdef HAVE_X86_SIMD
+enum simd_level { SIMD_UNKNOWN, SIMD_NONE, SIMD_SSSE3, SIMD_AVX2 };
+
+static int detected_level;
+
+static int simd_level(void) {
+    int level = __atomic_load_n(&detected_level, __ATOMIC_RELAXED);
+    if (level != SIMD_UNKNOWN)
+        return level;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    else if (__builtin_cpu_supports("ssse3"))
+        level = SIMD_SSSE3;
+    else
+        level = SIMD_NONE;
+    __atomic_store_n(&detected_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+/*
+ * The block functions below return how many leading characters, a multiple
+ * of the block size, they handled. They stop at the first block holding a
+ * character outside the alphabet and leave it to the scalar code, which
+ * then rejects the input.
+ */
+
+static __m128i in_range_128(__m128i input, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(input, _mm_set1_epi8(low - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), input));
+}
+
+/*
+ * Replaces 16 characters by their 6-bit values and returns a mask with all
+ * bits set in the lanes of valid characters. Bytes above 0x7f compare as
+ * negative and match no range.
+ */
+static __m128i translate_128(__m128i *block) {
+    __m128i upper = in_range_128(*block, 'A', 'Z');
+    __m128i lower = in_range_128(*block, 'a', 'z');
+    __m128i digit = in_range_128(*block, '0', '9');
+    __m128i plus = _mm_cmpeq_epi8(*block, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(*block, _mm_set1_epi8('/'));
+
+    __m128i shift =
+        _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                     _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+    shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+    shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+    *block = _mm_add_epi8(*block, shift);
+    return _mm_or_si128(_mm_or_si128(upper, lower),
+                        _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+}
+
+/* SSE2 is part of x86-64, so validation needs no dispatch for it. */
+static size_t validate_sse2(const unsigned char *input, size_t length) {
+    size_t done = 0;
+
+    for (; done + 16U <= length; done += 16U) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(input + done));
+        if (_mm_movemask_epi8(translate_128(&block)) != 0xffff)
+            break;
+    }
+    return done;
+}
+
+/*
+ * Merges the 6-bit values of each group of four into three bytes: pairs of
+ * values into 12 bits, pairs of those into 24, then reorders the bytes. The
+ * first 12 bytes of the result are the decoded block.
+ */
+__attribute__((target("ssse3"))) static __m128i pack_128(__m128i values) {
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                  14, 13, 12, -1, -1, -1, -1));
+}
+
+/* Each block stores 16 bytes, so space must leave room for the last four. */
+__attribute__((target("ssse3"))) static size_t
+decode_ssse3(const unsigned char *input, size_t length, unsigned char *output,
+             size_t space) {
+    size_t done = 0;
+
+    for (; done + 16U <= length && done / 4U * 3U + 16U <= space;
+         done += 16U) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(input + done));
+        if (_mm_movemask_epi8(translate_128(&block)) != 0xffff)
+            break;
+        _mm_storeu_si128((__m128i *)(output + done / 4U * 3U),
+                         pack_128(block));
+    }
+    return done;
+}
+
+__attribute__((target("avx2"))) static __m256i in_range_256(__m256i input,
+                                                             char low,
+                                                             char high) {
+    return _mm256_and_si256(
+        _mm256_cmpgt_epi8(input, _mm256_set1_epi8(low - 1)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), input));
+}
+
+/* translate_128() for 32 characters. */
+__attribute__((target("avx2"))) static __m256i translate_256(__m256i *block) {
+    __m256i upper = in_range_256(*block, 'A', 'Z');
+    __m256i lower = in_range_256(*block, 'a', 'z');
+    __m256i digit = in_range_256(*block, '0', '9');
+    __m256i plus = _mm256_cmpeq_epi8(*block, _mm256_set1_epi8('+'));
+    __m256i slash = _mm256_cmpeq_epi8(*block, _mm256_set1_epi8('/'));
+
+    __m256i shift =
+        _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                        _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+    shift = _mm256_or_si256(
+        shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+    *block = _mm256_add_epi8(*block, shift);
+    return _mm256_or_si256(
+        _mm256_or_si256(upper, lower),
+        _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+}
+
+__attribute__((target("avx2"))) static size_t
+validate_avx2(const unsigned char *input, size_t length) {
+    size_t done = 0;
+
+    for (; done + 32U <= length; done += 32U) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(input + done));
+        if ((uint32_t)_mm256_movemask_epi8(translate_256(&block)) !=
+            UINT32_MAX)
+            break;
+    }
+    return done;
+}
+
+/*
+ * pack_128() on each half, after which the 12 decoded bytes of the upper
+ * half are moved down to follow those of the lower half.
+ */
+__attribute__((target("avx2"))) static __m256i pack_256(__m256i values) {
+    __m256i pairs =
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    __m256i bytes = _mm256_shuffle_epi8(
+        groups,
+        _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1,
+                         -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                         -1, -1));
+    return _mm256_permutevar8x32_epi32(
+        bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+/* Each block stores 32 bytes, so space must leave room for the last eight. */
+__attribute__((target("avx2"))) static size_t
+decode_avx2(const unsigned char *input, size_t length, unsigned char *output,
+            size_t space) {
+    size_t done = 0;
+
+    for (; done + 32U <= length && done / 4U * 3U + 32U <= space;
+         done += 32U) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(input + done));
+        if ((uint32_t)_mm256_movemask_epi8(translate_256(&block)) !=
+            UINT32_MAX)
+            break;
+        _mm256_storeu_si256((__m256i *)(output + done / 4U * 3U),
+                            pack_256(block));
+    }
+    return done;
+}
+#endif /* HAVE_X86_SIMD */
+
+static size_t validate_blocks(const unsigned char *input, size_t length) {
+    size_t done = 0;
+
+#ifdef HAVE_X86_SIMD
+    if (simd_level() == SIMD_AVX2)
+        done = validate_avx2(input, length);
+    done += validate_sse2(input + done, length - done);
+#else
+    (void)input;
+    (void)length;
+#endif
+    return done;
+}
+
+/* length is a multiple of four; output has space bytes from its start. */
+static size_t decode_blocks(const unsigned char *input, size_t length,
+                            unsigned char *output, size_t space) {
+    size_t done = 0;
+
+#ifdef HAVE_X86_SIMD
+    switch (simd_level()) {
+    case SIMD_AVX2:
+        done = decode_avx2(input, length, output, space);
+        /* fall through */
+    case SIMD_SSSE3:
+        done += decode_ssse3(input + done, length - done,
+                             output + done / 4U * 3U,
+                             space - done / 4U * 3U);
+        break;
+    default:
+        break;
+    }
+#else
+    (void)input;
+    (void)length;
+    (void)output;
+    (void)space;
+#endif
+    return done;
+}
+
+static size_t padding_of(const unsigned char *input, size_t length) {
+    if (input[length - 1U] != '=')
+        return 0;
+    return input[length - 2U] == '=' ? 2U : 1U;
+}
+
+bool qkd_is_base64(const char *value, size_t length) {
+    const unsigned char *text = (const unsigned char *)value;
+
+    if (length == 0 || length % 4U != 0)
+        return false;
+
+    size_t end = length - padding_of(text, length);
+    unsigned int invalid = 0;
+    for (size_t i = validate_blocks(text, end); i < end; i++)
+        invalid |= base64_values[text[i]];
+    return !(invalid & INVALID);
+}
+
+bool qkd_decode_base64(const char *input, size_t length,
+                       unsigned char *output, size_t *output_length) {
+    const unsigned char *text = (const unsigned char *)input;
+
+    if (length == 0 || length % 4U != 0)
+        return false;
+
+    /* The last group, which may be padded, is always decoded below. */
+    size_t padding = padding_of(text, length);
+    size_t body = length - 4U;
+    size_t i = decode_blocks(text, body, output, length / 4U * 3U);
+    unsigned int invalid = 0;
+    unsigned char *next = output + i / 4U * 3U;
+    for (; i < length; i += 4U, next += 3U) {
+        unsigned int a = base64_values[text[i]];
+        unsigned int b = base64_values[text[i + 1U]];
+        unsigned int c = i < body || padding < 2U
+                             ? base64_values[text[i + 2U]]
+                             : 0;
+        unsigned int d = i < body || padding < 1U
+                             ? base64_values[text[i + 3U]]
+                             : 0;
+        invalid |= a | b | c | d;
+        uint32_t group = a << 18 | b << 12 | c << 6 | d;
+        next[0] = (unsigned char)(group >> 16);
+        next[1] = (unsigned char)(group >> 8);
+        next[2] = (unsigned char)group;
+    }
+    if (invalid & INVALID)
+        return false;
+
+    *output_length = length / 4U * 3U - padding;
+    OPENSSL_cleanse(output + *output_length, padding);
+    return true;
+}
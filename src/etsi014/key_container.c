@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_container.c
+ */
+
+#include <limits.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "etsi014/api.h"
+#include "etsi014/key_codec.h"
+#include "etsi014/key_container.h"
+#include "qkd_secure_alloc.h"
+
+/*
+ * Arena blocks are chained so that the arena can grow while keys are being
+ * added without moving strings that are already stored. The first block also
+ * holds the key array.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+};
+
+static struct arena_block *allocate_block(uint32_t flags, size_t size,
+                                          size_t zeroed) {
+    struct arena_block *block;
+
+    if (size > SIZE_MAX - sizeof(*block))
+        return NULL;
+    size += sizeof(*block);
+    if (flags & QKD_KEY_CONTAINER_LOCKED) {
+        block = qkd_locked_alloc(&size);
+    } else {
+        block = malloc(size);
+        if (block)
+            memset(block + 1, 0, zeroed);
+    }
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    return block;
+}
+
+void qkd_key_arena_free(void *arena, uint32_t flags) {
+    struct arena_block *block = arena;
+
+    while (block) {
+        struct arena_block *next = block->next;
+        if (flags & QKD_KEY_CONTAINER_LOCKED) {
+            qkd_locked_free(block, block->size);
+        } else {
+            OPENSSL_cleanse(block, block->size);
+            free(block);
+        }
+        block = next;
+    }
+}
+
+bool qkd_key_builder_begin(struct qkd_key_builder *builder,
+                           qkd_key_container_t *container, int32_t count,
+                           size_t string_size) {
+    uint32_t flags = container->flags;
+
+    memset(builder, 0, sizeof(*builder));
+    memset(container, 0, sizeof(*container));
+    container->flags = flags;
+    builder->container = container;
+    if (count <= 0)
+        return false;
+
+    size_t array_size = (size_t)count * sizeof(*container->keys);
+    if (!(flags & (QKD_KEY_CONTAINER_ARENA | QKD_KEY_CONTAINER_LOCKED))) {
+        container->keys = calloc((size_t)count, sizeof(*container->keys));
+        return container->keys != NULL;
+    }
+
+    if (string_size > SIZE_MAX - array_size)
+        return false;
+    struct arena_block *block =
+        allocate_block(flags, array_size + string_size, array_size);
+    if (!block)
+        return false;
+
+    container->arena = block;
+    container->arena_size = block->size;
+    container->keys = (qkd_key_t *)(block + 1);
+    builder->next = (char *)(block + 1) + array_size;
+    builder->end = (char *)block + block->size;
+    return true;
+}
+
+/* Returns size bytes from the arena, or a separate secure allocation. */
+static char *reserve(struct qkd_key_builder *builder, size_t size) {
+    qkd_key_container_t *container = builder->container;
+
+    if (!container->arena)
+        return qkd_secure_alloc(size);
+    if (size > (size_t)(builder->end - builder->next)) {
+        struct arena_block *first = container->arena;
+        size_t grown = size > first->size ? size : first->size;
+        struct arena_block *block =
+            allocate_block(container->flags, grown, 0);
+        if (!block)
+            return NULL;
+        block->next = first->next;
+        first->next = block;
+        container->arena_size += block->size;
+        builder->next = (char *)(block + 1);
+        builder->end = (char *)block + block->size;
+    }
+
+    char *region = builder->next;
+    builder->next += size;
+    return region;
+}
+
+static char *copy_string(struct qkd_key_builder *builder, const char *value,
+                         size_t length) {
+    if (length == SIZE_MAX)
+        return NULL;
+
+    char *copy = reserve(builder, length + 1U);
+    if (!copy)
+        return NULL;
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+bool qkd_key_builder_add(struct qkd_key_builder *builder, const char *key_ID,
+                         size_t key_ID_length, const char *key,
+                         size_t key_length) {
+    qkd_key_container_t *container = builder->container;
+    qkd_key_t *entry = &container->keys[container->key_count];
+
+    /* Counted first so that a failure below is released by the caller. */
+    container->key_count++;
+    entry->key_ID = copy_string(builder, key_ID, key_ID_length);
+    if (!entry->key_ID)
+        return false;
+    if (!(container->flags & QKD_KEY_CONTAINER_BINARY)) {
+        entry->key = copy_string(builder, key, key_length);
+        entry->key_length = key_length;
+        return entry->key != NULL;
+    }
+
+    if (!qkd_parse_uuid(key_ID, key_ID_length, entry->key_UUID))
+        return false;
+    entry->key = reserve(builder, key_length / 4U * 3U);
+    return entry->key &&
+           qkd_decode_base64(key, key_length, (unsigned char *)entry->key,
+                             &entry->key_length);
+}
+
+bool qkd_key_builder_add_raw(struct qkd_key_builder *builder,
+                             const char *key_ID, size_t key_ID_length,
+                             const unsigned char uuid[QKD_KEY_UUID_SIZE],
+                             const unsigned char *key, size_t key_length) {
+    qkd_key_container_t *container = builder->container;
+    qkd_key_t *entry = &container->keys[container->key_count];
+
+    container->key_count++;
+    entry->key_ID = copy_string(builder, key_ID, key_ID_length);
+    if (!entry->key_ID)
+        return false;
+    if (container->flags & QKD_KEY_CONTAINER_BINARY) {
+        memcpy(entry->key_UUID, uuid, QKD_KEY_UUID_SIZE);
+        entry->key = reserve(builder, key_length);
+        if (!entry->key)
+            return false;
+        memcpy(entry->key, key, key_length);
+        entry->key_length = key_length;
+        return true;
+    }
+
+    if (key_length > INT_MAX / 4 * 3 - 2)
+        return false;
+    entry->key = reserve(builder, 4U * ((key_length + 2U) / 3U) + 1U);
+    if (!entry->key)
+        return false;
+    entry->key_length = (size_t)EVP_EncodeBlock((unsigned char *)entry->key,
+                                                key, (int)key_length);
+    return true;
+}
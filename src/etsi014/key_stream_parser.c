@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/key_stream_parser.c
+ */
+
+#include <ctype.h>
+#include <openssl/crypto.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "etsi014/api.h"
+#include "etsi014/key_codec.h"
+#include "etsi014/key_container.h"
+#include "etsi014/key_stream_parser.h"
+#include "qkd_secure_alloc.h"
+
+#define DEFAULT_KEY_SIZE_BITS 256
+#define MIN_KEY_CAPACITY 64U
+#define MAX_KEY_LENGTH (1U << 20)
+
+enum lexer_state {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_END, /* Just after '[' */
+    EXPECT_NAME,
+    EXPECT_NAME_OR_END, /* Just after '{' */
+    EXPECT_COLON,
+    AFTER_VALUE,
+    IN_STRING,
+    IN_ESCAPE,
+    IN_UNICODE,
+    IN_LITERAL,
+    IN_NUMBER,
+    DONE
+};
+
+enum frame { FRAME_OBJECT, FRAME_ARRAY };
+
+enum capture { CAPTURE_NONE, CAPTURE_NAME, CAPTURE_KEY_ID, CAPTURE_KEY };
+
+enum member { MEMBER_OTHER, MEMBER_KEYS, MEMBER_KEY_ID, MEMBER_KEY };
+
+#define SEEN_KEY_ID 0x1U
+#define SEEN_KEY 0x2U
+
+static size_t base64_length(int32_t key_size_bits) {
+    size_t bytes = ((size_t)key_size_bits + 7U) / 8U;
+    return 4U * ((bytes + 2U) / 3U);
+}
+
+bool qkd_key_stream_parser_init(struct qkd_key_stream_parser *parser,
+                                uint32_t flags, int32_t max_keys,
+                                int32_t key_size_bits) {
+    memset(parser, 0, sizeof(*parser));
+    parser->container.flags = flags;
+    parser->max_keys = max_keys;
+    parser->state = EXPECT_VALUE;
+    if (key_size_bits <= 0)
+        key_size_bits = DEFAULT_KEY_SIZE_BITS;
+
+    size_t per_key =
+        QKD_KEY_STREAM_UUID_LENGTH + 1U + base64_length(key_size_bits) + 1U;
+    if (max_keys <= 0 || (size_t)max_keys > SIZE_MAX / per_key)
+        return false;
+    return qkd_key_builder_begin(&parser->builder, &parser->container,
+                                 max_keys, (size_t)max_keys * per_key);
+}
+
+void qkd_key_stream_parser_free(struct qkd_key_stream_parser *parser) {
+    qkd_key_container_free(&parser->container);
+    qkd_secure_free(parser->key);
+    OPENSSL_cleanse(parser, sizeof(*parser));
+}
+
+static bool fail(struct qkd_key_stream_parser *parser, const char *reason) {
+    (void)reason;
+    QKD_DBG_ERR("Invalid keys response: %s", reason);
+    parser->failed = true;
+    return false;
+}
+
+static bool grow_key(struct qkd_key_stream_parser *parser, size_t needed) {
+    size_t capacity = parser->key_capacity ? parser->key_capacity
+                                           : MIN_KEY_CAPACITY;
+    while (capacity < needed)
+        capacity *= 2U;
+
+    /* Never realloc, which could leave key material behind. */
+    char *key = qkd_secure_alloc(capacity);
+    if (!key)
+        return false;
+    if (parser->key) {
+        memcpy(key, parser->key, parser->key_length);
+        qkd_secure_free(parser->key);
+    }
+    parser->key = key;
+    parser->key_capacity = capacity;
+    return true;
+}
+
+static bool append(struct qkd_key_stream_parser *parser, const char *data,
+                   size_t length) {
+    switch (parser->capture) {
+    case CAPTURE_NAME:
+        if (parser->name_overflow ||
+            length >= sizeof(parser->name) - parser->name_length) {
+            parser->name_overflow = true;
+            return true;
+        }
+        memcpy(parser->name + parser->name_length, data, length);
+        parser->name_length += length;
+        return true;
+    case CAPTURE_KEY_ID:
+        if (length > QKD_KEY_STREAM_UUID_LENGTH - parser->key_ID_length)
+            return fail(parser, "key_ID is not a UUID");
+        memcpy(parser->key_ID + parser->key_ID_length, data, length);
+        parser->key_ID_length += length;
+        return true;
+    case CAPTURE_KEY:
+        if (length > MAX_KEY_LENGTH - parser->key_length)
+            return fail(parser, "key is too long");
+        if (parser->key_length + length > parser->key_capacity &&
+            !grow_key(parser, parser->key_length + length))
+            return fail(parser, "out of memory");
+        memcpy(parser->key + parser->key_length, data, length);
+        parser->key_length += length;
+        return true;
+    default:
+        return true;
+    }
+}
+
+static bool name_is(const struct qkd_key_stream_parser *parser,
+                    const char *name) {
+    return !parser->name_overflow && strlen(name) == parser->name_length &&
+           memcmp(parser->name, name, parser->name_length) == 0;
+}
+
+static bool in_key_object(const struct qkd_key_stream_parser *parser) {
+    return parser->keys_depth && parser->depth == parser->keys_depth + 1U;
+}
+
+/* Resolves which field, if any, the member name just read refers to. */
+static bool end_name(struct qkd_key_stream_parser *parser) {
+    parser->member = MEMBER_OTHER;
+    if (parser->depth == 1 && name_is(parser, "keys")) {
+        if (parser->seen_keys)
+            return fail(parser, "duplicate keys member");
+        parser->seen_keys = true;
+        parser->member = MEMBER_KEYS;
+    } else if (in_key_object(parser) && name_is(parser, "key_ID")) {
+        if (parser->seen_fields & SEEN_KEY_ID)
+            return fail(parser, "duplicate key_ID member");
+        parser->member = MEMBER_KEY_ID;
+    } else if (in_key_object(parser) && name_is(parser, "key")) {
+        if (parser->seen_fields & SEEN_KEY)
+            return fail(parser, "duplicate key member");
+        parser->member = MEMBER_KEY;
+    }
+    parser->state = EXPECT_COLON;
+    return true;
+}
+
+static bool end_string(struct qkd_key_stream_parser *parser) {
+    enum capture capture = parser->capture;
+
+    parser->capture = CAPTURE_NONE;
+    if (capture == CAPTURE_NAME)
+        return end_name(parser);
+    if (capture == CAPTURE_KEY_ID)
+        parser->seen_fields |= SEEN_KEY_ID;
+    else if (capture == CAPTURE_KEY)
+        parser->seen_fields |= SEEN_KEY;
+    parser->state = AFTER_VALUE;
+    return true;
+}
+
+/* Validates the key object that just closed and adds it to the output. */
+static bool emit_key(struct qkd_key_stream_parser *parser) {
+    bool binary = parser->container.flags & QKD_KEY_CONTAINER_BINARY;
+
+    if (parser->seen_fields != (SEEN_KEY_ID | SEEN_KEY))
+        return fail(parser, "key object without key_ID and key");
+    if (parser->container.key_count == parser->max_keys)
+        return fail(parser, "more keys than requested");
+    /* Binary containers validate both strings while decoding them. */
+    if (!binary) {
+        unsigned char uuid[QKD_KEY_UUID_SIZE];
+        if (!qkd_parse_uuid(parser->key_ID, parser->key_ID_length, uuid))
+            return fail(parser, "key_ID is not a UUID");
+        if (!qkd_is_base64(parser->key, parser->key_length))
+            return fail(parser, "key is not Base64");
+    }
+    if (!qkd_key_builder_add(&parser->builder, parser->key_ID,
+                             parser->key_ID_length, parser->key,
+                             parser->key_length))
+        return fail(parser, "key could not be stored");
+
+    OPENSSL_cleanse(parser->key, parser->key_length);
+    parser->key_length = 0;
+    parser->key_ID_length = 0;
+    parser->seen_fields = 0;
+    return true;
+}
+
+static bool open_container(struct qkd_key_stream_parser *parser,
+                           enum frame frame) {
+    if (parser->depth == QKD_KEY_STREAM_MAX_DEPTH)
+        return fail(parser, "nesting too deep");
+    parser->stack[parser->depth++] = (uint8_t)frame;
+    parser->state = frame == FRAME_OBJECT ? EXPECT_NAME_OR_END
+                                          : EXPECT_VALUE_OR_END;
+    return true;
+}
+
+static bool close_container(struct qkd_key_stream_parser *parser,
+                            enum frame frame) {
+    if (parser->depth == 0 || parser->stack[parser->depth - 1U] != frame)
+        return fail(parser, "mismatched bracket");
+    if (frame == FRAME_OBJECT && in_key_object(parser) && !emit_key(parser))
+        return false;
+    if (frame == FRAME_ARRAY && parser->depth == parser->keys_depth)
+        parser->keys_depth = 0;
+    parser->depth--;
+    parser->state = parser->depth == 0 ? DONE : AFTER_VALUE;
+    return true;
+}
+
+/* Checks the value about to start against the position in the document. */
+static bool begin_value(struct qkd_key_stream_parser *parser, char character) {
+    enum member member = parser->member;
+
+    parser->member = MEMBER_OTHER;
+    parser->capture = CAPTURE_NONE;
+    if (parser->depth == 0 && character != '{')
+        return fail(parser, "response is not an object");
+    if (member == MEMBER_KEYS) {
+        if (character != '[')
+            return fail(parser, "keys is not an array");
+        parser->keys_depth = 2;
+    } else if (parser->keys_depth && parser->depth == parser->keys_depth) {
+        if (character != '{')
+            return fail(parser, "key is not an object");
+        parser->seen_fields = 0;
+    } else if (member == MEMBER_KEY_ID || member == MEMBER_KEY) {
+        if (character != '"')
+            return fail(parser, "key field is not a string");
+        parser->capture =
+            member == MEMBER_KEY_ID ? CAPTURE_KEY_ID : CAPTURE_KEY;
+    }
+
+    switch (character) {
+    case '{':
+        return open_container(parser, FRAME_OBJECT);
+    case '[':
+        return open_container(parser, FRAME_ARRAY);
+    case '"':
+        parser->state = IN_STRING;
+        return true;
+    case 't':
+        parser->literal = "true";
+        break;
+    case 'f':
+        parser->literal = "false";
+        break;
+    case 'n':
+        parser->literal = "null";
+        break;
+    default:
+        if (character != '-' && !isdigit((unsigned char)character))
+            return fail(parser, "unexpected character");
+        parser->state = IN_NUMBER;
+        return true;
+    }
+    parser->literal_position = 1;
+    parser->state = IN_LITERAL;
+    return true;
+}
+
+static bool begin_name(struct qkd_key_stream_parser *parser, char character) {
+    if (character != '"')
+        return fail(parser, "expected a member name");
+    parser->capture = CAPTURE_NAME;
+    parser->name_length = 0;
+    parser->name_overflow = false;
+    parser->state = IN_STRING;
+    return true;
+}
+
+static bool after_value(struct qkd_key_stream_parser *parser, char character) {
+    if (character == '}')
+        return close_container(parser, FRAME_OBJECT);
+    if (character == ']')
+        return close_container(parser, FRAME_ARRAY);
+    if (character != ',')
+        return fail(parser, "expected ',' or a closing bracket");
+    parser->state = parser->stack[parser->depth - 1U] == FRAME_OBJECT
+                        ? EXPECT_NAME
+                        : EXPECT_VALUE;
+    return true;
+}
+
+static bool escape(struct qkd_key_stream_parser *parser, char character) {
+    static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+
+    if (character == 'u') {
+        parser->unicode_digits = 0;
+        parser->unicode_value = 0;
+        parser->state = IN_UNICODE;
+        return true;
+    }
+    for (size_t i = 0; i + 1U < sizeof(escapes); i += 2U) {
+        if (escapes[i] == character) {
+            parser->state = IN_STRING;
+            return append(parser, &escapes[i + 1U], 1);
+        }
+    }
+    return fail(parser, "invalid escape");
+}
+
+static bool unicode_digit(struct qkd_key_stream_parser *parser,
+                          char character) {
+    unsigned char digit = (unsigned char)character;
+
+    if (!isxdigit(digit))
+        return fail(parser, "invalid \\u escape");
+    parser->unicode_value =
+        parser->unicode_value << 4 |
+        (uint32_t)(isdigit(digit) ? digit - '0' : (tolower(digit) - 'a' + 10));
+    if (++parser->unicode_digits < 4)
+        return true;
+
+    parser->state = IN_STRING;
+    if (parser->unicode_value < 0x80U) {
+        char ascii = (char)parser->unicode_value;
+        return append(parser, &ascii, 1);
+    }
+    /* Only ASCII can appear in the fields that are kept. */
+    if (parser->capture == CAPTURE_NAME)
+        parser->name_overflow = true;
+    else if (parser->capture != CAPTURE_NONE)
+        return fail(parser, "non-ASCII key field");
+    return true;
+}
+
+static bool is_space(char character) {
+    return character == ' ' || character == '\t' || character == '\n' ||
+           character == '\r';
+}
+
+bool qkd_key_stream_parser_feed(struct qkd_key_stream_parser *parser,
+                                const char *data, size_t length) {
+    size_t i = 0;
+
+    while (!parser->failed && i < length) {
+        char character = data[i];
+
+        if (parser->state == IN_STRING) {
+            /* Copy runs of plain characters in one go. */
+            size_t run = i;
+            while (run < length && data[run] != '"' && data[run] != '\\' &&
+                   (unsigned char)data[run] >= 0x20U)
+                run++;
+            if (run > i && !append(parser, data + i, run - i))
+                break;
+            i = run;
+            if (i == length)
+                break;
+            character = data[i++];
+            if (character == '"')
+                end_string(parser);
+            else if (character == '\\')
+                parser->state = IN_ESCAPE;
+            else
+                fail(parser, "control character in string");
+            continue;
+        }
+        if (parser->state == IN_NUMBER) {
+            if (isdigit((unsigned char)character) || character == '.' ||
+                character == 'e' || character == 'E' || character == '+' ||
+                character == '-') {
+                i++;
+                continue;
+            }
+            /* The character that ends a number belongs to what follows. */
+            parser->state = AFTER_VALUE;
+        }
+        i++;
+
+        switch (parser->state) {
+        case IN_ESCAPE:
+            escape(parser, character);
+            continue;
+        case IN_UNICODE:
+            unicode_digit(parser, character);
+            continue;
+        case IN_LITERAL:
+            if (parser->literal[parser->literal_position] != character)
+                fail(parser, "invalid literal");
+            else if (parser->literal[++parser->literal_position] == '\0')
+                parser->state = AFTER_VALUE;
+            continue;
+        default:
+            break;
+        }
+
+        if (is_space(character))
+            continue;
+        switch (parser->state) {
+        case EXPECT_VALUE_OR_END:
+            if (character == ']') {
+                close_container(parser, FRAME_ARRAY);
+                break;
+            }
+            /* fall through */
+        case EXPECT_VALUE:
+            begin_value(parser, character);
+            break;
+        case EXPECT_NAME_OR_END:
+            if (character == '}') {
+                close_container(parser, FRAME_OBJECT);
+                break;
+            }
+            /* fall through */
+        case EXPECT_NAME:
+            begin_name(parser, character);
+            break;
+        case EXPECT_COLON:
+            if (character != ':')
+                fail(parser, "expected ':'");
+            parser->state = EXPECT_VALUE;
+            break;
+        case AFTER_VALUE:
+            after_value(parser, character);
+            break;
+        default:
+            fail(parser, "trailing data");
+            break;
+        }
+    }
+    return !parser->failed;
+}
+
+bool qkd_key_stream_parser_finish(struct qkd_key_stream_parser *parser,
+                                  qkd_key_container_t *container) {
+    if (parser->failed)
+        return false;
+    if (parser->state != DONE)
+        return fail(parser, "truncated response");
+    if (!parser->seen_keys || parser->container.key_count == 0)
+        return fail(parser, "no keys");
+
+    *container = parser->container;
+    memset(&parser->container, 0, sizeof(parser->container));
+    return true;
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/etsi014/status_cache.c
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "etsi014/api.h"
+#include "etsi014/status_cache.h"
+#include "qkd_etsi_api.h"
+
+#define MAX_STATUS_ENTRIES 16
+#define MAX_TTL_MS (3600 * 1000)
+#define RETRY_DELAY_MS 1000U
+#define IDLE_WAIT_MS 1000U
+
+/* Last status fetched for one (KME, slave SAE) pair. */
+struct status_entry {
+    char *kme_hostname;
+    char *slave_sae_id;
+    qkd_status_t status; /* As reported by the KME */
+    bool valid;
+    bool read; /* Read since it was fetched, so worth refreshing */
+    bool refreshing;
+    uint64_t fetched_ms;
+    uint64_t retry_after_ms;
+    int64_t consumed; /* Keys returned by GET_KEY since the fetch */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool enabled;
+    bool stopping;
+    qkd_status_cache_config_t config;
+    struct status_entry entries[MAX_STATUS_ENTRIES];
+    size_t entry_count;
+    qkd_status_cache_stats_t stats;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER,
+           .wake = PTHREAD_COND_INITIALIZER};
+
+static uint64_t get_current_time_ms(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static void release_entry(struct status_entry *entry) {
+    qkd_status_free(&entry->status);
+    free(entry->kme_hostname);
+    free(entry->slave_sae_id);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* Called with cache.lock held. */
+static struct status_entry *find_entry(const char *kme_hostname,
+                                       const char *slave_sae_id,
+                                       bool create) {
+    for (size_t i = 0; i < cache.entry_count; i++) {
+        struct status_entry *entry = &cache.entries[i];
+        if (strcmp(entry->kme_hostname, kme_hostname) == 0 &&
+            strcmp(entry->slave_sae_id, slave_sae_id) == 0)
+            return entry;
+    }
+    if (!create || cache.entry_count == MAX_STATUS_ENTRIES)
+        return NULL;
+
+    struct status_entry *entry = &cache.entries[cache.entry_count];
+    entry->kme_hostname = strdup(kme_hostname);
+    entry->slave_sae_id = strdup(slave_sae_id);
+    if (!entry->kme_hostname || !entry->slave_sae_id) {
+        release_entry(entry);
+        return NULL;
+    }
+    cache.entry_count++;
+    return entry;
+}
+
+/* Called with cache.lock held. */
+static bool is_fresh(const struct status_entry *entry, uint64_t now) {
+    return entry && entry->valid &&
+           now - entry->fetched_ms < (uint64_t)cache.config.ttl_ms;
+}
+
+/* Called with cache.lock held. Copies the cached numbers into status. */
+static void copy_counts(const struct status_entry *entry,
+                        qkd_status_t *status) {
+    const qkd_status_t *cached = &entry->status;
+    int64_t stored = (int64_t)cached->stored_key_count - entry->consumed;
+
+    status->key_size = cached->key_size;
+    status->stored_key_count = stored > 0 ? (int32_t)stored : 0;
+    status->max_key_count = cached->max_key_count;
+    status->max_key_per_request = cached->max_key_per_request;
+    status->max_key_size = cached->max_key_size;
+    status->min_key_size = cached->min_key_size;
+    status->max_SAE_ID_count = cached->max_SAE_ID_count;
+}
+
+static bool duplicate_ids(const qkd_status_t *from, qkd_status_t *to) {
+    to->source_KME_ID = strdup(from->source_KME_ID);
+    to->target_KME_ID = strdup(from->target_KME_ID);
+    to->master_SAE_ID = strdup(from->master_SAE_ID);
+    to->slave_SAE_ID = strdup(from->slave_SAE_ID);
+    if (to->source_KME_ID && to->target_KME_ID && to->master_SAE_ID &&
+        to->slave_SAE_ID)
+        return true;
+    qkd_status_free(to);
+    return false;
+}
+
+/*
+ * Compares the configuration of the KME link. stored_key_count moves with
+ * every key handed out and is left to the local estimate.
+ */
+static bool same_status(const qkd_status_t *a, const qkd_status_t *b) {
+    return a->key_size == b->key_size &&
+           a->max_key_count == b->max_key_count &&
+           a->max_key_per_request == b->max_key_per_request &&
+           a->max_key_size == b->max_key_size &&
+           a->min_key_size == b->min_key_size &&
+           a->max_SAE_ID_count == b->max_SAE_ID_count &&
+           strcmp(a->source_KME_ID, b->source_KME_ID) == 0 &&
+           strcmp(a->target_KME_ID, b->target_KME_ID) == 0 &&
+           strcmp(a->master_SAE_ID, b->master_SAE_ID) == 0 &&
+           strcmp(a->slave_SAE_ID, b->slave_SAE_ID) == 0;
+}
+
+/*
+ * Called with cache.lock held. Replaces the cached status with a copy of
+ * fetched and returns true when a previous status was replaced by a
+ * different one.
+ */
+static bool store_status(struct status_entry *entry,
+                         const qkd_status_t *fetched) {
+    qkd_status_t copy = *fetched;
+    bool changed = entry->valid && !same_status(&entry->status, fetched);
+
+    if (!duplicate_ids(fetched, &copy)) {
+        qkd_status_free(&entry->status);
+        entry->valid = false;
+        return false;
+    }
+    qkd_status_free(&entry->status);
+    entry->status = copy;
+    entry->valid = true;
+    entry->read = false;
+    entry->consumed = 0;
+    entry->fetched_ms = get_current_time_ms();
+    if (changed)
+        cache.stats.changes++;
+    return changed;
+}
+
+/*
+ * Called with cache.lock held. Returns an entry that is due for a refresh,
+ * or NULL and the time until the next one is due in *wait_ms.
+ */
+static struct status_entry *next_entry_to_refresh(uint64_t now,
+                                                  uint64_t *wait_ms) {
+    uint64_t refresh_ms = (uint64_t)cache.config.refresh_ms;
+
+    *wait_ms = IDLE_WAIT_MS;
+    for (size_t i = 0; i < cache.entry_count; i++) {
+        struct status_entry *entry = &cache.entries[i];
+        if (!entry->valid || !entry->read || entry->refreshing)
+            continue;
+
+        uint64_t due = entry->fetched_ms + refresh_ms;
+        if (entry->retry_after_ms > due)
+            due = entry->retry_after_ms;
+        if (due <= now)
+            return entry;
+        if (due - now < *wait_ms)
+            *wait_ms = due - now;
+    }
+    return NULL;
+}
+
+static void *refresh_thread(void *unused) {
+    (void)unused;
+
+    pthread_mutex_lock(&cache.lock);
+    while (!cache.stopping) {
+        uint64_t wait_ms;
+        struct status_entry *entry =
+            next_entry_to_refresh(get_current_time_ms(), &wait_ms);
+        if (!entry) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)(wait_ms / 1000U);
+            deadline.tv_nsec += (long)(wait_ms % 1000U) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&cache.wake, &cache.lock, &deadline);
+            continue;
+        }
+
+        /* Entries are only released after this thread has been joined. */
+        entry->refreshing = true;
+        pthread_mutex_unlock(&cache.lock);
+        const struct qkd_014_backend *backend = get_active_014_backend();
+        qkd_status_t fetched = {0};
+        bool ok = backend && backend->get_status &&
+                  backend->get_status(entry->kme_hostname, entry->slave_sae_id,
+                                      &fetched) == QKD_STATUS_OK;
+        pthread_mutex_lock(&cache.lock);
+
+        bool changed = false;
+        entry->refreshing = false;
+        if (ok) {
+            changed = store_status(entry, &fetched);
+            cache.stats.refreshes++;
+        } else {
+            QKD_DBG_WARN("Status refresh for %s failed", entry->kme_hostname);
+            cache.stats.refresh_failures++;
+            entry->retry_after_ms = get_current_time_ms() + RETRY_DELAY_MS;
+        }
+
+        qkd_status_cache_callback_t on_change = cache.config.on_change;
+        void *user_data = cache.config.user_data;
+        if (changed && on_change) {
+            pthread_mutex_unlock(&cache.lock);
+            on_change(entry->kme_hostname, entry->slave_sae_id, &fetched,
+                      user_data);
+            pthread_mutex_lock(&cache.lock);
+        }
+        qkd_status_free(&fetched);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return NULL;
+}
+
+uint32_t qkd_status_cache_enable(const qkd_status_cache_config_t *config) {
+    if (!config || config->ttl_ms <= 0 || config->ttl_ms > MAX_TTL_MS ||
+        config->refresh_ms < 0 || config->refresh_ms >= config->ttl_ms)
+        return QKD_STATUS_BAD_REQUEST;
+
+    pthread_mutex_lock(&cache.lock);
+    if (cache.enabled) {
+        pthread_mutex_unlock(&cache.lock);
+        return QKD_STATUS_BAD_REQUEST;
+    }
+    cache.config = *config;
+    if (cache.config.refresh_ms == 0)
+        cache.config.refresh_ms = cache.config.ttl_ms / 2;
+    cache.stopping = false;
+    memset(&cache.stats, 0, sizeof(cache.stats));
+    if (pthread_create(&cache.thread, NULL, refresh_thread, NULL) != 0) {
+        pthread_mutex_unlock(&cache.lock);
+        return QKD_STATUS_SERVER_ERROR;
+    }
+    cache.enabled = true;
+    pthread_mutex_unlock(&cache.lock);
+    return QKD_STATUS_OK;
+}
+
+void qkd_status_cache_disable(void) {
+    pthread_mutex_lock(&cache.lock);
+    if (!cache.enabled) {
+        pthread_mutex_unlock(&cache.lock);
+        return;
+    }
+    cache.enabled = false;
+    cache.stopping = true;
+    pthread_cond_signal(&cache.wake);
+    pthread_mutex_unlock(&cache.lock);
+
+    pthread_join(cache.thread, NULL);
+
+    pthread_mutex_lock(&cache.lock);
+    for (size_t i = 0; i < cache.entry_count; i++)
+        release_entry(&cache.entries[i]);
+    cache.entry_count = 0;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+void qkd_status_cache_get_stats(qkd_status_cache_stats_t *stats) {
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&cache.lock);
+    *stats = cache.stats;
+    pthread_mutex_unlock(&cache.lock);
+}
+
+/* Called with cache.lock held, after a read of a fresh entry. */
+static void note_read(struct status_entry *entry, uint64_t now) {
+    entry->read = true;
+    cache.stats.hits++;
+    if (now - entry->fetched_ms >= (uint64_t)cache.config.refresh_ms &&
+        !entry->refreshing)
+        pthread_cond_signal(&cache.wake);
+}
+
+bool qkd_status_cache_peek(const char *kme_hostname, const char *slave_sae_id,
+                           qkd_status_t *status) {
+    if (!kme_hostname || !slave_sae_id || !status)
+        return false;
+
+    pthread_mutex_lock(&cache.lock);
+    uint64_t now = get_current_time_ms();
+    struct status_entry *entry =
+        cache.enabled ? find_entry(kme_hostname, slave_sae_id, false) : NULL;
+    bool fresh = is_fresh(entry, now);
+    if (fresh) {
+        memset(status, 0, sizeof(*status));
+        copy_counts(entry, status);
+        note_read(entry, now);
+    }
+    pthread_mutex_unlock(&cache.lock);
+    return fresh;
+}
+
+bool qkd_status_cache_get_status(const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 qkd_status_t *status, uint32_t *result) {
+    pthread_mutex_lock(&cache.lock);
+    if (!cache.enabled) {
+        pthread_mutex_unlock(&cache.lock);
+        return false;
+    }
+
+    uint64_t now = get_current_time_ms();
+    struct status_entry *entry = find_entry(kme_hostname, slave_sae_id, true);
+    if (is_fresh(entry, now)) {
+        qkd_status_t copy = {0};
+        copy_counts(entry, &copy);
+        bool copied = duplicate_ids(&entry->status, &copy);
+        note_read(entry, now);
+        pthread_mutex_unlock(&cache.lock);
+        if (copied)
+            *status = copy;
+        *result = copied ? QKD_STATUS_OK : QKD_STATUS_SERVER_ERROR;
+        return true;
+    }
+    cache.stats.misses++;
+    pthread_mutex_unlock(&cache.lock);
+
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    if (!backend || !backend->get_status)
+        return false;
+    *result = backend->get_status(kme_hostname, slave_sae_id, status);
+    if (*result != QKD_STATUS_OK)
+        return true;
+
+    pthread_mutex_lock(&cache.lock);
+    bool changed = false;
+    entry = cache.enabled ? find_entry(kme_hostname, slave_sae_id, false)
+                          : NULL;
+    if (entry)
+        changed = store_status(entry, status);
+    qkd_status_cache_callback_t on_change = cache.config.on_change;
+    void *user_data = cache.config.user_data;
+    pthread_mutex_unlock(&cache.lock);
+
+    if (changed && on_change)
+        on_change(kme_hostname, slave_sae_id, status, user_data);
+    return true;
+}
+
+void qkd_status_cache_consume(const char *kme_hostname,
+                              const char *slave_sae_id, int32_t keys) {
+    if (keys <= 0)
+        return;
+
+    pthread_mutex_lock(&cache.lock);
+    struct status_entry *entry =
+        cache.enabled ? find_entry(kme_hostname, slave_sae_id, false) : NULL;
+    if (entry && entry->valid)
+        entry->consumed += keys;
+    pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/qkd_hash_index.c
+ */
+
+#include <openssl/rand.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qkd_hash_index.h"
+
+#define MIN_BUCKETS 16U
+
+/*
+ * Identifiers may be chosen by the peer (predefined KSIDs), so the hash is
+ * keyed with a random per-table seed to keep probe chains short.
+ */
+static size_t hash_key(const struct qkd_hash_index *index,
+                       const unsigned char *key) {
+    uint64_t low, high;
+
+    memcpy(&low, key, sizeof(low));
+    memcpy(&high, key + sizeof(low), sizeof(high));
+    uint64_t hash = (low ^ index->seed[0]) * 0x9e3779b97f4a7c15ULL;
+    hash ^= (high ^ index->seed[1]) + (hash >> 29);
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 32;
+    return (size_t)hash & index->mask;
+}
+
+bool qkd_hash_index_init(struct qkd_hash_index *index, size_t max_entries) {
+    size_t bucket_count = MIN_BUCKETS;
+
+    /* Keep the load factor at or below one half. */
+    while (bucket_count < max_entries * 2U) {
+        if (bucket_count > SIZE_MAX / 2U / sizeof(struct qkd_hash_bucket))
+            return false;
+        bucket_count *= 2U;
+    }
+
+    memset(index, 0, sizeof(*index));
+    if (RAND_bytes((unsigned char *)index->seed, sizeof(index->seed)) != 1)
+        return false;
+    index->buckets = malloc(bucket_count * sizeof(*index->buckets));
+    if (!index->buckets)
+        return false;
+    for (size_t i = 0; i < bucket_count; i++)
+        index->buckets[i].value = -1;
+    index->mask = bucket_count - 1U;
+    index->max_entries = max_entries;
+    return true;
+}
+
+void qkd_hash_index_free(struct qkd_hash_index *index) {
+    free(index->buckets);
+    memset(index, 0, sizeof(*index));
+}
+
+static size_t probe(const struct qkd_hash_index *index,
+                    const unsigned char *key) {
+    size_t position = hash_key(index, key);
+
+    while (index->buckets[position].value >= 0 &&
+           memcmp(index->buckets[position].key, key, QKD_HASH_KEY_SIZE) != 0)
+        position = (position + 1U) & index->mask;
+    return position;
+}
+
+int32_t qkd_hash_index_find(const struct qkd_hash_index *index,
+                            const unsigned char *key) {
+    if (!index->buckets || !key)
+        return -1;
+    return index->buckets[probe(index, key)].value;
+}
+
+bool qkd_hash_index_insert(struct qkd_hash_index *index,
+                           const unsigned char *key, int32_t value) {
+    if (!index->buckets || !key || value < 0)
+        return false;
+
+    struct qkd_hash_bucket *bucket = &index->buckets[probe(index, key)];
+    if (bucket->value < 0) {
+        if (index->count == index->max_entries)
+            return false;
+        memcpy(bucket->key, key, QKD_HASH_KEY_SIZE);
+        index->count++;
+    }
+    bucket->value = value;
+    return true;
+}
+
+bool qkd_hash_index_remove(struct qkd_hash_index *index,
+                           const unsigned char *key) {
+    if (!index->buckets || !key)
+        return false;
+
+    size_t hole = probe(index, key);
+    if (index->buckets[hole].value < 0)
+        return false;
+
+    /* Shift back later entries of the chain whose home precedes the hole. */
+    for (size_t next = (hole + 1U) & index->mask;
+         index->buckets[next].value >= 0; next = (next + 1U) & index->mask) {
+        size_t home = hash_key(index, index->buckets[next].key);
+        if (((next - home) & index->mask) >= ((next - hole) & index->mask)) {
+            index->buckets[hole] = index->buckets[next];
+            hole = next;
+        }
+    }
+    memset(&index->buckets[hole], 0, sizeof(index->buckets[hole]));
+    index->buckets[hole].value = -1;
+    index->count--;
+    return true;
+}
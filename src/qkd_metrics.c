@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/qkd_metrics.c
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qkd_metrics.h"
+
+/*
+ * Each thread owns a block of counters that only it writes. Writers use
+ * relaxed atomic loads and stores, so concurrent snapshots read whole values
+ * without the cost of locked instructions. Blocks of exited threads are
+ * folded into retired; a thread that records again from a later TLS
+ * destructor gets a new block, retired on the next destructor pass.
+ */
+struct thread_metrics {
+    struct qkd_metrics_snapshot data;
+    struct thread_metrics *prev;
+    struct thread_metrics *next;
+};
+
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_metrics *threads;
+static struct qkd_metrics_snapshot retired;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static bool key_ready;
+static __thread struct thread_metrics *local;
+
+static const char *const op_names[QKD_METRICS_OP_COUNT] = {
+    "004.open_connect", "004.get_key",    "004.get_key_batch",
+    "004.close",        "014.get_status", "014.get_key",
+    "014.get_key_with_ids"};
+
+static const char *const phase_names[QKD_METRICS_PHASE_COUNT] = {
+    "total", "connect", "tls", "transfer", "parse"};
+
+static void merge(struct qkd_metrics_snapshot *into,
+                  const struct qkd_metrics_snapshot *from) {
+    for (size_t op = 0; op < QKD_METRICS_OP_COUNT; op++) {
+        struct qkd_metrics_op_stats *to = &into->ops[op];
+        const struct qkd_metrics_op_stats *stats = &from->ops[op];
+        to->calls += __atomic_load_n(&stats->calls, __ATOMIC_RELAXED);
+        to->errors += __atomic_load_n(&stats->errors, __ATOMIC_RELAXED);
+
+        for (size_t phase = 0; phase < QKD_METRICS_PHASE_COUNT; phase++) {
+            struct qkd_metrics_histogram *histogram = &to->phases[phase];
+            const struct qkd_metrics_histogram *source = &stats->phases[phase];
+            uint64_t max = __atomic_load_n(&source->max_ns, __ATOMIC_RELAXED);
+            histogram->count +=
+                __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+            histogram->sum_ns +=
+                __atomic_load_n(&source->sum_ns, __ATOMIC_RELAXED);
+            if (max > histogram->max_ns)
+                histogram->max_ns = max;
+            for (size_t i = 0; i < QKD_METRICS_BUCKETS; i++)
+                histogram->buckets[i] +=
+                    __atomic_load_n(&source->buckets[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void retire_thread(void *value) {
+    struct thread_metrics *metrics = value;
+
+    pthread_mutex_lock(&threads_lock);
+    merge(&retired, &metrics->data);
+    if (metrics->prev)
+        metrics->prev->next = metrics->next;
+    else
+        threads = metrics->next;
+    if (metrics->next)
+        metrics->next->prev = metrics->prev;
+    pthread_mutex_unlock(&threads_lock);
+    if (local == metrics)
+        local = NULL;
+    free(metrics);
+}
+
+static void create_key(void) {
+    key_ready = pthread_key_create(&thread_key, retire_thread) == 0;
+}
+
+static struct thread_metrics *thread_metrics(void) {
+    if (local)
+        return local;
+
+    pthread_once(&key_once, create_key);
+    struct thread_metrics *metrics = calloc(1, sizeof(*metrics));
+    if (!key_ready || !metrics ||
+        pthread_setspecific(thread_key, metrics) != 0) {
+        free(metrics);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&threads_lock);
+    metrics->next = threads;
+    if (threads)
+        threads->prev = metrics;
+    threads = metrics;
+    pthread_mutex_unlock(&threads_lock);
+    local = metrics;
+    return metrics;
+}
+
+static void add(uint64_t *counter, uint64_t value) {
+    uint64_t current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    __atomic_store_n(counter, current + value, __ATOMIC_RELAXED);
+}
+
+static size_t bucket_index(uint64_t value) {
+    if (value < 4)
+        return (size_t)value;
+    unsigned int msb = 63U - (unsigned int)__builtin_clzll(value);
+    size_t index = (size_t)(msb - 1U) * 4U + ((value >> (msb - 2U)) & 3U);
+    return index < QKD_METRICS_BUCKETS ? index : QKD_METRICS_BUCKETS - 1U;
+}
+
+static uint64_t bucket_upper_bound(size_t index) {
+    if (index < 4)
+        return index;
+    unsigned int msb = (unsigned int)(index / 4U) + 1U;
+    uint64_t width = (uint64_t)1 << (msb - 2U);
+    return (4U + index % 4U) * width + width - 1U;
+}
+
+uint64_t qkd_metrics_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+void qkd_metrics_record(enum qkd_metrics_op op, enum qkd_metrics_phase phase,
+                        uint64_t elapsed_ns) {
+    struct thread_metrics *metrics = thread_metrics();
+    if (!metrics || (unsigned int)op >= QKD_METRICS_OP_COUNT ||
+        (unsigned int)phase >= QKD_METRICS_PHASE_COUNT)
+        return;
+
+    struct qkd_metrics_histogram *histogram =
+        &metrics->data.ops[op].phases[phase];
+    add(&histogram->count, 1);
+    add(&histogram->sum_ns, elapsed_ns);
+    add(&histogram->buckets[bucket_index(elapsed_ns)], 1);
+    if (elapsed_ns > __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED))
+        __atomic_store_n(&histogram->max_ns, elapsed_ns, __ATOMIC_RELAXED);
+}
+
+void qkd_metrics_finish(enum qkd_metrics_op op, uint64_t started,
+                        bool failed) {
+    struct thread_metrics *metrics = thread_metrics();
+    if (!metrics || (unsigned int)op >= QKD_METRICS_OP_COUNT)
+        return;
+
+    add(&metrics->data.ops[op].calls, 1);
+    if (failed)
+        add(&metrics->data.ops[op].errors, 1);
+    qkd_metrics_record(op, QKD_METRICS_TOTAL, qkd_metrics_now() - started);
+}
+
+void qkd_metrics_snapshot(struct qkd_metrics_snapshot *snapshot) {
+    if (!snapshot)
+        return;
+
+    pthread_mutex_lock(&threads_lock);
+    *snapshot = retired;
+    for (struct thread_metrics *metrics = threads; metrics;
+         metrics = metrics->next)
+        merge(snapshot, &metrics->data);
+    pthread_mutex_unlock(&threads_lock);
+}
+
+uint64_t qkd_metrics_percentile(const struct qkd_metrics_histogram *histogram,
+                                double percentile) {
+    if (!histogram || histogram->count == 0)
+        return 0;
+    if (percentile < 0)
+        percentile = 0;
+    if (percentile > 100)
+        percentile = 100;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count);
+    if ((double)rank < percentile / 100.0 * (double)histogram->count)
+        rank++;
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < QKD_METRICS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return i + 1U == QKD_METRICS_BUCKETS || bound > histogram->max_ns
+                       ? histogram->max_ns
+                       : bound;
+        }
+    }
+    return histogram->max_ns;
+}
+
+const char *qkd_metrics_op_name(enum qkd_metrics_op op) {
+    return (unsigned int)op < QKD_METRICS_OP_COUNT ? op_names[op] : NULL;
+}
+
+const char *qkd_metrics_phase_name(enum qkd_metrics_phase phase) {
+    return (unsigned int)phase < QKD_METRICS_PHASE_COUNT ? phase_names[phase]
+                                                         : NULL;
+}
+
+int qkd_metrics_export(const struct qkd_metrics_snapshot *snapshot,
+                       FILE *stream) {
+    if (!snapshot || !stream)
+        return -1;
+
+    for (size_t op = 0; op < QKD_METRICS_OP_COUNT; op++) {
+        const struct qkd_metrics_op_stats *stats = &snapshot->ops[op];
+        if (stats->calls == 0 && stats->phases[QKD_METRICS_TOTAL].count == 0)
+            continue;
+        if (fprintf(stream, "%s calls=%llu errors=%llu\n", op_names[op],
+                    (unsigned long long)stats->calls,
+                    (unsigned long long)stats->errors) < 0)
+            return -1;
+
+        for (size_t phase = 0; phase < QKD_METRICS_PHASE_COUNT; phase++) {
+            const struct qkd_metrics_histogram *histogram =
+                &stats->phases[phase];
+            if (histogram->count == 0)
+                continue;
+            if (fprintf(stream,
+                        "%s.%s count=%llu mean_ns=%llu p50_ns=%llu "
+                        "p99_ns=%llu max_ns=%llu\n",
+                        op_names[op], phase_names[phase],
+                        (unsigned long long)histogram->count,
+                        (unsigned long long)(histogram->sum_ns /
+                                             histogram->count),
+                        (unsigned long long)qkd_metrics_percentile(histogram,
+                                                                   50),
+                        (unsigned long long)qkd_metrics_percentile(histogram,
+                                                                   99),
+                        (unsigned long long)histogram->max_ns) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/qkd_plugin.c
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "qkd_etsi_api.h"
+#include "qkd_plugin.h"
+
+#ifndef QKD_PLUGIN_DIR
+#define QKD_PLUGIN_DIR "/usr/local/lib/qkd-etsi-api-c-wrapper"
+#endif
+
+#define MAX_PLUGIN_PATH 4096
+
+struct loaded_plugin {
+    char *path;
+    const void *backend;
+    struct loaded_plugin *next;
+};
+
+static pthread_mutex_t plugins_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct loaded_plugin *plugins;
+
+static bool is_backend_name(const char *name) {
+    if (!*name)
+        return false;
+    for (const char *c = name; *c; c++) {
+        if (!((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9') ||
+              *c == '_'))
+            return false;
+    }
+    return true;
+}
+
+static bool resolve_path(const char *api, const char *name, char *path,
+                         size_t size) {
+    if (!name) {
+        char variable[32];
+        snprintf(variable, sizeof(variable), "QKD_ETSI%s_BACKEND", api);
+        name = getenv(variable);
+        if (!name || !*name)
+            name = QKD_BACKEND_TYPE;
+    }
+
+    int length;
+    if (strchr(name, '/')) {
+        length = snprintf(path, size, "%s", name);
+    } else if (is_backend_name(name)) {
+        const char *directory = getenv("QKD_PLUGIN_DIR");
+        if (!directory || !*directory)
+            directory = QKD_PLUGIN_DIR;
+        length = snprintf(path, size, "%s/libqkd-etsi%s-%s.so", directory,
+                          api, name);
+    } else {
+        QKD_DBG_ERR("Invalid backend name: %s", name);
+        return false;
+    }
+    return length > 0 && (size_t)length < size;
+}
+
+static const void *open_plugin(const char *path, const char *entry_symbol,
+                               uint32_t abi_version) {
+    /* Local binding keeps the symbols of different plugins apart. */
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        QKD_DBG_ERR("Failed to load backend plugin: %s", dlerror());
+        return NULL;
+    }
+
+    qkd_plugin_entry_t entry;
+    void *symbol = dlsym(handle, entry_symbol);
+    memcpy(&entry, &symbol, sizeof(entry));
+    const void *backend = entry ? entry(abi_version) : NULL;
+    if (!backend) {
+        QKD_DBG_ERR("%s is not a compatible backend plugin", path);
+        dlclose(handle);
+    }
+    return backend;
+}
+
+const void *qkd_plugin_load(const char *api, const char *name,
+                            const char *entry_symbol, uint32_t abi_version) {
+    char path[MAX_PLUGIN_PATH];
+    if (!api || !entry_symbol ||
+        !resolve_path(api, name, path, sizeof(path)))
+        return NULL;
+
+    pthread_mutex_lock(&plugins_lock);
+    struct loaded_plugin *plugin = plugins;
+    while (plugin && strcmp(plugin->path, path) != 0)
+        plugin = plugin->next;
+    if (plugin) {
+        const void *backend = plugin->backend;
+        pthread_mutex_unlock(&plugins_lock);
+        return backend;
+    }
+
+    const void *backend = open_plugin(path, entry_symbol, abi_version);
+    plugin = backend ? malloc(sizeof(*plugin)) : NULL;
+    if (plugin) {
+        plugin->path = strdup(path);
+        plugin->backend = backend;
+        plugin->next = plugins;
+        if (plugin->path)
+            plugins = plugin;
+        else
+            free(plugin);
+    }
+    pthread_mutex_unlock(&plugins_lock);
+    if (backend) {
+        QKD_DBG_INFO("Loaded backend plugin %s", path);
+    }
+    return backend;
+}
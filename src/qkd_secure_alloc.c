@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * src/qkd_secure_alloc.c
+ */
+
+#include <malloc.h>
+#include <openssl/crypto.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "qkd_secure_alloc.h"
+
+#define SLAB_SIZE (64U * 1024U)
+#define HEADER_SIZE 64U /* Keeps objects 64-byte aligned */
+#define MIN_CLASS_SHIFT 4U
+#define CLASS_COUNT 9U /* 16 to QKD_SECURE_MAX_SLAB_OBJECT bytes */
+#define LARGE_CLASS CLASS_COUNT
+#define CACHE_BATCH 32U
+#define CACHE_LIMIT (2U * CACHE_BATCH)
+#define MIN_REGISTRY_SLOTS 256U
+#define REMOVED_SLOT ((uintptr_t)1)
+
+/*
+ * Slabs and large objects start at a SLAB_SIZE boundary with this header,
+ * so qkd_secure_free() finds the size of any object from its address once
+ * the registry has confirmed that the boundary is one of ours.
+ */
+struct slab_header {
+    uint32_t size_class;
+    size_t mapping_size; /* Large objects only */
+    size_t object_size;  /* Large objects only */
+};
+
+/* Free objects are linked through their first word, the rest is zero. */
+struct free_object {
+    struct free_object *next;
+};
+
+#define POOL_INITIALIZER {.lock = PTHREAD_MUTEX_INITIALIZER}
+
+static struct {
+    pthread_mutex_t lock;
+    struct free_object *free;
+} pools[CLASS_COUNT] = {POOL_INITIALIZER, POOL_INITIALIZER, POOL_INITIALIZER,
+                        POOL_INITIALIZER, POOL_INITIALIZER, POOL_INITIALIZER,
+                        POOL_INITIALIZER, POOL_INITIALIZER, POOL_INITIALIZER};
+
+struct thread_cache {
+    struct free_object *head[CLASS_COUNT];
+    uint32_t count[CLASS_COUNT];
+    bool registered;
+};
+
+/*
+ * Open addressing set of the SLAB_SIZE boundaries the allocator has mapped.
+ * Lookups read the current table without a lock; changes are made under
+ * registry_lock, and a table that outgrows its slots is replaced by a larger
+ * copy. Replaced tables stay allocated and linked from their successor, as
+ * a lookup may still be probing them; together they take less memory than
+ * the current table.
+ */
+struct registry_table {
+    struct registry_table *previous;
+    size_t mask;
+    size_t used; /* Live and removed slots */
+    uintptr_t slots[];
+};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct registry_table *registry;
+
+static __thread struct thread_cache cache;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static bool cache_key_ready;
+static uint64_t slab_count;
+static uint64_t large_count;
+
+static size_t class_size(uint32_t size_class) {
+    return (size_t)1U << (size_class + MIN_CLASS_SHIFT);
+}
+
+static uint32_t class_of(size_t size) {
+    uint32_t size_class = 0;
+
+    while (class_size(size_class) < size)
+        size_class++;
+    return size_class;
+}
+
+static size_t registry_slot(uintptr_t start, size_t mask) {
+    uint64_t hash = (uint64_t)(start / SLAB_SIZE) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(hash >> 32) & mask;
+}
+
+static bool is_registered(uintptr_t start) {
+    const struct registry_table *table =
+        __atomic_load_n(&registry, __ATOMIC_ACQUIRE);
+    if (!table)
+        return false;
+
+    for (size_t i = registry_slot(start, table->mask);;
+         i = (i + 1U) & table->mask) {
+        uintptr_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (slot == start)
+            return true;
+        if (slot == 0)
+            return false;
+    }
+}
+
+/* Called with registry_lock held; start is not in table. */
+static void insert_slot(struct registry_table *table, uintptr_t start) {
+    size_t i = registry_slot(start, table->mask);
+    while (table->slots[i] != 0)
+        i = (i + 1U) & table->mask;
+    __atomic_store_n(&table->slots[i], start, __ATOMIC_RELEASE);
+    table->used++;
+}
+
+/* Called with registry_lock held. Drops removed slots while copying. */
+static bool grow_registry(void) {
+    size_t live = 0;
+    if (registry) {
+        for (size_t i = 0; i <= registry->mask; i++)
+            live += registry->slots[i] > REMOVED_SLOT;
+    }
+    size_t count = MIN_REGISTRY_SLOTS;
+    while (count < 4U * (live + 1U))
+        count *= 2U;
+
+    struct registry_table *table =
+        calloc(1, sizeof(*table) + count * sizeof(table->slots[0]));
+    if (!table)
+        return false;
+    table->previous = registry;
+    table->mask = count - 1U;
+    for (size_t i = 0; registry && i <= registry->mask; i++) {
+        if (registry->slots[i] > REMOVED_SLOT)
+            insert_slot(table, registry->slots[i]);
+    }
+    __atomic_store_n(&registry, table, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Records a mapping before any of its objects can be handed out. */
+static bool register_mapping(uintptr_t start) {
+    pthread_mutex_lock(&registry_lock);
+    bool registered = (registry && 2U * (registry->used + 1U) <=
+                                       registry->mask + 1U) ||
+                      grow_registry();
+    if (registered)
+        insert_slot(registry, start);
+    pthread_mutex_unlock(&registry_lock);
+    return registered;
+}
+
+static void unregister_mapping(uintptr_t start) {
+    pthread_mutex_lock(&registry_lock);
+    for (size_t i = registry_slot(start, registry->mask);;
+         i = (i + 1U) & registry->mask) {
+        if (registry->slots[i] == start) {
+            __atomic_store_n(&registry->slots[i], REMOVED_SLOT,
+                             __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void *qkd_locked_alloc(size_t *size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (*size == 0 || *size > SIZE_MAX - page_size)
+        return NULL;
+    *size = (*size + page_size - 1U) / page_size * page_size;
+
+    void *region = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+    if (mlock(region, *size) != 0) {
+        QKD_DBG_WARN("Failed to lock key memory");
+    }
+#ifdef MADV_DONTDUMP
+    madvise(region, *size, MADV_DONTDUMP);
+#endif
+    return region;
+}
+
+void qkd_locked_free(void *region, size_t size) {
+    if (!region)
+        return;
+    OPENSSL_cleanse(region, size);
+    munlock(region, size);
+    munmap(region, size);
+}
+
+/* Locked mapping of *size bytes starting at a SLAB_SIZE boundary. */
+static struct slab_header *map_aligned(size_t *size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (*size > SIZE_MAX - SLAB_SIZE - page_size)
+        return NULL;
+    *size = (*size + page_size - 1U) / page_size * page_size;
+
+    size_t mapped = *size + SLAB_SIZE;
+    void *region = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+    uintptr_t start = ((uintptr_t)region + SLAB_SIZE - 1U) &
+                      ~(uintptr_t)(SLAB_SIZE - 1U);
+    size_t head = start - (uintptr_t)region;
+    if (head > 0)
+        munmap(region, head);
+    if (mapped - head > *size)
+        munmap((char *)start + *size, mapped - head - *size);
+
+    if (mlock((void *)start, *size) != 0) {
+        QKD_DBG_WARN("Failed to lock key memory");
+    }
+#ifdef MADV_DONTDUMP
+    madvise((void *)start, *size, MADV_DONTDUMP);
+#endif
+    return (struct slab_header *)start;
+}
+
+/* Called with the pool lock held. Carves a new slab into free objects. */
+static bool add_slab(uint32_t size_class) {
+    size_t size = SLAB_SIZE;
+    struct slab_header *slab = map_aligned(&size);
+    if (!slab)
+        return false;
+    if (!register_mapping((uintptr_t)slab)) {
+        qkd_locked_free(slab, size);
+        return false;
+    }
+
+    slab->size_class = size_class;
+    size_t object_size = class_size(size_class);
+    char *end = (char *)slab + SLAB_SIZE;
+    for (char *object = (char *)slab + HEADER_SIZE;
+         object + object_size <= end; object += object_size) {
+        struct free_object *entry = (struct free_object *)object;
+        entry->next = pools[size_class].free;
+        pools[size_class].free = entry;
+    }
+    __atomic_fetch_add(&slab_count, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Returns the objects cached by an exiting thread to the shared pools. */
+static void flush_cache(void *arg) {
+    struct thread_cache *exiting = arg;
+
+    for (uint32_t i = 0; i < CLASS_COUNT; i++) {
+        struct free_object *head = exiting->head[i];
+        if (!head)
+            continue;
+        struct free_object *tail = head;
+        while (tail->next)
+            tail = tail->next;
+        pthread_mutex_lock(&pools[i].lock);
+        tail->next = pools[i].free;
+        pools[i].free = head;
+        pthread_mutex_unlock(&pools[i].lock);
+        exiting->head[i] = NULL;
+        exiting->count[i] = 0;
+    }
+}
+
+static void create_cache_key(void) {
+    cache_key_ready = pthread_key_create(&cache_key, flush_cache) == 0;
+}
+
+/* Makes flush_cache() run when the calling thread exits. */
+static void register_cache(void) {
+    pthread_once(&cache_once, create_cache_key);
+    cache.registered =
+        cache_key_ready && pthread_setspecific(cache_key, &cache) == 0;
+}
+
+/* Moves up to CACHE_BATCH objects from the shared pool to this thread. */
+static bool refill_cache(uint32_t size_class) {
+    if (!cache.registered)
+        register_cache();
+
+    pthread_mutex_lock(&pools[size_class].lock);
+    if (!pools[size_class].free && !add_slab(size_class)) {
+        pthread_mutex_unlock(&pools[size_class].lock);
+        return false;
+    }
+    for (uint32_t i = 0; i < CACHE_BATCH && pools[size_class].free; i++) {
+        struct free_object *entry = pools[size_class].free;
+        pools[size_class].free = entry->next;
+        entry->next = cache.head[size_class];
+        cache.head[size_class] = entry;
+        cache.count[size_class]++;
+    }
+    pthread_mutex_unlock(&pools[size_class].lock);
+    return true;
+}
+
+static void *allocate_large(size_t size) {
+    if (size > SIZE_MAX - HEADER_SIZE)
+        return NULL;
+    size_t mapping_size = size + HEADER_SIZE;
+    struct slab_header *header = map_aligned(&mapping_size);
+    if (!header)
+        return NULL;
+    if (!register_mapping((uintptr_t)header)) {
+        qkd_locked_free(header, mapping_size);
+        return NULL;
+    }
+
+    header->size_class = LARGE_CLASS;
+    header->mapping_size = mapping_size;
+    header->object_size = size;
+    __atomic_fetch_add(&large_count, 1, __ATOMIC_RELAXED);
+    return (char *)header + HEADER_SIZE;
+}
+
+void *qkd_secure_alloc(size_t size) {
+    if (size == 0)
+        return NULL;
+    if (size > QKD_SECURE_MAX_SLAB_OBJECT)
+        return allocate_large(size);
+
+    uint32_t size_class = class_of(size);
+    if (!cache.head[size_class] && !refill_cache(size_class))
+        return NULL;
+
+    struct free_object *entry = cache.head[size_class];
+    cache.head[size_class] = entry->next;
+    cache.count[size_class]--;
+    entry->next = NULL;
+    return entry;
+}
+
+void qkd_secure_free(void *object) {
+    if (!object)
+        return;
+
+    uintptr_t start = (uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1U);
+    if (!is_registered(start)) {
+        OPENSSL_cleanse(object, malloc_usable_size(object));
+        free(object);
+        return;
+    }
+
+    struct slab_header *header = (struct slab_header *)start;
+    if (header->size_class == LARGE_CLASS) {
+        OPENSSL_cleanse(object, header->object_size);
+        __atomic_fetch_sub(&large_count, 1, __ATOMIC_RELAXED);
+        unregister_mapping(start);
+        qkd_locked_free(header, header->mapping_size);
+        return;
+    }
+
+    uint32_t size_class = header->size_class;
+    OPENSSL_cleanse(object, class_size(size_class));
+    if (!cache.registered)
+        register_cache();
+    struct free_object *entry = object;
+    entry->next = cache.head[size_class];
+    cache.head[size_class] = entry;
+    if (++cache.count[size_class] <= CACHE_LIMIT)
+        return;
+
+    /* Keep the most recently freed objects and share the others. */
+    struct free_object *last = entry;
+    for (uint32_t i = 1; i < CACHE_BATCH; i++)
+        last = last->next;
+    struct free_object *returned = last->next;
+    last->next = NULL;
+    cache.count[size_class] = CACHE_BATCH;
+
+    struct free_object *tail = returned;
+    while (tail->next)
+        tail = tail->next;
+    pthread_mutex_lock(&pools[size_class].lock);
+    tail->next = pools[size_class].free;
+    pools[size_class].free = returned;
+    pthread_mutex_unlock(&pools[size_class].lock);
+}
+
+char *qkd_secure_strndup(const char *value, size_t length) {
+    if (length == SIZE_MAX)
+        return NULL;
+
+    char *copy = qkd_secure_alloc(length + 1U);
+    if (copy)
+        memcpy(copy, value, length);
+    return copy;
+}
+
+void qkd_secure_alloc_get_stats(qkd_secure_alloc_stats_t *stats) {
+    if (!stats)
+        return;
+
+    stats->slabs = __atomic_load_n(&slab_count, __ATOMIC_RELAXED);
+    stats->large_objects = __atomic_load_n(&large_count, __ATOMIC_RELAXED);
+}
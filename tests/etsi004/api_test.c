@@ -6,13 +6,18 @@
  * - Javier Blanco-Romero (@fj-blanco) - UC3M
  */
 
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "etsi004/api.h"
+#include "etsi004/key_ring.h"
 #include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
 
 #define CHECK(condition)                                                       \
     do {                                                                       \
@@ -42,6 +47,10 @@ static void test_backend_registration(void) {
     const struct qkd_004_backend *backend = get_active_004_backend();
 
     CHECK(backend != NULL);
+    CHECK(qkd_004_load_backend(NULL) == backend);
+    CHECK(qkd_004_load_backend(QKD_BACKEND_TYPE) == backend);
+    CHECK(qkd_004_load_backend("missing") == NULL);
+    CHECK(qkd_004_load_backend("../missing") == NULL);
     register_qkd_004_backend(NULL);
     CHECK(get_active_004_backend() == NULL);
     CHECK(OPEN_CONNECT(NULL, NULL, NULL, NULL, NULL) ==
@@ -250,6 +259,427 @@ static void test_metadata_mimetype_negotiation(void) {
     CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
 }
 
+static void check_batch_matches_get_key(const unsigned char *key_stream_id,
+                                        uint32_t start_index, uint32_t count) {
+    unsigned char keys[8 * QKD_KEY_SIZE];
+    unsigned char key[QKD_KEY_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(count <= 8);
+    CHECK(GET_KEY_BATCH(key_stream_id, start_index, count, keys, &retrieved,
+                        &status) == QKD_STATUS_SUCCESS);
+    CHECK(status == QKD_STATUS_SUCCESS);
+    CHECK(retrieved == count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t index = start_index + i;
+        CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+              QKD_STATUS_SUCCESS);
+        CHECK(memcmp(key, keys + i * QKD_KEY_SIZE, sizeof(key)) == 0);
+    }
+}
+
+static void test_key_batch(void) {
+    struct qkd_qos_s qos = supported_qos();
+    qos.Max_bps = 1000000000U;
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char keys[8 * QKD_KEY_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(GET_KEY_BATCH(key_stream_id, 0, 1, keys, &retrieved, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY);
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+
+    const struct timespec delay = {.tv_nsec = 20000000L};
+    nanosleep(&delay, NULL);
+    check_batch_matches_get_key(key_stream_id, 0, 8);
+    check_batch_matches_get_key(key_stream_id, 100, 3);
+
+    /* The stream holds 1024 keys; a batch crossing the end is cut short. */
+    CHECK(GET_KEY_BATCH(key_stream_id, 1020, 8, keys, &retrieved, &status) ==
+          QKD_STATUS_INSUFFICIENT_KEY);
+    CHECK(retrieved == 4);
+    CHECK(GET_KEY_BATCH(key_stream_id, UINT32_MAX, 2, keys, &retrieved,
+                        &status) == QKD_STATUS_INSUFFICIENT_KEY);
+    CHECK(retrieved == 0);
+
+    /* Backends without the hook are served one GET_KEY at a time. */
+    const struct qkd_004_backend *backend = get_active_004_backend();
+    struct qkd_004_backend unbatched = *backend;
+    unbatched.get_key_batch = NULL;
+    register_qkd_004_backend(&unbatched);
+    check_batch_matches_get_key(key_stream_id, 8, 8);
+    CHECK(GET_KEY_BATCH(key_stream_id, 1020, 8, keys, &retrieved, &status) ==
+          QKD_STATUS_INSUFFICIENT_KEY);
+    CHECK(retrieved == 4);
+    register_qkd_004_backend(backend);
+
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+}
+
+static void test_large_chunks(void) {
+    enum { CHUNK_SIZE = 4096 };
+    struct qkd_qos_s qos = supported_qos();
+    qos.Max_bps = 1000000000U;
+    qos.Key_chunk_size = 1U << 20;
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char *key = malloc(CHUNK_SIZE);
+    unsigned char *keys = malloc(2 * CHUNK_SIZE);
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(key && keys);
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_QOS_NOT_MET);
+    CHECK(qos.Key_chunk_size < 1U << 20);
+    qos.Key_chunk_size = CHUNK_SIZE;
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(qos.Key_chunk_size == CHUNK_SIZE);
+    const struct timespec delay = {.tv_nsec = 20000000L};
+    nanosleep(&delay, NULL);
+
+    uint32_t index = 0;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(GET_KEY_BATCH(key_stream_id, 0, 2, keys, &retrieved, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(retrieved == 2);
+    CHECK(memcmp(key, keys, CHUNK_SIZE) == 0);
+    CHECK(memcmp(keys, keys + CHUNK_SIZE, CHUNK_SIZE) != 0);
+    /* The whole chunk is key material, not a padded digest. */
+    CHECK(memcmp(key + CHUNK_SIZE - QKD_KEY_SIZE, keys + CHUNK_SIZE,
+                 QKD_KEY_SIZE) != 0);
+    size_t zero_bytes = 0;
+    for (size_t i = 0; i < CHUNK_SIZE; i++)
+        zero_bytes += key[i] == 0;
+    CHECK(zero_bytes < CHUNK_SIZE / 64);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+
+    free(keys);
+    free(key);
+}
+
+static void wait_for_ring(const unsigned char *key_stream_id,
+                          uint32_t expected) {
+    const struct timespec delay = {.tv_nsec = 1000000L};
+    qkd_004_key_ring_stats_t stats = {0};
+
+    for (int i = 0; i < 2000; i++) {
+        CHECK(qkd_004_key_ring_get_stats(key_stream_id, &stats));
+        if (stats.buffered >= expected)
+            return;
+        nanosleep(&delay, NULL);
+    }
+    CHECK(stats.buffered >= expected);
+}
+
+static void test_key_ring(void) {
+    struct qkd_qos_s qos = supported_qos();
+    qos.Max_bps = 1000000000U;
+    qkd_004_key_ring_config_t config = {.capacity = 8, .batch_size = 4};
+    qkd_004_key_ring_stats_t stats;
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char expected[6 * QKD_KEY_SIZE];
+    unsigned char key[QKD_KEY_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    qkd_004_key_ring_config_t invalid = {.capacity = 4, .batch_size = 5};
+    CHECK(qkd_004_key_ring_start(key_stream_id, &qos, &invalid, &status) ==
+          QKD_STATUS_NO_CONNECTION);
+    struct qkd_qos_s no_chunks = qos;
+    no_chunks.Key_chunk_size = 0;
+    CHECK(qkd_004_key_ring_start(key_stream_id, &no_chunks, &config,
+                                 &status) == QKD_STATUS_QOS_NOT_MET);
+    CHECK(qkd_004_key_ring_start(key_stream_id, &qos, &config, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(qkd_004_key_ring_start(key_stream_id, &qos, &config, &status) ==
+          QKD_STATUS_KSID_IN_USE);
+    wait_for_ring(key_stream_id, config.capacity);
+    const struct timespec delay = {.tv_nsec = 20000000L};
+    nanosleep(&delay, NULL);
+    CHECK(GET_KEY_BATCH(key_stream_id, 0, 6, expected, &retrieved, &status) ==
+          QKD_STATUS_SUCCESS);
+
+    /* In-order GET_KEY calls pop the ring, others reach the backend. */
+    uint32_t index = 0;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(memcmp(key, expected, QKD_KEY_SIZE) == 0);
+    index = 5;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(memcmp(key, expected + 5 * QKD_KEY_SIZE, QKD_KEY_SIZE) == 0);
+    for (uint32_t i = 1; i < 5; i++) {
+        CHECK(GET_KEY_WAIT(key_stream_id, &index, key, &status) ==
+              QKD_STATUS_SUCCESS);
+        CHECK(index == i);
+        CHECK(memcmp(key, expected + i * QKD_KEY_SIZE, QKD_KEY_SIZE) == 0);
+    }
+    CHECK(qkd_004_key_ring_get_stats(key_stream_id, &stats));
+    CHECK(stats.hits == 5 && stats.misses == 1 && stats.next_index == 5);
+    CHECK(stats.fetched >= config.capacity);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+    CHECK(!qkd_004_key_ring_get_stats(key_stream_id, &stats));
+    CHECK(GET_KEY_WAIT(key_stream_id, &index, key, &status) ==
+          QKD_STATUS_NO_CONNECTION);
+
+    /* At 256 bit/s the producer delivers one chunk per second. */
+    memset(key_stream_id, 0, sizeof(key_stream_id));
+    qos.Max_bps = QKD_KEY_SIZE_BITS;
+    qos.Min_bps = 0;
+    qos.Timeout = 50;
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(qkd_004_key_ring_start(key_stream_id, &qos, &config, &status) ==
+          QKD_STATUS_SUCCESS);
+    int fd = qkd_004_key_ring_fd(key_stream_id);
+    CHECK(fd >= 0);
+    struct pollfd pending = {.fd = fd, .events = POLLIN};
+    uint64_t signals = 0;
+    CHECK(poll(&pending, 1, 2000) == 1);
+    CHECK(read(fd, &signals, sizeof(signals)) == sizeof(signals));
+    CHECK(GET_KEY_WAIT(key_stream_id, &index, key, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(index == 0);
+    CHECK(GET_KEY_WAIT(key_stream_id, &index, key, &status) ==
+          QKD_STATUS_TIMEOUT);
+    CHECK(status == QKD_STATUS_TIMEOUT);
+
+    /* The timeout armed the descriptor for the next chunk. */
+    CHECK(poll(&pending, 1, 0) == 0);
+    CHECK(poll(&pending, 1, 2000) == 1);
+    CHECK(read(fd, &signals, sizeof(signals)) == sizeof(signals));
+    index = 1;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(qkd_004_key_ring_get_stats(key_stream_id, &stats));
+    CHECK(stats.hits == 2 && stats.misses == 0);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+    CHECK(qkd_004_key_ring_fd(key_stream_id) == -1);
+}
+
+static void test_key_ring_chunk_size(void) {
+    enum { RING_CHUNK_SIZE = 1000 }; /* Not a multiple of the slot alignment */
+    struct qkd_qos_s qos = supported_qos();
+    qos.Key_chunk_size = RING_CHUNK_SIZE;
+    qos.Max_bps = 1000000000U;
+    qkd_004_key_ring_config_t config = {.capacity = 4, .batch_size = 2};
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char expected[4 * RING_CHUNK_SIZE];
+    unsigned char key[RING_CHUNK_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(qkd_004_key_ring_start(key_stream_id, &qos, &config, &status) ==
+          QKD_STATUS_SUCCESS);
+    wait_for_ring(key_stream_id, config.capacity);
+    CHECK(GET_KEY_BATCH(key_stream_id, 0, 4, expected, &retrieved, &status) ==
+          QKD_STATUS_SUCCESS);
+
+    uint32_t index = 0;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(memcmp(key, expected, RING_CHUNK_SIZE) == 0);
+    for (uint32_t i = 1; i < 4; i++) {
+        CHECK(GET_KEY_WAIT(key_stream_id, &index, key, &status) ==
+              QKD_STATUS_SUCCESS);
+        CHECK(index == i);
+        CHECK(memcmp(key, expected + i * RING_CHUNK_SIZE, RING_CHUNK_SIZE) ==
+              0);
+    }
+    qkd_004_key_ring_stats_t stats;
+    CHECK(qkd_004_key_ring_get_stats(key_stream_id, &stats));
+    CHECK(stats.hits == 4 && stats.misses == 0);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+}
+
+static void open_stream(struct qkd_qos_s *qos, unsigned char *key_stream_id) {
+    uint32_t status;
+
+    memset(key_stream_id, 0, QKD_KSID_SIZE);
+    CHECK(OPEN_CONNECT("alice", "bob", qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+}
+
+/* The key rate the simulator reports in the metadata of the stream. */
+static uint32_t stream_rate(const unsigned char *key_stream_id) {
+    unsigned char key[QKD_KEY_SIZE];
+    unsigned char buffer[QKD_METADATA_MAX_SIZE];
+    struct qkd_metadata_s metadata = {.Metadata_size = sizeof(buffer),
+                                      .Metadata_buffer = buffer};
+    uint32_t index = 0;
+    uint32_t status;
+    unsigned int rate = 0;
+
+    CHECK(GET_KEY(key_stream_id, &index, key, &metadata, &status) ==
+          QKD_STATUS_SUCCESS);
+    const char *field = strstr((const char *)buffer, "\"bps\": ");
+    CHECK(field && sscanf(field, "\"bps\": %u", &rate) == 1);
+    return (uint32_t)rate;
+}
+
+static void test_link_scheduler(void) {
+    unsigned char urgent_id[QKD_KSID_SIZE];
+    unsigned char bulk_ids[2][QKD_KSID_SIZE];
+    uint32_t status;
+
+    CHECK(setenv("QKD_SIM_LINK_BPS", "100000", 1) == 0);
+    struct qkd_qos_s urgent = supported_qos();
+    urgent.Min_bps = 20000;
+    urgent.Max_bps = 50000;
+    urgent.Priority = 0;
+    struct qkd_qos_s bulk = supported_qos();
+    bulk.Min_bps = 10000;
+    bulk.Priority = 1;
+    open_stream(&urgent, urgent_id);
+    CHECK(stream_rate(urgent_id) == 50000);
+    open_stream(&bulk, bulk_ids[0]);
+    open_stream(&bulk, bulk_ids[1]);
+
+    /* The urgent stream is served up to Max_bps, the rest is shared. */
+    CHECK(stream_rate(urgent_id) == 50000);
+    CHECK(stream_rate(bulk_ids[0]) == 25000);
+    CHECK(stream_rate(bulk_ids[1]) == 25000);
+
+    /* Admission fails only when the Min_bps no longer fits the link. */
+    unsigned char rejected_id[QKD_KSID_SIZE] = {0};
+    struct qkd_qos_s greedy = supported_qos();
+    greedy.Min_bps = 60001;
+    CHECK(OPEN_CONNECT("alice", "bob", &greedy, rejected_id, &status) ==
+          QKD_STATUS_QOS_NOT_MET);
+    CHECK(greedy.Min_bps == 60000);
+    unsigned char admitted_id[QKD_KSID_SIZE];
+    open_stream(&greedy, admitted_id);
+    CHECK(stream_rate(urgent_id) == 20000);
+    CHECK(stream_rate(bulk_ids[0]) == 10000);
+    CHECK(stream_rate(admitted_id) == 60000);
+    CHECK(CLOSE(admitted_id, &status) == QKD_STATUS_SUCCESS);
+
+    CHECK(CLOSE(urgent_id, &status) == QKD_STATUS_SUCCESS);
+    CHECK(stream_rate(bulk_ids[0]) == 50000);
+    CHECK(stream_rate(bulk_ids[1]) == 50000);
+    CHECK(CLOSE(bulk_ids[0], &status) == QKD_STATUS_SUCCESS);
+    CHECK(CLOSE(bulk_ids[1], &status) == QKD_STATUS_SUCCESS);
+
+    /* Without a link each stream runs at its Max_bps. */
+    CHECK(unsetenv("QKD_SIM_LINK_BPS") == 0);
+    open_stream(&urgent, urgent_id);
+    open_stream(&bulk, bulk_ids[0]);
+    CHECK(stream_rate(urgent_id) == urgent.Max_bps);
+    CHECK(stream_rate(bulk_ids[0]) == bulk.Max_bps);
+    CHECK(CLOSE(urgent_id, &status) == QKD_STATUS_SUCCESS);
+    CHECK(CLOSE(bulk_ids[0], &status) == QKD_STATUS_SUCCESS);
+}
+
+static void test_contexts(void) {
+    const struct qkd_004_backend *backend = get_active_004_backend();
+    struct qkd_004_backend unbatched = *backend;
+    unbatched.get_key_batch = NULL;
+    struct qkd_004_backend closed = {.name = "closed"};
+    struct qkd_qos_s qos = supported_qos();
+    qos.Max_bps = 1000000000U;
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char key[QKD_KEY_SIZE];
+    unsigned char keys[4 * QKD_KEY_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    CHECK(qkd_004_ctx_open_connect(NULL, "alice", "bob", &qos, key_stream_id,
+                                   &status) == QKD_STATUS_PEER_NOT_CONNECTED);
+
+    /* A context keeps its backend whatever the default context uses. */
+    qkd_004_ctx_t *ctx = qkd_004_ctx_create(&unbatched);
+    CHECK(ctx != NULL);
+    register_qkd_004_backend(&closed);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_NO_CONNECTION);
+    CHECK(qkd_004_ctx_open_connect(ctx, "bob", "alice", &qos, key_stream_id,
+                                   &status) == QKD_STATUS_SUCCESS);
+    const struct timespec delay = {.tv_nsec = 20000000L};
+    nanosleep(&delay, NULL);
+    CHECK(qkd_004_ctx_get_key_batch(ctx, key_stream_id, 4, 4, keys, &retrieved,
+                                    &status) == QKD_STATUS_SUCCESS);
+    CHECK(retrieved == 4);
+    register_qkd_004_backend(backend);
+
+    uint32_t index = 7;
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(memcmp(key, keys + 3 * QKD_KEY_SIZE, QKD_KEY_SIZE) == 0);
+    index = 4;
+    CHECK(qkd_004_ctx_get_key(ctx, key_stream_id, &index, key, NULL,
+                              &status) == QKD_STATUS_SUCCESS);
+    CHECK(memcmp(key, keys, QKD_KEY_SIZE) == 0);
+    CHECK(qkd_004_ctx_close(ctx, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    qkd_004_ctx_destroy(ctx);
+
+    ctx = qkd_004_ctx_create(&closed);
+    CHECK(ctx != NULL);
+    status = UINT32_MAX;
+    CHECK(qkd_004_ctx_close(ctx, key_stream_id, &status) ==
+          QKD_STATUS_NO_CONNECTION);
+    CHECK(status == QKD_STATUS_NO_CONNECTION);
+    qkd_004_ctx_destroy(ctx);
+
+    /* The default context outlives attempts to destroy it. */
+    qkd_004_ctx_destroy(qkd_004_default_ctx());
+    CHECK(get_active_004_backend() == backend);
+}
+
+static void test_metrics(void) {
+    struct qkd_metrics_snapshot before, after;
+    struct qkd_qos_s qos = supported_qos();
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char keys[2 * QKD_KEY_SIZE];
+    uint32_t retrieved = 0;
+    uint32_t status;
+
+    qkd_metrics_snapshot(&before);
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    qkd_004_ctx_get_key_batch(NULL, key_stream_id, 0, 2, keys, &retrieved,
+                              &status);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+    qkd_metrics_snapshot(&after);
+
+    const struct qkd_metrics_op_stats *open =
+        &after.ops[QKD_METRICS_004_OPEN_CONNECT];
+    const struct qkd_metrics_op_stats *close =
+        &after.ops[QKD_METRICS_004_CLOSE];
+    CHECK(open->calls == before.ops[QKD_METRICS_004_OPEN_CONNECT].calls + 1);
+    CHECK(open->errors == before.ops[QKD_METRICS_004_OPEN_CONNECT].errors + 1);
+    CHECK(open->phases[QKD_METRICS_TOTAL].count ==
+          before.ops[QKD_METRICS_004_OPEN_CONNECT]
+                  .phases[QKD_METRICS_TOTAL]
+                  .count +
+              1);
+    CHECK(after.ops[QKD_METRICS_004_GET_KEY_BATCH].calls ==
+          before.ops[QKD_METRICS_004_GET_KEY_BATCH].calls + 1);
+    CHECK(close->calls == before.ops[QKD_METRICS_004_CLOSE].calls + 1);
+    CHECK(close->errors == before.ops[QKD_METRICS_004_CLOSE].errors);
+}
+
 int main(void) {
     test_backend_registration();
     test_legacy_fixture();
@@ -257,6 +687,13 @@ int main(void) {
     test_predefined_stream_and_qos();
     test_key_and_metadata();
     test_metadata_mimetype_negotiation();
+    test_key_batch();
+    test_large_chunks();
+    test_key_ring();
+    test_key_ring_chunk_size();
+    test_link_scheduler();
+    test_contexts();
+    test_metrics();
     puts("ETSI 004 simulated backend tests passed");
     return 0;
 }
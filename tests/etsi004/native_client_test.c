@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+#include <arpa/inet.h>
+#include <jansson.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "etsi004/api.h"
+#include "qkd_etsi_api.h"
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "CHECK failed at %s:%d: %s\n", __FILE__, __LINE__, \
+                    #condition);                                               \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+#define MOCK_MAX_STREAMS 8
+#define MOCK_SILENT_INDEX 999U /* GET_KEY that is never answered */
+#define MOCK_BASE64_INDEX 998U /* GET_KEY answered with a Base64 key */
+#define MOCK_METADATA "{\"age\": 0}"
+
+/*
+ * Loopback KMS speaking the message format of the native client: one JSON
+ * object per request and reply, back to back on the connection. Each
+ * connection is served by its own thread; requests that do not match the
+ * documented fields are counted in protocol_errors.
+ */
+static struct {
+    pthread_mutex_t lock;
+    int listen_fd;
+    char streams[MOCK_MAX_STREAMS][37];
+    int peers[MOCK_MAX_STREAMS];
+    unsigned int stream_count;
+    unsigned int protocol_errors;
+    char last_metadata[256];
+} mock = {.lock = PTHREAD_MUTEX_INITIALIZER, .listen_fd = -1};
+
+static const char *const qos_names[] = {
+    "Key_chunk_size", "Max_bps", "Min_bps", "Jitter",
+    "Priority",       "Timeout", "TTL"};
+
+static void protocol_error(const char *reason) {
+    fprintf(stderr, "mock KMS: %s\n", reason);
+    pthread_mutex_lock(&mock.lock);
+    mock.protocol_errors++;
+    pthread_mutex_unlock(&mock.lock);
+}
+
+static bool is_valid_qos(const json_t *qos) {
+    if (!json_is_object(qos) ||
+        !json_is_string(json_object_get(qos, "Metadata_mimetype")))
+        return false;
+    for (size_t i = 0; i < sizeof(qos_names) / sizeof(qos_names[0]); i++) {
+        if (!json_is_integer(json_object_get(qos, qos_names[i])))
+            return false;
+    }
+    return true;
+}
+
+/* Index of the open stream named by data.key_stream_id, or -1. */
+static int find_stream(const json_t *data) {
+    const json_t *id = json_object_get(data, "key_stream_id");
+    if (!json_is_string(id))
+        return -1;
+
+    int found = -1;
+    pthread_mutex_lock(&mock.lock);
+    for (unsigned int i = 0; i < mock.stream_count && found < 0; i++) {
+        if (mock.peers[i] > 0 &&
+            strcmp(mock.streams[i], json_string_value(id)) == 0)
+            found = (int)i;
+    }
+    pthread_mutex_unlock(&mock.lock);
+    return found;
+}
+
+static json_t *open_connect(const json_t *data) {
+    const json_t *qos = json_object_get(data, "qos");
+    const json_t *id = json_object_get(data, "key_stream_id");
+    if (!json_is_string(json_object_get(data, "source")) ||
+        !json_is_string(json_object_get(data, "destination")) ||
+        !is_valid_qos(qos) || (!json_is_string(id) && !json_is_null(id))) {
+        protocol_error("malformed OPEN_CONNECT");
+        return NULL;
+    }
+
+    json_t *reply = json_object();
+    json_t *reply_qos = json_object();
+    json_object_set_new(reply_qos, "Key_chunk_size",
+                        json_integer(QKD_KEY_SIZE));
+    json_object_set_new(reply, "qos", reply_qos);
+    if (json_integer_value(json_object_get(qos, "Key_chunk_size")) !=
+        QKD_KEY_SIZE) {
+        json_object_set_new(reply, "status",
+                            json_integer(QKD_STATUS_QOS_NOT_MET));
+        json_object_set_new(reply, "key_stream_id", json_null());
+        return reply;
+    }
+
+    if (json_is_string(id)) {
+        int stream = find_stream(data);
+        if (stream >= 0) {
+            pthread_mutex_lock(&mock.lock);
+            mock.peers[stream]++;
+            pthread_mutex_unlock(&mock.lock);
+        }
+        json_object_set_new(reply, "status",
+                            json_integer(stream >= 0
+                                             ? QKD_STATUS_SUCCESS
+                                             : QKD_STATUS_NO_CONNECTION));
+        json_object_set_new(reply, "key_stream_id",
+                            json_string(json_string_value(id)));
+        return reply;
+    }
+
+    pthread_mutex_lock(&mock.lock);
+    unsigned int stream = mock.stream_count++;
+    snprintf(mock.streams[stream], sizeof(mock.streams[stream]),
+             "6f1c2d3e-4b5a-4c6d-8e7f-%012x", stream + 1U);
+    mock.peers[stream] = 1;
+    pthread_mutex_unlock(&mock.lock);
+    json_object_set_new(reply, "status",
+                        json_integer(QKD_STATUS_PEER_NOT_CONNECTED));
+    json_object_set_new(reply, "key_stream_id",
+                        json_string(mock.streams[stream]));
+    return reply;
+}
+
+static json_t *get_key(const json_t *data) {
+    const json_t *index = json_object_get(data, "index");
+    const json_t *metadata = json_object_get(data, "metadata");
+    if (!json_is_integer(index) || !json_is_string(metadata)) {
+        protocol_error("malformed GET_KEY");
+        return NULL;
+    }
+    pthread_mutex_lock(&mock.lock);
+    snprintf(mock.last_metadata, sizeof(mock.last_metadata), "%s",
+             json_string_value(metadata));
+    pthread_mutex_unlock(&mock.lock);
+
+    json_int_t value = json_integer_value(index);
+    json_t *reply = json_object();
+    if (find_stream(data) < 0) {
+        json_object_set_new(reply, "status",
+                            json_integer(QKD_STATUS_NO_CONNECTION));
+        return reply;
+    }
+    if (value == MOCK_SILENT_INDEX) {
+        json_decref(reply);
+        return NULL;
+    }
+
+    json_t *key = json_array();
+    for (int i = 0; i < QKD_KEY_SIZE; i++)
+        json_array_append_new(key, json_integer((value * 7 + i) & 0xFF));
+    if (value == MOCK_BASE64_INDEX) {
+        json_decref(key);
+        key = json_string("AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwdHh8=");
+    }
+    json_object_set_new(reply, "status", json_integer(QKD_STATUS_SUCCESS));
+    json_object_set_new(reply, "index", json_integer(value));
+    json_object_set_new(reply, "key_buffer", key);
+    json_object_set_new(reply, "metadata", json_string(MOCK_METADATA));
+    return reply;
+}
+
+static json_t *close_stream(const json_t *data) {
+    int stream = find_stream(data);
+    if (stream < 0) {
+        protocol_error("CLOSE of an unknown stream");
+        return NULL;
+    }
+    pthread_mutex_lock(&mock.lock);
+    mock.peers[stream]--;
+    pthread_mutex_unlock(&mock.lock);
+
+    json_t *reply = json_object();
+    json_object_set_new(reply, "status", json_integer(QKD_STATUS_SUCCESS));
+    return reply;
+}
+
+/* Sends a reply in two writes, so the client has to reassemble it. */
+static void send_reply(int fd, json_t *reply) {
+    char *encoded = json_dumps(reply, JSON_COMPACT);
+    json_decref(reply);
+    if (!encoded)
+        return;
+
+    size_t length = strlen(encoded);
+    size_t half = length / 2;
+    struct timespec pause = {0, 2000000};
+    if (send(fd, encoded, half, MSG_NOSIGNAL) < 0 ||
+        nanosleep(&pause, NULL) != 0 ||
+        send(fd, encoded + half, length - half, MSG_NOSIGNAL) < 0 ||
+        send(fd, "\n", 1, MSG_NOSIGNAL) < 0) {
+        fprintf(stderr, "mock KMS: send failed\n");
+    }
+    free(encoded);
+}
+
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    char buffer[16384];
+    size_t length = 0;
+
+    for (;;) {
+        ssize_t received =
+            recv(fd, buffer + length, sizeof(buffer) - length, 0);
+        if (received <= 0)
+            break;
+        length += (size_t)received;
+
+        json_error_t error;
+        json_t *message;
+        while (length > 0 &&
+               (message = json_loadb(buffer, length, JSON_DISABLE_EOF_CHECK,
+                                     &error))) {
+            size_t used = (size_t)error.position;
+            memmove(buffer, buffer + used, length - used);
+            length -= used;
+
+            const json_t *command = json_object_get(message, "command");
+            const json_t *data = json_object_get(message, "data");
+            const char *name = json_string_value(command);
+            json_t *reply = NULL;
+            if (!json_is_object(message) || !name || !json_is_object(data))
+                protocol_error("request is not {command, data}");
+            else if (strcmp(name, "OPEN_CONNECT") == 0)
+                reply = open_connect(data);
+            else if (strcmp(name, "GET_KEY") == 0)
+                reply = get_key(data);
+            else if (strcmp(name, "CLOSE") == 0)
+                reply = close_stream(data);
+            else
+                protocol_error("unknown command");
+            json_decref(message);
+            if (reply)
+                send_reply(fd, reply);
+        }
+        if (length == sizeof(buffer)) {
+            protocol_error("request too large");
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *accept_connections(void *arg) {
+    (void)arg;
+    for (;;) {
+        int fd = accept(mock.listen_fd, NULL, NULL);
+        if (fd < 0)
+            return NULL;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection,
+                           (void *)(intptr_t)fd) != 0)
+            close(fd);
+        else
+            pthread_detach(thread);
+    }
+}
+
+/* Starts the mock KMS on a loopback port and returns that port. */
+static int start_mock_kms(void) {
+    struct sockaddr_in address = {.sin_family = AF_INET};
+    socklen_t address_length = sizeof(address);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    mock.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK(mock.listen_fd >= 0);
+    CHECK(bind(mock.listen_fd, (struct sockaddr *)&address,
+               sizeof(address)) == 0);
+    CHECK(listen(mock.listen_fd, 16) == 0);
+    CHECK(getsockname(mock.listen_fd, (struct sockaddr *)&address,
+                      &address_length) == 0);
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, accept_connections, NULL) == 0);
+    CHECK(pthread_detach(thread) == 0);
+    return ntohs(address.sin_port);
+}
+
+static struct qkd_qos_s supported_qos(void) {
+    struct qkd_qos_s qos = {
+        .Key_chunk_size = QKD_KEY_SIZE,
+        .Max_bps = 1000000,
+        .Min_bps = 100,
+        .Jitter = 10,
+        .Priority = 1,
+        .Timeout = 1000,
+        .TTL = 60,
+    };
+    memcpy(qos.Metadata_mimetype, "application/json",
+           sizeof("application/json"));
+    return qos;
+}
+
+static bool is_null_ksid(const unsigned char *key_stream_id) {
+    static const unsigned char null_ksid[QKD_KSID_SIZE] = {0};
+    return memcmp(key_stream_id, null_ksid, QKD_KSID_SIZE) == 0;
+}
+
+static void test_open_connect(const char *destination) {
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    struct qkd_qos_s qos = supported_qos();
+    uint32_t status;
+
+    /* The server's counter-offer is copied into the caller's QoS. */
+    qos.Key_chunk_size = 2U * QKD_KEY_SIZE;
+    CHECK(OPEN_CONNECT("client://alice", destination, &qos, key_stream_id,
+                       &status) == QKD_STATUS_QOS_NOT_MET);
+    CHECK(status == QKD_STATUS_QOS_NOT_MET);
+    CHECK(qos.Key_chunk_size == QKD_KEY_SIZE);
+    CHECK(is_null_ksid(key_stream_id));
+
+    CHECK(OPEN_CONNECT("client://alice", "kms://localhost", &qos,
+                       key_stream_id, &status) == QKD_STATUS_NO_CONNECTION);
+    CHECK(OPEN_CONNECT("client://alice", "server://127.0.0.1:1", &qos,
+                       key_stream_id, &status) == QKD_STATUS_NO_CONNECTION);
+
+    /* A KSID the server does not know is refused. */
+    memset(key_stream_id, 0x42, sizeof(key_stream_id));
+    CHECK(OPEN_CONNECT("client://bob", destination, &qos, key_stream_id,
+                       &status) == QKD_STATUS_NO_CONNECTION);
+}
+
+static void test_key_exchange(const char *destination) {
+    unsigned char alice_id[QKD_KSID_SIZE] = {0};
+    unsigned char bob_id[QKD_KSID_SIZE];
+    unsigned char key[QKD_KEY_SIZE];
+    unsigned char buffer[QKD_METADATA_MAX_SIZE];
+    struct qkd_qos_s qos = supported_qos();
+    uint32_t status;
+
+    CHECK(OPEN_CONNECT("client://alice", destination, &qos, alice_id,
+                       &status) == QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(!is_null_ksid(alice_id));
+    memcpy(bob_id, alice_id, sizeof(bob_id));
+    CHECK(OPEN_CONNECT("client://bob", destination, &qos, bob_id, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(memcmp(alice_id, bob_id, QKD_KSID_SIZE) == 0);
+
+    struct qkd_metadata_s metadata = {.Metadata_size = sizeof(buffer),
+                                      .Metadata_buffer = buffer};
+    uint32_t index = 5;
+    CHECK(GET_KEY(alice_id, &index, key, &metadata, &status) ==
+          QKD_STATUS_SUCCESS);
+    CHECK(index == 5);
+    for (int i = 0; i < QKD_KEY_SIZE; i++)
+        CHECK(key[i] == ((5 * 7 + i) & 0xFF));
+    CHECK(strcmp((const char *)buffer, MOCK_METADATA) == 0);
+    CHECK(metadata.Metadata_size == strlen(MOCK_METADATA));
+    pthread_mutex_lock(&mock.lock);
+    json_t *descriptor = json_loads(mock.last_metadata, 0, NULL);
+    pthread_mutex_unlock(&mock.lock);
+    CHECK(json_is_object(descriptor));
+    json_decref(descriptor);
+
+    /* Without a metadata buffer the request carries an empty descriptor. */
+    index = 6;
+    CHECK(GET_KEY(bob_id, &index, key, NULL, &status) == QKD_STATUS_SUCCESS);
+    CHECK(key[0] == ((6 * 7) & 0xFF));
+    pthread_mutex_lock(&mock.lock);
+    CHECK(mock.last_metadata[0] == '\0');
+    pthread_mutex_unlock(&mock.lock);
+
+    metadata.Metadata_size = 4;
+    CHECK(GET_KEY(alice_id, &index, key, &metadata, &status) ==
+          QKD_STATUS_METADATA_SIZE_INSUFFICIENT);
+    CHECK(metadata.Metadata_size == strlen(MOCK_METADATA) + 1U);
+
+    /* key_buffer must be an array of byte values. */
+    index = MOCK_BASE64_INDEX;
+    CHECK(GET_KEY(alice_id, &index, key, NULL, &status) ==
+          QKD_STATUS_INSUFFICIENT_KEY);
+
+    CHECK(CLOSE(alice_id, &status) == QKD_STATUS_SUCCESS);
+    CHECK(CLOSE(bob_id, &status) == QKD_STATUS_SUCCESS);
+    index = 7;
+    CHECK(GET_KEY(alice_id, &index, key, NULL, &status) ==
+          QKD_STATUS_NO_CONNECTION);
+    CHECK(CLOSE(alice_id, &status) == QKD_STATUS_NO_CONNECTION);
+}
+
+static void test_timeout(const char *destination) {
+    unsigned char key_stream_id[QKD_KSID_SIZE] = {0};
+    unsigned char key[QKD_KEY_SIZE];
+    struct qkd_qos_s qos = supported_qos();
+    uint32_t status;
+
+    qos.Timeout = 200;
+    CHECK(OPEN_CONNECT("client://alice", destination, &qos, key_stream_id,
+                       &status) == QKD_STATUS_PEER_NOT_CONNECTED);
+
+    struct timespec started, finished;
+    uint32_t index = MOCK_SILENT_INDEX;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    CHECK(GET_KEY(key_stream_id, &index, key, NULL, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long long elapsed_ms = (finished.tv_sec - started.tv_sec) * 1000LL +
+                           (finished.tv_nsec - started.tv_nsec) / 1000000;
+    CHECK(elapsed_ms >= 150 && elapsed_ms < 2000);
+    CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+}
+
+int main(void) {
+    char destination[64];
+
+    CHECK(unsetenv("SERVER_CERT_PEM") == 0);
+    CHECK(setenv("QKD_004_ALLOW_PLAINTEXT", "1", 1) == 0);
+    snprintf(destination, sizeof(destination), "server://127.0.0.1:%d",
+             start_mock_kms());
+
+    test_open_connect(destination);
+    test_key_exchange(destination);
+    test_timeout(destination);
+    CHECK(mock.protocol_errors == 0);
+
+    printf("Native client tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 QURSA Project
+ * SPDX-License-Identifier: MIT
+ *
+ * Authors:
+ * - Javier Blanco-Romero (@fj-blanco) - UC3M
+ */
+
+/*
+ * Concurrent use of the ETSI 004 simulated backend: worker threads open,
+ * read and close private streams while all of them read one shared stream.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "etsi004/api.h"
+#include "qkd_etsi_api.h"
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "CHECK failed at %s:%d: %s\n", __FILE__, __LINE__, \
+                    #condition);                                               \
+            exit(EXIT_FAILURE);                                                \
+        }                                                                      \
+    } while (0)
+
+#define WORKER_COUNT 8
+#define ITERATIONS 50
+#define KEYS_PER_STREAM 32
+#define SHARED_KEYS 256
+
+static unsigned char shared_stream_id[QKD_KSID_SIZE];
+static unsigned char shared_keys[SHARED_KEYS][QKD_KEY_SIZE];
+
+struct worker {
+    unsigned char first_key[QKD_KEY_SIZE];
+};
+
+static struct qkd_qos_s fast_qos(void) {
+    struct qkd_qos_s qos = {
+        .Key_chunk_size = QKD_KEY_SIZE,
+        .Max_bps = 1000000000U,
+        .Min_bps = 100,
+        .Timeout = 1000,
+        .TTL = 60,
+    };
+    memcpy(qos.Metadata_mimetype, "application/json",
+           sizeof("application/json"));
+    return qos;
+}
+
+/* Keys become available at Max_bps; retry until the index is generated. */
+static void get_key(const unsigned char *key_stream_id, uint32_t index,
+                    unsigned char *key) {
+    const struct timespec delay = {.tv_nsec = 100000L};
+    uint32_t status;
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint32_t requested = index;
+        if (GET_KEY(key_stream_id, &requested, key, NULL, &status) ==
+            QKD_STATUS_SUCCESS)
+            return;
+        CHECK(status == QKD_STATUS_INSUFFICIENT_KEY);
+        nanosleep(&delay, NULL);
+    }
+    CHECK(!"key never became available");
+}
+
+static void open_stream(unsigned char *key_stream_id) {
+    struct qkd_qos_s qos = fast_qos();
+    uint32_t status;
+
+    memset(key_stream_id, 0, QKD_KSID_SIZE);
+    CHECK(OPEN_CONNECT("alice", "bob", &qos, key_stream_id, &status) ==
+          QKD_STATUS_PEER_NOT_CONNECTED);
+    CHECK(OPEN_CONNECT("bob", "alice", &qos, key_stream_id, &status) ==
+          QKD_STATUS_SUCCESS);
+}
+
+static void *run_worker(void *arg) {
+    struct worker *worker = arg;
+    unsigned char key_stream_id[QKD_KSID_SIZE];
+    unsigned char key[QKD_KEY_SIZE];
+    unsigned char again[QKD_KEY_SIZE];
+    uint32_t status;
+
+    for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+        open_stream(key_stream_id);
+        for (uint32_t index = 0; index < KEYS_PER_STREAM; index++) {
+            get_key(key_stream_id, index, key);
+            get_key(key_stream_id, index, again);
+            CHECK(memcmp(key, again, sizeof(key)) == 0);
+            if (iteration == 0 && index == 0)
+                memcpy(worker->first_key, key, sizeof(key));
+
+            uint32_t shared_index =
+                (index * WORKER_COUNT + (uint32_t)iteration) % SHARED_KEYS;
+            get_key(shared_stream_id, shared_index, key);
+            CHECK(memcmp(key, shared_keys[shared_index], sizeof(key)) == 0);
+        }
+        CHECK(CLOSE(key_stream_id, &status) == QKD_STATUS_SUCCESS);
+        CHECK(GET_KEY(key_stream_id, &(uint32_t){0}, key, NULL, &status) ==
+              QKD_STATUS_PEER_NOT_CONNECTED_GET_KEY);
+    }
+    return NULL;
+}
+
+int main(void) {
+    struct worker workers[WORKER_COUNT];
+    pthread_t threads[WORKER_COUNT];
+    uint32_t status;
+
+    open_stream(shared_stream_id);
+    for (uint32_t index = 0; index < SHARED_KEYS; index++)
+        get_key(shared_stream_id, index, shared_keys[index]);
+
+    for (int i = 0; i < WORKER_COUNT; i++)
+        CHECK(pthread_create(&threads[i], NULL, run_worker, &workers[i]) == 0);
+    for (int i = 0; i < WORKER_COUNT; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+
+    /* Every worker stream was opened with its own random secret. */
+    for (int i = 0; i < WORKER_COUNT; i++) {
+        for (int j = i + 1; j < WORKER_COUNT; j++)
+            CHECK(memcmp(workers[i].first_key, workers[j].first_key,
+                         QKD_KEY_SIZE) != 0);
+    }
+
+    CHECK(CLOSE(shared_stream_id, &status) == QKD_STATUS_SUCCESS);
+    puts("ETSI 004 stress tests passed");
+    return 0;
+}
@@ -9,13 +9,28 @@
 
 #include <ctype.h>
 #include <openssl/evp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "etsi014/api.h"
+#include "etsi014/backends/qkd_etsi014_backend.h"
+#include "etsi014/key_broker.h"
+#include "etsi014/key_cache.h"
+#include "etsi014/key_codec.h"
+#include "etsi014/key_coalescer.h"
+#include "etsi014/key_stream_parser.h"
+#include "etsi014/status_cache.h"
 #include "qkd_etsi_api.h"
+#include "qkd_metrics.h"
+#include "qkd_secure_alloc.h"
 
 #define CHECK(condition)                                                       \
     do {                                                                       \
@@ -86,6 +101,10 @@ static void test_backend_registration(void) {
     const struct qkd_014_backend *backend = get_active_014_backend();
 
     CHECK(backend != NULL);
+    CHECK(qkd_014_load_backend(NULL) == backend);
+    CHECK(qkd_014_load_backend(QKD_BACKEND_TYPE) == backend);
+    CHECK(qkd_014_load_backend("missing") == NULL);
+    CHECK(qkd_014_load_backend("../missing") == NULL);
     register_qkd_014_backend(NULL);
     CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, NULL) ==
           QKD_STATUS_BAD_REQUEST);
@@ -121,8 +140,8 @@ static void test_get_status(void) {
     CHECK(status.max_SAE_ID_count >= 0);
 #ifndef QKD_USE_ETSI014_BACKEND
     CHECK(status.key_size == QKD_KEY_SIZE_BITS);
-    CHECK(status.min_key_size == QKD_KEY_SIZE_BITS);
-    CHECK(status.max_key_size == QKD_KEY_SIZE_BITS);
+    CHECK(status.min_key_size == 8);
+    CHECK(status.max_key_size >= 4096 * 8);
     CHECK(status.max_key_per_request >= 2);
     CHECK(status.max_SAE_ID_count == 0);
     CHECK(status.stored_key_count == status.max_key_count);
@@ -131,6 +150,16 @@ static void test_get_status(void) {
     qkd_status_free(&status);
 
     CHECK(GET_STATUS(NULL, slave_sae, &status) == QKD_STATUS_BAD_REQUEST);
+
+#ifdef QKD_USE_ETSI014_BACKEND
+    /* Credentials are loaded again after being dropped. */
+    etsi014_cert_config_t config = {0};
+    CHECK(init_cert_config(1, &config) == QKD_STATUS_OK);
+    CHECK(config.credentials && config.cert_path);
+    qkd_etsi014_credentials_cleanup();
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) == QKD_STATUS_OK);
+    qkd_status_free(&status);
+#endif
 }
 
 static void test_unsupported_request_features(void) {
@@ -156,6 +185,79 @@ static void test_unsupported_request_features(void) {
           QKD_STATUS_BAD_REQUEST);
 }
 
+struct async_result {
+    uint32_t result;
+    int calls;
+};
+
+static void record_async_result(uint32_t result, void *user_data) {
+    struct async_result *record = user_data;
+
+    record->result = result;
+    record->calls++;
+}
+
+static void wait_for_async(qkd_014_async_t *async) {
+    int outstanding;
+
+    do {
+        outstanding = qkd_014_async_perform(async, 1000);
+        CHECK(outstanding >= 0);
+    } while (outstanding > 0);
+}
+
+static void test_async(void) {
+    qkd_014_async_t *async = qkd_014_async_create();
+    CHECK(async != NULL);
+    CHECK(qkd_014_async_fd(async) >= 0);
+    CHECK(qkd_014_async_perform(async, 0) == 0);
+
+    qkd_status_t status = {0};
+    struct async_result status_result = {0};
+    CHECK(GET_STATUS_ASYNC(async, master_kme_hostname, slave_sae, &status,
+                           NULL, NULL) == QKD_STATUS_BAD_REQUEST);
+    CHECK(GET_STATUS_ASYNC(async, master_kme_hostname, slave_sae, &status,
+                           record_async_result,
+                           &status_result) == QKD_STATUS_OK);
+    CHECK(status_result.calls == 0);
+
+    qkd_key_container_t container = {0};
+    struct async_result key_result = {0};
+    qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
+    CHECK(GET_KEY_ASYNC(async, master_kme_hostname, slave_sae, &request,
+                        &container, record_async_result,
+                        &key_result) == QKD_STATUS_OK);
+
+    wait_for_async(async);
+    CHECK(status_result.calls == 1);
+    CHECK(status_result.result == QKD_STATUS_OK);
+    CHECK(status.key_size > 0);
+    CHECK(key_result.calls == 1);
+    CHECK(key_result.result == QKD_STATUS_OK);
+    CHECK(container.key_count == 2);
+
+    qkd_key_id_t requested_ids[2] = {
+        {.key_ID = container.keys[0].key_ID},
+        {.key_ID = container.keys[1].key_ID},
+    };
+    qkd_key_ids_t key_ids = {.key_IDs = requested_ids, .key_ID_count = 2};
+    qkd_key_container_t retrieved = {0};
+    struct async_result ids_result = {0};
+    CHECK(GET_KEY_WITH_IDS_ASYNC(async, slave_kme_hostname, master_sae,
+                                 &key_ids, &retrieved, record_async_result,
+                                 &ids_result) == QKD_STATUS_OK);
+    wait_for_async(async);
+    CHECK(ids_result.calls == 1);
+    CHECK(ids_result.result == QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 2);
+    CHECK(strcmp(retrieved.keys[1].key, container.keys[1].key) == 0);
+
+    qkd_key_container_free(&retrieved);
+    qkd_key_container_free(&container);
+    qkd_status_free(&status);
+    qkd_014_async_destroy(async);
+}
+
 #ifndef QKD_USE_ETSI014_BACKEND
 static void test_simulated_key_exchange(void) {
     qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
@@ -235,56 +337,1117 @@ static void test_simulated_key_exchange(void) {
 
     CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) == QKD_STATUS_OK);
     CHECK(status.stored_key_count == status.max_key_count);
+    int32_t max_key_size = status.max_key_size;
+    request.number = status.max_key_per_request + 1;
     qkd_status_free(&status);
 
-    request.number = 17;
     CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
           QKD_STATUS_BAD_REQUEST);
     request.number = -1;
     CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
           QKD_STATUS_BAD_REQUEST);
     request.number = 1;
-    request.size = 128;
+    request.size = 100;
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_BAD_REQUEST);
+    request.size = max_key_size + 8;
     CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
           QKD_STATUS_BAD_REQUEST);
+
+    /* Large keys are delivered at the requested size. */
+    request.size = 4096 * 8;
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 1);
+    CHECK(strlen(issued.keys[0].key) == 4 * ((4096 + 2) / 3));
+    requested_ids[0].key_ID = issued.keys[0].key_ID;
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    CHECK(strcmp(retrieved.keys[0].key, issued.keys[0].key) == 0);
+    qkd_key_container_free(&retrieved);
+    qkd_key_container_free(&issued);
 }
 
+/* Fills the store to its configured capacity and drains it again. */
 static void test_simulated_capacity(void) {
-    qkd_key_request_t request = {.number = 16, .size = QKD_KEY_SIZE_BITS};
-    qkd_key_container_t issued = {0};
-    qkd_key_container_t retrieved = {0};
-
-    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+    qkd_status_t status = {0};
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) ==
           QKD_STATUS_OK);
-    CHECK(issued.key_count == 16);
+    int32_t capacity = status.max_key_count;
+    int32_t per_request = status.max_key_per_request;
+    CHECK(status.stored_key_count == capacity);
+    CHECK(per_request > 0 && per_request <= capacity);
+    qkd_status_free(&status);
+
+    int32_t rounds = (capacity + per_request - 1) / per_request;
+    qkd_key_container_t *issued = calloc((size_t)rounds, sizeof(*issued));
+    qkd_key_id_t *requested_ids =
+        calloc((size_t)per_request, sizeof(*requested_ids));
+    CHECK(issued && requested_ids);
+
+    for (int32_t round = 0; round < rounds; round++) {
+        int32_t remaining = capacity - round * per_request;
+        qkd_key_request_t request = {
+            .number = remaining < per_request ? remaining : per_request,
+            .size = QKD_KEY_SIZE_BITS};
+        CHECK(GET_KEY(master_kme_hostname, slave_sae, &request,
+                      &issued[round]) == QKD_STATUS_OK);
+        CHECK(issued[round].key_count == request.number);
+    }
 
     qkd_key_container_t extra = {0};
     CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, &extra) ==
           QKD_STATUS_SERVER_ERROR);
     CHECK(extra.keys == NULL);
 
-    qkd_key_id_t requested_ids[16] = {0};
+    if (issued[0].key_count > 1) {
+        qkd_key_id_t duplicate[2] = {{.key_ID = issued[0].keys[0].key_ID},
+                                     {.key_ID = issued[0].keys[0].key_ID}};
+        qkd_key_ids_t ids = {.key_IDs = duplicate, .key_ID_count = 2};
+        CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &ids,
+                               &extra) == QKD_STATUS_BAD_REQUEST);
+    }
+
+    for (int32_t round = 0; round < rounds; round++) {
+        qkd_key_container_t retrieved = {0};
+        for (int32_t i = 0; i < issued[round].key_count; i++)
+            requested_ids[i].key_ID = issued[round].keys[i].key_ID;
+        qkd_key_ids_t ids = {.key_IDs = requested_ids,
+                             .key_ID_count = issued[round].key_count};
+        CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &ids,
+                               &retrieved) == QKD_STATUS_OK);
+        CHECK(retrieved.key_count == issued[round].key_count);
+        for (int32_t i = 0; i < retrieved.key_count; i++)
+            CHECK(strcmp(retrieved.keys[i].key, issued[round].keys[i].key) ==
+                  0);
+        qkd_key_container_free(&retrieved);
+        qkd_key_container_free(&issued[round]);
+    }
+
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) ==
+          QKD_STATUS_OK);
+    CHECK(status.stored_key_count == capacity);
+    qkd_status_free(&status);
+    free(requested_ids);
+    free(issued);
+}
+#endif
+
+static void wait_for_cached_keys(int32_t expected) {
+    const struct timespec delay = {.tv_nsec = 10000000L};
+    qkd_key_cache_stats_t stats;
+
+    for (int attempt = 0; attempt < 500; attempt++) {
+        qkd_key_cache_get_stats(&stats);
+        if (stats.cached_keys >= expected)
+            return;
+        nanosleep(&delay, NULL);
+    }
+    CHECK(stats.cached_keys >= expected);
+}
+
+static void test_key_cache(void) {
+    qkd_key_cache_config_t invalid = {.low_watermark = 4,
+                                      .high_watermark = 4};
+    qkd_key_cache_config_t config = {
+        .low_watermark = 1, .high_watermark = 4, .batch_size = 2};
+    qkd_key_cache_stats_t stats;
+
+    CHECK(qkd_key_cache_enable(NULL) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_cache_enable(&invalid) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_cache_enable(&config) == QKD_STATUS_OK);
+    CHECK(qkd_key_cache_enable(&config) == QKD_STATUS_BAD_REQUEST);
+
+    qkd_key_container_t missed = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, &missed) ==
+          QKD_STATUS_OK);
+    CHECK(missed.key_count == 1);
+    wait_for_cached_keys(config.high_watermark);
+
+    qkd_key_container_t cached = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, &cached) ==
+          QKD_STATUS_OK);
+    CHECK(cached.key_count == 1);
+    check_key_format(&cached.keys[0]);
+    CHECK(strcmp(cached.keys[0].key_ID, missed.keys[0].key_ID) != 0);
+
+    qkd_key_request_t batch = {.number = 2};
+    qkd_key_container_t uncached = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &batch, &uncached) ==
+          QKD_STATUS_OK);
+    CHECK(uncached.key_count == 2);
+
+    qkd_key_cache_get_stats(&stats);
+    CHECK(stats.hits == 1);
+    CHECK(stats.misses == 1);
+    CHECK(stats.refills >= 2);
+    CHECK(stats.prefetched_keys >= 4);
+    CHECK(stats.cached_keys == config.high_watermark - 1);
+
+    qkd_key_id_t requested_id = {.key_ID = cached.keys[0].key_ID};
+    qkd_key_ids_t key_ids = {.key_IDs = &requested_id, .key_ID_count = 1};
+    qkd_key_container_t retrieved = {0};
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    CHECK(strcmp(retrieved.keys[0].key, cached.keys[0].key) == 0);
+
+    /* Keys already cached make a new descriptor readable at once. */
+    int fd = qkd_key_cache_fd(master_kme_hostname, slave_sae);
+    CHECK(fd >= 0);
+    CHECK(qkd_key_cache_fd(master_kme_hostname, slave_sae) == fd);
+    struct pollfd pending = {.fd = fd, .events = POLLIN};
+    uint64_t signals = 0;
+    CHECK(poll(&pending, 1, 0) == 1);
+    CHECK(read(fd, &signals, sizeof(signals)) == sizeof(signals));
+    CHECK(signals == 1);
+    CHECK(poll(&pending, 1, 0) == 0);
+
+    qkd_key_cache_disable();
+    CHECK(qkd_key_cache_fd(master_kme_hostname, slave_sae) == -1);
+    qkd_key_cache_get_stats(&stats);
+    CHECK(stats.cached_keys == 0);
+    qkd_key_cache_disable();
+
+    qkd_key_container_free(&retrieved);
+    qkd_key_container_free(&uncached);
+    qkd_key_container_free(&cached);
+    qkd_key_container_free(&missed);
+}
+
+struct coalesced_call {
+    qkd_key_id_t key_id;
+    qkd_key_container_t container;
+    uint32_t result;
+};
+
+static void *run_coalesced_call(void *arg) {
+    struct coalesced_call *call = arg;
+    qkd_key_ids_t key_ids = {.key_IDs = &call->key_id, .key_ID_count = 1};
+
+    call->result = GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                                    &call->container);
+    return NULL;
+}
+
+static void run_coalesced_calls(struct coalesced_call *calls, int count) {
+    pthread_t threads[4];
+
+    for (int i = 0; i < count; i++)
+        CHECK(pthread_create(&threads[i], NULL, run_coalesced_call,
+                             &calls[i]) == 0);
+    for (int i = 0; i < count; i++)
+        CHECK(pthread_join(threads[i], NULL) == 0);
+}
+
+static void test_key_coalescer(void) {
+    qkd_key_coalescer_config_t invalid = {.window_us = 0, .max_key_ids = 4};
+    qkd_key_coalescer_config_t config = {.window_us = 200000,
+                                         .max_key_ids = 4};
+    qkd_key_coalescer_stats_t stats;
+
+    CHECK(qkd_key_coalescer_enable(NULL) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_coalescer_enable(&invalid) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_coalescer_enable(&config) == QKD_STATUS_OK);
+    CHECK(qkd_key_coalescer_enable(&config) == QKD_STATUS_BAD_REQUEST);
+
+    qkd_key_request_t request = {.number = 4, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 4);
+
+    /* Four single-ID calls fill one batch and share a single request. */
+    struct coalesced_call calls[4] = {0};
+    for (int i = 0; i < 4; i++)
+        calls[i].key_id.key_ID = issued.keys[i].key_ID;
+    run_coalesced_calls(calls, 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(calls[i].result == QKD_STATUS_OK);
+        CHECK(calls[i].container.key_count == 1);
+        CHECK(strcmp(calls[i].container.keys[0].key_ID,
+                     issued.keys[i].key_ID) == 0);
+        CHECK(strcmp(calls[i].container.keys[0].key, issued.keys[i].key) ==
+              0);
+        qkd_key_container_free(&calls[i].container);
+    }
+    qkd_key_coalescer_get_stats(&stats);
+    CHECK(stats.calls == 4);
+    CHECK(stats.requests < stats.calls);
+    CHECK(stats.merged_calls > 0);
+    qkd_key_container_free(&issued);
+
+    /* An unknown ID must not fail the call it was combined with. */
+    request.number = 1;
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    struct coalesced_call mixed[2] = {0};
+    mixed[0].key_id.key_ID = issued.keys[0].key_ID;
+    mixed[1].key_id.key_ID = "00000000-0000-4000-8000-000000000000";
+    run_coalesced_calls(mixed, 2);
+    CHECK(mixed[0].result == QKD_STATUS_OK);
+    CHECK(strcmp(mixed[0].container.keys[0].key, issued.keys[0].key) == 0);
+    CHECK(mixed[1].result != QKD_STATUS_OK);
+    qkd_key_container_free(&mixed[0].container);
+    qkd_key_container_free(&issued);
+
+    qkd_key_coalescer_disable();
+}
+
+static void test_arena_containers(void) {
+    qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {.flags = QKD_KEY_CONTAINER_ARENA};
+
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 2 && issued.arena);
+    check_key_format(&issued.keys[0]);
+    check_key_format(&issued.keys[1]);
+
+    qkd_key_id_t requested_ids[2] = {
+        {.key_ID = issued.keys[0].key_ID},
+        {.key_ID = issued.keys[1].key_ID},
+    };
+    qkd_key_ids_t key_ids = {.key_IDs = requested_ids, .key_ID_count = 2};
+    qkd_key_container_t retrieved = {.flags = QKD_KEY_CONTAINER_ARENA |
+                                              QKD_KEY_CONTAINER_LOCKED};
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 2 && retrieved.arena);
+    for (int32_t i = 0; i < retrieved.key_count; i++) {
+        CHECK(strcmp(retrieved.keys[i].key_ID, issued.keys[i].key_ID) == 0);
+        CHECK(strcmp(retrieved.keys[i].key, issued.keys[i].key) == 0);
+    }
+
+    /* Freeing keeps the storage options so the container can be reused. */
+    qkd_key_container_free(&retrieved);
+    CHECK(!retrieved.keys && !retrieved.arena && retrieved.key_count == 0);
+    CHECK(retrieved.flags ==
+          (QKD_KEY_CONTAINER_ARENA | QKD_KEY_CONTAINER_LOCKED));
+    qkd_key_container_free(&issued);
+    CHECK(issued.flags == QKD_KEY_CONTAINER_ARENA);
+
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, &retrieved) ==
+          QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 1 && retrieved.arena);
+    check_key_format(&retrieved.keys[0]);
+    requested_ids[0].key_ID = retrieved.keys[0].key_ID;
+    key_ids.key_ID_count = 1;
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &issued) == QKD_STATUS_OK);
+    CHECK(issued.key_count == 1 && issued.arena);
+    CHECK(strcmp(issued.keys[0].key, retrieved.keys[0].key) == 0);
+    qkd_key_container_free(&issued);
+    qkd_key_container_free(&retrieved);
+}
+
+static void check_binary_key(const qkd_key_t *binary, const qkd_key_t *text) {
+    unsigned char decoded[64];
+
+    CHECK(strcmp(binary->key_ID, text->key_ID) == 0);
+    CHECK(binary->key_length == 32);
+    CHECK(EVP_DecodeBlock(decoded, (const unsigned char *)text->key,
+                          (int)strlen(text->key)) >= 32);
+    CHECK(memcmp(binary->key, decoded, binary->key_length) == 0);
+
+    for (size_t i = 0, j = 0; i < QKD_KEY_UUID_SIZE; i++, j += 2U) {
+        char hex[3];
+        if (j == 8 || j == 13 || j == 18 || j == 23)
+            j++;
+        memcpy(hex, text->key_ID + j, 2);
+        hex[2] = '\0';
+        CHECK(binary->key_UUID[i] == (unsigned char)strtoul(hex, NULL, 16));
+    }
+}
+
+static void test_binary_containers(void) {
+    qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {.flags = QKD_KEY_CONTAINER_BINARY};
+
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 2);
+
+    qkd_key_id_t requested_ids[2] = {
+        {.key_ID = issued.keys[0].key_ID},
+        {.key_ID = issued.keys[1].key_ID},
+    };
+    qkd_key_ids_t key_ids = {.key_IDs = requested_ids, .key_ID_count = 2};
+    qkd_key_container_t retrieved = {0};
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 2);
+    for (int32_t i = 0; i < retrieved.key_count; i++) {
+        check_key_format(&retrieved.keys[i]);
+        check_binary_key(&issued.keys[i], &retrieved.keys[i]);
+    }
+    qkd_key_container_free(&issued);
+    CHECK(issued.flags == QKD_KEY_CONTAINER_BINARY);
+
+    /* Text on the master side, binary keys in an arena on the slave side. */
+    qkd_key_container_free(&retrieved);
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &retrieved) ==
+          QKD_STATUS_OK);
+    requested_ids[0].key_ID = retrieved.keys[0].key_ID;
+    requested_ids[1].key_ID = retrieved.keys[1].key_ID;
+    issued.flags |= QKD_KEY_CONTAINER_ARENA;
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &issued) == QKD_STATUS_OK);
+    CHECK(issued.key_count == 2 && issued.arena);
     for (int32_t i = 0; i < issued.key_count; i++)
-        requested_ids[i].key_ID = issued.keys[i].key_ID;
-    qkd_key_ids_t ids = {.key_IDs = requested_ids, .key_ID_count = 16};
-    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &ids, &retrieved) ==
+        check_binary_key(&issued.keys[i], &retrieved.keys[i]);
+    qkd_key_container_free(&issued);
+    qkd_key_container_free(&retrieved);
+}
+
+static const char stream_response[] =
+    "{\"keys\": [\n"
+    "  {\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\",\n"
+    "   \"key_ID_extension\": {\"nested\": [1, -2.5e3, true, null, {}]},\n"
+    "   \"key\": \"wHHVxRwDJs3\\/bXd38GHP3oe4svTuRpZS0yCC7x4Ly+s=\"},\n"
+    "  {\"key\": \"OeGMPxh1+2RpJpNCYixWHFLYRubpOKCw94FcZI7AU6A=\",\n"
+    "   \"key_extension\": \"\\u00e9\\\"\", \"key_ID\":\n"
+    "   \"0a782fb5-3434-48fe-aa4d-14f41d46cf92\"}\n"
+    "], \"key_container_extension\": [\"keys\", {\"keys\": false}]}\n";
+
+static bool parse_keys(const char *response, size_t chunk, uint32_t flags,
+                       int32_t max_keys, qkd_key_container_t *container) {
+    struct qkd_key_stream_parser parser;
+    size_t length = strlen(response);
+
+    CHECK(qkd_key_stream_parser_init(&parser, flags, max_keys, 256));
+    for (size_t i = 0; i < length; i += chunk) {
+        size_t size = length - i < chunk ? length - i : chunk;
+        qkd_key_stream_parser_feed(&parser, response + i, size);
+    }
+    bool parsed = qkd_key_stream_parser_finish(&parser, container);
+    qkd_key_stream_parser_free(&parser);
+    return parsed;
+}
+
+static bool is_zeroed(const unsigned char *object, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (object[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+static void *churn_secure_objects(void *arg) {
+    unsigned char *objects[64];
+    unsigned char seed = (unsigned char)(uintptr_t)arg;
+
+    for (int round = 0; round < 200; round++) {
+        for (size_t i = 0; i < 64; i++) {
+            size_t size = 1U + (i * 97U + (size_t)round) % 5000U;
+            objects[i] = qkd_secure_alloc(size);
+            if (!objects[i] || !is_zeroed(objects[i], size))
+                return NULL;
+            objects[i][0] = seed;
+            objects[i][size - 1U] = seed;
+        }
+        for (size_t i = 0; i < 64; i++) {
+            size_t size = 1U + (i * 97U + (size_t)round) % 5000U;
+            if (objects[i][0] != seed || objects[i][size - 1U] != seed)
+                return NULL;
+            qkd_secure_free(objects[i]);
+        }
+    }
+    return arg;
+}
+
+static void test_secure_alloc(void) {
+    qkd_secure_alloc_stats_t before;
+    qkd_secure_alloc_stats_t stats;
+
+    qkd_secure_alloc_get_stats(&before);
+    CHECK(qkd_secure_alloc(0) == NULL);
+    unsigned char *object = qkd_secure_alloc(40);
+    CHECK(object && (uintptr_t)object % 16U == 0 && is_zeroed(object, 64));
+    memset(object, 0xa5, 40);
+    qkd_secure_free(object);
+    unsigned char *reused = qkd_secure_alloc(33);
+    CHECK(reused == object);
+    CHECK(is_zeroed(reused, 64));
+    qkd_secure_free(reused);
+    qkd_secure_free(NULL);
+
+    size_t large_size = QKD_SECURE_MAX_SLAB_OBJECT + 1U;
+    unsigned char *large = qkd_secure_alloc(large_size);
+    CHECK(large && is_zeroed(large, large_size));
+    qkd_secure_alloc_get_stats(&stats);
+    CHECK(stats.slabs > before.slabs || before.slabs > 0);
+    CHECK(stats.large_objects == before.large_objects + 1U);
+    qkd_secure_free(large);
+    qkd_secure_alloc_get_stats(&stats);
+    CHECK(stats.large_objects == before.large_objects);
+
+    char *copy = qkd_secure_strndup("key-id", 3);
+    CHECK(copy && strcmp(copy, "key") == 0);
+    qkd_secure_free(copy);
+
+    /* Enough mappings to grow the registry, then free them all. */
+    unsigned char *mappings[300];
+    for (size_t i = 0; i < 300; i++) {
+        mappings[i] = qkd_secure_alloc(large_size);
+        CHECK(mappings[i] != NULL);
+    }
+    for (size_t i = 0; i < 300; i++)
+        qkd_secure_free(mappings[i]);
+    qkd_secure_alloc_get_stats(&stats);
+    CHECK(stats.large_objects == before.large_objects);
+
+    /* Containers built by the caller on the heap are released with free(). */
+    qkd_key_container_t heap_container = {.key_count = 1};
+    heap_container.keys = calloc(1, sizeof(*heap_container.keys));
+    CHECK(heap_container.keys != NULL);
+    heap_container.keys[0].key_ID =
+        strdup("bc49d0b9-8a5b-4e29-9d0e-6c3b6e2b9f1a");
+    heap_container.keys[0].key = strdup("a2V5");
+    CHECK(heap_container.keys[0].key_ID && heap_container.keys[0].key);
+    qkd_key_container_free(&heap_container);
+    CHECK(heap_container.keys == NULL && heap_container.key_count == 0);
+    qkd_secure_free(malloc(2U * 65536U));
+
+    /* Objects freed by exiting threads return to the shared pools. */
+    pthread_t threads[4];
+    for (uintptr_t i = 0; i < 4; i++)
+        CHECK(pthread_create(&threads[i], NULL, churn_secure_objects,
+                             (void *)(i + 1U)) == 0);
+    for (uintptr_t i = 0; i < 4; i++) {
+        void *result = NULL;
+        CHECK(pthread_join(threads[i], &result) == 0);
+        CHECK(result == (void *)(i + 1U));
+    }
+    qkd_secure_alloc_get_stats(&stats);
+    CHECK(stats.large_objects == before.large_objects);
+}
+
+/*
+ * Long enough inputs go through the SIMD blocks, so every corrupted position
+ * and every tail length checks them against the scalar tables.
+ */
+static void test_key_codec(void) {
+    static const unsigned char bad[] = {'-', '_', '=', '\0', ' ', 0x80, 0xff};
+    unsigned char raw[200];
+    char text[4 * sizeof(raw) / 3 + 4];
+    unsigned char decoded[sizeof(raw) + 3];
+    size_t decoded_length = 0;
+
+    for (size_t i = 0; i < sizeof(raw); i++)
+        raw[i] = (unsigned char)(i * 151U + 7U);
+    for (size_t size = 1; size <= sizeof(raw); size++) {
+        size_t length = (size_t)EVP_EncodeBlock((unsigned char *)text, raw,
+                                                (int)size);
+        CHECK(qkd_is_base64(text, length));
+        CHECK(qkd_decode_base64(text, length, decoded, &decoded_length));
+        CHECK(decoded_length == size && memcmp(decoded, raw, size) == 0);
+
+        size_t padding = 2U - (size + 2U) % 3U;
+        for (size_t i = 0; i < length - padding; i++) {
+            char saved = text[i];
+            for (size_t j = 0; j < sizeof(bad); j++) {
+                /* Padding in the last group is valid, just shorter. */
+                if (bad[j] == '=' && i >= length - 4U)
+                    continue;
+                text[i] = (char)bad[j];
+                CHECK(!qkd_is_base64(text, length));
+                CHECK(!qkd_decode_base64(text, length, decoded,
+                                         &decoded_length));
+            }
+            text[i] = saved;
+        }
+    }
+    CHECK(!qkd_is_base64("", 0) && !qkd_is_base64("QUJD", 3));
+    CHECK(!qkd_decode_base64("QUI", 3, decoded, &decoded_length));
+    CHECK(!qkd_decode_base64("Q===", 4, decoded, &decoded_length));
+
+    unsigned char uuid[QKD_KEY_UUID_SIZE];
+    const char *id = "0123abcd-EF45-6789-aBcD-ef0123456789";
+    static const unsigned char expected[QKD_KEY_UUID_SIZE] = {
+        0x01, 0x23, 0xab, 0xcd, 0xef, 0x45, 0x67, 0x89,
+        0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89};
+    CHECK(qkd_parse_uuid(id, strlen(id), uuid));
+    CHECK(memcmp(uuid, expected, sizeof(expected)) == 0);
+    CHECK(!qkd_parse_uuid(id, strlen(id) - 1U, uuid));
+    char broken[QKD_KEY_UUID_LENGTH + 1];
+    for (size_t i = 0; i < QKD_KEY_UUID_LENGTH; i++) {
+        memcpy(broken, id, sizeof(broken));
+        broken[i] = broken[i] == '-' ? '0' : 'g';
+        CHECK(!qkd_parse_uuid(broken, QKD_KEY_UUID_LENGTH, uuid));
+    }
+}
+
+static void test_key_stream_parser(void) {
+    static const size_t chunks[] = {1, 7, sizeof(stream_response)};
+    static const char *invalid[] = {
+        "",
+        "[]",
+        "{\"keys\": []}",
+        "{\"keys\": {}}",
+        "{\"keys\": [{\"key_ID\": \"bc490419\", \"key\": \"AAAA\"}]}",
+        "{\"keys\": [{\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\", "
+        "\"key\": \"AAA\"}]}",
+        "{\"keys\": [{\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\", "
+        "\"key\": \"AAAA\"}]",
+        "{\"keys\": [{\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\", "
+        "\"key\": \"AAAA\", \"key\": \"AAAA\"}]}",
+        "{\"keys\": [{\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\", "
+        "\"key\": 1}]}",
+        "{\"keys\": [{\"key_ID\": \"bc490419-7d60-487f-adc1-4ddcc177c139\", "
+        "\"key\": \"AAAA\"}]} x",
+    };
+    qkd_key_container_t container = {0};
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        CHECK(parse_keys(stream_response, chunks[i], 0, 2, &container));
+        CHECK(container.key_count == 2);
+        CHECK(strcmp(container.keys[0].key_ID,
+                     "bc490419-7d60-487f-adc1-4ddcc177c139") == 0);
+        CHECK(strcmp(container.keys[0].key,
+                     "wHHVxRwDJs3/bXd38GHP3oe4svTuRpZS0yCC7x4Ly+s=") == 0);
+        CHECK(strcmp(container.keys[1].key_ID,
+                     "0a782fb5-3434-48fe-aa4d-14f41d46cf92") == 0);
+        check_key_format(&container.keys[1]);
+        qkd_key_container_free(&container);
+    }
+
+    /* A small initial arena grows for keys larger than expected. */
+    container.flags = QKD_KEY_CONTAINER_ARENA | QKD_KEY_CONTAINER_BINARY;
+    struct qkd_key_stream_parser parser;
+    CHECK(qkd_key_stream_parser_init(&parser, container.flags, 2, 8));
+    CHECK(qkd_key_stream_parser_feed(&parser, stream_response,
+                                     strlen(stream_response)));
+    CHECK(qkd_key_stream_parser_finish(&parser, &container));
+    qkd_key_stream_parser_free(&parser);
+    CHECK(container.key_count == 2 && container.arena);
+    CHECK(container.keys[0].key_length == 32);
+    CHECK(container.keys[0].key_UUID[0] == 0xbc);
+    CHECK(container.keys[1].key_UUID[15] == 0x92);
+    qkd_key_container_free(&container);
+
+    CHECK(!parse_keys(stream_response, 5, 0, 1, &container));
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(!parse_keys(invalid[i], 3, 0, 4, &container));
+    CHECK(!container.keys && container.key_count == 0);
+}
+
+static void record_status_change(const char *kme_hostname,
+                                 const char *slave_sae_id,
+                                 const qkd_status_t *status, void *user_data) {
+    int32_t *stored_key_count = user_data;
+    CHECK(kme_hostname && slave_sae_id && status->source_KME_ID);
+    __atomic_store_n(stored_key_count, status->stored_key_count,
+                     __ATOMIC_SEQ_CST);
+}
+
+static void test_status_cache(void) {
+    qkd_status_cache_config_t config = {.ttl_ms = 0};
+    CHECK(qkd_status_cache_enable(&config) == QKD_STATUS_BAD_REQUEST);
+    config = (qkd_status_cache_config_t){.ttl_ms = 1000, .refresh_ms = 1000};
+    CHECK(qkd_status_cache_enable(&config) == QKD_STATUS_BAD_REQUEST);
+    config.ttl_ms = 60000;
+    config.refresh_ms = 30000;
+    CHECK(qkd_status_cache_enable(&config) == QKD_STATUS_OK);
+    CHECK(qkd_status_cache_enable(&config) == QKD_STATUS_BAD_REQUEST);
+
+    qkd_status_t peeked;
+    CHECK(!qkd_status_cache_peek(master_kme_hostname, slave_sae, &peeked));
+    qkd_status_t fetched = {0}, cached = {0};
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &fetched) ==
           QKD_STATUS_OK);
-    CHECK(retrieved.key_count == issued.key_count);
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &cached) ==
+          QKD_STATUS_OK);
+    CHECK(cached.stored_key_count == fetched.stored_key_count);
+    CHECK(cached.max_key_per_request == fetched.max_key_per_request);
+    CHECK(strcmp(cached.source_KME_ID, fetched.source_KME_ID) == 0);
+    CHECK(cached.slave_SAE_ID != fetched.slave_SAE_ID);
+    qkd_status_free(&cached);
+
+    /* The estimate follows the keys handed out since the fetch. */
+    qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t container = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &container) ==
+          QKD_STATUS_OK);
+    qkd_key_container_free(&container);
+    CHECK(qkd_status_cache_peek(master_kme_hostname, slave_sae, &peeked));
+    CHECK(peeked.stored_key_count ==
+          (fetched.stored_key_count > 2 ? fetched.stored_key_count - 2 : 0));
+    CHECK(peeked.key_size == fetched.key_size && !peeked.source_KME_ID);
+    qkd_status_free(&fetched);
 
+    qkd_status_cache_stats_t stats;
+    qkd_status_cache_get_stats(&stats);
+    CHECK(stats.misses == 1 && stats.hits == 2 && stats.refreshes == 0);
+    qkd_status_cache_disable();
+    CHECK(!qkd_status_cache_peek(master_kme_hostname, slave_sae, &peeked));
+
+    /* Statuses that are read are refreshed in the background. */
+    int32_t notified = -1;
+    config = (qkd_status_cache_config_t){.ttl_ms = 60000,
+                                         .refresh_ms = 10,
+                                         .on_change = record_status_change,
+                                         .user_data = &notified};
+    CHECK(qkd_status_cache_enable(&config) == QKD_STATUS_OK);
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &fetched) ==
+          QKD_STATUS_OK);
+    request.number = 1;
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &container) ==
+          QKD_STATUS_OK);
+    qkd_key_container_free(&container);
+    CHECK(qkd_status_cache_peek(master_kme_hostname, slave_sae, &peeked));
+    struct timespec pause = {.tv_nsec = 10000000};
+    for (int i = 0; i < 200 && stats.refreshes == 0; i++) {
+        nanosleep(&pause, NULL);
+        qkd_status_cache_get_stats(&stats);
+    }
+    CHECK(stats.refreshes > 0);
+    /* A new stored_key_count alone is not a change. */
+    CHECK(stats.changes == 0);
+    CHECK(__atomic_load_n(&notified, __ATOMIC_SEQ_CST) == -1);
+#ifndef QKD_USE_ETSI014_BACKEND
+    /* The refresh replaced the estimate with the count of the KME. */
+    CHECK(qkd_status_cache_peek(master_kme_hostname, slave_sae, &peeked));
+    CHECK(peeked.stored_key_count == fetched.stored_key_count - 1);
+#endif
+    qkd_status_free(&fetched);
+    qkd_status_cache_disable();
+}
+
+static void wait_for_brokered_keys(int32_t expected) {
+    struct timespec delay = {.tv_nsec = 10000000};
+    qkd_key_broker_stats_t stats;
+
+    for (int i = 0; i < 500; i++) {
+        qkd_key_broker_get_stats(&stats);
+        if (stats.available_keys >= expected)
+            return;
+        nanosleep(&delay, NULL);
+    }
+    CHECK(stats.available_keys >= expected);
+}
+
+/* Pops a key in a forked client and sends its ID and value back. */
+static void send_brokered_key(int fd) {
+    qkd_key_container_t container = {0};
+    char message[512];
+
+    if (GET_KEY(master_kme_hostname, slave_sae, NULL, &container) !=
+        QKD_STATUS_OK)
+        _exit(EXIT_FAILURE);
+    int length = snprintf(message, sizeof(message), "%s %s",
+                          container.keys[0].key_ID, container.keys[0].key);
+    qkd_key_container_free(&container);
+    if (length < 0 || (size_t)length >= sizeof(message) ||
+        write(fd, message, sizeof(message)) != (ssize_t)sizeof(message))
+        _exit(EXIT_FAILURE);
+}
+
+static void check_brokered_key(int fd) {
+    char message[512];
+    char key_ID[37];
+    char key[256];
+
+    CHECK(read(fd, message, sizeof(message)) == (ssize_t)sizeof(message));
+    CHECK(sscanf(message, "%36s %255s", key_ID, key) == 2);
+    qkd_key_id_t requested_id = {.key_ID = key_ID};
+    qkd_key_ids_t key_ids = {.key_IDs = &requested_id, .key_ID_count = 1};
+    qkd_key_container_t retrieved = {0};
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    CHECK(strcmp(retrieved.keys[0].key, key) == 0);
+    qkd_key_container_free(&retrieved);
+}
+
+static void test_key_broker(void) {
+    char name[64];
+    qkd_key_broker_pair_t pair = {.kme_hostname = master_kme_hostname,
+                                  .slave_sae_id = slave_sae};
+    qkd_key_broker_config_t config = {
+        .pairs = &pair, .pair_count = 1, .capacity = 0};
+    qkd_key_broker_stats_t stats;
+
+    snprintf(name, sizeof(name), "/qkd-api-test-%ld", (long)getpid());
+    CHECK(qkd_key_broker_start(NULL) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_broker_start(&config) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_broker_attach_fd(-1) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_broker_attach(name) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_broker_fd() == -1);
+
+    /* The owner serves its own requests from the anonymous segment. */
+    config.capacity = 2;
+    CHECK(qkd_key_broker_start(&config) == QKD_STATUS_OK);
+    CHECK(qkd_key_broker_start(&config) == QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_key_broker_fd() >= 0);
+    wait_for_brokered_keys(config.capacity);
+    qkd_key_container_t brokered = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, NULL, &brokered) ==
+          QKD_STATUS_OK);
+    CHECK(brokered.key_count == 1);
+    check_key_format(&brokered.keys[0]);
+    qkd_key_container_free(&brokered);
+    qkd_key_broker_get_stats(&stats);
+    CHECK(stats.hits == 1 && stats.misses == 0 && stats.refills > 0);
+    qkd_key_broker_stop();
+    CHECK(qkd_key_broker_fd() == -1);
+    qkd_key_broker_get_stats(&stats);
+    CHECK(stats.available_keys == 0);
+
+    /*
+     * A forked worker pops from the inherited mapping, then detaches and
+     * attaches again by name like an unrelated process would.
+     */
+    config.name = name;
+    int status;
+    pid_t owner = fork();
+    CHECK(owner >= 0);
+    if (owner == 0)
+        _exit(qkd_key_broker_start(&config) == QKD_STATUS_OK ? EXIT_SUCCESS
+                                                             : EXIT_FAILURE);
+    CHECK(waitpid(owner, &status, 0) == owner);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    /* The segment of an owner that exited without stopping is replaced. */
+    CHECK(qkd_key_broker_start(&config) == QKD_STATUS_OK);
+    wait_for_brokered_keys(config.capacity);
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t child = fork();
+    CHECK(child >= 0);
+    if (child == 0) {
+        close(fds[0]);
+        send_brokered_key(fds[1]);
+        qkd_key_broker_detach();
+        if (qkd_key_broker_start(&config) != QKD_STATUS_SERVER_ERROR ||
+            qkd_key_broker_attach(name) != QKD_STATUS_OK)
+            _exit(EXIT_FAILURE);
+        send_brokered_key(fds[1]);
+        qkd_key_broker_get_stats(&stats);
+        _exit(stats.hits == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fds[1]);
+    CHECK(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    check_brokered_key(fds[0]);
+    check_brokered_key(fds[0]);
+    close(fds[0]);
+    qkd_key_broker_get_stats(&stats);
+    CHECK(stats.hits == 0 && stats.stored_keys >= 2);
+    qkd_key_broker_stop();
+    CHECK(qkd_key_broker_attach(name) == QKD_STATUS_BAD_REQUEST);
+}
+
+static void test_contexts(void) {
+    const struct qkd_014_backend *backend = get_active_014_backend();
+    qkd_014_ctx_config_t master_config = {.kme_hostname = master_kme_hostname};
+    qkd_014_ctx_config_t slave_config = {.kme_hostname = slave_kme_hostname};
+#ifdef QKD_USE_ETSI014_BACKEND
+    master_config.master_cert_path = getenv("QKD_MASTER_CERT_PATH");
+    master_config.master_key_path = getenv("QKD_MASTER_KEY_PATH");
+    master_config.master_ca_cert_path = getenv("QKD_MASTER_CA_CERT_PATH");
+#endif
+    qkd_014_ctx_t *master = qkd_014_ctx_create(&master_config);
+    qkd_014_ctx_t *slave = qkd_014_ctx_create(&slave_config);
+    CHECK(master && slave);
+
+    /* Contexts keep their backend whatever the default context uses. */
+    const struct qkd_014_backend incomplete_backend = {.name = "incomplete"};
+    register_qkd_014_backend(&incomplete_backend);
+    qkd_status_t status = {0};
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) ==
+          QKD_STATUS_SERVER_ERROR);
+    CHECK(qkd_014_ctx_get_status(master, NULL, slave_sae, &status) ==
+          QKD_STATUS_OK);
+    qkd_status_free(&status);
+
+    qkd_key_request_t request = {.number = 1, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {0};
+    CHECK(qkd_014_ctx_get_key(master, NULL, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 1);
+    check_key_format(&issued.keys[0]);
+
+    qkd_key_id_t requested_id = {.key_ID = issued.keys[0].key_ID};
+    qkd_key_ids_t key_ids = {.key_IDs = &requested_id, .key_ID_count = 1};
+    qkd_key_container_t retrieved = {0};
+    CHECK(qkd_014_ctx_get_key_with_ids(slave, NULL, master_sae, &key_ids,
+                                       &retrieved) == QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 1);
+    CHECK(strcmp(retrieved.keys[0].key, issued.keys[0].key) == 0);
     qkd_key_container_free(&retrieved);
     qkd_key_container_free(&issued);
+    register_qkd_014_backend(backend);
+
+    /* NULL selects the default context, which has no default hostname. */
+    CHECK(qkd_014_ctx_get_status(NULL, NULL, slave_sae, &status) ==
+          QKD_STATUS_BAD_REQUEST);
+    CHECK(qkd_014_ctx_get_status(NULL, master_kme_hostname, slave_sae,
+                                 &status) == QKD_STATUS_OK);
+    qkd_status_free(&status);
+    qkd_014_ctx_destroy(qkd_014_default_ctx());
+    CHECK(get_active_014_backend() == backend);
+
+    qkd_014_ctx_config_t incomplete_config = {.backend = &incomplete_backend};
+    qkd_014_ctx_t *incomplete = qkd_014_ctx_create(&incomplete_config);
+    CHECK(incomplete != NULL);
+    CHECK(qkd_014_ctx_get_key(incomplete, master_kme_hostname, slave_sae, NULL,
+                              &issued) == QKD_STATUS_SERVER_ERROR);
+    qkd_014_ctx_destroy(incomplete);
+
+#ifdef QKD_USE_ETSI014_BACKEND
+    /* Each context loads the credentials it was configured with. */
+    master_config.master_cert_path = "/nonexistent/client.crt";
+    qkd_014_ctx_t *misconfigured = qkd_014_ctx_create(&master_config);
+    CHECK(misconfigured != NULL);
+    CHECK(qkd_014_ctx_get_status(misconfigured, NULL, slave_sae, &status) ==
+          QKD_STATUS_SERVER_ERROR);
+    CHECK(qkd_014_ctx_get_status(master, NULL, slave_sae, &status) ==
+          QKD_STATUS_OK);
+    qkd_status_free(&status);
+    qkd_014_ctx_destroy(misconfigured);
+#endif
+
+    qkd_014_ctx_destroy(master);
+    qkd_014_ctx_destroy(slave);
+}
+
+#ifdef QKD_USE_ETSI014_BACKEND
+static void test_endpoint_sets(void) {
+    /* Nothing listens on port 1, so requests fail over to the KME. */
+    char master_set[512], slave_set[512];
+    snprintf(master_set, sizeof(master_set), "https://localhost:1, %s",
+             master_kme_hostname);
+    snprintf(slave_set, sizeof(slave_set), "%s,https://localhost:1",
+             slave_kme_hostname);
+
+    qkd_status_t status = {0};
+    for (int i = 0; i < 8; i++) {
+        CHECK(GET_STATUS(master_set, slave_sae, &status) == QKD_STATUS_OK);
+        qkd_status_free(&status);
+    }
+
+    qkd_key_request_t request = {.number = 1, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {0};
+    CHECK(GET_KEY(master_set, slave_sae, &request, &issued) == QKD_STATUS_OK);
+    CHECK(issued.key_count == 1);
+    qkd_key_id_t requested_id = {.key_ID = issued.keys[0].key_ID};
+    qkd_key_ids_t key_ids = {.key_IDs = &requested_id, .key_ID_count = 1};
+    qkd_key_container_t retrieved = {0};
+    CHECK(GET_KEY_WITH_IDS(slave_set, master_sae, &key_ids, &retrieved) ==
+          QKD_STATUS_OK);
+    CHECK(strcmp(retrieved.keys[0].key, issued.keys[0].key) == 0);
+    qkd_key_container_free(&retrieved);
+    qkd_key_container_free(&issued);
+
+    qkd_014_async_t *async = qkd_014_async_create();
+    CHECK(async != NULL);
+    struct async_result status_result = {0};
+    for (int i = 0; i < 2; i++) {
+        CHECK(GET_STATUS_ASYNC(async, master_set, slave_sae, &status,
+                               record_async_result,
+                               &status_result) == QKD_STATUS_OK);
+        wait_for_async(async);
+        CHECK(status_result.result == QKD_STATUS_OK);
+        qkd_status_free(&status);
+    }
+    qkd_014_async_destroy(async);
+
+    const char *invalid[] = {
+        "https://localhost:1,,https://localhost:2",
+        "https://localhost:1,localhost:2",
+        "https://localhost:1,https://",
+        "https://a,https://b,https://c,https://d,https://e,https://f,"
+        "https://g,https://h,https://i",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+        CHECK(GET_STATUS(invalid[i], slave_sae, &status) ==
+              QKD_STATUS_BAD_REQUEST);
+}
+
+static void test_kme_recording(void) {
+    char path[] = "/tmp/qkd_kme_recording_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(unlink(path) == 0);
+
+    CHECK(setenv("QKD_KME_RECORD", path, 1) == 0);
+    qkd_etsi014_recording_cleanup();
+    qkd_status_t recorded_status = {0};
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &recorded_status) ==
+          QKD_STATUS_OK);
+    qkd_key_request_t request = {.number = 2, .size = QKD_KEY_SIZE_BITS};
+    qkd_key_container_t issued = {0};
+    CHECK(GET_KEY(master_kme_hostname, slave_sae, &request, &issued) ==
+          QKD_STATUS_OK);
+    CHECK(issued.key_count == 2);
+    qkd_key_id_t ids[2] = {{.key_ID = issued.keys[0].key_ID},
+                           {.key_ID = issued.keys[1].key_ID}};
+    qkd_key_ids_t key_ids = {.key_IDs = ids, .key_ID_count = 2};
+    qkd_key_container_t retrieved = {0};
+    CHECK(GET_KEY_WITH_IDS(slave_kme_hostname, master_sae, &key_ids,
+                           &retrieved) == QKD_STATUS_OK);
+    qkd_key_container_free(&retrieved);
+    CHECK(unsetenv("QKD_KME_RECORD") == 0);
+
+    /* Replayed calls never reach the KME, so any https URL will do. */
+    CHECK(setenv("QKD_KME_REPLAY", path, 1) == 0);
+    qkd_etsi014_recording_cleanup();
+    const char *nowhere = "https://localhost:1";
+    qkd_status_t status = {0};
+    CHECK(GET_STATUS(nowhere, slave_sae, &status) == QKD_STATUS_OK);
+    CHECK(strcmp(status.source_KME_ID, recorded_status.source_KME_ID) == 0);
+    CHECK(status.max_key_per_request == recorded_status.max_key_per_request);
+    qkd_status_free(&status);
+    for (int round = 0; round < 2; round++) {
+        qkd_key_container_t replayed = {0};
+        CHECK(GET_KEY(nowhere, slave_sae, &request, &replayed) ==
+              QKD_STATUS_OK);
+        CHECK(replayed.key_count == 2);
+        for (int32_t i = 0; i < 2; i++) {
+            CHECK(strcmp(replayed.keys[i].key_ID, issued.keys[i].key_ID) == 0);
+            CHECK(strcmp(replayed.keys[i].key, issued.keys[i].key) == 0);
+        }
+        qkd_key_container_free(&replayed);
+    }
+    CHECK(GET_KEY_WITH_IDS(nowhere, master_sae, &key_ids, &retrieved) ==
+          QKD_STATUS_OK);
+    CHECK(retrieved.key_count == 2);
+    CHECK(strcmp(retrieved.keys[1].key, issued.keys[1].key) == 0);
+    qkd_key_container_free(&retrieved);
+
+    qkd_key_container_free(&issued);
+    qkd_status_free(&recorded_status);
+
+    /* More keys than requested are still rejected. */
+    qkd_key_request_t single = {.number = 1, .size = QKD_KEY_SIZE_BITS};
+    CHECK(GET_KEY(nowhere, slave_sae, &single, &issued) ==
+          QKD_STATUS_SERVER_ERROR);
+    qkd_key_container_free(&issued);
+
+    /* Without a readable file every call fails instead of going out. */
+    CHECK(unlink(path) == 0);
+    qkd_etsi014_recording_cleanup();
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) ==
+          QKD_STATUS_SERVER_ERROR);
+    CHECK(unsetenv("QKD_KME_REPLAY") == 0);
+    qkd_etsi014_recording_cleanup();
 }
 #endif
 
+static pthread_key_t late_key;
+
+static void record_late(void *value) {
+    (void)value;
+    qkd_metrics_record(QKD_METRICS_004_CLOSE, QKD_METRICS_PARSE, 1);
+}
+
+static void *record_and_exit(void *arg) {
+    (void)arg;
+    qkd_metrics_record(QKD_METRICS_004_CLOSE, QKD_METRICS_PARSE, 1);
+    pthread_setspecific(late_key, &late_key);
+    return NULL;
+}
+
+static void test_metrics(void) {
+    struct qkd_metrics_snapshot before, after;
+    qkd_metrics_snapshot(&before);
+
+    qkd_status_t status = {0};
+    CHECK(GET_STATUS(master_kme_hostname, slave_sae, &status) ==
+          QKD_STATUS_OK);
+    qkd_status_free(&status);
+    CHECK(GET_STATUS(NULL, slave_sae, &status) == QKD_STATUS_BAD_REQUEST);
+
+    qkd_metrics_snapshot(&after);
+    const struct qkd_metrics_op_stats *calls =
+        &after.ops[QKD_METRICS_014_GET_STATUS];
+    const struct qkd_metrics_op_stats *previous =
+        &before.ops[QKD_METRICS_014_GET_STATUS];
+    CHECK(calls->calls == previous->calls + 2);
+    CHECK(calls->errors == previous->errors + 1);
+    CHECK(calls->phases[QKD_METRICS_TOTAL].count ==
+          previous->phases[QKD_METRICS_TOTAL].count + 2);
+    CHECK(calls->phases[QKD_METRICS_TOTAL].max_ns > 0);
+#ifdef QKD_USE_ETSI014_BACKEND
+    CHECK(calls->phases[QKD_METRICS_TRANSFER].count >
+          previous->phases[QKD_METRICS_TRANSFER].count);
+#endif
+
+    /* Percentiles are bucket upper bounds, capped at the maximum. */
+    CHECK(before.ops[QKD_METRICS_004_GET_KEY_BATCH]
+              .phases[QKD_METRICS_PARSE]
+              .count == 0);
+    for (int i = 0; i < 99; i++)
+        qkd_metrics_record(QKD_METRICS_004_GET_KEY_BATCH, QKD_METRICS_PARSE,
+                           100);
+    qkd_metrics_record(QKD_METRICS_004_GET_KEY_BATCH, QKD_METRICS_PARSE,
+                       10000);
+    qkd_metrics_snapshot(&after);
+    const struct qkd_metrics_histogram *histogram =
+        &after.ops[QKD_METRICS_004_GET_KEY_BATCH].phases[QKD_METRICS_PARSE];
+    CHECK(histogram->count == 100 && histogram->sum_ns == 19900);
+    CHECK(qkd_metrics_percentile(histogram, 50) >= 100);
+    CHECK(qkd_metrics_percentile(histogram, 99) < 125);
+    CHECK(qkd_metrics_percentile(histogram, 100) == 10000);
+    CHECK(qkd_metrics_percentile(&before.ops[QKD_METRICS_004_GET_KEY_BATCH]
+                                      .phases[QKD_METRICS_PARSE],
+                                 50) == 0);
+    CHECK(strcmp(qkd_metrics_op_name(QKD_METRICS_014_GET_KEY),
+                 "014.get_key") == 0);
+    CHECK(qkd_metrics_phase_name(QKD_METRICS_PHASE_COUNT) == NULL);
+
+    FILE *output = tmpfile();
+    CHECK(output != NULL);
+    CHECK(qkd_metrics_export(&after, output) == 0);
+    rewind(output);
+    char line[256];
+    bool found = false;
+    while (fgets(line, sizeof(line), output))
+        found = found || strncmp(line, "014.get_status.total count=",
+                                 strlen("014.get_status.total count=")) == 0;
+    fclose(output);
+    CHECK(found);
+
+    /*
+     * A destructor of a key created after the metrics one runs once the
+     * thread's block is retired, and must not write to it.
+     */
+    pthread_t thread;
+    CHECK(pthread_key_create(&late_key, record_late) == 0);
+    CHECK(pthread_create(&thread, NULL, record_and_exit, NULL) == 0);
+    CHECK(pthread_join(thread, NULL) == 0);
+    CHECK(pthread_key_delete(late_key) == 0);
+    qkd_metrics_snapshot(&after);
+    CHECK(after.ops[QKD_METRICS_004_CLOSE].phases[QKD_METRICS_PARSE].count ==
+          before.ops[QKD_METRICS_004_CLOSE].phases[QKD_METRICS_PARSE].count +
+              2);
+}
+
 int main(void) {
     init_test_config();
     test_backend_registration();
     test_get_status();
     test_unsupported_request_features();
+    test_async();
+    test_arena_containers();
+    test_binary_containers();
+    test_secure_alloc();
+    test_key_codec();
+    test_key_stream_parser();
 #ifndef QKD_USE_ETSI014_BACKEND
     test_simulated_key_exchange();
     test_simulated_capacity();
 #endif
+    test_key_cache();
+    test_key_coalescer();
+    test_status_cache();
+    test_contexts();
+#ifdef QKD_USE_ETSI014_BACKEND
+    test_endpoint_sets();
+    test_kme_recording();
+#endif
+    test_metrics();
+    test_key_broker();
     puts("ETSI 014 API tests passed");
     return 0;
 }